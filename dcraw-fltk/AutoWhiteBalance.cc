@@ -0,0 +1,148 @@
+/**
+ * class AutoWhiteBalance
+ * Calculates the automatic white balance of a raw file in process,
+ * so that it is worked out once per file instead of by dcraw's -a
+ * averaging the whole full size image on every conversion
+ *
+ * Images with automatic white balance are decoded with the camera's
+ * white balance, as manual ones are. The first buffer decoded from a
+ * file, which in the GUI is the small binned preview, is binned into
+ * blocks, and the red and blue multipliers that make the average of
+ * the unclipped blocks grey are kept. They are applied on top of the
+ * camera's white balance afterwards, the way manual multipliers are
+ * (see ToneKernels), by every later preview and conversion of the file.
+ * The results are cached by file, size and modification time
+ *
+ * PUBLIC FEATURES:
+ *       static bool get(string filename, PixelBuffer &decoded, double &redMultiplier, double &blueMultiplier);
+ *       static bool measure(PixelBuffer &linear, double &redMultiplier, double &blueMultiplier);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "AutoWhiteBalance.h"
+#include "Metrics.h"
+#include <sstream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * Finds the automatic white balance of a raw file, measuring it from
+ * the buffer given the first time the file (at its current size and
+ * modification time) is asked for, and reusing that measurement after
+ * @param filename - the raw file
+ * @param decoded - the file decoded with the camera white balance, at any size
+ * @param redMultiplier - set to the red multiplier to apply on top of the camera's
+ * @param blueMultiplier - set to the blue multiplier to apply on top of the camera's
+ * @return true if the white balance was found, false if the camera's should be kept
+ */
+bool AutoWhiteBalance::get(const string filename, const PixelBuffer &decoded, double &redMultiplier, double &blueMultiplier)
+{
+    static mutex cacheLock;
+    static map< string, pair<double, double> > cache;
+    static Metrics::Counter &hits = Metrics::counter("dcraw_fltk_cache_requests_total", "Cache lookups, by cache and result",
+                                                   "cache=\"auto_white_balance\",result=\"hit\"");
+    static Metrics::Counter &misses = Metrics::counter("dcraw_fltk_cache_requests_total", "Cache lookups, by cache and result",
+                                                     "cache=\"auto_white_balance\",result=\"miss\"");
+
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0)
+        return measure(decoded, redMultiplier, blueMultiplier);
+    ostringstream key(ostringstream::out);
+    key << filename << " " << (long long)status.st_size << " " << (long long)status.st_mtime;
+
+    {
+        lock_guard<mutex> guard(cacheLock);
+        map< string, pair<double, double> >::iterator found = cache.find(key.str());
+        if (found != cache.end())
+        {
+            redMultiplier = found->second.first;
+            blueMultiplier = found->second.second;
+            hits.add();
+            return true;
+        }
+    }
+    misses.add();
+
+    if (!measure(decoded, redMultiplier, blueMultiplier))
+        return false;
+
+    lock_guard<mutex> guard(cacheLock);
+    if ((int)cache.size() >= CACHE_SIZE)
+        cache.clear();
+    cache[key.str()] = make_pair(redMultiplier, blueMultiplier);
+    return true;
+}
+
+/**
+ * Finds the multipliers that make the average of an image grey
+ * The image is binned into BLOCK_SIZE square blocks, and blocks with a
+ * clipped sample are left out, as their colour is not the light's
+ * Each band of block rows is first summed down its columns, which
+ * runs over contiguous samples and is vectorised by the compiler,
+ * and then across each block
+ * @param linear - the linear RGB image, decoded with the camera white balance
+ * @param redMultiplier - set to the red multiplier to apply on top of the camera's
+ * @param blueMultiplier - set to the blue multiplier to apply on top of the camera's
+ * @return true if there were unclipped blocks to measure, false otherwise
+ */
+bool AutoWhiteBalance::measure(const PixelBuffer &linear, double &redMultiplier, double &blueMultiplier)
+{
+    if (linear.getChannels() != 3)
+        return false;
+
+    int width = linear.getWidth();
+    int height = linear.getHeight();
+    int rowSamples = width * 3;
+    const unsigned short * data = linear.getData();
+    vector<unsigned int> columnSums(rowSamples);
+    vector<unsigned short> columnPeaks(rowSamples);
+    double sums[3] = {0, 0, 0};
+
+    for (int top = 0; top + BLOCK_SIZE <= height; top += BLOCK_SIZE)
+    {
+        unsigned int * sum = &columnSums[0];
+        unsigned short * peak = &columnPeaks[0];
+        for (int i = 0; i < rowSamples; i++)
+        {
+            sum[i] = 0;
+            peak[i] = 0;
+        }
+        for (int y = top; y < top + BLOCK_SIZE; y++)
+        {
+            const unsigned short * row = data + (size_t)y * rowSamples;
+            for (int i = 0; i < rowSamples; i++)
+            {
+                sum[i] += row[i];
+                peak[i] = row[i] > peak[i] ? row[i] : peak[i];
+            }
+        }
+
+        for (int left = 0; left + BLOCK_SIZE <= width; left += BLOCK_SIZE)
+        {
+            unsigned int blockSums[3] = {0, 0, 0};
+            unsigned short blockPeak = 0;
+            for (int i = left * 3; i < (left + BLOCK_SIZE) * 3; i += 3)
+                for (int c = 0; c < 3; c++)
+                {
+                    blockSums[c] += sum[i + c];
+                    blockPeak = peak[i + c] > blockPeak ? peak[i + c] : blockPeak;
+                }
+            if (blockPeak >= CLIP_LEVEL)
+                continue;
+            for (int c = 0; c < 3; c++)
+                sums[c] += blockSums[c];
+        }
+    }
+
+    if (sums[0] <= 0 || sums[1] <= 0 || sums[2] <= 0)
+        return false;
+    redMultiplier = sums[1] / sums[0];
+    blueMultiplier = sums[1] / sums[2];
+    return true;
+}
@@ -0,0 +1,30 @@
+/**
+ * AutoWhiteBalance.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef AUTOWHITEBALANCE_H
+#define AUTOWHITEBALANCE_H
+
+#include <string>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class AutoWhiteBalance
+{
+    public:
+        static bool get(const string filename, const PixelBuffer &decoded, double &redMultiplier, double &blueMultiplier);
+        static bool measure(const PixelBuffer &linear, double &redMultiplier, double &blueMultiplier);
+
+        // Side of the square blocks the image is binned into, in pixels
+        const static int BLOCK_SIZE = 8;
+        // Blocks with any sample at or above this are clipped and left out
+        const static int CLIP_LEVEL = 64000;
+        // Number of files whose multipliers get() keeps
+        const static int CACHE_SIZE = 1024;
+
+    private:
+        AutoWhiteBalance();
+};
+#endif
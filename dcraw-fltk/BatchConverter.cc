@@ -0,0 +1,548 @@
+/**
+ * class BatchConverter
+ * Runs several Image conversions in parallel, one dcraw
+ * process per Image, admitting a new conversion only while
+ * the estimated memory of everything running stays within
+ * a memory budget
+ * A dark frame is unpacked once for the whole batch, and given to
+ * each dcraw with its bad pixel map (see CalibrationFrames)
+ * Images with manual or automatic white balance are converted by
+ * Converter in this process instead, so that their multipliers are
+ * applied on top of the camera's as in every other output; automatic
+ * ones are measured once per file (see AutoWhiteBalance) instead of
+ * by dcraw's -a averaging the full image on every conversion. Their
+ * memory is sampled from this process's own, shared among those running
+ * Each dcraw runs under a Supervisor, so a file that hangs or
+ * crashes it fails on its own without holding up the batch
+ * The time each conversion spends in each stage is reported from
+ * dcraw's verbose messages, and summed up for each camera model
+ * The headers of every file are probed on several threads before
+ * anything starts: files that are not raw files, are cut short or
+ * cannot be decoded fail without a dcraw being run, and the rest are
+ * sized from their headers and admitted largest first
+ *
+ * PUBLIC FEATURES:
+ *       BatchConverter();
+ *       BatchConverter(string theExecutable, size_t memoryBudget, int maxJobs);
+ *       ~BatchConverter();
+ *       void setExecutable(string theExecutable);
+ *       void setMemoryBudget(size_t memoryBudget);
+ *       void setMaxJobs(int maxJobs);
+ *       void addImage(Image * toConvert);
+ *       int run();
+ *       string getExecutable();
+ *       size_t getMemoryBudget();
+ *       int getMaxJobs();
+ *       size_t estimatePeakMemory(Image * toConvert);
+ *       size_t estimatePeakMemory(Image * toConvert, int width, int height);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "BatchConverter.h"
+#include "DecoderBackends.h"
+#include "RawProbe.h"
+#include "CalibrationFrames.h"
+#include "Supervisor.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <set>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+// How often the memory of running conversions is sampled
+const static int SAMPLE_MILLISECONDS = 200;
+
+// Fixed cost of a dcraw process (code, stdio buffers, tables)
+const static size_t PROCESS_OVERHEAD = 16 * 1024 * 1024;
+
+/**
+ * Default constructor
+ * Budgets three quarters of physical memory and one job per core
+ */
+BatchConverter::BatchConverter()
+{
+    theExecutable = "";
+    memoryBudget = Process::getPhysicalMemory() / 4 * 3;
+    maxJobs = (int)thread::hardware_concurrency();
+    if (maxJobs < 1)
+        maxJobs = 1;
+    estimateScale = 1.0;
+    baselineRSS = 0;
+}
+
+/**
+ * Constructor
+ * @param theExecutable - the name of the dcraw executable to run
+ * @param memoryBudget - the total memory in bytes that running conversions may use
+ * @param maxJobs - the maximum number of conversions to run at once
+ */
+BatchConverter::BatchConverter(const string theExecutable, const size_t memoryBudget, const int maxJobs)
+{
+    this->theExecutable = theExecutable;
+    this->memoryBudget = memoryBudget;
+    this->maxJobs = maxJobs < 1 ? 1 : maxJobs;
+    estimateScale = 1.0;
+    baselineRSS = 0;
+}
+
+/**
+ * Destructor
+ * Deletes the queued Images, which the BatchConverter owns
+ */
+BatchConverter::~BatchConverter()
+{
+    for (size_t i = 0; i < theJobs.size(); i++)
+    {
+        delete theJobs[i]->theProcess;
+        delete theJobs[i]->theProgress;
+        delete theJobs[i]->theImage;
+        delete theJobs[i];
+    }
+}
+
+/**
+ * @param theExecutable - the name of the dcraw executable to run
+ */
+void BatchConverter::setExecutable(const string theExecutable)
+{
+    this->theExecutable = theExecutable;
+}
+
+/**
+ * @param memoryBudget - the total memory in bytes that running conversions may use
+ */
+void BatchConverter::setMemoryBudget(const size_t memoryBudget)
+{
+    this->memoryBudget = memoryBudget;
+}
+
+/**
+ * @param maxJobs - the maximum number of conversions to run at once
+ */
+void BatchConverter::setMaxJobs(const int maxJobs)
+{
+    this->maxJobs = maxJobs < 1 ? 1 : maxJobs;
+}
+
+/**
+ * Queues an Image for conversion
+ * @param toConvert - the Image to convert, owned by the BatchConverter from now on
+ */
+void BatchConverter::addImage(Image * toConvert)
+{
+    Job * theJob = new Job();
+    theJob->theImage = toConvert;
+    theJob->estimate = 0;
+    theJob->peakRSS = 0;
+    theJob->sampledRSS = 0;
+    theJob->exitCode = Process::SPAWN_FAILED;
+    theJob->skipped = 0;
+    theJob->theProcess = NULL;
+    theJob->theProgress = new ConversionProgress();
+    theJob->started = false;
+    theJob->finished = false;
+    theJobs.push_back(theJob);
+}
+
+/**
+ * Estimates the peak memory of a dcraw process converting an Image,
+ * from the size its headers give
+ * @param toConvert - the Image to estimate
+ * @return the estimated peak memory in bytes
+ */
+const size_t BatchConverter::estimatePeakMemory(Image * toConvert)
+{
+    RawProbe::Header header = RawProbe().probe(toConvert->getSourceFilename());
+    return estimatePeakMemory(toConvert, header.width, header.height);
+}
+
+/**
+ * Estimates the peak memory of a dcraw process converting an Image
+ * dcraw holds the raw samples (2 bytes each), the working image
+ * (4 channels of 2 bytes per pixel) and one output row whose size
+ * depends on the output format. A conversion run in this process
+ * (see convertsHere()) also holds the decoded frame and a toned
+ * copy (6 bytes per pixel each) here
+ * @param toConvert - the Image to estimate
+ * @param width - the width of the sensor data, 0 to ask dcraw
+ * @param height - the height of the sensor data, 0 to ask dcraw
+ * @return the estimated peak memory in bytes
+ */
+const size_t BatchConverter::estimatePeakMemory(Image * toConvert, int width, int height)
+{
+    Converter theConverter;
+    theConverter.setExecutable(theExecutable);
+    theConverter.setImage(toConvert);
+    if ((width <= 0 || height <= 0) && !theConverter.identify(width, height))
+    {
+        width = FALLBACK_WIDTH;
+        height = FALLBACK_HEIGHT;
+    }
+
+    size_t bytesPerSample = 1;
+    if (toConvert->getFileFormat() == Image::TIFF_16 || toConvert->getFileFormat() == Image::PPM_16)
+        bytesPerSample = 2;
+
+    size_t pixels = (size_t)width * (size_t)height;
+    size_t rawSamples = pixels * 2;
+    size_t workingImage = pixels * 4 * 2;
+    size_t outputRow = (size_t)width * 3 * bytesPerSample;
+
+    size_t inProcess = convertsHere(toConvert) ? pixels * 6 * 2 : 0;
+
+    return PROCESS_OVERHEAD + rawSamples + workingImage + outputRow + inProcess;
+}
+
+/**
+ * Runs all queued conversions
+ * Conversions are admitted first-fit in queue order; a conversion
+ * at the head of the queue that has been passed over too often
+ * holds back later ones so that large frames are not starved
+ * @return the number of conversions that failed
+ */
+int BatchConverter::run()
+{
+    if (!validateCalibration())
+        return (int)theJobs.size();
+
+    vector<string> filenames;
+    for (size_t i = 0; i < theJobs.size(); i++)
+        filenames.push_back(theJobs[i]->theImage->getSourceFilename());
+    vector<RawProbe::Header> headers = RawProbe::probeAll(filenames, maxJobs);
+
+    vector<Job *> pending;
+    int failures = 0;
+    for (size_t i = 0; i < theJobs.size(); i++)
+    {
+        if (headers[i].isRejected())
+        {
+            cout << filenames[i] << ": not converted, " << headers[i].describe() << endl;
+            failures++;
+            continue;
+        }
+        theJobs[i]->estimate = estimatePeakMemory(theJobs[i]->theImage, headers[i].width, headers[i].height);
+        theJobs[i]->backend = DecoderBackends::getShared().route(theExecutable, headers[i]);
+
+        // Unpacked once by each backend, before anything is admitted
+        Image * theImage = theJobs[i]->theImage;
+        string error;
+        if (theImage->hasCalibration() && !(theJobs[i]->calibration = CalibrationFrames::get(theJobs[i]->backend,
+                                                theImage->getDarkFrame(), theImage->getBadPixelMap(), error)))
+        {
+            cout << filenames[i] << ": not converted, " << error << endl;
+            failures++;
+            continue;
+        }
+        pending.push_back(theJobs[i]);
+    }
+
+    // Largest first, so that the last conversions to start are small ones
+    // that fit beside whatever is still running
+    stable_sort(pending.begin(), pending.end(), [](const Job * a, const Job * b) { return a->estimate > b->estimate; });
+
+    vector<thread> workers;
+    int running = 0;
+    Metrics::Gauge &waiting = Metrics::gauge("dcraw_fltk_batch_pending", "Batch conversions not yet started");
+    Metrics::Gauge &converting = Metrics::gauge("dcraw_fltk_batch_running", "Batch conversions running");
+
+    unique_lock<mutex> guard(lock);
+    baselineRSS = Process::getOwnRSS();
+    while (!pending.empty() || running > 0)
+    {
+        // Admit as many pending conversions as the budget allows
+        vector<Job *>::iterator next = pending.begin();
+        while (next != pending.end() && running < maxJobs)
+        {
+            Job * theJob = *next;
+            size_t needed = (size_t)(theJob->estimate * estimateScale);
+
+            if (running == 0 || committedMemory() + needed <= memoryBudget)
+            {
+                if (convertsHere(theJob->theImage))
+                {
+                    running++;
+                    theJob->started = true;
+                    workers.push_back(thread(&BatchConverter::runJob, this, theJob));
+                    next = pending.erase(next);
+                    continue;
+                }
+
+                // Started by runJob() under the limits of a Supervisor
+                Converter theConverter;
+                theConverter.setImage(theJob->theImage);
+                vector<string> args = theConverter.buildArguments(false);
+                if (theJob->calibration)
+                    theJob->calibration->addArguments(args);
+                theJob->theProcess = new Process(theJob->backend, args);
+                theJob->theProcess->setErrorHandler(ConversionProgress::handleLine, theJob->theProgress);
+                running++;
+                theJob->started = true;
+                workers.push_back(thread(&BatchConverter::runJob, this, theJob));
+                next = pending.erase(next);
+                continue;
+            }
+
+            if (next == pending.begin() && ++theJob->skipped > maxJobs * 4)
+                break;
+            ++next;
+        }
+
+        jobFinished.wait_for(guard, chrono::milliseconds(SAMPLE_MILLISECONDS));
+        sampleOwnMemory();
+
+        // Account for conversions that have finished since the last pass
+        running = 0;
+        for (size_t i = 0; i < theJobs.size(); i++)
+        {
+            Job * theJob = theJobs[i];
+            if (!theJob->started)
+                continue;
+            if (!theJob->finished)
+            {
+                running++;
+                continue;
+            }
+
+            if (theJob->peakRSS > theJob->estimate && theJob->estimate > 0)
+            {
+                double scale = (double)theJob->peakRSS / (double)theJob->estimate;
+                if (scale > estimateScale)
+                    estimateScale = scale;
+            }
+            if (theJob->exitCode != 0)
+                failures++;
+
+            cout << theJob->theImage->getSourceFilename()
+                 << ": estimated " << theJob->estimate / (1024 * 1024) << " MB"
+                 << ", peak " << theJob->peakRSS / (1024 * 1024) << " MB"
+                 << ", " << theJob->outcome << endl;
+            string stages = theJob->theProgress->describe();
+            if (!stages.empty())
+                cout << "    " << (theJob->theProgress->getCamera().empty() ? "unknown camera" : theJob->theProgress->getCamera())
+                     << ": " << stages << endl;
+
+            delete theJob->theProcess;
+            theJob->theProcess = NULL;
+            theJob->calibration.reset();
+            theJob->started = false;
+        }
+        waiting.set((double)pending.size());
+        converting.set((double)running);
+    }
+    guard.unlock();
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    reportStageTimes();
+    return failures;
+}
+
+/**
+ * Runs the dcraw process of one conversion under a Supervisor and
+ * records how it ended and its peak memory, or runs the conversion
+ * here if it has no dcraw process of its own
+ * Runs on its own thread
+ * @param theJob - the conversion to run
+ */
+void BatchConverter::runJob(Job * theJob)
+{
+    int exitCode;
+    size_t peakRSS = 0;
+    string outcome;
+    if (theJob->theProcess)
+    {
+        theJob->theProgress->start();
+        Supervisor::Result result = Supervisor().run(*theJob->theProcess);
+        theJob->theProgress->finish();
+        Converter::recordConversion(result.succeeded(), result.seconds);
+        exitCode = result.exitCode;
+        peakRSS = result.peakRSS;
+        outcome = result.describe();
+    }
+    else
+    {
+        Converter theConverter(theExecutable, "");
+        theConverter.setImage(theJob->theImage);
+        theConverter.setProgress(theJob->theProgress);
+        exitCode = theConverter.run(false);
+        peakRSS = theConverter.getPeakRSS();
+        outcome = exitCode == 0 ? "succeeded" : "failed (exit code " + to_string(exitCode) + ")";
+    }
+
+    lock_guard<mutex> guard(lock);
+    theJob->exitCode = exitCode;
+    theJob->outcome = outcome;
+    // A conversion run here adds the peak of its dcraw to the largest
+    // share of this process it was sampled holding
+    if (theJob->theProcess)
+        theJob->peakRSS = peakRSS;
+    else
+        theJob->peakRSS += peakRSS;
+    theJob->finished = true;
+    jobFinished.notify_one();
+}
+
+/**
+ * Samples the growth of this process's resident set since the batch
+ * started, and charges an equal share of it to each conversion running
+ * in this process, as nothing tells which of them holds what
+ * Must be called with the lock held
+ */
+void BatchConverter::sampleOwnMemory()
+{
+    int here = 0;
+    for (size_t i = 0; i < theJobs.size(); i++)
+        if (theJobs[i]->started && !theJobs[i]->finished && !theJobs[i]->theProcess)
+            here++;
+    if (here == 0)
+        return;
+
+    size_t resident = Process::getOwnRSS();
+    size_t share = resident > baselineRSS ? (resident - baselineRSS) / here : 0;
+    for (size_t i = 0; i < theJobs.size(); i++)
+    {
+        Job * theJob = theJobs[i];
+        if (!theJob->started || theJob->finished || theJob->theProcess)
+            continue;
+        theJob->sampledRSS = share;
+        if (share > theJob->peakRSS)
+            theJob->peakRSS = share;
+    }
+}
+
+/**
+ * Prints the mean time of each stage for every camera model in the
+ * batch, and the stage that takes longest, from the conversions that
+ * succeeded
+ */
+void BatchConverter::reportStageTimes() const
+{
+    map<string, vector<double> > totals;
+    map<string, int> counts;
+    for (size_t i = 0; i < theJobs.size(); i++)
+    {
+        if (theJobs[i]->exitCode != 0)
+            continue;
+        string camera = theJobs[i]->theProgress->getCamera();
+        vector<double> durations = theJobs[i]->theProgress->getDurations();
+        vector<double> &total = totals[camera.empty() ? "unknown camera" : camera];
+        total.resize(durations.size(), 0.0);
+        for (size_t stage = 0; stage < durations.size(); stage++)
+            total[stage] += durations[stage];
+        counts[camera.empty() ? "unknown camera" : camera]++;
+    }
+    if (totals.empty())
+        return;
+
+    cout << "Mean stage times by camera:" << endl;
+    ios::fmtflags flags = cout.setf(ios::fixed);
+    streamsize precision = cout.precision(2);
+    for (map<string, vector<double> >::const_iterator camera = totals.begin(); camera != totals.end(); ++camera)
+    {
+        int count = counts[camera->first];
+        int slowest = ConversionProgress::LOADING;
+        cout << "  " << camera->first << " (" << count << (count == 1 ? " file):" : " files):");
+        const char * separator = " ";
+        for (int stage = ConversionProgress::LOADING; stage < ConversionProgress::FINISHED; stage++)
+        {
+            if (camera->second[stage] <= 0)
+                continue;
+            cout << separator << ConversionProgress::getStageName(stage) << " " << camera->second[stage] / count << " s";
+            separator = ", ";
+            if (camera->second[stage] > camera->second[slowest])
+                slowest = stage;
+        }
+        cout << ", mostly " << ConversionProgress::getStageName(slowest) << endl;
+    }
+    cout.precision(precision);
+    cout.flags(flags);
+}
+
+/**
+ * Checks each distinct dark frame and bad pixel map in the queue once,
+ * so that a missing or malformed one stops the batch before it starts
+ * @return true if every calibration can be used, false otherwise
+ */
+bool BatchConverter::validateCalibration()
+{
+    set<pair<string, string> > checked;
+    bool valid = true;
+    for (size_t i = 0; i < theJobs.size(); i++)
+    {
+        Image * theImage = theJobs[i]->theImage;
+        pair<string, string> calibration(theImage->getDarkFrame(), theImage->getBadPixelMap());
+        if (!theImage->hasCalibration() || !checked.insert(calibration).second)
+            continue;
+
+        string error;
+        if (!CalibrationFrames::validate(calibration.first, calibration.second, error))
+        {
+            cerr << error << endl;
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+/**
+ * @param toConvert - an Image
+ * @return true if it is converted by Converter in this process rather
+ *         than by a dcraw writing its own output: if it has manual or
+ *         automatic white balance
+ */
+const bool BatchConverter::convertsHere(const Image * toConvert)
+{
+    return toConvert->getWhiteBalance() != Image::CAMERA;
+}
+
+/**
+ * Sums the memory held by running conversions, using the larger of
+ * each conversion's estimate and its sampled resident set size, or its
+ * share of this process's for a conversion run here
+ * Must be called with the lock held
+ * @return the committed memory in bytes
+ */
+const size_t BatchConverter::committedMemory() const
+{
+    size_t committed = 0;
+    for (size_t i = 0; i < theJobs.size(); i++)
+    {
+        Job * theJob = theJobs[i];
+        if (!theJob->started || theJob->finished)
+            continue;
+        size_t estimate = (size_t)(theJob->estimate * estimateScale);
+        size_t resident = theJob->theProcess ? theJob->theProcess->getCurrentRSS() : theJob->sampledRSS;
+        committed += resident > estimate ? resident : estimate;
+    }
+    return committed;
+}
+
+/**
+ * @return the name of the dcraw executable to run
+ */
+const string BatchConverter::getExecutable() const
+{
+    return theExecutable;
+}
+
+/**
+ * @return the total memory in bytes that running conversions may use
+ */
+const size_t BatchConverter::getMemoryBudget() const
+{
+    return memoryBudget;
+}
+
+/**
+ * @return the maximum number of conversions to run at once
+ */
+const int BatchConverter::getMaxJobs() const
+{
+    return maxJobs;
+}
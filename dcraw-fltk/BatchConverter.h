@@ -0,0 +1,89 @@
+/**
+ * BatchConverter.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef BATCHCONVERTER_H
+#define BATCHCONVERTER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "Image.h"
+#include "Converter.h"
+#include "Process.h"
+#include "ConversionProgress.h"
+#include "CalibrationFrames.h"
+
+using namespace std;
+
+class BatchConverter
+{
+    public:
+        BatchConverter();
+        BatchConverter(const string theExecutable, const size_t memoryBudget, const int maxJobs);
+        ~BatchConverter();
+
+        void setExecutable(const string theExecutable);
+        void setMemoryBudget(const size_t memoryBudget);
+        void setMaxJobs(const int maxJobs);
+        void addImage(Image * toConvert);
+        int run();
+
+        const string getExecutable() const;
+        const size_t getMemoryBudget() const;
+        const int getMaxJobs() const;
+        const size_t estimatePeakMemory(Image * toConvert);
+        const size_t estimatePeakMemory(Image * toConvert, int width, int height);
+
+        // Estimate used when dcraw cannot report the image dimensions (a 24 MP frame)
+        const static int FALLBACK_WIDTH = 6000;
+        const static int FALLBACK_HEIGHT = 4000;
+
+    private:
+        BatchConverter(BatchConverter &toCopy);
+
+        struct Job
+        {
+            Image * theImage;
+            // The executable to convert with (see DecoderBackends)
+            string backend;
+            size_t estimate;
+            size_t peakRSS;
+            // The share of this process's resident set last sampled for a conversion run here
+            size_t sampledRSS;
+            int exitCode;
+            // How the conversion ended, for the report
+            string outcome;
+            int skipped;
+            // The dcraw process, or NULL for a conversion run in this process
+            Process * theProcess;
+            // The dark frame and bad pixel map the process is given, kept until it finishes
+            shared_ptr<const CalibrationFrames> calibration;
+            ConversionProgress * theProgress;
+            // Started and not yet accounted for
+            bool started;
+            bool finished;
+        };
+
+        void runJob(Job * theJob);
+        bool validateCalibration();
+        static const bool convertsHere(const Image * toConvert);
+        void reportStageTimes() const;
+        const size_t committedMemory() const;
+        void sampleOwnMemory();
+
+        string theExecutable;
+        size_t memoryBudget;
+        int maxJobs;
+        double estimateScale;
+        // The resident set of this process when the batch started
+        size_t baselineRSS;
+        vector<Job *> theJobs;
+
+        mutex lock;
+        condition_variable jobFinished;
+};
+#endif
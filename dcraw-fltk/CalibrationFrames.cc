@@ -0,0 +1,257 @@
+/**
+ * class CalibrationFrames
+ * A dark frame and a bad pixel map, given to dcraw with -K and -P so
+ * that it corrects the raw data before white balance and demosaicing,
+ * and loaded once for every frame they correct
+ *
+ * dcraw can only take a dark frame already unpacked to a PGM. Here the
+ * dark frame is a raw file from the same camera, unpacked once with
+ * "dcraw -D -4 -j -t 0" by the dcraw that decodes the frames it corrects,
+ * to a PGM in the temporary directory that every frame is then given.
+ * The PGM is removed when the last frame using it is done. The bad pixel
+ * map is in dcraw's format, a "column row timestamp" line per pixel, and
+ * is read here once only to check it. Both are in the sensor's
+ * coordinates, whatever the orientation of the output
+ *
+ * PUBLIC FEATURES:
+ *       ~CalibrationFrames();
+ *       void addArguments(vector<string> &args);
+ *       bool hasDarkFrame();
+ *       int getBadPixelCount();
+ *       static shared_ptr<CalibrationFrames> get(string theExecutable, string darkFrame,
+ *                                                string badPixelMap, string &error);
+ *       static bool validate(string darkFrame, string badPixelMap, string &error);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "CalibrationFrames.h"
+#include "Process.h"
+#include "Supervisor.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * Default constructor, used by get()
+ */
+CalibrationFrames::CalibrationFrames()
+{
+    darkFrame = "";
+    badPixelMap = "";
+    badPixelCount = 0;
+}
+
+/**
+ * Destructor
+ * Removes the unpacked dark frame
+ */
+CalibrationFrames::~CalibrationFrames()
+{
+    if (!darkFrame.empty())
+        remove(darkFrame.c_str());
+}
+
+/**
+ * Adds -K and -P for the dark frame and bad pixel map to the arguments
+ * of a decode, before the filename they end with
+ * The calibration must be kept until the decode has finished
+ * @param args - the arguments, ending with the source filename
+ */
+void CalibrationFrames::addArguments(vector<string> &args) const
+{
+    vector<string> calibration;
+    if (!darkFrame.empty())
+    {
+        // -K file
+        // Subtract a dark frame from the raw data
+        calibration.push_back("-K");
+        calibration.push_back(darkFrame);
+    }
+    if (!badPixelMap.empty())
+    {
+        // -P file
+        // Read the dead pixel list from this file
+        calibration.push_back("-P");
+        calibration.push_back(badPixelMap);
+    }
+    args.insert(args.empty() ? args.end() : args.end() - 1, calibration.begin(), calibration.end());
+}
+
+/**
+ * @return true if there is a dark frame to subtract
+ */
+const bool CalibrationFrames::hasDarkFrame() const
+{
+    return !darkFrame.empty();
+}
+
+/**
+ * @return the number of bad pixels in the map; dcraw skips those dated
+ *         after the shot, and those off the sensor, when it repairs a frame
+ */
+const int CalibrationFrames::getBadPixelCount() const
+{
+    return badPixelCount;
+}
+
+/**
+ * Finds or loads the calibration for frames decoded by a dcraw
+ * The most recently used calibrations are kept, and failures are kept
+ * too, so that a bad dark frame is reported for each frame but unpacked only once
+ * @param theExecutable - the path to the dcraw that decodes the frames
+ * @param darkFrame - the raw file of the dark frame, "" for none
+ * @param badPixelMap - the bad pixel map, "" for none
+ * @param error - set to the reason if the calibration cannot be loaded
+ * @return the calibration, or NULL if it could not be loaded
+ */
+shared_ptr<const CalibrationFrames> CalibrationFrames::get(const string theExecutable, const string darkFrame,
+                                                           const string badPixelMap, string &error)
+{
+    struct Entry
+    {
+        string key;
+        shared_ptr<const CalibrationFrames> frames;
+        string error;
+    };
+    static mutex cacheLock;
+    static list<Entry> cache;
+    static Metrics::Counter &hits = Metrics::counter("dcraw_fltk_cache_requests_total", "Cache lookups, by cache and result",
+                                                   "cache=\"calibration\",result=\"hit\"");
+    static Metrics::Counter &misses = Metrics::counter("dcraw_fltk_cache_requests_total", "Cache lookups, by cache and result",
+                                                     "cache=\"calibration\",result=\"miss\"");
+
+    ostringstream key(ostringstream::out);
+    key << theExecutable << "\n" << darkFrame << "\n" << badPixelMap;
+
+    // Held while loading, so that frames waiting for the same calibration share one load
+    lock_guard<mutex> guard(cacheLock);
+    for (list<Entry>::iterator entry = cache.begin(); entry != cache.end(); ++entry)
+        if (entry->key == key.str())
+        {
+            cache.splice(cache.begin(), cache, entry);
+            error = cache.front().error;
+            hits.add();
+            return cache.front().frames;
+        }
+    misses.add();
+
+    Entry loaded;
+    loaded.key = key.str();
+    shared_ptr<CalibrationFrames> frames(new CalibrationFrames());
+    vector<unsigned long long> pixels;
+    bool succeeded = badPixelMap.empty() || readBadPixelMap(badPixelMap, pixels, loaded.error);
+    frames->badPixelMap = badPixelMap;
+    frames->badPixelCount = (int)pixels.size();
+
+    if (succeeded && !darkFrame.empty())
+    {
+        // -D -4 leaves the raw samples unscaled and undemosaiced, -j and -t 0
+        // leave them unstretched and unturned, as dcraw's -K expects
+        vector<string> args;
+        args.push_back("-D");
+        args.push_back("-4");
+        args.push_back("-j");
+        args.push_back("-t");
+        args.push_back("0");
+        args.push_back("-c");
+        args.push_back(darkFrame);
+        frames->darkFrame = Process::getTemporaryFilename(".dark.pgm");
+        Process dcraw(theExecutable, args);
+        dcraw.setOutputFile(frames->darkFrame);
+        cout << "\nAbout to run " << dcraw.getCommandLine();
+
+        char magic[2] = {0, 0};
+        ifstream unpacked;
+        succeeded = Supervisor().run(dcraw).succeeded();
+        if (succeeded)
+        {
+            unpacked.open(frames->darkFrame.c_str(), ios::binary);
+            succeeded = unpacked.read(magic, 2) && magic[0] == 'P' && magic[1] == '5';
+        }
+        if (!succeeded)
+            loaded.error = "cannot unpack the dark frame " + darkFrame;
+    }
+
+    if (succeeded)
+        loaded.frames = frames;
+    cache.push_front(loaded);
+    if ((int)cache.size() > CACHE_SIZE)
+        cache.pop_back();
+    error = loaded.error;
+    return loaded.frames;
+}
+
+/**
+ * Checks a dark frame and bad pixel map before a batch starts, so
+ * that a mistyped name fails at once rather than on every file
+ * @param darkFrame - the raw file of the dark frame, "" for none
+ * @param badPixelMap - the bad pixel map, "" for none
+ * @param error - set to the reason if either cannot be used
+ * @return true if both can be used, false otherwise
+ */
+bool CalibrationFrames::validate(const string darkFrame, const string badPixelMap, string &error)
+{
+    struct stat status;
+    if (!darkFrame.empty() && stat(darkFrame.c_str(), &status) != 0)
+    {
+        error = "cannot find the dark frame " + darkFrame;
+        return false;
+    }
+    vector<unsigned long long> pixels;
+    return badPixelMap.empty() || readBadPixelMap(badPixelMap, pixels, error);
+}
+
+/**
+ * Reads a bad pixel map in dcraw's format: one "column row timestamp"
+ * line per pixel, with anything after a # ignored. dcraw quietly skips
+ * a line without all three fields, so such a line is refused here
+ * rather than counted
+ * @param filename - the bad pixel map
+ * @param pixels - set to the pixels, as row << 32 | column, sorted
+ * @param error - set to the reason if the map cannot be read
+ * @return true if the map was read, false otherwise
+ */
+bool CalibrationFrames::readBadPixelMap(const string filename, vector<unsigned long long> &pixels, string &error)
+{
+    ifstream file(filename.c_str());
+    if (!file)
+    {
+        error = "cannot open the bad pixel map " + filename;
+        return false;
+    }
+
+    pixels.clear();
+    string line;
+    for (int number = 1; getline(file, line); number++)
+    {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+
+        istringstream fields(line);
+        long long column, row, timestamp;
+        if (!(fields >> column >> row >> timestamp) || column < 0 || row < 0 || column > 0xffffffffLL
+            || row > 0xffffffffLL)
+        {
+            ostringstream message(ostringstream::out);
+            message << "cannot read line " << number << " of the bad pixel map " << filename;
+            error = message.str();
+            return false;
+        }
+        pixels.push_back(((unsigned long long)row << 32) | (unsigned long long)column);
+    }
+
+    sort(pixels.begin(), pixels.end());
+    pixels.erase(unique(pixels.begin(), pixels.end()), pixels.end());
+    return true;
+}
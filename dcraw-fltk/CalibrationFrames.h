@@ -0,0 +1,44 @@
+/**
+ * CalibrationFrames.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef CALIBRATIONFRAMES_H
+#define CALIBRATIONFRAMES_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+class CalibrationFrames
+{
+    public:
+        ~CalibrationFrames();
+
+        void addArguments(vector<string> &args) const;
+
+        const bool hasDarkFrame() const;
+        const int getBadPixelCount() const;
+
+        static shared_ptr<const CalibrationFrames> get(const string theExecutable, const string darkFrame,
+                                                       const string badPixelMap, string &error);
+        static bool validate(const string darkFrame, const string badPixelMap, string &error);
+
+        // Number of calibrations get() keeps
+        const static int CACHE_SIZE = 4;
+
+    private:
+        CalibrationFrames();
+        CalibrationFrames(CalibrationFrames &toCopy);
+
+        static bool readBadPixelMap(const string filename, vector<unsigned long long> &pixels, string &error);
+
+        // The dark frame unpacked by dcraw -D to a temporary PGM, "" if there is none
+        string darkFrame;
+        // The bad pixel map as given, "" if there is none
+        string badPixelMap;
+        int badPixelCount;
+};
+#endif
@@ -0,0 +1,924 @@
+/**
+ * class CommandLine
+ * The modes of dcraw-fltk that run without the GUI
+ *
+ *   --batch       convert several raw images at once (see BatchConverter)
+ *   --convert     write several outputs from one decode of each raw image
+ *   --stack       stack several raw frames into one image (see FrameStacker)
+ *   --queue       share a batch between processes and hosts through a directory (see WorkQueue)
+ *   --serve       convert for other programs over a local socket (see ConversionService)
+ *   --decode-worker  decode for the GUI in a separate process (see DecoderPool)
+ *   --index       build the thumbnail and metadata index of a directory
+ *   --benchmark   check the tone kernels against each other and time them
+ *   --backends    time dcraw-compatible executables on each camera model (see DecoderBackends)
+ *   --probe       recognise raw files from their headers, without dcraw (see RawProbe)
+ *
+ * Every mode also takes the limits each dcraw runs under (see Supervisor):
+ *   --timeout S, --cpu-limit S, --memory-limit MB, --retries N
+ * and where to publish its Metrics while it runs (see MetricsExporter):
+ *   --metrics-file path, --metrics-socket path, --metrics-interval S
+ * and the profile that picks the quickest executable for each camera model:
+ *   --backend-profile file
+ *
+ * PUBLIC FEATURES:
+ *       static int run(int argc, char **argv);
+ *       static bool isCommand(int argc, char **argv);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "CommandLine.h"
+#include "Image.h"
+#include "BatchConverter.h"
+#include "Converter.h"
+#include "DirectoryIndex.h"
+#include "CalibrationFrames.h"
+#include "FrameStacker.h"
+#include "WorkQueue.h"
+#include "ConversionService.h"
+#include "DecoderPool.h"
+#include "Supervisor.h"
+#include "MetricsExporter.h"
+#include "DecoderBackends.h"
+#include "RawProbe.h"
+#include "PixelBuffer.h"
+#include "JpegEncoder.h"
+#include "ToneKernels.h"
+#include <Fl/filename.H>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <chrono>
+#include <vector>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+/**
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return true if the arguments select a command line mode, false to start the GUI
+ */
+const bool CommandLine::isCommand(int argc, char **argv)
+{
+    if (argc < 2)
+        return false;
+    return strcmp(argv[1], "--batch") == 0 || strcmp(argv[1], "--convert") == 0 ||
+           strcmp(argv[1], "--stack") == 0 || strcmp(argv[1], "--queue") == 0 ||
+           strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--decode-worker") == 0 ||
+           strcmp(argv[1], "--index") == 0 || strcmp(argv[1], "--benchmark") == 0 ||
+           strcmp(argv[1], "--backends") == 0 || strcmp(argv[1], "--probe") == 0;
+}
+
+/**
+ * Runs the command line mode selected by the first argument
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return the exit code for the program
+ */
+int CommandLine::run(int argc, char **argv)
+{
+    argc = parseSupervision(argc, argv);
+    argc = parseBackendProfile(argc, argv);
+    if (argc < 0)
+        return 1;
+
+    string metricsFile, metricsSocket;
+    int metricsInterval = MetricsExporter::DEFAULT_INTERVAL_SECONDS;
+    argc = parseMetrics(argc, argv, metricsFile, metricsSocket, metricsInterval);
+    if (metricsFile.empty() && metricsSocket.empty())
+        return runMode(argc, argv);
+
+    MetricsExporter exporter(metricsFile, metricsSocket, metricsInterval);
+    if (!exporter.start())
+        return 1;
+    int exitCode = runMode(argc, argv);
+    exporter.stop();
+    return exitCode;
+}
+
+/**
+ * Runs the mode named by the first argument, once the options every mode takes are removed
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return the exit code for the program
+ */
+int CommandLine::runMode(int argc, char **argv)
+{
+    if (strcmp(argv[1], "--batch") == 0)
+        return runBatch(argc, argv);
+    if (strcmp(argv[1], "--convert") == 0)
+        return runConvert(argc, argv);
+    if (strcmp(argv[1], "--stack") == 0)
+        return runStack(argc, argv);
+    if (strcmp(argv[1], "--queue") == 0)
+        return runQueue(argc, argv);
+    if (strcmp(argv[1], "--serve") == 0)
+        return runServe(argc, argv);
+    if (strcmp(argv[1], "--decode-worker") == 0)
+        return DecoderPool::runWorker();
+    if (strcmp(argv[1], "--index") == 0)
+        return runIndex(argc, argv);
+    if (strcmp(argv[1], "--benchmark") == 0)
+        return runBenchmark(argc, argv);
+    if (strcmp(argv[1], "--backends") == 0)
+        return runBackends(argc, argv);
+    if (strcmp(argv[1], "--probe") == 0)
+        return runProbe(argc, argv);
+    return 1;
+}
+
+/**
+ * Takes the Supervisor limits out of the arguments, wherever they
+ * appear, and makes them the defaults for every dcraw run from now on
+ * @param argc - the number of arguments
+ * @param argv - the arguments, with the limits removed on return
+ * @return the number of arguments left
+ */
+int CommandLine::parseSupervision(int argc, char **argv)
+{
+    Supervisor limits;
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+            limits.setTimeout(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--cpu-limit") == 0 && i + 1 < argc)
+            limits.setCPULimit(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc)
+            limits.setMemoryLimit((size_t)atol(argv[++i]) * 1024 * 1024);
+        else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc)
+            limits.setRetries(atoi(argv[++i]));
+        else
+            argv[kept++] = argv[i];
+    }
+    Supervisor::setDefaults(limits);
+    return kept;
+}
+
+/**
+ * Takes the metrics options out of the arguments, wherever they appear
+ * @param argc - the number of arguments
+ * @param argv - the arguments, with the options removed on return
+ * @param textFile - set to the file to write the metrics to, if given
+ * @param socketPath - set to the socket to answer scrapes on, if given
+ * @param intervalSeconds - set to the seconds between writes of the file, if given
+ * @return the number of arguments left
+ */
+int CommandLine::parseMetrics(int argc, char **argv, string &textFile, string &socketPath, int &intervalSeconds)
+{
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc)
+            textFile = argv[++i];
+        else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc)
+            intervalSeconds = atoi(argv[++i]);
+        else
+            argv[kept++] = argv[i];
+    }
+    return kept;
+}
+
+/**
+ * Takes --backend-profile out of the arguments, wherever it appears,
+ * and loads the profile every conversion is routed through from now on
+ * @param argc - the number of arguments
+ * @param argv - the arguments, with the option removed on return
+ * @return the number of arguments left, or -1 if the profile could not be read
+ */
+int CommandLine::parseBackendProfile(int argc, char **argv)
+{
+    int kept = 1;
+    bool loaded = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--backend-profile") == 0 && i + 1 < argc)
+        {
+            loaded = DecoderBackends::getShared().load(argv[++i]);
+            if (!loaded)
+                cerr << "Could not read the backend profile " << argv[i] << endl;
+        }
+        else
+            argv[kept++] = argv[i];
+    }
+    return loaded ? kept : -1;
+}
+
+/**
+ * @param format - a file format name (jpeg, tiff8, tiff16, ppm8 or ppm16)
+ * @return the matching Image file format constant, PPM_16 if unknown
+ */
+const int CommandLine::parseFileFormat(const string format)
+{
+    if (format == "jpeg" || format == "jpg")
+        return Image::JPEG;
+    if (format == "tiff8")
+        return Image::TIFF_8;
+    if (format == "tiff16")
+        return Image::TIFF_16;
+    if (format == "ppm8")
+        return Image::PPM_8;
+    return Image::PPM_16;
+}
+
+/**
+ * Converts raw images from the command line
+ * dcraw-fltk --batch <dcraw> [--jobs N] [--memory MB] [--format tiff8|tiff16|ppm8|ppm16] [--noise T]
+ *             [--dark file] [--bad-pixels file] files...
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if every conversion succeeded, 1 otherwise
+ */
+int CommandLine::runBatch(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        cerr << "Usage: " << argv[0] << " --batch <dcraw> [--jobs N] [--memory MB]"
+             << " [--format tiff8|tiff16|ppm8|ppm16] [--noise T] [--dark file] [--bad-pixels file] files or directories..." << endl;
+        return 1;
+    }
+
+    BatchConverter theBatch;
+    theBatch.setExecutable(argv[2]);
+    int fileFormat = Image::PPM_16;
+    double noiseThreshold = 0;
+    string darkFrame, badPixelMap;
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            theBatch.setMaxJobs(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--noise") == 0 && i + 1 < argc)
+            noiseThreshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--dark") == 0 && i + 1 < argc)
+            darkFrame = argv[++i];
+        else if (strcmp(argv[i], "--bad-pixels") == 0 && i + 1 < argc)
+            badPixelMap = argv[++i];
+        else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+            theBatch.setMemoryBudget((size_t)atol(argv[++i]) * 1024 * 1024);
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            fileFormat = parseFileFormat(argv[++i]);
+            if (fileFormat == Image::JPEG)
+            {
+                cerr << "dcraw cannot write JPEG files, use --convert --output jpeg instead" << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            vector<string> files;
+            addFiles(argv[i], files);
+            for (size_t f = 0; f < files.size(); f++)
+            {
+                Image * theImage = new Image();
+                theImage->setSourceFilename(files[f]);
+                theImage->setFileFormat(fileFormat);
+                theImage->setNoiseThreshold(noiseThreshold);
+                setCalibration(*theImage, darkFrame, badPixelMap);
+                theBatch.addImage(theImage);
+            }
+        }
+    }
+
+    return theBatch.run() == 0 ? 0 : 1;
+}
+
+/**
+ * Gives an Image the dark frame and bad pixel map from the command line
+ * Both are applied by dcraw to the raw data, before white balance, so
+ * they suit any white balance
+ * @param theImage - the Image to calibrate
+ * @param darkFrame - the raw file of the dark frame, "" for none
+ * @param badPixelMap - the bad pixel map, "" for none
+ */
+void CommandLine::setCalibration(Image &theImage, const string darkFrame, const string badPixelMap)
+{
+    theImage.setDarkFrame(darkFrame);
+    theImage.setBadPixelMap(badPixelMap);
+}
+
+/**
+ * Adds a file, or the raw files of a directory
+ * @param path - a file or a directory
+ * @param files - the file, or the raw files of the directory, added to the end
+ */
+void CommandLine::addFiles(const string path, vector<string> &files)
+{
+    if (!fl_filename_isdir(path.c_str()))
+    {
+        files.push_back(path);
+        return;
+    }
+    vector<string> names = DirectoryIndex::listRawFiles(path);
+    for (size_t i = 0; i < names.size(); i++)
+        files.push_back(path + "/" + names[i]);
+}
+
+/**
+ * Reads an output target description: format[:maxsize[:quality]]
+ * The output filename is left for the caller to fill in
+ * @param description - the description, for example jpeg:2048:85
+ * @param target - set to the target described
+ * @return true if the description could be read, false otherwise
+ */
+const bool CommandLine::parseOutputTarget(const string description, OutputTarget &target)
+{
+    string fields[3];
+    size_t start = 0;
+    for (int i = 0; i < 3 && start != string::npos; i++)
+    {
+        size_t end = description.find(':', start);
+        fields[i] = description.substr(start, end == string::npos ? string::npos : end - start);
+        start = end == string::npos ? end : end + 1;
+    }
+    if (start != string::npos || fields[0].empty())
+        return false;
+
+    target.fileFormat = parseFileFormat(fields[0]);
+    target.maxSize = fields[1].empty() ? 0 : atoi(fields[1].c_str());
+    target.quality = fields[2].empty() ? JpegEncoder::DEFAULT_QUALITY : atoi(fields[2].c_str());
+    return target.maxSize >= 0 && target.quality >= 1 && target.quality <= 100;
+}
+
+/**
+ * Adds output targets to an Image, named after a base name with the
+ * size appended for downscaled outputs: IMG_0001.tiff, IMG_0001-2048.jpg, ...
+ * @param theImage - the Image to add the targets to
+ * @param targets - the targets, without output filenames
+ * @param base - the output filename without the size or extension
+ */
+void CommandLine::addNamedTargets(Image &theImage, const vector<OutputTarget> &targets, const string base)
+{
+    for (size_t t = 0; t < targets.size(); t++)
+    {
+        OutputTarget target = targets[t];
+        ostringstream name(ostringstream::out);
+        name << base;
+        if (target.maxSize > 0)
+            name << "-" << target.maxSize;
+        name << Image::getFileExtension(target.fileFormat);
+        target.outputFilename = name.str();
+        theImage.addOutputTarget(target);
+    }
+}
+
+/**
+ * Writes several outputs from one decode of each raw image, for
+ * example a full size TIFF, a web JPEG and a thumbnail
+ * dcraw-fltk --convert <dcraw> --output format[:maxsize[:quality]]... [--noise T]
+ *             [--dark file] [--bad-pixels file] files...
+ * Outputs are named after the source file, with the size appended
+ * for downscaled outputs: IMG_0001.tiff, IMG_0001-2048.jpg, ...
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if every output was written, 1 otherwise
+ */
+int CommandLine::runConvert(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        cerr << "Usage: " << argv[0] << " --convert <dcraw> --output format[:maxsize[:quality]]... [--noise T]"
+             << " [--dark file] [--bad-pixels file] files..." << endl
+             << "  formats: jpeg, tiff8, tiff16, ppm8, ppm16" << endl;
+        return 1;
+    }
+
+    vector<OutputTarget> targets;
+    vector<string> files;
+    double noiseThreshold = 0;
+    string darkFrame, badPixelMap;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--noise") == 0 && i + 1 < argc)
+            noiseThreshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--dark") == 0 && i + 1 < argc)
+            darkFrame = argv[++i];
+        else if (strcmp(argv[i], "--bad-pixels") == 0 && i + 1 < argc)
+            badPixelMap = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            OutputTarget target;
+            if (!parseOutputTarget(argv[++i], target))
+            {
+                cerr << "Cannot read output " << argv[i] << endl;
+                return 1;
+            }
+            targets.push_back(target);
+        }
+        else
+            files.push_back(argv[i]);
+    }
+    if (targets.empty())
+    {
+        OutputTarget target;
+        parseOutputTarget("ppm16", target);
+        targets.push_back(target);
+    }
+
+    string error;
+    if (!CalibrationFrames::validate(darkFrame, badPixelMap, error))
+    {
+        cerr << error << endl;
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        Image theImage;
+        theImage.setSourceFilename(files[f]);
+        theImage.setNoiseThreshold(noiseThreshold);
+        setCalibration(theImage, darkFrame, badPixelMap);
+        addNamedTargets(theImage, targets, files[f].substr(0, files[f].find_last_of(".")));
+
+        Converter theConverter;
+        theConverter.setExecutable(argv[2]);
+        theConverter.setImage(&theImage);
+        if (!theConverter.runTargets())
+        {
+            cerr << "Could not convert " << files[f] << endl;
+            failed++;
+        }
+    }
+
+    return failed == 0 ? 0 : 1;
+}
+
+/**
+ * Stacks several raw frames of one scene and writes the result
+ * dcraw-fltk --stack <dcraw> [--method mean|sigma|median] [--sigma K] [--jobs N] [--memory MB] [--spill dir]
+ *            [--output format[:maxsize[:quality]]]... [--noise T] [--dark file] [--bad-pixels file] files...
+ * Outputs are named after the first frame with the method appended:
+ * IMG_0001-median.tiff, IMG_0001-median-2048.jpg, ...
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if every output was written, 1 otherwise
+ */
+int CommandLine::runStack(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        cerr << "Usage: " << argv[0] << " --stack <dcraw> [--method mean|sigma|median] [--sigma K] [--jobs N]"
+             << " [--memory MB] [--spill dir] [--output format[:maxsize[:quality]]]... [--noise T]"
+             << " [--dark file] [--bad-pixels file] files..." << endl;
+        return 1;
+    }
+
+    FrameStacker theStacker;
+    theStacker.setExecutable(argv[2]);
+    vector<OutputTarget> targets;
+    vector<string> files;
+    string methodName = "median";
+    double noiseThreshold = 0;
+    string darkFrame, badPixelMap;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--method") == 0 && i + 1 < argc)
+            methodName = argv[++i];
+        else if (strcmp(argv[i], "--sigma") == 0 && i + 1 < argc)
+            theStacker.setClipSigma(atof(argv[++i]));
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            theStacker.setMaxJobs(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+            theStacker.setMemoryBudget((size_t)atol(argv[++i]) * 1024 * 1024);
+        else if (strcmp(argv[i], "--spill") == 0 && i + 1 < argc)
+            theStacker.setSpillDirectory(argv[++i]);
+        else if (strcmp(argv[i], "--noise") == 0 && i + 1 < argc)
+            noiseThreshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--dark") == 0 && i + 1 < argc)
+            darkFrame = argv[++i];
+        else if (strcmp(argv[i], "--bad-pixels") == 0 && i + 1 < argc)
+            badPixelMap = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            OutputTarget target;
+            if (!parseOutputTarget(argv[++i], target))
+            {
+                cerr << "Cannot read output " << argv[i] << endl;
+                return 1;
+            }
+            targets.push_back(target);
+        }
+        else
+            files.push_back(argv[i]);
+    }
+
+    if (methodName == "mean")
+        theStacker.setMethod(FrameStacker::MEAN);
+    else if (methodName == "sigma")
+        theStacker.setMethod(FrameStacker::SIGMA_CLIPPED);
+    else if (methodName == "median")
+        theStacker.setMethod(FrameStacker::MEDIAN);
+    else
+    {
+        cerr << "Unknown method " << methodName << ", use mean, sigma or median" << endl;
+        return 1;
+    }
+    if (files.empty())
+    {
+        cerr << "There are no frames to stack" << endl;
+        return 1;
+    }
+    if (targets.empty())
+    {
+        OutputTarget target;
+        parseOutputTarget("tiff16", target);
+        targets.push_back(target);
+    }
+
+    string error;
+    if (!CalibrationFrames::validate(darkFrame, badPixelMap, error))
+    {
+        cerr << error << endl;
+        return 1;
+    }
+
+    // Every frame must be decoded alike, so automatic white balance is not used
+    Image theImage;
+    theImage.setWhiteBalance(Image::CAMERA);
+    theImage.setNoiseThreshold(noiseThreshold);
+    setCalibration(theImage, darkFrame, badPixelMap);
+    addNamedTargets(theImage, targets, files[0].substr(0, files[0].find_last_of(".")) + "-" + methodName);
+
+    theStacker.setImage(&theImage);
+    for (size_t f = 0; f < files.size(); f++)
+        theStacker.addFrame(files[f]);
+
+    auto start = chrono::steady_clock::now();
+    shared_ptr<PixelBuffer> stacked(new PixelBuffer());
+    if (!theStacker.run(*stacked, error))
+    {
+        cerr << "Could not stack: " << error << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << files.size() << " frames stacked in " << seconds << "s" << endl;
+
+    Converter theConverter;
+    theConverter.setExecutable(argv[2]);
+    theConverter.setImage(&theImage);
+    return theConverter.writeLinear(stacked) ? 0 : 1;
+}
+
+/**
+ * Submits conversions to a directory work queue, works through one,
+ * or reports how many of its jobs are in each state
+ * dcraw-fltk --queue submit <queue> [--format tiff8|tiff16|ppm8|ppm16] [--output format[:maxsize[:quality]]]...
+ *            [--noise T] [--dark file] [--bad-pixels file] files...
+ * dcraw-fltk --queue work <queue> <dcraw> [--jobs N] [--lease seconds] [--until-empty]
+ * dcraw-fltk --queue status <queue>
+ * Filenames are stored as given, so must reach the files from every worker
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if every job was submitted or converted, 1 otherwise
+ */
+int CommandLine::runQueue(int argc, char **argv)
+{
+    if (argc < 4 || (strcmp(argv[2], "work") == 0 && argc < 5))
+    {
+        cerr << "Usage: " << argv[0] << " --queue submit <queue> [--format tiff8|tiff16|ppm8|ppm16]"
+             << " [--output format[:maxsize[:quality]]]... [--noise T] [--dark file] [--bad-pixels file] files..." << endl
+             << "       " << argv[0] << " --queue work <queue> <dcraw> [--jobs N] [--lease seconds] [--until-empty]" << endl
+             << "       " << argv[0] << " --queue status <queue>" << endl;
+        return 1;
+    }
+
+    WorkQueue theQueue(argv[3]);
+    if (!theQueue.create())
+    {
+        cerr << "Cannot create the queue " << argv[3] << endl;
+        return 1;
+    }
+
+    if (strcmp(argv[2], "status") == 0)
+    {
+        cout << theQueue.count(WorkQueue::PENDING) << " pending, " << theQueue.count(WorkQueue::CLAIMED) << " claimed, "
+             << theQueue.count(WorkQueue::DONE) << " done, " << theQueue.count(WorkQueue::FAILED) << " failed" << endl;
+        return 0;
+    }
+
+    if (strcmp(argv[2], "work") == 0)
+    {
+        int jobs = (int)thread::hardware_concurrency();
+        bool untilEmpty = false;
+        for (int i = 5; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+                jobs = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--lease") == 0 && i + 1 < argc)
+                theQueue.setLeaseSeconds(atoi(argv[++i]));
+            else if (strcmp(argv[i], "--until-empty") == 0)
+                untilEmpty = true;
+        }
+        return theQueue.work(argv[4], max(jobs, 1), untilEmpty) == 0 ? 0 : 1;
+    }
+
+    int fileFormat = Image::PPM_16;
+    vector<OutputTarget> targets;
+    double noiseThreshold = 0;
+    string darkFrame, badPixelMap;
+    int failed = 0;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+            fileFormat = parseFileFormat(argv[++i]);
+        else if (strcmp(argv[i], "--noise") == 0 && i + 1 < argc)
+            noiseThreshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--dark") == 0 && i + 1 < argc)
+            darkFrame = argv[++i];
+        else if (strcmp(argv[i], "--bad-pixels") == 0 && i + 1 < argc)
+            badPixelMap = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            OutputTarget target;
+            if (!parseOutputTarget(argv[++i], target))
+            {
+                cerr << "Cannot read output " << argv[i] << endl;
+                return 1;
+            }
+            targets.push_back(target);
+        }
+        else
+        {
+            if (targets.empty() && fileFormat == Image::JPEG)
+            {
+                cerr << "dcraw cannot write JPEG files, use --output jpeg instead" << endl;
+                return 1;
+            }
+
+            Image theImage;
+            theImage.setSourceFilename(argv[i]);
+            theImage.setFileFormat(fileFormat);
+            theImage.setNoiseThreshold(noiseThreshold);
+            setCalibration(theImage, darkFrame, badPixelMap);
+            string source = argv[i];
+            addNamedTargets(theImage, targets, source.substr(0, source.find_last_of(".")));
+
+            string jobName;
+            if (theQueue.submit(theImage, jobName))
+                cout << jobName << ": " << argv[i] << endl;
+            else
+            {
+                cerr << "Cannot queue " << argv[i] << endl;
+                failed++;
+            }
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+// The service stopped by SIGINT and SIGTERM
+static ConversionService * theService = NULL;
+
+/**
+ * Stops the running service, and any retries of the dcraw runs it is waiting for
+ * @param signalNumber - the signal received
+ */
+static void stopService(int signalNumber)
+{
+    Supervisor::stop();
+    if (theService)
+        theService->stop();
+}
+
+/**
+ * Serves conversions over a local socket until interrupted
+ * dcraw-fltk --serve <dcraw> <socket> [--jobs N] [--queue N]
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if the service ran, 1 if it could not listen
+ */
+int CommandLine::runServe(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        cerr << "Usage: " << argv[0] << " --serve <dcraw> <socket> [--jobs N] [--queue N]" << endl;
+        return 1;
+    }
+
+    int jobs = (int)thread::hardware_concurrency();
+    int queueCapacity = 0;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc)
+            queueCapacity = atoi(argv[++i]);
+    }
+    jobs = max(jobs, 1);
+
+    // By default as many requests may wait as are being converted, twice over
+    ConversionService service(argv[2], argv[3], jobs, queueCapacity > 0 ? queueCapacity : jobs * 2);
+    theService = &service;
+    signal(SIGINT, stopService);
+    signal(SIGTERM, stopService);
+    bool served = service.run();
+    theService = NULL;
+    return served ? 0 : 1;
+}
+
+/**
+ * Indexes the raw files of a directory, extracting the metadata and
+ * thumbnails of the files that are new or have changed since last time
+ * dcraw-fltk --index <dcraw> <directory> [--jobs N]
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if the index was saved, 1 otherwise
+ */
+int CommandLine::runIndex(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        cerr << "Usage: " << argv[0] << " --index <dcraw> <directory> [--jobs N]" << endl;
+        return 1;
+    }
+
+    int jobs = (int)thread::hardware_concurrency();
+    for (int i = 4; i < argc; i++)
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+
+    DirectoryIndex theIndex(argv[3]);
+    theIndex.load();
+    auto start = chrono::steady_clock::now();
+    int extracted = theIndex.update(argv[2], max(jobs, 1));
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (extracted < 0)
+    {
+        cerr << "Could not save the index of " << argv[3] << endl;
+        return 1;
+    }
+
+    cout << theIndex.getEntryCount() << " files indexed, " << extracted << " extracted in "
+         << seconds << "s" << (theIndex.isMapped() ? "" : " (thumbnails kept in memory only)") << endl;
+    return 0;
+}
+
+/**
+ * Checks every tone kernel this processor supports against the
+ * scalar reference, for 16 bit and float input, and reports the
+ * throughput of each in pixels per second
+ * dcraw-fltk --benchmark [megapixels]
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if every kernel matched the scalar reference, 1 otherwise
+ */
+int CommandLine::runBenchmark(int argc, char **argv)
+{
+    size_t pixels = (size_t)((argc > 2 ? atof(argv[2]) : 24.0) * 1000000);
+    if (pixels < 1)
+        pixels = 1;
+
+    // Repeatable samples spread over the whole 16 bit range, including clipped ones
+    vector<unsigned short> samples(pixels * 3);
+    vector<float> floatSamples(pixels * 3);
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        samples[i] = (unsigned short)(seed >> 16);
+        floatSamples[i] = samples[i] * 1.25f - 1000.0f;
+    }
+
+    ToneKernels theKernels(1.4, 0.8, 3.5, 16000, 0.6);
+    vector<unsigned short> reference(pixels * 3), reference32(pixels * 3), output(pixels * 3);
+    theKernels.apply(&samples[0], &reference[0], pixels, ToneKernels::SCALAR);
+    theKernels.apply(&floatSamples[0], &reference32[0], pixels, ToneKernels::SCALAR);
+
+    cout << "Best kernel: " << ToneKernels::getInstructionSetName(ToneKernels::getInstructionSet()) << endl;
+
+    bool matched = true;
+    for (int instructionSet = ToneKernels::SCALAR; instructionSet <= ToneKernels::AVX512; instructionSet++)
+    {
+        if (!ToneKernels::isSupported(instructionSet))
+            continue;
+
+        for (int floatInput = 0; floatInput < 2; floatInput++)
+        {
+            chrono::steady_clock::time_point started = chrono::steady_clock::now();
+            if (floatInput)
+                theKernels.apply(&floatSamples[0], &output[0], pixels, instructionSet);
+            else
+                theKernels.apply(&samples[0], &output[0], pixels, instructionSet);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+            const vector<unsigned short> &expected = floatInput ? reference32 : reference;
+            bool same = memcmp(&output[0], &expected[0], output.size() * sizeof(unsigned short)) == 0;
+            matched = matched && same;
+
+            cout << ToneKernels::getInstructionSetName(instructionSet) << (floatInput ? " float" : " 16 bit")
+                 << ": " << (seconds > 0 ? pixels / seconds / 1000000 : 0) << " Mpixels/s, "
+                 << (same ? "matches scalar" : "DIFFERS FROM SCALAR") << endl;
+        }
+    }
+
+    return matched ? 0 : 1;
+}
+
+/**
+ * Times each dcraw-compatible executable on a few files of every camera
+ * model among the files, checks its output against the first one's and
+ * saves the profile for --backend-profile
+ * dcraw-fltk --backends <profile> --backend <dcraw> [--backend <dcraw>]... [--samples N] files...
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if the profile was saved, 1 otherwise
+ */
+int CommandLine::runBackends(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        cerr << "Usage: " << argv[0] << " --backends <profile> --backend <dcraw> [--backend <dcraw>]... [--samples N] files..." << endl;
+        return 1;
+    }
+
+    DecoderBackends theBackends;
+    int samples = DecoderBackends::DEFAULT_SAMPLES;
+    vector<string> files;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            theBackends.addBackend(argv[++i]);
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            samples = atoi(argv[++i]);
+        else
+            files.push_back(argv[i]);
+    }
+    if (theBackends.getBackends().empty() || files.empty())
+    {
+        cerr << "At least one --backend and one raw file are needed" << endl;
+        return 1;
+    }
+
+    int cameras = theBackends.benchmark(files, max(samples, 1));
+    if (cameras == 0)
+    {
+        cerr << "None of the files could be identified by " << theBackends.getBackends()[0] << endl;
+        return 1;
+    }
+    cout << theBackends.describe();
+    if (!theBackends.save(argv[2]))
+    {
+        cerr << "Could not save the backend profile " << argv[2] << endl;
+        return 1;
+    }
+    cout << cameras << " camera models profiled, saved to " << argv[2] << endl;
+    return 0;
+}
+
+/**
+ * Reads the headers of raw files, N at once, and reports the format,
+ * camera, size and compression of each, or why dcraw will not decode it
+ * dcraw-fltk --probe [--jobs N] files or directories...
+ * @param argc - the number of arguments
+ * @param argv - the arguments
+ * @return 0 if no file was rejected, 1 otherwise
+ */
+int CommandLine::runProbe(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0] << " --probe [--jobs N] files or directories..." << endl;
+        return 1;
+    }
+
+    int jobs = max((int)thread::hardware_concurrency(), 1);
+    vector<string> files;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else
+            addFiles(argv[i], files);
+    }
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    vector<RawProbe::Header> headers = RawProbe::probeAll(files, jobs);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    int counts[RawProbe::UNREADABLE + 1] = { 0 };
+    size_t bytesRead = 0;
+    for (size_t i = 0; i < headers.size(); i++)
+    {
+        cout << headers[i].filename << ": " << headers[i].describe() << endl;
+        counts[headers[i].status]++;
+        bytesRead += headers[i].bytesRead;
+    }
+
+    cout << headers.size() << (headers.size() == 1 ? " file" : " files");
+    for (int status = RawProbe::RAW; status <= RawProbe::UNREADABLE; status++)
+        if (counts[status] > 0)
+            cout << ", " << counts[status] << " " << RawProbe::getStatusName((RawProbe::Status)status);
+    cout.setf(ios::fixed);
+    cout.precision(3);
+    cout << ", " << bytesRead / 1024 << " KB read in " << seconds << " s" << endl;
+    return counts[RawProbe::NOT_RAW] + counts[RawProbe::TRUNCATED] + counts[RawProbe::UNSUPPORTED] + counts[RawProbe::UNREADABLE] > 0 ? 1 : 0;
+}
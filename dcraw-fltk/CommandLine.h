@@ -0,0 +1,41 @@
+/**
+ * CommandLine.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <string>
+#include <vector>
+#include "Image.h"
+
+using namespace std;
+
+class CommandLine
+{
+    public:
+        static int run(int argc, char **argv);
+        static const bool isCommand(int argc, char **argv);
+
+    private:
+        static int runMode(int argc, char **argv);
+        static int runBatch(int argc, char **argv);
+        static int runConvert(int argc, char **argv);
+        static int runStack(int argc, char **argv);
+        static int runQueue(int argc, char **argv);
+        static int runServe(int argc, char **argv);
+        static int runIndex(int argc, char **argv);
+        static int runBenchmark(int argc, char **argv);
+        static int runBackends(int argc, char **argv);
+        static int runProbe(int argc, char **argv);
+        static int parseSupervision(int argc, char **argv);
+        static int parseMetrics(int argc, char **argv, string &textFile, string &socketPath, int &intervalSeconds);
+        static int parseBackendProfile(int argc, char **argv);
+        static const int parseFileFormat(const string format);
+        static const bool parseOutputTarget(const string description, OutputTarget &target);
+        static void addNamedTargets(Image &theImage, const vector<OutputTarget> &targets, const string base);
+        static void setCalibration(Image &theImage, const string darkFrame, const string badPixelMap);
+        static void addFiles(const string path, vector<string> &files);
+};
+#endif
@@ -0,0 +1,250 @@
+/**
+ * class ConversionProgress
+ * Follows a conversion through its stages, from the messages dcraw -v
+ * writes to standard error as it works ("Loading Canon EOS 5D image
+ * from IMG_0001.CR2 ...", "AHD interpolation...", "Writing data to
+ * IMG_0001.tiff ..."), together with the stages Converter runs itself,
+ * and times each one. The camera is taken from the loading message,
+ * so that batch timings can be compared between camera models
+ *
+ * The stage may be read from another thread, such as the GUI's, while
+ * the conversion runs. getFraction() turns it into the share of a
+ * typical conversion done before the stage began
+ *
+ * PUBLIC FEATURES:
+ *       ConversionProgress();
+ *       void start();
+ *       void enter(Stage stage);
+ *       bool addMessage(string message);
+ *       void finish();
+ *       Stage getStage();
+ *       double getFraction();
+ *       string getCamera();
+ *       vector<double> getDurations();
+ *       string describe();
+ *       static int parseStage(string message);
+ *       static string getStageName(int stage);
+ *       static void handleLine(string line, void * data);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "ConversionProgress.h"
+#include "Metrics.h"
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+// The start of each dcraw -v message that begins a stage
+static const struct
+{
+    const char * prefix;
+    ConversionProgress::Stage stage;
+} STAGE_MESSAGES[] = {
+    { "Loading ", ConversionProgress::LOADING },
+    { "Wavelet denoising", ConversionProgress::DENOISING },
+    { "Scaling with darkness", ConversionProgress::SCALING },
+    // The second line of the scaling message
+    { "multipliers ", ConversionProgress::SCALING },
+    { "Subtracting dark frame", ConversionProgress::SCALING },
+    { "Bilinear interpolation", ConversionProgress::INTERPOLATING },
+    { "VNG interpolation", ConversionProgress::INTERPOLATING },
+    { "PPG interpolation", ConversionProgress::INTERPOLATING },
+    { "AHD interpolation", ConversionProgress::INTERPOLATING },
+    { "Converting to ", ConversionProgress::CONVERTING },
+    { "Writing data to ", ConversionProgress::WRITING }
+};
+
+// The share of a typical full size conversion each stage takes
+static const double STAGE_WEIGHTS[ConversionProgress::STAGES] = { 0, 0.2, 0.1, 0.05, 0.4, 0.1, 0.15, 0 };
+
+/**
+ * Constructor
+ * Starts out waiting, before the conversion starts
+ */
+ConversionProgress::ConversionProgress()
+{
+    stage = WAITING;
+    durations.assign(STAGES, 0.0);
+    stageStarted = chrono::steady_clock::now();
+}
+
+/**
+ * Starts the clock of a new conversion, forgetting any earlier one
+ */
+void ConversionProgress::start()
+{
+    lock_guard<mutex> guard(lock);
+    durations.assign(STAGES, 0.0);
+    camera.clear();
+    stage = LOADING;
+    stageStarted = chrono::steady_clock::now();
+}
+
+/**
+ * Ends the current stage and begins another, for the stages run outside dcraw
+ * @param stage - the stage to begin
+ */
+void ConversionProgress::enter(const Stage stage)
+{
+    lock_guard<mutex> guard(lock);
+    enterLocked(stage);
+}
+
+/**
+ * Ends the current stage and begins another
+ * Must be called with the lock held
+ * @param stage - the stage to begin
+ */
+void ConversionProgress::enterLocked(const Stage stage)
+{
+    // Registered once; each stage's histogram is then updated without a lock
+    static vector<Metrics::Histogram *> stageSeconds = []()
+    {
+        vector<Metrics::Histogram *> histograms(STAGES, (Metrics::Histogram *)NULL);
+        for (int i = LOADING; i < FINISHED; i++)
+            histograms[i] = &Metrics::histogram("dcraw_fltk_stage_seconds", "Time spent in each stage of a conversion",
+                                                "stage=\"" + getStageName(i) + "\"", Metrics::secondsBuckets());
+        return histograms;
+    }();
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(now - stageStarted).count();
+    durations[this->stage] += seconds;
+    if (stageSeconds[this->stage])
+        stageSeconds[this->stage]->observe(seconds);
+    this->stage = stage;
+    stageStarted = now;
+}
+
+/**
+ * Begins the stage a dcraw -v message announces
+ * @param message - one line of dcraw's standard error
+ * @return true if the message began a stage, false if it is something else
+ */
+const bool ConversionProgress::addMessage(const string message)
+{
+    int found = parseStage(message);
+    if (found < 0)
+        return false;
+
+    lock_guard<mutex> guard(lock);
+    if (found == LOADING)
+    {
+        // Loading <make> <model> image from <file> ...
+        size_t end = message.find(" image from ");
+        if (end != string::npos)
+            camera = message.substr(8, end - 8);
+    }
+    if (found != stage)
+        enterLocked((Stage)found);
+    return true;
+}
+
+/**
+ * Ends the last stage
+ */
+void ConversionProgress::finish()
+{
+    enter(FINISHED);
+}
+
+/**
+ * @return the stage the conversion is in
+ */
+const ConversionProgress::Stage ConversionProgress::getStage() const
+{
+    lock_guard<mutex> guard(lock);
+    return stage;
+}
+
+/**
+ * @return the share of a typical conversion done before the current stage began, 0 to 1
+ */
+const double ConversionProgress::getFraction() const
+{
+    lock_guard<mutex> guard(lock);
+    if (stage == FINISHED)
+        return 1.0;
+    double done = 0;
+    for (int i = 0; i < stage; i++)
+        done += STAGE_WEIGHTS[i];
+    return done;
+}
+
+/**
+ * @return the make and model of the camera, "" until dcraw has loaded the file
+ */
+const string ConversionProgress::getCamera() const
+{
+    lock_guard<mutex> guard(lock);
+    return camera;
+}
+
+/**
+ * @return the seconds spent in each stage, indexed by Stage, the current stage not included
+ */
+const vector<double> ConversionProgress::getDurations() const
+{
+    lock_guard<mutex> guard(lock);
+    return durations;
+}
+
+/**
+ * @return the stages the conversion went through and their times,
+ *         for example "loading 0.41 s, interpolating 2.30 s, writing 0.52 s"
+ */
+const string ConversionProgress::describe() const
+{
+    vector<double> seconds = getDurations();
+    ostringstream description(ostringstream::out);
+    description.setf(ios::fixed);
+    description.precision(2);
+    for (int i = LOADING; i < FINISHED; i++)
+    {
+        if (seconds[i] <= 0)
+            continue;
+        if (!description.str().empty())
+            description << ", ";
+        description << getStageName(i) << " " << seconds[i] << " s";
+    }
+    return description.str();
+}
+
+/**
+ * @param message - one line of dcraw's standard error
+ * @return the Stage the message begins, -1 if it does not begin one
+ */
+const int ConversionProgress::parseStage(const string message)
+{
+    for (size_t i = 0; i < sizeof(STAGE_MESSAGES) / sizeof(STAGE_MESSAGES[0]); i++)
+        if (message.compare(0, string(STAGE_MESSAGES[i].prefix).length(), STAGE_MESSAGES[i].prefix) == 0)
+            return STAGE_MESSAGES[i].stage;
+    return -1;
+}
+
+/**
+ * @param stage - a Stage
+ * @return the name of the stage, as shown and reported
+ */
+const string ConversionProgress::getStageName(const int stage)
+{
+    static const char * NAMES[STAGES] = { "waiting", "loading", "denoising", "scaling",
+                                          "interpolating", "converting", "writing", "finished" };
+    return stage >= 0 && stage < STAGES ? NAMES[stage] : "unknown";
+}
+
+/**
+ * A Process error handler for dcraw -v
+ * Begins the stages the messages announce; anything else, such as
+ * an error message, is passed on to our standard error
+ * @param line - one line of dcraw's standard error
+ * @param data - the ConversionProgress
+ */
+void ConversionProgress::handleLine(const string line, void * data)
+{
+    ConversionProgress * access = static_cast<ConversionProgress *>(data);
+    if (!access->addMessage(line))
+        cerr << line << endl;
+}
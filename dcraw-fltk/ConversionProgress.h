@@ -0,0 +1,52 @@
+/**
+ * ConversionProgress.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef CONVERSIONPROGRESS_H
+#define CONVERSIONPROGRESS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+using namespace std;
+
+class ConversionProgress
+{
+    public:
+        // The stages of a conversion, in the order dcraw runs them
+        enum Stage { WAITING, LOADING, DENOISING, SCALING, INTERPOLATING, CONVERTING, WRITING, FINISHED };
+        const static int STAGES = FINISHED + 1;
+
+        ConversionProgress();
+
+        void start();
+        void enter(const Stage stage);
+        const bool addMessage(const string message);
+        void finish();
+
+        const Stage getStage() const;
+        const double getFraction() const;
+        const string getCamera() const;
+        const vector<double> getDurations() const;
+        const string describe() const;
+
+        static const int parseStage(const string message);
+        static const string getStageName(const int stage);
+        static void handleLine(const string line, void * data);
+
+    private:
+        ConversionProgress(ConversionProgress &toCopy);
+        void enterLocked(const Stage stage);
+
+        // Written by the thread reading dcraw and read by the GUI
+        mutable mutex lock;
+        Stage stage;
+        chrono::steady_clock::time_point stageStarted;
+        // Seconds spent in each stage, indexed by Stage
+        vector<double> durations;
+        string camera;
+};
+#endif
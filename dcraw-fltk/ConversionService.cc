@@ -0,0 +1,543 @@
+/**
+ * class ConversionService
+ * Serves conversions to other programs, such as asset managers and
+ * tethering software, over a local (Unix domain) socket, so that they
+ * pay for neither starting dcraw-fltk nor the GUI on every request
+ *
+ * A client connects, sends the settings of an Image as written by
+ * Image::serialize() and then a line naming the action:
+ *
+ *   convert   write the Image's output files; the reply is a
+ *             "file <path>" line for each, then "ok"
+ *   decode    decode the full size image to shared memory; the reply is
+ *   preview   (half size) "frame <name> <width> <height> <channels> <bytes>",
+ *             naming a segment of 16 bit RGB samples in native byte order
+ *             (a memfd opened by its /proc path on Linux, shm_open
+ *             elsewhere, or OpenFileMapping on Windows), which lasts
+ *             until the client closes the connection
+ *
+ * Requests are read from every client at once, by a listener that only
+ * reads what has arrived, so that a slow client holds up no other and
+ * one that sends nothing for CLIENT_SECONDS is answered with an error
+ * A request accepted into the queue is answered "queued <position>"
+ * at once. While the queue is full new requests are answered "busy"
+ * and closed, so that clients back off rather than pile up. Failures
+ * are answered "error <reason>". A pool of worker threads takes the
+ * requests in order, each running its own dcraw
+ *
+ * PUBLIC FEATURES:
+ *       ConversionService(string theExecutable, string socketPath, int workers, int queueCapacity);
+ *       ~ConversionService();
+ *       bool run();
+ *       void stop();
+ *       string getExecutable();
+ *       string getSocketPath();
+ *       int getWorkers();
+ *       int getQueueCapacity();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+
+#include "ConversionService.h"
+#include "Converter.h"
+#include "PixelBuffer.h"
+#include "SharedFrame.h"
+#include "Metrics.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+#define closeSocket closesocket
+static const Socket NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int Socket;
+#define closeSocket close
+static const Socket NO_SOCKET = -1;
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * Sends all of a reply to a client
+ * @param connection - the client's socket
+ * @param text - the reply
+ * @return true if it was sent, false if the client has gone
+ */
+static bool sendText(const long long connection, const string text)
+{
+    size_t sent = 0;
+    while (sent < text.size())
+    {
+        int count = send((Socket)connection, text.data() + sent, (int)(text.size() - sent), MSG_NOSIGNAL);
+        if (count <= 0)
+            return false;
+        sent += count;
+    }
+    return true;
+}
+
+/**
+ * Limits how long a receive from a client may wait
+ * @param connection - the client's socket
+ * @param seconds - the longest wait
+ */
+static void setReceiveTimeout(const long long connection, const int seconds)
+{
+#ifdef _WIN32
+    DWORD timeout = seconds * 1000;
+#else
+    struct timeval timeout;
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+#endif
+    setsockopt((Socket)connection, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+}
+
+/**
+ * Removes the socket left at a path by an earlier run
+ * Anything other than a socket is left alone, so that a mistyped path
+ * can never remove a file
+ * @param path - the path of the socket
+ * @return true if nothing is left at the path, false if something other than a socket is there
+ */
+static bool removeSocket(const string path)
+{
+#ifdef _WIN32
+    // Unix domain sockets are reparse points on Windows
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES)
+        return true;
+    if (!(attributes & FILE_ATTRIBUTE_REPARSE_POINT) || (attributes & FILE_ATTRIBUTE_DIRECTORY))
+        return false;
+#else
+    struct stat status;
+    if (lstat(path.c_str(), &status) != 0)
+        return true;
+    if (!S_ISSOCK(status.st_mode))
+        return false;
+#endif
+    return remove(path.c_str()) == 0;
+}
+
+/**
+ * Constructor
+ * @param theExecutable - the name of the dcraw executable to run
+ * @param socketPath - the path of the socket to listen on, replaced if a socket is left there
+ * @param workers - the number of requests converted at once
+ * @param queueCapacity - the most requests waiting for a worker before new ones are refused
+ */
+ConversionService::ConversionService(const string theExecutable, const string socketPath, const int workers,
+                                     const int queueCapacity)
+{
+    this->theExecutable = theExecutable;
+    this->socketPath = socketPath;
+    this->workers = workers < 1 ? 1 : workers;
+    this->queueCapacity = queueCapacity < 1 ? 1 : queueCapacity;
+    stopping = false;
+}
+
+/**
+ * Destructor
+ */
+ConversionService::~ConversionService()
+{}
+
+/**
+ * Listens for requests and serves them until stop() is called
+ * @return true if the service ran, false if the socket could not be opened
+ */
+bool ConversionService::run()
+{
+#ifdef _WIN32
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        return false;
+#endif
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        cerr << "The socket path " << socketPath << " is too long" << endl;
+        return false;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    if (!removeSocket(socketPath))
+    {
+        cerr << socketPath << " exists and is not a socket" << endl;
+        return false;
+    }
+
+    Socket listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == NO_SOCKET || ::bind(listener, (sockaddr *)&address, sizeof(address)) != 0
+        || listen(listener, queueCapacity + workers) != 0)
+    {
+        cerr << "Cannot listen on " << socketPath << endl;
+        if (listener != NO_SOCKET)
+            closeSocket(listener);
+        return false;
+    }
+    cout << "Listening on " << socketPath << " with " << workers << " workers" << endl;
+
+    vector<thread> pool;
+    for (int t = 0; t < workers; t++)
+        pool.push_back(thread(&ConversionService::serve, this));
+
+    Metrics::Counter &refused = Metrics::counter("dcraw_fltk_service_requests_total", "Requests received, by answer",
+                                                 "answer=\"busy\"");
+    Metrics::Counter &unreadable = Metrics::counter("dcraw_fltk_service_requests_total", "Requests received, by answer",
+                                                    "answer=\"error\"");
+
+    // Clients whose requests are still arriving
+    vector<Reading> reading;
+    while (!stopping)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        Socket highest = listener;
+        for (size_t i = 0; i < reading.size(); i++)
+        {
+            FD_SET((Socket)reading[i].connection, &readable);
+            if ((Socket)reading[i].connection > highest)
+                highest = (Socket)reading[i].connection;
+        }
+        struct timeval wait;
+        wait.tv_sec = 0;
+        wait.tv_usec = POLL_MILLISECONDS * 1000;
+        int ready = select((int)highest + 1, &readable, NULL, NULL, &wait);
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        for (size_t i = 0; i < reading.size(); )
+        {
+            Reading &theClient = reading[i];
+            Request * theRequest = NULL;
+            bool finished = false;
+            if (ready > 0 && FD_ISSET((Socket)theClient.connection, &readable))
+            {
+                theRequest = new Request();
+                bool complete = false;
+                if (!readRequest(theClient, *theRequest, complete))
+                {
+                    unreadable.add();
+                    sendText(theClient.connection, "error cannot read the request\n");
+                    closeSocket((Socket)theClient.connection);
+                    finished = true;
+                }
+                else if (complete)
+                {
+                    admit(theRequest);
+                    theRequest = NULL;
+                    finished = true;
+                }
+                delete theRequest;
+            }
+            if (!finished && now >= theClient.deadline)
+            {
+                unreadable.add();
+                sendText(theClient.connection, "error the request was not sent in time\n");
+                closeSocket((Socket)theClient.connection);
+                finished = true;
+            }
+
+            if (finished)
+                reading.erase(reading.begin() + i);
+            else
+                i++;
+        }
+
+        if (ready <= 0 || !FD_ISSET(listener, &readable))
+            continue;
+        Socket client = accept(listener, NULL, NULL);
+        if (client == NO_SOCKET)
+            continue;
+        bool full = (int)reading.size() >= READING_CLIENTS;
+#ifndef _WIN32
+        // select() cannot watch a descriptor past its set
+        full = full || client >= FD_SETSIZE;
+#endif
+        if (full)
+        {
+            refused.add();
+            sendText((long long)client, "busy\n");
+            closeSocket(client);
+            continue;
+        }
+        Reading theClient;
+        theClient.connection = (long long)client;
+        theClient.deadline = now + chrono::seconds(CLIENT_SECONDS);
+        reading.push_back(theClient);
+    }
+
+    for (size_t i = 0; i < reading.size(); i++)
+    {
+        sendText(reading[i].connection, "error the service has stopped\n");
+        closeSocket((Socket)reading[i].connection);
+    }
+
+    queueChanged.notify_all();
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        sendText(queue[i]->connection, "error the service has stopped\n");
+        closeSocket((Socket)queue[i]->connection);
+        delete queue[i];
+    }
+    queue.clear();
+
+    closeSocket(listener);
+    removeSocket(socketPath);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return true;
+}
+
+/**
+ * Stops the service once the requests being converted have finished
+ * Requests still queued are answered with an error. Only sets a flag
+ * that the listener polls, so may be called from a signal handler
+ */
+void ConversionService::stop()
+{
+    stopping = true;
+}
+
+/**
+ * Takes requests from the queue and answers them until the service stops
+ * Runs on each worker thread
+ */
+void ConversionService::serve()
+{
+    Metrics::Gauge &depth = Metrics::gauge("dcraw_fltk_service_queue_depth", "Requests waiting for a worker");
+    while (true)
+    {
+        Request * theRequest;
+        {
+            unique_lock<mutex> guard(queueLock);
+            queueChanged.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            theRequest = queue.front();
+            queue.pop_front();
+            depth.set((double)queue.size());
+        }
+
+        if (theRequest->action == "convert")
+            convert(*theRequest);
+        else
+            sendFrame(*theRequest);
+        closeSocket((Socket)theRequest->connection);
+        delete theRequest;
+    }
+}
+
+/**
+ * Reads what a client has sent since the last read, which select() has
+ * found waiting, so that the read never blocks
+ * A request is Image settings, then a line naming the action
+ * @param theClient - the client, with what it has sent so far
+ * @param theRequest - set to the request once it is complete
+ * @param complete - set to true once the whole request has been read
+ * @return true if the request is complete or may still be, false if the client has gone or sent something else
+ */
+bool ConversionService::readRequest(Reading &theClient, Request &theRequest, bool &complete)
+{
+    complete = false;
+    char buffer[4096];
+    int count = recv((Socket)theClient.connection, buffer, sizeof(buffer), 0);
+    if (count <= 0)
+        return false;
+    string &text = theClient.text;
+    text.append(buffer, count);
+    if ((int)text.size() > REQUEST_BYTES)
+        return false;
+    if (text[text.size() - 1] != '\n')
+        return true;
+
+    // The action is the last line, after the settings
+    size_t start = text.size() > 1 ? text.find_last_of('\n', text.size() - 2) : string::npos;
+    start = start == string::npos ? 0 : start + 1;
+    string action = text.substr(start, text.size() - 1 - start);
+    if (!action.empty() && action[action.size() - 1] == '\r')
+        action.erase(action.size() - 1);
+    if (action != "convert" && action != "decode" && action != "preview")
+        return true;
+
+    complete = true;
+    theRequest.connection = theClient.connection;
+    theRequest.action = action;
+    return theRequest.theImage.deserialize(text.substr(0, start))
+        && !theRequest.theImage.getSourceFilename().empty();
+}
+
+/**
+ * Queues a complete request for a worker, or answers busy and closes
+ * it if the queue is full
+ * @param theRequest - the request, which the queue or this call deletes
+ */
+void ConversionService::admit(Request * theRequest)
+{
+    Metrics::Gauge &depth = Metrics::gauge("dcraw_fltk_service_queue_depth", "Requests waiting for a worker");
+    Metrics::Counter &refused = Metrics::counter("dcraw_fltk_service_requests_total", "Requests received, by answer",
+                                                 "answer=\"busy\"");
+    Metrics::Counter &accepted = Metrics::counter("dcraw_fltk_service_requests_total", "Requests received, by answer",
+                                                  "answer=\"queued\"");
+
+    // A worker may take and delete the request as soon as it is queued
+    long long connection = theRequest->connection;
+    unique_lock<mutex> guard(queueLock);
+    if ((int)queue.size() >= queueCapacity)
+    {
+        guard.unlock();
+        refused.add();
+        sendText(connection, "busy\n");
+        closeSocket((Socket)connection);
+        delete theRequest;
+        return;
+    }
+    queue.push_back(theRequest);
+    depth.set((double)queue.size());
+    accepted.add();
+    ostringstream reply(ostringstream::out);
+    reply << "queued " << queue.size() << "\n";
+    guard.unlock();
+    queueChanged.notify_one();
+    sendText(connection, reply.str());
+}
+
+/**
+ * Writes the output files of a request and tells the client where they are
+ * @param theRequest - the request
+ */
+void ConversionService::convert(Request &theRequest)
+{
+    Image &theImage = theRequest.theImage;
+    Converter theConverter(theExecutable, "");
+    theConverter.setImage(&theImage);
+
+    vector<string> written;
+    int exitCode;
+    if (theImage.getOutputTargets().empty())
+    {
+        exitCode = theConverter.run(false);
+        string output = theImage.getOutputFilename();
+        if (output.empty())
+        {
+            string source = theImage.getSourceFilename();
+            output = source.substr(0, source.find_last_of(".")) + Image::getFileExtension(theImage.getFileFormat());
+        }
+        written.push_back(output);
+    }
+    else
+    {
+        exitCode = theConverter.runTargets() ? 0 : 1;
+        vector<OutputTarget> targets = theImage.getOutputTargets();
+        for (size_t i = 0; i < targets.size(); i++)
+            written.push_back(targets[i].outputFilename);
+    }
+
+    ostringstream reply(ostringstream::out);
+    if (exitCode == 0)
+    {
+        for (size_t i = 0; i < written.size(); i++)
+            reply << "file " << written[i] << "\n";
+        reply << "ok\n";
+    }
+    else
+        reply << "error exit code " << exitCode << "\n";
+    sendText(theRequest.connection, reply.str());
+}
+
+/**
+ * Decodes a request into a shared memory segment and hands it to the
+ * client, keeping the segment until the client closes the connection
+ * @param theRequest - the request
+ */
+void ConversionService::sendFrame(Request &theRequest)
+{
+    Converter theConverter(theExecutable, "");
+    theConverter.setImage(&theRequest.theImage);
+    SharedFrame shared;
+    PixelBuffer frame;
+    shared.prepare(frame);
+    if (!theConverter.decode(frame, theRequest.action == "preview"))
+    {
+        sendText(theRequest.connection, "error cannot decode " + theRequest.theImage.getSourceFilename() + "\n");
+        return;
+    }
+
+    if (!shared.create(frame))
+    {
+        sendText(theRequest.connection, "error cannot create shared memory\n");
+        return;
+    }
+
+    // The segment lasts until the client has mapped it and closed the connection
+    if (sendText(theRequest.connection, "frame " + shared.describe() + "\n"))
+    {
+        setReceiveTimeout(theRequest.connection, CLIENT_SECONDS);
+        char ignored[256];
+        while (recv((Socket)theRequest.connection, ignored, sizeof(ignored), 0) > 0)
+            ;
+    }
+}
+
+/**
+ * @return the name of the dcraw executable to run
+ */
+const string ConversionService::getExecutable() const
+{
+    return theExecutable;
+}
+
+/**
+ * @return the path of the socket the service listens on
+ */
+const string ConversionService::getSocketPath() const
+{
+    return socketPath;
+}
+
+/**
+ * @return the number of requests converted at once
+ */
+const int ConversionService::getWorkers() const
+{
+    return workers;
+}
+
+/**
+ * @return the most requests waiting for a worker before new ones are refused
+ */
+const int ConversionService::getQueueCapacity() const
+{
+    return queueCapacity;
+}
@@ -0,0 +1,85 @@
+/**
+ * ConversionService.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef CONVERSIONSERVICE_H
+#define CONVERSIONSERVICE_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "Image.h"
+
+using namespace std;
+
+class ConversionService
+{
+    public:
+        ConversionService(const string theExecutable, const string socketPath, const int workers, const int queueCapacity);
+        ~ConversionService();
+
+        bool run();
+        void stop();
+
+        const string getExecutable() const;
+        const string getSocketPath() const;
+        const int getWorkers() const;
+        const int getQueueCapacity() const;
+
+        // Longest request accepted, in bytes
+        const static int REQUEST_BYTES = 64 * 1024;
+        // How long a client has to send its request, or to release a shared frame
+        const static int CLIENT_SECONDS = 30;
+        // Most clients whose requests are read at once; more are answered busy
+        const static int READING_CLIENTS = 32;
+        // How often the listener checks whether it has been stopped
+        const static int POLL_MILLISECONDS = 500;
+
+    private:
+        ConversionService(ConversionService &toCopy);
+
+        /**
+         * One request waiting for a worker
+         */
+        struct Request
+        {
+            // The client's connection, a socket handle
+            long long connection;
+            Image theImage;
+            // "convert", "decode" or "preview"
+            string action;
+        };
+
+        /**
+         * A client whose request is still arriving
+         */
+        struct Reading
+        {
+            long long connection;
+            // What the client has sent so far
+            string text;
+            chrono::steady_clock::time_point deadline;
+        };
+
+        void serve();
+        bool readRequest(Reading &theClient, Request &theRequest, bool &complete);
+        void admit(Request * theRequest);
+        void convert(Request &theRequest);
+        void sendFrame(Request &theRequest);
+
+        string theExecutable;
+        string socketPath;
+        int workers;
+        int queueCapacity;
+        atomic<bool> stopping;
+
+        // Requests accepted and not yet taken by a worker
+        deque<Request *> queue;
+        mutex queueLock;
+        condition_variable queueChanged;
+};
+#endif
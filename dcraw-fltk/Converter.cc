@@ -4,6 +4,7 @@
  * (or any other conversion program) executable
  * Reads in Image parameters and then creates the appropriate
  * system arguments
+ * Every dcraw it runs is held to the limits of a Supervisor
  *
  * PUBLIC FEATURES:
  *       Converter();
@@ -13,17 +14,43 @@
  *       void setExecutable(string theExecutable);
  *       void setArguments(string theArguments);
  *       void setImage(Image * toConvert);
+ *       void setProgress(ConversionProgress * theProgress);
+ *       void setCancel(const atomic<bool> * cancel);
  *       int run(bool preview);
+ *       bool decode(PixelBuffer &theBuffer, bool halfSize);
+ *       bool runTargets();
+ *       bool writeLinear(shared_ptr<PixelBuffer> linear);
+ *       bool identify(int &width, int &height);
+ *       vector<string> buildArguments(bool preview);
+ *       vector<string> buildDecodeArguments(bool halfSize);
+ *       bool addCalibrationArguments(vector<string> &args, shared_ptr<CalibrationFrames> &calibration);
  *       string getExecutable();
  *       string getArguments();
  *       Image * getImage();
+ *       size_t getPeakRSS();
+ *       static void resolveWhiteBalance(Image * theImage, PixelBuffer &linear, double &redMultiplier, double &blueMultiplier);
+ *       static void recordConversion(bool succeeded, double seconds);
  *
  * @author https://github.com/aaronmboyd
  */
 
 #include "Converter.h"
+#include "DecoderBackends.h"
 #include "Image.h"
+#include "ImageWriter.h"
+#include "ResizePyramid.h"
+#include "Orientation.h"
+#include "ToneKernels.h"
+#include "AutoWhiteBalance.h"
+#include "WaveletDenoiser.h"
+#include "JpegEncoder.h"
+#include "CalibrationFrames.h"
+#include "Supervisor.h"
+#include "Metrics.h"
 #include <iostream>
+#include <thread>
+#include <memory>
+#include <chrono>
 
 using namespace std;
 
@@ -34,6 +61,10 @@ Converter::Converter()
 {
     theExecutable = "";
     theArguments = "";
+    theImage = NULL;
+    theProgress = NULL;
+    cancel = NULL;
+    peakRSS = 0;
 }
 
 /**
@@ -45,6 +76,10 @@ Converter::Converter(string theExecutable, string theArguments)
 {
     this->theExecutable = theExecutable;
     this->theArguments = theArguments;
+    theImage = NULL;
+    theProgress = NULL;
+    cancel = NULL;
+    peakRSS = 0;
 }
 
 /**
@@ -56,6 +91,9 @@ Converter::Converter(Converter &toCopy)
     theExecutable = toCopy.theExecutable;
     theArguments = toCopy.theArguments;
     theImage = toCopy.theImage;
+    theProgress = toCopy.theProgress;
+    cancel = toCopy.cancel;
+    peakRSS = toCopy.peakRSS;
 }
 
 /**
@@ -92,55 +130,129 @@ void Converter::setImage(Image * toConvert)
 }
 
 /**
- * Performs the Image conversion
+ * Follows conversions through their stages, from dcraw's verbose
+ * messages and the stages run here
+ * @param theProgress - the ConversionProgress to update, NULL for none
+ */
+void Converter::setProgress(ConversionProgress * theProgress)
+{
+    this->theProgress = theProgress;
+}
+
+/**
+ * Sets a flag that another thread raises to stop the conversion, which
+ * kills its dcraw and so fails it
+ * @param cancel - the flag, or NULL for none
+ */
+void Converter::setCancel(const atomic<bool> * cancel)
+{
+    this->cancel = cancel;
+}
+
+/**
+ * Formats a number the same way the arguments string stream does
+ * @param value - the number to format
+ * @return the number as an argument
+ */
+static string numberArgument(const double value)
+{
+	ostringstream number(ostringstream::out);
+	number << value;
+	return number.str();
+}
+
+/**
+ * Adds the arguments that decide the colours dcraw decodes
+ * (interpolation and white balance) to an argument list
+ * Manual and automatic white balance are decoded with the camera white
+ * balance, and their red and blue multipliers are applied on top of it
+ * afterwards (see resolveWhiteBalance()), on every path alike
+ * @param args - the argument list to add to
+ */
+void Converter::addColourArguments(vector<string> &args) const
+{
+	// Add interpolate 4-colour RGBG if required
+	if(theImage->getInterpolateRGBG())
+		args.push_back("-f");
+
+	// -q quality
+	// Demosaic with bilinear (0), VNG (1), PPG (2) or AHD (3) interpolation; ignored with -h
+	if (theImage->getInterpolationQuality() != Image::DEFAULT_QUALITY)
+	{
+		args.push_back("-q");
+		args.push_back(numberArgument(theImage->getInterpolationQuality()));
+	}
+
+	// -w
+	// Use the white balance specified by the camera. If this is not found, print a warning and use another method.
+	// Automatic and manual white balance are applied on top of it
+	args.push_back("-w");
+}
+
+/**
+ * Finds the multipliers to apply on top of the camera white balance an
+ * Image is decoded with: its own if it is manual, those AutoWhiteBalance
+ * measures from the file (once, from the first buffer decoded) if it is
+ * automatic, and none if it is the camera's
+ * @param theImage - the Image
+ * @param linear - the Image decoded as by decode(), at any size
+ * @param redMultiplier - set to the red multiplier
+ * @param blueMultiplier - set to the blue multiplier
+ */
+void Converter::resolveWhiteBalance(const Image * theImage, const PixelBuffer &linear, double &redMultiplier, double &blueMultiplier)
+{
+	redMultiplier = blueMultiplier = 1.0;
+	if (theImage->getWhiteBalance() == Image::MANUAL)
+	{
+		redMultiplier = theImage->getRedMultiplier();
+		blueMultiplier = theImage->getBlueMultiplier();
+	}
+	else if (theImage->getWhiteBalance() == Image::AUTO &&
+	         !AutoWhiteBalance::get(theImage->getSourceFilename(), linear, redMultiplier, blueMultiplier))
+		redMultiplier = blueMultiplier = 1.0;
+}
+
+/**
+ * Builds the dcraw argument list for the current Image
  * See dcraw Unix man page here https://www.cybercom.net/~dcoffin/dcraw/dcraw.1.html
  * @param preview - true if only a preview (quick option), false otherwise
+ * @return the arguments, ending with the source filename
  */
-int Converter::run(bool preview)
+const vector<string> Converter::buildArguments(const bool preview) const
 {
-	ostringstream args(ostringstream::out);
-	ostringstream convert(ostringstream::out);
+	vector<string> args;
 
 	if(preview)
 		// -h
 		// Output a half - size color image. Twice as fast as -q 0.
-		args << "-h" << " "; 
+		args.push_back("-h");
 	else
 		// Add versbose messaging 
-		args << "-v" << " ";
+		args.push_back("-v");
 
-	// Add interpolate 4-colour RGBG if required
-	if(theImage->getInterpolateRGBG())
-		args << "-f" << " ";
-
-	// Add white balance mode to arguments
-	switch(theImage->getWhiteBalance())
-	{
-		case Image::CAMERA:
-			// -w
-			// Use the white balance specified by the camera. If this is not found, print a warning and use another method.
-			args << "-w" << " "; 
-			break;
-		case Image::AUTO:
-			// -a
-			// Calculate the white balance by averaging the entire image. 
-			args << "-a" << " "; 
-			break;
-		case Image::MANUAL:
-			// Set manual red and blue multipliers
-			args << "-r" << " " << theImage->getRedMultiplier() << " ";
-			args << "-l" << " " << theImage->getBlueMultiplier() << " ";
-			break;
-	}
+	addColourArguments(args);
 
 	// -g power toe_slope 
 	// Set the gamma curve, by default BT.709 (-g 2.222 4.5).
 	// If you prefer sRGB gamma, use (-g 2.4 12.92). For a simple power curve, set the toe slope to zero.
-	args << "-g" << " " << theImage->getGamma() << " 0 "; 
+	args.push_back("-g");
+	args.push_back(numberArgument(theImage->getGamma()));
+	args.push_back("0");
 
 	// -b brightness
 	//	Divide the white level by this number, 1.0 by default.
-	args << "-b" << " " << theImage->getBrightness() << " ";
+	args.push_back("-b");
+	args.push_back(numberArgument(theImage->getBrightness()));
+
+	// -n noise_threshold
+	// Use wavelets to erase noise while preserving real detail.
+	// run() denoises in process instead, but BatchConverter runs these
+	// arguments itself, one dcraw per core
+	if (theImage->getNoiseThreshold() > 0)
+	{
+		args.push_back("-n");
+		args.push_back(numberArgument(theImage->getNoiseThreshold()));
+	}
 
 	// Add fileformat to arguments
 	// Only not in preview mode (which defaults to PPM)
@@ -152,16 +264,17 @@ int Converter::run(bool preview)
 				// Not implemented
 				break;
 			case Image::TIFF_8:
-				args << "-T" << " ";
+				args.push_back("-T");
 				break;
 			case Image::TIFF_16:
-				args << "-T -6" << " ";
+				args.push_back("-T");
+				args.push_back("-6");
 				break;
 			case Image::PPM_8:
 				// Nothing to do - 8bit PPM is the default format
 				break;
 			case Image::PPM_16:
-				args << "-6" << " ";
+				args.push_back("-6");
 				break;
 			case Image::PSD:
 				// Not implemented
@@ -169,33 +282,351 @@ int Converter::run(bool preview)
 		}
 	}
 
-	// Store arguments, clear string stream
-	setArguments(args.str());
+	// Add source filename
+	args.push_back(theImage->getSourceFilename());
 
-	ostringstream final;
-	final << "\"";
+	return args;
+}
+
+/**
+ * Builds the dcraw argument list that decodes the current Image to
+ * linear 16 bit samples on standard output, leaving brightness and
+ * gamma to be applied afterwards (see ToneKernels).
+ * Manual white balance multipliers are applied afterwards too
+ * @param halfSize - true to decode a half-size image, false otherwise
+ * @return the arguments, ending with the source filename
+ */
+const vector<string> Converter::buildDecodeArguments(const bool halfSize) const
+{
+	vector<string> args;
 
- 	// Add executable
-    final << "\"" << getExecutable() << "\" ";
-    // Add arguments
-    final << getArguments();
-    // Add source filename
-    final << "\"" << theImage->getSourceFilename() << "\"";
+	if(halfSize)
+		args.push_back("-h");
 
-	final << "\"";
+	addColourArguments(args);
+
+	// -4
+	// Linear 16-bit, same as "-6 -W -g 1 1"
+	args.push_back("-4");
+
+	// -c
+	// Write decoded images or thumbnails to standard output.
+	args.push_back("-c");
+
+	args.push_back(theImage->getSourceFilename());
+
+	return args;
+}
+
+/**
+ * Counts a finished conversion and records how long it took, for Metrics
+ * @param succeeded - true if the conversion succeeded, false otherwise
+ * @param seconds - the wall clock time of the conversion
+ */
+void Converter::recordConversion(const bool succeeded, const double seconds)
+{
+	static Metrics::Counter &converted = Metrics::counter("dcraw_fltk_conversions_total",
+		"Conversions finished, by result", "result=\"succeeded\"");
+	static Metrics::Counter &failed = Metrics::counter("dcraw_fltk_conversions_total",
+		"Conversions finished, by result", "result=\"failed\"");
+	static Metrics::Histogram &duration = Metrics::histogram("dcraw_fltk_conversion_seconds",
+		"Wall clock time of each conversion", "", Metrics::secondsBuckets());
 
-	// Make system call
-	try
+	(succeeded ? converted : failed).add();
+	duration.observe(seconds);
+}
+
+/**
+ * Performs the Image conversion
+ * @param preview - true if only a preview (quick option), false otherwise
+ * @return the exit code of dcraw, or Process::SPAWN_FAILED if it could not be started
+ *         (128 + the signal if it was killed or timed out; for a denoised conversion, 0 if the file was written and 1 otherwise)
+ */
+int Converter::run(bool preview)
+{
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	if (theProgress)
+		theProgress->start();
+	int exitCode = convert(preview);
+	if (theProgress)
+		theProgress->finish();
+	recordConversion(exitCode == 0, chrono::duration<double>(chrono::steady_clock::now() - started).count());
+	return exitCode;
+}
+
+/**
+ * Performs the Image conversion, for run()
+ * @param preview - true if only a preview (quick option), false otherwise
+ * @return the exit code, as for run()
+ */
+int Converter::convert(const bool preview)
+{
+	// dcraw's own -n is a slow single threaded pass, so denoised
+	// conversions are decoded, denoised and written here instead
+	// So are manual and automatic white balance, which dcraw cannot apply on top
+	// of the camera's, and which saves dcraw's full image -a pass for every file
+	if ((!preview && theImage->getNoiseThreshold() > 0) || theImage->getWhiteBalance() != Image::CAMERA)
 	{
-		cout << "\nAbout to system call " << final.str();
-		system(final.str().c_str());
+		OutputTarget target;
+		target.fileFormat = theImage->getFileFormat();
+		target.maxSize = 0;
+		target.quality = JpegEncoder::DEFAULT_QUALITY;
+		target.outputFilename = theImage->getOutputFilename();
+		if (target.outputFilename.empty())
+		{
+			// Named the way dcraw names its own output
+			string source = theImage->getSourceFilename();
+			target.outputFilename = source.substr(0, source.find_last_of(".")) + Image::getFileExtension(target.fileFormat);
+		}
+		return writeTargets(vector<OutputTarget>(1, target)) ? 0 : 1;
 	}
-	catch(...)
+
+	vector<string> args = buildArguments(preview);
+	shared_ptr<const CalibrationFrames> calibration;
+	if (!addCalibrationArguments(args, calibration))
+		return 1;
+
+	// Store arguments (without the source filename)
+	ostringstream joined(ostringstream::out);
+	for (size_t i = 0; i + 1 < args.size(); i++)
+		joined << args[i] << " ";
+	setArguments(joined.str());
+
+	Process dcraw(getBackend(), args);
+	if (theProgress)
+		dcraw.setErrorHandler(ConversionProgress::handleLine, theProgress);
+	dcraw.setCancel(cancel);
+	cout << "\nAbout to run " << dcraw.getCommandLine();
+	Supervisor::Result result = Supervisor().run(dcraw);
+	if (result.peakRSS > peakRSS)
+		peakRSS = result.peakRSS;
+	if (!result.succeeded())
+		cerr << theImage->getSourceFilename() << ": dcraw " << result.describe() << endl;
+	return result.exitCode;
+}
+
+/**
+ * Decodes the Image into memory as linear 16 bit RGB, with its dark
+ * frame subtracted and bad pixels repaired if it has them, and upright
+ * @param theBuffer - filled with the decoded image
+ * @param halfSize - true to decode a half-size image (quick option), false otherwise
+ * @return true if the image was decoded, false otherwise
+ */
+bool Converter::decode(PixelBuffer &theBuffer, const bool halfSize)
+{
+	int flip;
+	if (!decode(theBuffer, halfSize, flip))
+		return false;
+	if (flip != Orientation::NONE)
+	{
+		PixelBuffer upright;
+		upright.setAllocator(theBuffer);
+		Orientation::apply(theBuffer, flip, upright);
+		theBuffer.swap(upright);
+	}
+	return true;
+}
+
+/**
+ * Decodes the Image as decode() does, but leaves turning it upright to the caller
+ * dcraw is asked to keep the sensor orientation (-t 0) whenever the
+ * orientation can be read from the raw file, since Orientation turns
+ * the image far faster than dcraw, or not at all if it is resized first
+ * @param theBuffer - filled with the decoded image
+ * @param halfSize - true to decode a half-size image (quick option), false otherwise
+ * @param flip - set to dcraw's flip value to turn the image by, Orientation::NONE if it is upright
+ * @return true if the image was decoded, false otherwise
+ */
+bool Converter::decode(PixelBuffer &theBuffer, const bool halfSize, int &flip)
+{
+	vector<string> args = buildDecodeArguments(halfSize);
+	shared_ptr<const CalibrationFrames> calibration;
+	if (!addCalibrationArguments(args, calibration))
+		return false;
+	flip = Orientation::read(theImage->getSourceFilename());
+	if (flip > Orientation::NONE)
+	{
+		args.insert(args.end() - 1, "-t");
+		args.insert(args.end() - 1, "0");
+	}
+	else if (flip < Orientation::NONE)
+		flip = Orientation::NONE;
+
+	// Verbose only when there is progress to follow
+	if (theProgress)
+		args.insert(args.begin(), "-v");
+
+	Process dcraw(getBackend(), args);
+	dcraw.setCaptureOutput(true);
+	if (theProgress)
+		dcraw.setErrorHandler(ConversionProgress::handleLine, theProgress);
+	dcraw.setCancel(cancel);
+	cout << "\nAbout to run " << dcraw.getCommandLine();
+	Supervisor::Result result = Supervisor().run(dcraw);
+	if (result.peakRSS > peakRSS)
+		peakRSS = result.peakRSS;
+	if (!result.succeeded())
+		cerr << theImage->getSourceFilename() << ": dcraw " << result.describe() << endl;
+	return result.succeeded() && theBuffer.parsePPM(dcraw.getOutput());
+}
+
+/**
+ * Adds the dark frame and bad pixel map of the Image, if it has them,
+ * to the arguments of a decode, so that dcraw corrects the raw data
+ * before white balance and demosaicing. The dark frame is unpacked by
+ * the same backend as the frames it corrects, once (see CalibrationFrames)
+ * @param args - the arguments, ending with the source filename
+ * @param calibration - set to the calibration, which must be kept until the decode has finished
+ * @return true if the arguments are ready, false if the calibration could not be loaded
+ */
+bool Converter::addCalibrationArguments(vector<string> &args, shared_ptr<const CalibrationFrames> &calibration) const
+{
+	if (!theImage->hasCalibration())
+		return true;
+
+	string error;
+	calibration = CalibrationFrames::get(getBackend(), theImage->getDarkFrame(), theImage->getBadPixelMap(), error);
+	if (!calibration)
+	{
+		cerr << theImage->getSourceFilename() << ": " << error << endl;
+		return false;
+	}
+	calibration->addArguments(args);
+	return true;
+}
+
+/**
+ * Writes every output target of the Image from a single full size decode
+ * Downscaled targets are taken from a ResizePyramid shared between them,
+ * and each target is toned and encoded on its own thread. Brightness,
+ * gamma and the white level are applied the way dcraw applies them
+ * @return true if every target was written, false otherwise
+ */
+bool Converter::runTargets()
+{
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	if (theProgress)
+		theProgress->start();
+	bool written = writeTargets(theImage->getOutputTargets());
+	if (theProgress)
+		theProgress->finish();
+	recordConversion(written, chrono::duration<double>(chrono::steady_clock::now() - started).count());
+	return written;
+}
+
+/**
+ * Writes output files from a single full size decode of the Image,
+ * calibrated and then denoised if the Image asks for it
+ * @param targets - the files to write
+ * @return true if every target was written, false otherwise
+ */
+bool Converter::writeTargets(const vector<OutputTarget> &targets)
+{
+	shared_ptr<PixelBuffer> linear(new PixelBuffer());
+	int flip;
+	if (targets.empty() || !decode(*linear, false, flip))
+		return false;
+
+	return writeTargets(linear, targets, flip);
+}
+
+/**
+ * Writes every output target of the Image from a linear image decoded
+ * elsewhere, for example a stack of several frames (see FrameStacker)
+ * @param linear - the linear 16 bit RGB image, decoded as by decode()
+ * @return true if every target was written, false otherwise
+ */
+bool Converter::writeLinear(shared_ptr<PixelBuffer> linear)
+{
+	return writeTargets(linear, theImage->getOutputTargets(), Orientation::NONE);
+}
+
+/**
+ * Denoises a linear image if the Image has a noise threshold, then
+ * tones it and writes it to each target in parallel, turning each
+ * one upright as it is resized
+ * @param linear - the linear 16 bit RGB image
+ * @param targets - the files to write
+ * @param flip - dcraw's flip value to turn the image by, Orientation::NONE if it is upright
+ * @return true if every target was written, false otherwise
+ */
+bool Converter::writeTargets(shared_ptr<PixelBuffer> linear, const vector<OutputTarget> &targets, const int flip)
+{
+	if (targets.empty() || linear->getChannels() != 3)
+		return false;
+
+	if (theImage->getNoiseThreshold() > 0)
 	{
-		return -1;
+		if (theProgress)
+			theProgress->enter(ConversionProgress::DENOISING);
+		shared_ptr<PixelBuffer> denoised(new PixelBuffer());
+		WaveletDenoiser(theImage->getNoiseThreshold()).apply(*linear, *denoised);
+		linear = denoised;
 	}
 
-	return 0;
+	if (theProgress)
+		theProgress->enter(ConversionProgress::WRITING);
+	double redMultiplier, blueMultiplier;
+	resolveWhiteBalance(theImage, *linear, redMultiplier, blueMultiplier);
+	ToneKernels theKernels(redMultiplier, blueMultiplier,
+	                       theImage->getBrightness(), ToneKernels::autoWhiteLevel(*linear), theImage->getGamma());
+	ResizePyramid thePyramid(linear, flip);
+
+	vector<char> written(targets.size(), 0);
+	vector<thread> encoders;
+	for (size_t i = 0; i < targets.size(); i++)
+		encoders.push_back(thread([&, i]()
+		{
+			shared_ptr<const PixelBuffer> source = thePyramid.get(targets[i].maxSize, targets[i].maxSize);
+			PixelBuffer toned(source->getWidth(), source->getHeight(), 3);
+			theKernels.apply(source->getData(), toned.getData(), source->getPixelCount());
+			written[i] = ImageWriter::write(toned, targets[i].fileFormat, targets[i].outputFilename, targets[i].quality);
+		}));
+
+	bool succeeded = true;
+	for (size_t i = 0; i < encoders.size(); i++)
+	{
+		encoders[i].join();
+		if (!written[i])
+		{
+			cerr << "Could not write " << targets[i].outputFilename << endl;
+			succeeded = false;
+		}
+	}
+	return succeeded;
+}
+
+/**
+ * Asks dcraw for the output dimensions of the Image without decoding it
+ * Runs "dcraw -i -v" and reads the "Image size:" line
+ * @param width - set to the width of the decoded image in pixels
+ * @param height - set to the height of the decoded image in pixels
+ * @return true if the dimensions were found, false otherwise
+ */
+bool Converter::identify(int &width, int &height)
+{
+	vector<string> args;
+	args.push_back("-i");
+	args.push_back("-v");
+	args.push_back(theImage->getSourceFilename());
+
+	Process dcraw(getExecutable(), args);
+	dcraw.setCaptureOutput(true);
+	if (!Supervisor().run(dcraw).succeeded())
+		return false;
+
+	istringstream lines(dcraw.getOutput());
+	string line;
+	while (getline(lines, line))
+	{
+		if (line.compare(0, 11, "Image size:") != 0)
+			continue;
+		char separator = 0;
+		istringstream size(line.substr(11));
+		if (size >> width >> separator >> height && separator == 'x')
+			return width > 0 && height > 0;
+	}
+	return false;
 }
 
 /**
@@ -216,6 +647,16 @@ const string Converter::getExecutable() const
     return theExecutable;
 }
 
+/**
+ * Gets the executable to decode the Image with, which is the one set
+ * unless a DecoderBackends profile has found a quicker one for its camera
+ * @return the executable name
+ */
+const string Converter::getBackend() const
+{
+    return DecoderBackends::getShared().route(theExecutable, theImage->getSourceFilename());
+}
+
 /**
  * Gets the Image for conversion
  * @return the Image
@@ -224,3 +665,13 @@ const Image * Converter::getImage() const
 {
     return theImage;
 }
+
+/**
+ * Gets the largest peak resident set size of the dcraws this Converter
+ * has run to convert or decode
+ * @return the peak in bytes, 0 if none has run
+ */
+const size_t Converter::getPeakRSS() const
+{
+    return peakRSS;
+}
@@ -10,7 +10,13 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <vector>
 #include "Image.h"
+#include <memory>
+#include "Process.h"
+#include "PixelBuffer.h"
+#include "ConversionProgress.h"
+#include "CalibrationFrames.h"
 
 using namespace std;
 
@@ -24,13 +30,38 @@ class Converter
         void setExecutable(const string theExecutable);
         void setArguments(const string theArguments);
         void setImage(Image * toConvert);
+        void setProgress(ConversionProgress * theProgress);
+        void setCancel(const atomic<bool> * cancel);
         int run(bool preview);
+        bool decode(PixelBuffer &theBuffer, const bool halfSize);
+        bool runTargets();
+        bool writeLinear(shared_ptr<PixelBuffer> linear);
+        bool identify(int &width, int &height);
+        const vector<string> buildArguments(const bool preview) const;
+        const vector<string> buildDecodeArguments(const bool halfSize) const;
+        bool addCalibrationArguments(vector<string> &args, shared_ptr<const CalibrationFrames> &calibration) const;
         const string getExecutable() const;
         const string getArguments() const;
         const Image * getImage() const;
+        const size_t getPeakRSS() const;
+
+        static void resolveWhiteBalance(const Image * theImage, const PixelBuffer &linear, double &redMultiplier, double &blueMultiplier);
+        static void recordConversion(const bool succeeded, const double seconds);
     private:
+        int convert(const bool preview);
+        bool decode(PixelBuffer &theBuffer, const bool halfSize, int &flip);
+        const string getBackend() const;
+        void addColourArguments(vector<string> &args) const;
+        bool writeTargets(const vector<OutputTarget> &targets);
+        bool writeTargets(shared_ptr<PixelBuffer> linear, const vector<OutputTarget> &targets, const int flip);
+
         string theExecutable;
         string theArguments;
         Image * theImage;
+        ConversionProgress * theProgress;
+        // Raised by another thread to kill the dcraw of the conversion, NULL for none
+        const atomic<bool> * cancel;
+        // The largest peak resident set size of the dcraws run so far
+        size_t peakRSS;
 };
 #endif
@@ -0,0 +1,400 @@
+/**
+ * class DecoderBackends
+ * A registry of dcraw-compatible executables, such as dcraw built with
+ * different compilers and flags or LibRaw's dcraw_emu, and a profile of
+ * which is quickest for each camera model
+ *
+ * benchmark() identifies the camera model of each file from its headers
+ * (see RawProbe), or with the first (reference) backend for formats the
+ * probe does not know, and decodes a few files of each model with every
+ * backend, as the converter decodes them. A backend passes for a model
+ * if all of its decodes succeed and have the same size as the
+ * reference's, no sample differs by more than MAX_DIFFERENCE and no more
+ * than MAX_OUTLIERS_PER_MILLION of them differ by more than TOLERANCE.
+ * The profile keeps the mean time of each backend on each model, and
+ * can be saved and loaded again
+ *
+ * route() then picks, for a file, the quickest backend that passed for
+ * its camera model, identified in the same way, from headers already
+ * probed if the caller has them. Files of a model that was not
+ * profiled, or with no profile loaded, use the executable given. Every
+ * backend must take dcraw's command line and write to standard output with -c
+ *
+ * PUBLIC FEATURES:
+ *       DecoderBackends();
+ *       ~DecoderBackends();
+ *       void addBackend(string theExecutable);
+ *       vector<string> getBackends();
+ *       int benchmark(vector<string> &files, int samplesPerCamera);
+ *       bool load(string filename);
+ *       bool save(string filename);
+ *       string route(string theExecutable, string filename);
+ *       string route(string theExecutable, RawProbe::Header &header);
+ *       string describe();
+ *       bool isEmpty();
+ *       static string identifyCamera(string theExecutable, string filename);
+ *       static DecoderBackends & getShared();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "DecoderBackends.h"
+#include "Converter.h"
+#include "Image.h"
+#include "Process.h"
+#include "PixelBuffer.h"
+#include "Supervisor.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * Constructor
+ */
+DecoderBackends::DecoderBackends()
+{}
+
+/**
+ * Destructor
+ */
+DecoderBackends::~DecoderBackends()
+{}
+
+/**
+ * Adds an executable to benchmark; the first one added is the reference
+ * @param theExecutable - the path of a dcraw-compatible executable
+ */
+void DecoderBackends::addBackend(const string theExecutable)
+{
+    lock_guard<mutex> guard(lock);
+    backends.push_back(theExecutable);
+}
+
+/**
+ * @return the executables, the reference first
+ */
+const vector<string> DecoderBackends::getBackends() const
+{
+    lock_guard<mutex> guard(lock);
+    return backends;
+}
+
+/**
+ * Decodes a raw file with a backend, as the converter would
+ * @param theExecutable - the backend
+ * @param filename - the raw file
+ * @param theBuffer - the decoded image
+ * @param seconds - set to the time the decode took
+ * @return true if the file was decoded, false otherwise
+ */
+static bool decodeWith(const string theExecutable, const string filename, PixelBuffer &theBuffer, double &seconds)
+{
+    // Camera white balance, so that no backend runs an extra pass for it
+    Image theImage;
+    theImage.setSourceFilename(filename);
+    theImage.setWhiteBalance(Image::CAMERA);
+    Converter theConverter;
+    theConverter.setImage(&theImage);
+
+    Process dcraw(theExecutable, theConverter.buildDecodeArguments(false));
+    dcraw.setCaptureOutput(true);
+    Supervisor::Result result = Supervisor().run(dcraw);
+    seconds = result.seconds;
+    return result.succeeded() && theBuffer.parsePPM(dcraw.getOutput());
+}
+
+/**
+ * Compares two decodes of a file. Rounding spreads small differences
+ * over the whole image, so many samples may differ a little; a few may
+ * differ more, at edges the interpolation treats differently, but a
+ * patch of wrong colour fails however small a share of the image it is
+ * @param reference - the reference decode
+ * @param candidate - a decode of the same file by another backend
+ * @return true if the decodes are the same size, no sample differs by more
+ *         than MAX_DIFFERENCE and at most MAX_OUTLIERS_PER_MILLION differ by more than TOLERANCE
+ */
+static bool matches(const PixelBuffer &reference, const PixelBuffer &candidate)
+{
+    if (reference.getWidth() != candidate.getWidth() || reference.getHeight() != candidate.getHeight()
+        || reference.getChannels() != candidate.getChannels())
+        return false;
+
+    size_t samples = reference.getPixelCount() * reference.getChannels();
+    size_t allowed = (size_t)((double)samples * DecoderBackends::MAX_OUTLIERS_PER_MILLION / 1000000);
+    const unsigned short * expected = reference.getData();
+    const unsigned short * actual = candidate.getData();
+    size_t outliers = 0;
+    for (size_t i = 0; i < samples; i++)
+    {
+        int difference = abs((int)expected[i] - (int)actual[i]);
+        if (difference > DecoderBackends::MAX_DIFFERENCE)
+            return false;
+        if (difference > DecoderBackends::TOLERANCE && ++outliers > allowed)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Times every backend on a sample of the files of each camera model and
+ * checks its output against the reference backend, replacing the profile
+ * @param files - raw files, from which up to samplesPerCamera of each model are decoded
+ * @param samplesPerCamera - the most files of one model to decode
+ * @return the number of camera models profiled
+ */
+int DecoderBackends::benchmark(const vector<string> &files, const int samplesPerCamera)
+{
+    vector<string> executables = getBackends();
+    if (executables.empty())
+        return 0;
+
+    vector<RawProbe::Header> headers = RawProbe::probeAll(files, max((int)thread::hardware_concurrency(), 1));
+    map< string, vector<string> > samples;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        string camera = identify(executables[0], headers[i]);
+        if (!camera.empty() && (int)samples[camera].size() < samplesPerCamera)
+            samples[camera].push_back(files[i]);
+    }
+
+    vector<Timing> profile;
+    for (map< string, vector<string> >::iterator model = samples.begin(); model != samples.end(); ++model)
+    {
+        vector<Timing> results(executables.size());
+        for (size_t b = 0; b < executables.size(); b++)
+        {
+            results[b].camera = model->first;
+            results[b].executable = executables[b];
+            results[b].seconds = 0;
+            results[b].passed = true;
+            results[b].samples = 0;
+        }
+
+        for (size_t f = 0; f < model->second.size(); f++)
+        {
+            // The reference decodes first, which also brings the file into the cache
+            PixelBuffer reference;
+            double seconds = 0;
+            bool decoded = decodeWith(executables[0], model->second[f], reference, seconds);
+            results[0].seconds += seconds;
+            results[0].passed = results[0].passed && decoded;
+            results[0].samples++;
+
+            for (size_t b = 1; b < executables.size(); b++)
+            {
+                PixelBuffer candidate;
+                bool passed = decodeWith(executables[b], model->second[f], candidate, seconds) && decoded
+                              && matches(reference, candidate);
+                results[b].seconds += seconds;
+                results[b].passed = results[b].passed && passed;
+                results[b].samples++;
+                if (!passed)
+                    cerr << model->second[f] << ": " << executables[b] << " does not match " << executables[0] << endl;
+            }
+        }
+
+        for (size_t b = 0; b < results.size(); b++)
+        {
+            results[b].seconds /= results[b].samples;
+            profile.push_back(results[b]);
+        }
+    }
+
+    lock_guard<mutex> guard(lock);
+    timings = profile;
+    return (int)samples.size();
+}
+
+/**
+ * Reads a profile written by save(), replacing the current one
+ * @param filename - the profile
+ * @return true if it was read, false otherwise
+ */
+bool DecoderBackends::load(const string filename)
+{
+    ifstream in(filename.c_str());
+    if (!in)
+        return false;
+
+    vector<Timing> profile;
+    string line;
+    while (getline(in, line))
+    {
+        // camera <tab> executable <tab> seconds <tab> passed <tab> samples
+        istringstream fields(line);
+        Timing theTiming;
+        string seconds, passed, samples;
+        if (!getline(fields, theTiming.camera, '\t') || !getline(fields, theTiming.executable, '\t')
+            || !getline(fields, seconds, '\t') || !getline(fields, passed, '\t') || !getline(fields, samples))
+            continue;
+        theTiming.seconds = atof(seconds.c_str());
+        theTiming.passed = passed == "passed";
+        theTiming.samples = atoi(samples.c_str());
+        profile.push_back(theTiming);
+    }
+
+    lock_guard<mutex> guard(lock);
+    timings = profile;
+    cameras.clear();
+    return true;
+}
+
+/**
+ * Writes the profile, one line per camera model and backend
+ * @param filename - the file to write, replaced if it exists
+ * @return true if it was written, false otherwise
+ */
+bool DecoderBackends::save(const string filename) const
+{
+    ofstream out(filename.c_str(), ios::out | ios::trunc);
+    if (!out)
+        return false;
+
+    lock_guard<mutex> guard(lock);
+    out.precision(6);
+    for (size_t i = 0; i < timings.size(); i++)
+        out << timings[i].camera << "\t" << timings[i].executable << "\t" << timings[i].seconds << "\t"
+            << (timings[i].passed ? "passed" : "failed") << "\t" << timings[i].samples << "\n";
+    return (bool)out;
+}
+
+/**
+ * Picks the backend to decode a file with, probing its headers
+ * @param theExecutable - the executable to use if the profile has nothing better
+ * @param filename - the raw file
+ * @return the quickest backend that passed for the file's camera model, or theExecutable
+ */
+const string DecoderBackends::route(const string theExecutable, const string filename)
+{
+    if (isEmpty())
+        return theExecutable;
+    return route(theExecutable, RawProbe().probe(filename));
+}
+
+/**
+ * Picks the backend to decode a file with, from headers already probed
+ * @param theExecutable - the executable to use if the profile has nothing better
+ * @param header - the probed headers of the raw file
+ * @return the quickest backend that passed for the file's camera model, or theExecutable
+ */
+const string DecoderBackends::route(const string theExecutable, const RawProbe::Header &header)
+{
+    if (isEmpty())
+        return theExecutable;
+    string camera = identify(theExecutable, header);
+
+    lock_guard<mutex> guard(lock);
+    const Timing * fastest = NULL;
+    for (size_t i = 0; i < timings.size(); i++)
+        if (timings[i].camera == camera && timings[i].passed && (!fastest || timings[i].seconds < fastest->seconds))
+            fastest = &timings[i];
+    return fastest ? fastest->executable : theExecutable;
+}
+
+/**
+ * Finds the camera model of a raw file from its headers or, for a format
+ * the probe does not know, with dcraw once, remembering the model while
+ * the file's size and time stay the same
+ * @param theExecutable - the dcraw executable to identify with
+ * @param header - the probed headers of the raw file
+ * @return the make and model, such as "Canon EOS 5D", or "" if it could not be identified
+ */
+const string DecoderBackends::identify(const string theExecutable, const RawProbe::Header &header)
+{
+    // Models usually repeat the first word of the make: NIKON CORPORATION, NIKON D850
+    string brand = header.make.substr(0, header.make.find(' '));
+    if (!header.model.empty() && (brand.empty() || header.model.compare(0, brand.size(), brand) == 0))
+        return header.model;
+    if (!header.make.empty())
+        return header.make + (header.model.empty() ? "" : " ") + header.model;
+    if (header.isRejected())
+        return "";
+
+    struct stat status;
+    if (stat(header.filename.c_str(), &status) != 0)
+        return "";
+    ostringstream key(ostringstream::out);
+    key << header.filename << " " << (long long)status.st_size << " " << (long long)status.st_mtime;
+    {
+        lock_guard<mutex> guard(lock);
+        map<string, string>::iterator found = cameras.find(key.str());
+        if (found != cameras.end())
+            return found->second;
+    }
+    string camera = identifyCamera(theExecutable, header.filename);
+    lock_guard<mutex> guard(lock);
+    cameras[key.str()] = camera;
+    return camera;
+}
+
+/**
+ * @return the profile as a table, one line per camera model and backend,
+ *         with the backend each model is routed to marked
+ */
+const string DecoderBackends::describe() const
+{
+    lock_guard<mutex> guard(lock);
+    ostringstream description(ostringstream::out);
+    description.setf(ios::fixed);
+    description.precision(3);
+    for (size_t i = 0; i < timings.size(); i++)
+    {
+        bool fastest = timings[i].passed;
+        for (size_t j = 0; j < timings.size() && fastest; j++)
+            if (timings[j].camera == timings[i].camera && timings[j].passed && timings[j].seconds < timings[i].seconds)
+                fastest = false;
+        description << timings[i].camera << ": " << timings[i].executable << " " << timings[i].seconds << " s"
+                    << (timings[i].passed ? "" : ", output differs") << (fastest ? " (used)" : "") << "\n";
+    }
+    return description.str();
+}
+
+/**
+ * @return true if there is no profile, so every file uses the executable given
+ */
+const bool DecoderBackends::isEmpty() const
+{
+    lock_guard<mutex> guard(lock);
+    return timings.empty();
+}
+
+/**
+ * Finds the camera model of a raw file with dcraw -i -v
+ * @param theExecutable - the dcraw executable
+ * @param filename - the raw file
+ * @return the make and model, such as "Canon EOS 5D", or "" if it could not be identified
+ */
+const string DecoderBackends::identifyCamera(const string theExecutable, const string filename)
+{
+    vector<string> args;
+    args.push_back("-i");
+    args.push_back("-v");
+    args.push_back(filename);
+
+    Process dcraw(theExecutable, args);
+    dcraw.setCaptureOutput(true);
+    if (!Supervisor().run(dcraw).succeeded())
+        return "";
+
+    istringstream lines(dcraw.getOutput());
+    string line;
+    while (getline(lines, line))
+        if (line.compare(0, 8, "Camera: ") == 0)
+            return line.substr(8);
+    return "";
+}
+
+/**
+ * @return the registry every conversion is routed through, empty until a profile is loaded
+ */
+DecoderBackends & DecoderBackends::getShared()
+{
+    static DecoderBackends shared;
+    return shared;
+}
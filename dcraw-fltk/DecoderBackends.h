@@ -0,0 +1,72 @@
+/**
+ * DecoderBackends.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef DECODERBACKENDS_H
+#define DECODERBACKENDS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include "RawProbe.h"
+
+using namespace std;
+
+class DecoderBackends
+{
+    public:
+        DecoderBackends();
+        ~DecoderBackends();
+
+        void addBackend(const string theExecutable);
+        const vector<string> getBackends() const;
+
+        int benchmark(const vector<string> &files, const int samplesPerCamera);
+        bool load(const string filename);
+        bool save(const string filename) const;
+        const string route(const string theExecutable, const string filename);
+        const string route(const string theExecutable, const RawProbe::Header &header);
+        const string describe() const;
+        const bool isEmpty() const;
+
+        static const string identifyCamera(const string theExecutable, const string filename);
+        static DecoderBackends & getShared();
+
+        // Files of each camera model decoded by the benchmark, unless set
+        const static int DEFAULT_SAMPLES = 3;
+        // Largest difference from the reference decode of a sample that is not an outlier, in 16 bit levels
+        const static int TOLERANCE = 256;
+        // Outliers allowed in every million samples of a decode
+        const static int MAX_OUTLIERS_PER_MILLION = 1000;
+        // Largest difference from the reference decode of any sample, in 16 bit levels
+        const static int MAX_DIFFERENCE = 4096;
+
+    private:
+        DecoderBackends(DecoderBackends &toCopy);
+        const string identify(const string theExecutable, const RawProbe::Header &header);
+
+        /**
+         * How one backend did on the samples of one camera model
+         */
+        struct Timing
+        {
+            string camera;
+            string executable;
+            // Mean seconds per decode
+            double seconds;
+            // True if every sample decoded and matched the reference
+            bool passed;
+            int samples;
+        };
+
+        // The executables, the first of which is the reference
+        vector<string> backends;
+        // The profile, from benchmark() or load()
+        vector<Timing> timings;
+        // Camera model of each file dcraw identified, by name, size and time
+        map<string, string> cameras;
+        mutable mutex lock;
+};
+#endif
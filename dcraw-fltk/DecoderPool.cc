@@ -0,0 +1,303 @@
+/**
+ * class DecoderPool
+ * Decodes raw files in long-lived worker processes rather than in
+ * the GUI, so that a malformed raw file can at worst take down a
+ * worker. The workers are copies of dcraw-fltk started with
+ * --decode-worker, once, and reused for every decode; they keep the
+ * white balance and calibration caches warm between decodes
+ *
+ * The pool sends a worker the settings of an Image, as written by
+ * Image::serialize() with the dcraw executable added, then a line
+ * "decode" or "preview" (half size). The worker decodes the image
+ * with Converter straight into a SharedFrame and answers
+ * "frame <description>" naming it, or "error <reason>". Once the pool
+ * has mapped the frame, which becomes the samples of its PixelBuffer,
+ * it answers "release", and the worker lets go of the segment
+ * A worker that exits or closes its output is started again, and the
+ * decode it was running fails
+ *
+ * PUBLIC FEATURES:
+ *       DecoderPool(string workerExecutable, int workers);
+ *       ~DecoderPool();
+ *       bool decode(string theExecutable, Image &theImage, bool halfSize, PixelBuffer &frame);
+ *       int getWorkers();
+ *       int getRestarts();
+ *       static DecoderPool & getShared();
+ *       static string getSelfExecutable();
+ *       static int runWorker();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "DecoderPool.h"
+#include "Converter.h"
+#include "SharedFrame.h"
+#include "Metrics.h"
+#include <cstdio>
+#include <csignal>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+using namespace std;
+
+/**
+ * Constructor
+ * Workers are started when they are first needed
+ * @param workerExecutable - dcraw-fltk itself, run with --decode-worker
+ * @param workers - the number of worker processes
+ */
+DecoderPool::DecoderPool(const string workerExecutable, const int workers)
+{
+    this->workerExecutable = workerExecutable;
+    theWorkers.assign(workers < 1 ? 1 : workers, (Process *)NULL);
+    busy.assign(theWorkers.size(), false);
+    restarts = 0;
+#ifndef _WIN32
+    // A worker that has crashed must fail the write to it, not kill us
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+/**
+ * Destructor
+ * Closes the input of each worker, which tells it to exit
+ */
+DecoderPool::~DecoderPool()
+{
+    for (size_t slot = 0; slot < theWorkers.size(); slot++)
+        stopWorker((int)slot);
+}
+
+/**
+ * Decodes an Image in a worker, as Converter::decode() would here
+ * Decodes here instead if no worker can be started
+ * @param theExecutable - the name of the dcraw executable to run
+ * @param theImage - the Image to decode
+ * @param halfSize - true to decode a half-size image, false otherwise
+ * @param frame - set to the decoded image
+ * @return true if the image was decoded, false otherwise
+ */
+bool DecoderPool::decode(const string theExecutable, Image &theImage, const bool halfSize, PixelBuffer &frame)
+{
+    int slot = -1;
+    Process * theWorker = NULL;
+    {
+        unique_lock<mutex> guard(poolLock);
+        while (true)
+        {
+            for (size_t i = 0; i < busy.size() && slot < 0; i++)
+                if (!busy[i])
+                    slot = (int)i;
+            if (slot >= 0)
+                break;
+            workerFreed.wait(guard);
+        }
+        busy[slot] = true;
+        if (!theWorkers[slot] && !workerExecutable.empty())
+            startWorker(slot);
+        theWorker = theWorkers[slot];
+    }
+
+    bool decoded = false;
+    if (!theWorker)
+    {
+        Converter theConverter(theExecutable, "");
+        theConverter.setImage(&theImage);
+        decoded = theConverter.decode(frame, halfSize);
+    }
+    else
+    {
+        string reply;
+        bool answered = theWorker->writeInput(theImage.serialize() + "executable " + theExecutable + "\n"
+                                              + (halfSize ? "preview\n" : "decode\n"))
+                        && theWorker->readLine(reply);
+        if (answered && reply.compare(0, 6, "frame ") == 0)
+        {
+            decoded = SharedFrame::read(reply.substr(6), frame);
+            answered = theWorker->writeInput("release\n");
+        }
+        else if (answered)
+            cerr << theImage.getSourceFilename() << ": " << reply << endl;
+
+        if (!answered)
+        {
+            cerr << theImage.getSourceFilename() << ": the decoder worker exited with code "
+                 << theWorker->wait() << ", restarting it" << endl;
+            static Metrics::Counter &restarted = Metrics::counter("dcraw_fltk_decode_worker_restarts_total",
+                                                                  "Decoder workers started again after exiting");
+            static Metrics::Histogram &memory = Metrics::histogram("dcraw_fltk_decode_worker_peak_memory_bytes",
+                "Peak resident memory of each decoder worker that exited", "", Metrics::bytesBuckets());
+            restarted.add();
+            if (theWorker->getPeakRSS() > 0)
+                memory.observe((double)theWorker->getPeakRSS());
+
+            lock_guard<mutex> guard(poolLock);
+            stopWorker(slot);
+            startWorker(slot);
+            restarts++;
+        }
+    }
+
+    lock_guard<mutex> guard(poolLock);
+    busy[slot] = false;
+    workerFreed.notify_one();
+    return decoded;
+}
+
+/**
+ * Starts the worker of a slot
+ * Must be called with the pool lock held
+ * @param slot - the slot
+ * @return true if the worker was started, false otherwise
+ */
+bool DecoderPool::startWorker(const int slot)
+{
+    Process * theWorker = new Process(workerExecutable, vector<string>(1, "--decode-worker"));
+    theWorker->setInteractive(true);
+    if (!theWorker->start())
+    {
+        cerr << "Cannot start the decoder worker " << workerExecutable << endl;
+        delete theWorker;
+        theWorker = NULL;
+    }
+    theWorkers[slot] = theWorker;
+    return theWorker != NULL;
+}
+
+/**
+ * Stops the worker of a slot, waiting for it to exit
+ * @param slot - the slot
+ */
+void DecoderPool::stopWorker(const int slot)
+{
+    if (!theWorkers[slot])
+        return;
+    theWorkers[slot]->closeInput();
+    theWorkers[slot]->wait();
+    delete theWorkers[slot];
+    theWorkers[slot] = NULL;
+}
+
+/**
+ * @return the number of worker processes
+ */
+const int DecoderPool::getWorkers() const
+{
+    return (int)theWorkers.size();
+}
+
+/**
+ * @return the number of times a worker has had to be started again
+ */
+const int DecoderPool::getRestarts() const
+{
+    return restarts;
+}
+
+/**
+ * @return the pool the preview decodes in, created on first use
+ */
+DecoderPool & DecoderPool::getShared()
+{
+    static DecoderPool shared(getSelfExecutable(), SHARED_WORKERS);
+    return shared;
+}
+
+/**
+ * @return the path of the running dcraw-fltk executable, "" if it cannot be found
+ */
+const string DecoderPool::getSelfExecutable()
+{
+    char path[4096] = "";
+#ifdef _WIN32
+    DWORD length = GetModuleFileNameA(NULL, path, sizeof(path));
+    if (length == 0 || length >= sizeof(path))
+        return "";
+#elif defined(__APPLE__)
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) != 0)
+        return "";
+#else
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0)
+        return "";
+    path[length] = '\0';
+#endif
+    return path;
+}
+
+/**
+ * The worker process: decodes requests from standard input until it closes
+ * Standard output carries only replies, so everything else printed
+ * there, such as the dcraw command lines, goes to standard error
+ * @return the exit code of the worker
+ */
+int DecoderPool::runWorker()
+{
+    fflush(stdout);
+#ifdef _WIN32
+    int replies = _dup(1);
+    _dup2(2, 1);
+    FILE * output = _fdopen(replies, "w");
+#else
+    int replies = dup(1);
+    dup2(2, 1);
+    FILE * output = fdopen(replies, "w");
+#endif
+    if (!output)
+        return 1;
+
+    SharedFrame frame;
+    string request;
+    string line;
+    while (getline(cin, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line == "release")
+        {
+            frame.release();
+            continue;
+        }
+        if (line != "decode" && line != "preview")
+        {
+            request += line + "\n";
+            continue;
+        }
+
+        Image theImage;
+        string theExecutable;
+        size_t found = request.find("\nexecutable ");
+        if (request.compare(0, 11, "executable ") == 0)
+            found = 0;
+        else if (found != string::npos)
+            found++;
+        if (found != string::npos)
+            theExecutable = request.substr(found + 11, request.find('\n', found) - found - 11);
+
+        PixelBuffer decoded;
+        frame.prepare(decoded);
+        Converter theConverter(theExecutable, "");
+        theConverter.setImage(&theImage);
+        if (!theImage.deserialize(request) || theExecutable.empty())
+            fprintf(output, "error cannot read the request\n");
+        else if (!theConverter.decode(decoded, line == "preview"))
+            fprintf(output, "error cannot decode %s\n", theImage.getSourceFilename().c_str());
+        else if (!frame.create(decoded))
+            fprintf(output, "error cannot create shared memory\n");
+        else
+            fprintf(output, "frame %s\n", frame.describe().c_str());
+        fflush(output);
+        request.clear();
+    }
+    return 0;
+}
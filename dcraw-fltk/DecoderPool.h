@@ -0,0 +1,52 @@
+/**
+ * DecoderPool.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef DECODERPOOL_H
+#define DECODERPOOL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "Image.h"
+#include "PixelBuffer.h"
+#include "Process.h"
+
+using namespace std;
+
+class DecoderPool
+{
+    public:
+        DecoderPool(const string workerExecutable, const int workers);
+        ~DecoderPool();
+
+        bool decode(const string theExecutable, Image &theImage, const bool halfSize, PixelBuffer &frame);
+
+        const int getWorkers() const;
+        const int getRestarts() const;
+
+        static DecoderPool & getShared();
+        static const string getSelfExecutable();
+        static int runWorker();
+
+        // Workers of the pool getShared() returns
+        const static int SHARED_WORKERS = 2;
+
+    private:
+        DecoderPool(DecoderPool &toCopy);
+
+        bool startWorker(const int slot);
+        void stopWorker(const int slot);
+
+        string workerExecutable;
+        // One worker process per slot, NULL until first used
+        vector<Process *> theWorkers;
+        vector<bool> busy;
+        int restarts;
+
+        mutex poolLock;
+        condition_variable workerFreed;
+};
+#endif
@@ -0,0 +1,774 @@
+/**
+ * class DirectoryIndex
+ * A persistent index of the raw files in one directory: the metadata
+ * that "dcraw -i -v" reports for each and its embedded thumbnail,
+ * kept beside the raw files so that reopening the directory needs
+ * no dcraw at all
+ *
+ * The index file holds the metadata of every entry. The thumbnails
+ * are kept in fixed size slots of a separate atlas file, which is
+ * memory-mapped, so only the thumbnails actually looked at are read
+ * from disk. An entry is current while the size and modification
+ * time of its raw file match the ones it was indexed at
+ *
+ * PUBLIC FEATURES:
+ *       DirectoryIndex(string directory);
+ *       ~DirectoryIndex();
+ *       bool load();
+ *       bool save();
+ *       int update(string theExecutable, int threads);
+ *       void store(RawMetadata &metadata, vector<unsigned char> &pixels);
+ *       int find(string filename);
+ *       bool isCurrent(string filename);
+ *       RawMetadata getEntry(int entry);
+ *       int getEntryCount();
+ *       bool getThumbnail(int entry, vector<unsigned char> &pixels);
+ *       vector<string> select(vector<string> filenames, int sortKey, string filter);
+ *       string getDirectory();
+ *       bool isMapped();
+ *       static bool extract(string theExecutable, string path, RawMetadata &metadata,
+ *                           vector<unsigned char> &pixels);
+ *       static vector<string> listRawFiles(string directory);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "DirectoryIndex.h"
+#include "Process.h"
+#include "Supervisor.h"
+#include "PixelBuffer.h"
+#include "PixelPipeline.h"
+#include "ResizePyramid.h"
+#include "Orientation.h"
+#include "RawProbe.h"
+#include <Fl/Fl_JPEG_Image.H>
+#include <Fl/filename.H>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+const char * const DirectoryIndex::INDEX_FILENAME = ".dcraw-fltk.index";
+const char * const DirectoryIndex::ATLAS_FILENAME = ".dcraw-fltk.atlas";
+
+// Index file header: magic number, then the format version
+const static char INDEX_MAGIC[4] = { 'D', 'F', 'I', 'X' };
+const static int INDEX_VERSION = 1;
+
+// Fewest slots the atlas grows by
+const static size_t ATLAS_GROWTH = 64;
+
+/**
+ * Appends little-endian integers, doubles and strings to the index file contents
+ */
+static void putInteger(string &out, const long long value, const int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out += (char)((value >> (i * 8)) & 0xff);
+}
+
+static void putDouble(string &out, const double value)
+{
+    long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putInteger(out, bits, 8);
+}
+
+static void putString(string &out, const string value)
+{
+    putInteger(out, (long long)value.size(), 4);
+    out += value;
+}
+
+/**
+ * Reads back what the put functions write, moving a position through the
+ * contents. Reading past the end leaves the position past the end
+ */
+static long long getInteger(const string &in, size_t &position, const int bytes)
+{
+    long long value = 0;
+    if (position + bytes > in.size())
+    {
+        position = in.size() + 1;
+        return 0;
+    }
+    for (int i = 0; i < bytes; i++)
+        value |= (long long)(unsigned char)in[position + i] << (i * 8);
+    position += bytes;
+    return value;
+}
+
+static double getDouble(const string &in, size_t &position)
+{
+    long long bits = getInteger(in, position, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static string getString(const string &in, size_t &position)
+{
+    size_t length = (size_t)getInteger(in, position, 4);
+    if (position > in.size() || position + length > in.size())
+    {
+        position = in.size() + 1;
+        return "";
+    }
+    string value = in.substr(position, length);
+    position += length;
+    return value;
+}
+
+/**
+ * Constructor
+ * Nothing is read until load() is called
+ * @param directory - the directory of raw files to index
+ */
+DirectoryIndex::DirectoryIndex(const string directory)
+{
+    this->directory = directory;
+    changed = false;
+    atlas = NULL;
+    atlasSlots = 0;
+#ifdef _WIN32
+    atlasFile = INVALID_HANDLE_VALUE;
+    atlasMapping = NULL;
+#else
+    atlasFile = -1;
+#endif
+}
+
+/**
+ * Destructor
+ * Changes not saved with save() are lost
+ */
+DirectoryIndex::~DirectoryIndex()
+{
+    unmapAtlas();
+#ifdef _WIN32
+    if (atlasFile != INVALID_HANDLE_VALUE)
+        CloseHandle(atlasFile);
+#else
+    if (atlasFile >= 0)
+        close(atlasFile);
+#endif
+}
+
+/**
+ * Reads the index and maps the thumbnail atlas, dropping the
+ * entries of raw files that are no longer in the directory
+ * @return true if an index was read, false if there was none (the index is then empty)
+ */
+bool DirectoryIndex::load()
+{
+    lock_guard<mutex> lock(indexMutex);
+    entries.clear();
+    byName.clear();
+    changed = false;
+
+    ifstream file((directory + "/" + INDEX_FILENAME).c_str(), ios::in | ios::binary);
+    string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    size_t position = 4;
+    if (contents.size() < 20 || memcmp(contents.data(), INDEX_MAGIC, 4) != 0 ||
+        getInteger(contents, position, 4) != INDEX_VERSION ||
+        getInteger(contents, position, 4) != THUMBNAIL_WIDTH ||
+        getInteger(contents, position, 4) != THUMBNAIL_HEIGHT)
+        return false;
+
+    size_t count = (size_t)getInteger(contents, position, 4);
+    for (size_t i = 0; i < count && position <= contents.size(); i++)
+    {
+        RawMetadata entry;
+        entry.filename = getString(contents, position);
+        entry.fileSize = getInteger(contents, position, 8);
+        entry.modified = getInteger(contents, position, 8);
+        entry.camera = getString(contents, position);
+        entry.iso = getDouble(contents, position);
+        entry.shutter = getDouble(contents, position);
+        entry.aperture = getDouble(contents, position);
+        entry.focalLength = getDouble(contents, position);
+        entry.timestamp = getString(contents, position);
+        entry.timestampKey = getInteger(contents, position, 8);
+        entry.width = (int)getInteger(contents, position, 4);
+        entry.height = (int)getInteger(contents, position, 4);
+        for (int c = 0; c < 4; c++)
+            entry.multipliers[c] = getDouble(contents, position);
+        entry.thumbnailWidth = (int)getInteger(contents, position, 4);
+        entry.thumbnailHeight = (int)getInteger(contents, position, 4);
+        if (position <= contents.size())
+            entries.push_back(entry);
+    }
+    if (!mapAtlas(entries.size()))
+    {
+        entries.clear();
+        return false;
+    }
+
+    // Drop the entries of deleted files, moving the later thumbnails down
+    vector<string> present = listRawFiles(directory);
+    set<string> names(present.begin(), present.end());
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (names.count(entries[i].filename) == 0)
+            continue;
+        if (kept != i)
+        {
+            memmove(atlas + kept * SLOT_BYTES, atlas + i * SLOT_BYTES, SLOT_BYTES);
+            entries[kept] = entries[i];
+        }
+        byName[entries[kept].filename] = (int)kept;
+        kept++;
+    }
+    changed = kept != entries.size();
+    entries.resize(kept);
+    return true;
+}
+
+/**
+ * Writes the index beside the raw files, if anything changed since it was loaded
+ * The atlas is already written through its mapping and is only flushed
+ * @return true if the index is saved, false if it could not be written
+ */
+bool DirectoryIndex::save()
+{
+    lock_guard<mutex> lock(indexMutex);
+    if (!changed)
+        return true;
+    if (!isMapped())
+        return false;
+
+    string contents(INDEX_MAGIC, 4);
+    putInteger(contents, INDEX_VERSION, 4);
+    putInteger(contents, THUMBNAIL_WIDTH, 4);
+    putInteger(contents, THUMBNAIL_HEIGHT, 4);
+    putInteger(contents, (long long)entries.size(), 4);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const RawMetadata &entry = entries[i];
+        putString(contents, entry.filename);
+        putInteger(contents, entry.fileSize, 8);
+        putInteger(contents, entry.modified, 8);
+        putString(contents, entry.camera);
+        putDouble(contents, entry.iso);
+        putDouble(contents, entry.shutter);
+        putDouble(contents, entry.aperture);
+        putDouble(contents, entry.focalLength);
+        putString(contents, entry.timestamp);
+        putInteger(contents, entry.timestampKey, 8);
+        putInteger(contents, entry.width, 4);
+        putInteger(contents, entry.height, 4);
+        for (int c = 0; c < 4; c++)
+            putDouble(contents, entry.multipliers[c]);
+        putInteger(contents, entry.thumbnailWidth, 4);
+        putInteger(contents, entry.thumbnailHeight, 4);
+    }
+
+#ifdef _WIN32
+    FlushViewOfFile(atlas, 0);
+#else
+    msync(atlas, atlasSlots * SLOT_BYTES, MS_SYNC);
+#endif
+
+    // Written aside and renamed over the old index, so a crash never leaves half an index
+    string path = directory + "/" + INDEX_FILENAME;
+    string temporary = path + ".tmp";
+    FILE * file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    written = written && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    written = written && rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+    if (!written)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    changed = false;
+    return true;
+}
+
+/**
+ * Indexes every raw file of the directory that is new or has changed,
+ * extracting several at once, then saves the index
+ * @param theExecutable - the path to dcraw
+ * @param threads - the number of files to extract at once
+ * @return the number of files indexed, -1 if the index could not be saved
+ */
+const int DirectoryIndex::update(const string theExecutable, const int threads)
+{
+    vector<string> stale;
+    vector<string> present = listRawFiles(directory);
+    for (size_t i = 0; i < present.size(); i++)
+        if (!isCurrent(present[i]))
+            stale.push_back(present[i]);
+
+    atomic<size_t> next(0);
+    atomic<int> indexed(0);
+    vector<thread> workers;
+    for (int t = 0; t < max(threads, 1); t++)
+        workers.push_back(thread([&]()
+        {
+            // Files whose headers rule them out are not given to dcraw
+            RawProbe theProbe;
+            for (size_t i = next++; i < stale.size(); i = next++)
+            {
+                RawMetadata metadata;
+                vector<unsigned char> pixels;
+                string path = directory + "/" + stale[i];
+                if (theProbe.probe(path).isRejected() || !extract(theExecutable, path, metadata, pixels))
+                    continue;
+                store(metadata, pixels);
+                indexed++;
+            }
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    if (!save())
+        return -1;
+    return indexed;
+}
+
+/**
+ * Adds or replaces the entry of a raw file
+ * @param metadata - the metadata, with the name of the file within the directory
+ * @param pixels - the 8 bit RGB thumbnail, thumbnailWidth x thumbnailHeight
+ */
+void DirectoryIndex::store(const RawMetadata &metadata, const vector<unsigned char> &pixels)
+{
+    lock_guard<mutex> lock(indexMutex);
+    map<string, int>::iterator found = byName.find(metadata.filename);
+    int entry;
+    if (found != byName.end())
+    {
+        entry = found->second;
+        entries[entry] = metadata;
+    }
+    else
+    {
+        if (!mapAtlas(entries.size() + 1))
+            return;
+        entry = (int)entries.size();
+        entries.push_back(metadata);
+        byName[metadata.filename] = entry;
+    }
+
+    RawMetadata &stored = entries[entry];
+    size_t bytes = (size_t)stored.thumbnailWidth * stored.thumbnailHeight * 3;
+    if (bytes > pixels.size() || bytes > (size_t)SLOT_BYTES)
+    {
+        stored.thumbnailWidth = 0;
+        stored.thumbnailHeight = 0;
+        bytes = 0;
+    }
+    if (bytes > 0)
+        memcpy(atlas + (size_t)entry * SLOT_BYTES, &pixels[0], bytes);
+    changed = true;
+}
+
+/**
+ * @param filename - the name of a raw file within the directory
+ * @return its entry, or -1 if it has none
+ */
+const int DirectoryIndex::find(const string filename) const
+{
+    lock_guard<mutex> lock(indexMutex);
+    map<string, int>::const_iterator found = byName.find(filename);
+    return found == byName.end() ? -1 : found->second;
+}
+
+/**
+ * @param filename - the name of a raw file within the directory
+ * @return true if it has an entry and has not changed since it was indexed
+ */
+const bool DirectoryIndex::isCurrent(const string filename) const
+{
+    int entry = find(filename);
+    long long fileSize, modified;
+    if (entry < 0 || !statFile(directory + "/" + filename, fileSize, modified))
+        return false;
+    lock_guard<mutex> lock(indexMutex);
+    return entries[entry].fileSize == fileSize && entries[entry].modified == modified;
+}
+
+/**
+ * @param entry - the entry, from find()
+ * @return the metadata of the entry
+ */
+const RawMetadata DirectoryIndex::getEntry(const int entry) const
+{
+    lock_guard<mutex> lock(indexMutex);
+    return entries[entry];
+}
+
+/**
+ * @return the number of entries
+ */
+const int DirectoryIndex::getEntryCount() const
+{
+    lock_guard<mutex> lock(indexMutex);
+    return (int)entries.size();
+}
+
+/**
+ * Copies the thumbnail of an entry out of the atlas
+ * @param entry - the entry, from find()
+ * @param pixels - set to the 8 bit RGB thumbnail
+ * @return true if the entry has a thumbnail, false otherwise
+ */
+bool DirectoryIndex::getThumbnail(const int entry, vector<unsigned char> &pixels) const
+{
+    lock_guard<mutex> lock(indexMutex);
+    size_t bytes = (size_t)entries[entry].thumbnailWidth * entries[entry].thumbnailHeight * 3;
+    if (bytes == 0)
+        return false;
+    const unsigned char * slot = atlas + (size_t)entry * SLOT_BYTES;
+    pixels.assign(slot, slot + bytes);
+    return true;
+}
+
+/**
+ * Filters and sorts raw files by their metadata. Files that are not
+ * indexed are kept only by a filter on the name, and sort after the rest
+ * @param filenames - the names of raw files within the directory
+ * @param sortKey - SORT_NAME, SORT_DATE, SORT_ISO or SORT_CAMERA
+ * @param filter - text that the name or camera must contain, ignoring case; "" for all
+ * @return the names that pass the filter, sorted
+ */
+const vector<string> DirectoryIndex::select(const vector<string> filenames, const int sortKey, const string filter) const
+{
+    string lowerFilter = filter;
+    transform(lowerFilter.begin(), lowerFilter.end(), lowerFilter.begin(), ::tolower);
+
+    // Each file with its entry, or -1 if it is not indexed
+    vector< pair<int, string> > chosen;
+    {
+        lock_guard<mutex> lock(indexMutex);
+        for (size_t i = 0; i < filenames.size(); i++)
+        {
+            map<string, int>::const_iterator found = byName.find(filenames[i]);
+            int entry = found == byName.end() ? -1 : found->second;
+            string text = filenames[i] + "\n" + (entry < 0 ? "" : entries[entry].camera);
+            transform(text.begin(), text.end(), text.begin(), ::tolower);
+            if (text.find(lowerFilter) != string::npos)
+                chosen.push_back(make_pair(entry, filenames[i]));
+        }
+
+        const vector<RawMetadata> &all = entries;
+        stable_sort(chosen.begin(), chosen.end(), [&](const pair<int, string> &a, const pair<int, string> &b)
+        {
+            if ((a.first < 0) != (b.first < 0))
+                return a.first >= 0;
+            if (a.first >= 0 && sortKey != SORT_NAME)
+            {
+                const RawMetadata &first = all[a.first];
+                const RawMetadata &second = all[b.first];
+                if (sortKey == SORT_DATE && first.timestampKey != second.timestampKey)
+                    return first.timestampKey < second.timestampKey;
+                if (sortKey == SORT_ISO && first.iso != second.iso)
+                    return first.iso < second.iso;
+                if (sortKey == SORT_CAMERA && first.camera != second.camera)
+                    return first.camera < second.camera;
+            }
+            return a.second < b.second;
+        });
+    }
+
+    vector<string> selected;
+    for (size_t i = 0; i < chosen.size(); i++)
+        selected.push_back(chosen[i].second);
+    return selected;
+}
+
+/**
+ * @return the directory indexed
+ */
+const string DirectoryIndex::getDirectory() const
+{
+    return directory;
+}
+
+/**
+ * @return true if the atlas is mapped from its file, false if it is only in memory
+ */
+const bool DirectoryIndex::isMapped() const
+{
+    return atlas != NULL && memoryAtlas.empty();
+}
+
+/**
+ * Makes sure the atlas has room for a number of slots, growing
+ * its file and mapping it again if it has not. The first call
+ * opens the file, and falls back to memory if it cannot be written
+ * @param slots - the number of slots needed
+ * @return true if the atlas has the room, false otherwise
+ */
+bool DirectoryIndex::mapAtlas(const size_t slots)
+{
+    if (atlas != NULL && slots <= atlasSlots)
+        return true;
+
+    size_t grown = max(max(slots, atlasSlots * 2), ATLAS_GROWTH);
+    if (!memoryAtlas.empty())
+    {
+        memoryAtlas.resize(grown * SLOT_BYTES);
+        atlas = &memoryAtlas[0];
+        atlasSlots = grown;
+        return true;
+    }
+
+    string path = directory + "/" + ATLAS_FILENAME;
+    unmapAtlas();
+    size_t bytes = grown * SLOT_BYTES;
+#ifdef _WIN32
+    if (atlasFile == INVALID_HANDLE_VALUE)
+        atlasFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (atlasFile != INVALID_HANDLE_VALUE)
+    {
+        // Mapping more than the file holds extends the file
+        atlasMapping = CreateFileMappingA(atlasFile, NULL, PAGE_READWRITE,
+                                          (DWORD)((unsigned long long)bytes >> 32), (DWORD)bytes, NULL);
+        if (atlasMapping != NULL)
+            atlas = (unsigned char *)MapViewOfFile(atlasMapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    }
+#else
+    if (atlasFile < 0)
+        atlasFile = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat status;
+    if (atlasFile >= 0 && fstat(atlasFile, &status) == 0 &&
+        ((size_t)status.st_size >= bytes || ftruncate(atlasFile, (off_t)bytes) == 0))
+    {
+        void * mapped = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, atlasFile, 0);
+        atlas = mapped == MAP_FAILED ? NULL : (unsigned char *)mapped;
+    }
+#endif
+
+    if (atlas == NULL)
+    {
+        // Read-only directory: keep the thumbnails for this session only
+        memoryAtlas.assign(bytes, 0);
+        atlas = &memoryAtlas[0];
+    }
+    atlasSlots = grown;
+    return true;
+}
+
+/**
+ * Unmaps the atlas from memory, leaving its file open
+ */
+void DirectoryIndex::unmapAtlas()
+{
+    if (atlas == NULL || !memoryAtlas.empty())
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(atlas);
+    CloseHandle(atlasMapping);
+    atlasMapping = NULL;
+#else
+    munmap(atlas, atlasSlots * SLOT_BYTES);
+#endif
+    atlas = NULL;
+}
+
+/**
+ * @param path - a file
+ * @param fileSize - set to the size of the file in bytes
+ * @param modified - set to the modification time of the file
+ * @return true if the file exists, false otherwise
+ */
+bool DirectoryIndex::statFile(const string path, long long &fileSize, long long &modified)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        return false;
+    fileSize = (long long)status.st_size;
+    modified = (long long)status.st_mtime;
+    return true;
+}
+
+/**
+ * Reads a timestamp as printed by dcraw ("Sat Jun  2 12:00:00 2012")
+ * @param timestamp - the timestamp
+ * @return the timestamp as yyyymmddhhmmss, or 0 if it cannot be read
+ */
+static long long timestampKey(const string timestamp)
+{
+    const char * MONTHS = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char weekday[4], month[4];
+    int day, hour, minute, second, year;
+    if (sscanf(timestamp.c_str(), "%3s %3s %d %d:%d:%d %d", weekday, month, &day, &hour, &minute, &second, &year) != 7)
+        return 0;
+    const char * found = strstr(MONTHS, month);
+    if (!found || (found - MONTHS) % 3 != 0)
+        return 0;
+    long long date = year * 10000LL + ((found - MONTHS) / 3 + 1) * 100 + day;
+    return date * 1000000 + hour * 10000 + minute * 100 + second;
+}
+
+/**
+ * Extracts the metadata and the thumbnail of one raw file with dcraw,
+ * running "dcraw -i -v" and then "dcraw -e -c". The thumbnail, JPEG or
+ * PPM, is scaled down to fit a slot of the atlas
+ * @param theExecutable - the path to dcraw
+ * @param path - the raw file
+ * @param metadata - set to the metadata of the file
+ * @param pixels - set to the 8 bit RGB thumbnail, empty if the file has none
+ * @return true if dcraw could identify the file, false otherwise
+ */
+bool DirectoryIndex::extract(const string theExecutable, const string path, RawMetadata &metadata,
+                             vector<unsigned char> &pixels)
+{
+    metadata = RawMetadata();
+    metadata.filename = fl_filename_name(path.c_str());
+    metadata.iso = metadata.shutter = metadata.aperture = metadata.focalLength = 0;
+    metadata.timestampKey = 0;
+    metadata.width = metadata.height = 0;
+    metadata.thumbnailWidth = metadata.thumbnailHeight = 0;
+    for (int c = 0; c < 4; c++)
+        metadata.multipliers[c] = 0;
+    pixels.clear();
+    if (!statFile(path, metadata.fileSize, metadata.modified))
+        return false;
+
+    vector<string> args;
+    args.push_back("-i");
+    args.push_back("-v");
+    args.push_back(path);
+    Process identify(theExecutable, args);
+    identify.setCaptureOutput(true);
+    if (!Supervisor().run(identify).succeeded())
+        return false;
+
+    istringstream lines(identify.getOutput());
+    string line;
+    while (getline(lines, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == string::npos)
+            continue;
+        string key = line.substr(0, colon);
+        string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+
+        double numerator = 0, denominator = 0;
+        if (key == "Camera")
+            metadata.camera = value;
+        else if (key == "ISO speed")
+            metadata.iso = atof(value.c_str());
+        else if (key == "Shutter")
+            metadata.shutter = sscanf(value.c_str(), "%lf/%lf", &numerator, &denominator) == 2 && denominator > 0
+                               ? numerator / denominator : atof(value.c_str());
+        else if (key == "Aperture")
+            metadata.aperture = atof(value.c_str() + (value.compare(0, 2, "f/") == 0 ? 2 : 0));
+        else if (key == "Focal length")
+            metadata.focalLength = atof(value.c_str());
+        else if (key == "Timestamp")
+        {
+            metadata.timestamp = value;
+            metadata.timestampKey = timestampKey(value);
+        }
+        else if (key == "Output size" || (key == "Image size" && metadata.width == 0))
+            sscanf(value.c_str(), "%d x %d", &metadata.width, &metadata.height);
+        else if (key == "Camera multipliers")
+            sscanf(value.c_str(), "%lf %lf %lf %lf", &metadata.multipliers[0], &metadata.multipliers[1],
+                   &metadata.multipliers[2], &metadata.multipliers[3]);
+    }
+
+    args[0] = "-e";
+    args[1] = "-c";
+    Process thumbnail(theExecutable, args);
+    thumbnail.setCaptureOutput(true);
+    if (!Supervisor().run(thumbnail).succeeded() || thumbnail.getOutput().size() < 4)
+        return true;
+
+    const string &output = thumbnail.getOutput();
+    if ((unsigned char)output[0] == 0xff && (unsigned char)output[1] == 0xd8)
+    {
+        Fl_JPEG_Image decoded(NULL, (const unsigned char *)output.data());
+        if (decoded.w() <= 0 || decoded.h() <= 0 || decoded.count() < 1 || (decoded.d() != 1 && decoded.d() < 3))
+            return true;
+        // Scale to fit keeping the aspect ratio, as copy() stretches to the size given
+        int width = decoded.w(), height = decoded.h();
+        if (width > THUMBNAIL_WIDTH || height > THUMBNAIL_HEIGHT)
+        {
+            if (width * THUMBNAIL_HEIGHT > height * THUMBNAIL_WIDTH)
+            {
+                height = max(height * THUMBNAIL_WIDTH / width, 1);
+                width = THUMBNAIL_WIDTH;
+            }
+            else
+            {
+                width = max(width * THUMBNAIL_HEIGHT / height, 1);
+                height = THUMBNAIL_HEIGHT;
+            }
+        }
+        Fl_Image * scaled = decoded.copy(width, height);
+        int depth = scaled->d();
+        int stride = scaled->ld() ? scaled->ld() : width * depth;
+        const unsigned char * data = (const unsigned char *)scaled->data()[0];
+        pixels.resize((size_t)width * height * 3);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                for (int c = 0; c < 3; c++)
+                    pixels[((size_t)y * width + x) * 3 + c] = data[y * stride + x * depth + (depth >= 3 ? c : 0)];
+        delete scaled;
+        metadata.thumbnailWidth = width;
+        metadata.thumbnailHeight = height;
+    }
+    else
+    {
+        // Some cameras store the thumbnail as a bitmap, which dcraw writes as PPM
+        PixelBuffer decoded, fitted;
+        if (!decoded.parsePPM(output) || decoded.getChannels() != 3)
+            return true;
+        ResizePyramid::fit(decoded, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, fitted, Orientation::NONE);
+        pixels.resize(fitted.getPixelCount() * 3);
+        PixelPipeline<unsigned char, 3, true>::packRow(fitted.getData(), &pixels[0], (int)fitted.getPixelCount());
+        metadata.thumbnailWidth = fitted.getWidth();
+        metadata.thumbnailHeight = fitted.getHeight();
+    }
+    return true;
+}
+
+/**
+ * @param directory - a directory
+ * @return the names of the raw files in the directory, sorted ignoring case
+ */
+const vector<string> DirectoryIndex::listRawFiles(const string directory)
+{
+    vector<string> files;
+    dirent ** entries;
+    int count = fl_filename_list(directory.c_str(), &entries, fl_casealphasort);
+    for (int i = 0; i < count; i++)
+        if (fl_filename_match(entries[i]->d_name, RawProbe::getFilePattern().c_str()))
+            files.push_back(entries[i]->d_name);
+    if (count > 0)
+        fl_filename_free_list(&entries, count);
+    return files;
+}
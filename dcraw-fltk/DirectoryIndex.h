@@ -0,0 +1,113 @@
+/**
+ * DirectoryIndex.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef DIRECTORYINDEX_H
+#define DIRECTORYINDEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstddef>
+
+using namespace std;
+
+/**
+ * What "dcraw -i -v" reports about one raw file, plus where its
+ * thumbnail is kept in the thumbnail atlas
+ */
+struct RawMetadata
+{
+    // Name within the directory, and the size and modification time it was indexed at
+    string filename;
+    long long fileSize;
+    long long modified;
+
+    string camera;
+    double iso;
+    double shutter;
+    double aperture;
+    double focalLength;
+    // As printed by dcraw, and as yyyymmddhhmmss for sorting (0 if unknown)
+    string timestamp;
+    long long timestampKey;
+    // Output size in pixels
+    int width;
+    int height;
+    // Camera white balance: red, green, blue, second green
+    double multipliers[4];
+
+    // Size of the thumbnail in its atlas slot, 0 x 0 if there is none
+    int thumbnailWidth;
+    int thumbnailHeight;
+};
+
+class DirectoryIndex
+{
+    public:
+        DirectoryIndex(const string directory);
+        ~DirectoryIndex();
+
+        bool load();
+        bool save();
+        const int update(const string theExecutable, const int threads);
+
+        void store(const RawMetadata &metadata, const vector<unsigned char> &pixels);
+        const int find(const string filename) const;
+        const bool isCurrent(const string filename) const;
+        const RawMetadata getEntry(const int entry) const;
+        const int getEntryCount() const;
+        bool getThumbnail(const int entry, vector<unsigned char> &pixels) const;
+        const vector<string> select(const vector<string> filenames, const int sortKey, const string filter) const;
+        const string getDirectory() const;
+        const bool isMapped() const;
+
+        static bool extract(const string theExecutable, const string path, RawMetadata &metadata,
+                            vector<unsigned char> &pixels);
+        static const vector<string> listRawFiles(const string directory);
+
+        // Largest thumbnail kept in the atlas
+        const static int THUMBNAIL_WIDTH = 112;
+        const static int THUMBNAIL_HEIGHT = 76;
+        const static int SLOT_BYTES = THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 3;
+
+        // Sort keys for select()
+        const static int SORT_NAME = 0;
+        const static int SORT_DATE = 1;
+        const static int SORT_ISO = 2;
+        const static int SORT_CAMERA = 3;
+
+        // Names of the files kept in the indexed directory
+        static const char * const INDEX_FILENAME;
+        static const char * const ATLAS_FILENAME;
+
+    private:
+        DirectoryIndex(DirectoryIndex &toCopy);
+
+        bool mapAtlas(const size_t slots);
+        void unmapAtlas();
+        static bool statFile(const string path, long long &fileSize, long long &modified);
+
+        string directory;
+        vector<RawMetadata> entries;
+        map<string, int> byName;
+        bool changed;
+
+        // The atlas holds one slot of SLOT_BYTES per entry, in entry order. It is
+        // memory-mapped from ATLAS_FILENAME, or kept in memory if that cannot be written
+        unsigned char * atlas;
+        size_t atlasSlots;
+        vector<unsigned char> memoryAtlas;
+#ifdef _WIN32
+        void * atlasFile;
+        void * atlasMapping;
+#else
+        int atlasFile;
+#endif
+
+        // Guards entries and the atlas while update() extracts in parallel
+        mutable mutex indexMutex;
+};
+#endif
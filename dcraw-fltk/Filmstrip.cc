@@ -0,0 +1,433 @@
+/**
+ * class Filmstrip
+ * Extends Fl_Group
+ * A horizontal strip of the raw files in a directory, showing the
+ * thumbnail embedded in each. The cells are drawn directly rather
+ * than being widgets, and only the cells on screen are drawn, so a
+ * directory of thousands of files costs no more than a few cells
+ *
+ * Thumbnails and metadata come from the DirectoryIndex of the
+ * directory when it has them, and are otherwise extracted by a
+ * ThumbnailLoader, on-screen cells first, then the cells a screen
+ * either side, and added to the index. Scrolling re-prioritises the
+ * loader's queue and drops the work for cells that have left that range
+ * The bar above the cells sorts the files and filters them by name
+ * or camera, using the metadata in the index
+ * Clicking a cell selects its file and calls the callback
+ *
+ * PUBLIC FEATURES:
+ *      Filmstrip(int x, int y, int w, int h, const char * label);
+ *      ~Filmstrip();
+ *      void setExecutable(string theExecutable);
+ *      void setDirectory(string directory, string selectedFile);
+ *      string getSelectedFile();
+ *      bool getSelectedMetadata(RawMetadata &metadata);
+ *      int getFileCount();
+ *      void draw();
+ *      int handle(int event);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "Filmstrip.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+using namespace std;
+
+/**
+ * Overloaded constructor
+ * Extends Fl_Group
+ * @param x - the horizontal position
+ * @param y - the vertical position
+ * @param w - the width
+ * @param h - the height
+ * @param label - the label for this Filmstrip
+ */
+Filmstrip::Filmstrip(const int x, const int y, const int w, const int h, const char * label) : Fl_Group(x,y,w,h,label)
+{
+    // Same order as the DirectoryIndex sort keys
+    sortChoice = new Fl_Choice(x + 40, y, 110, TOOLBAR_HEIGHT - 4, "Sort");
+    sortChoice->add("Name");
+    sortChoice->add("Date taken");
+    sortChoice->add("ISO");
+    sortChoice->add("Camera");
+    sortChoice->value(DirectoryIndex::SORT_NAME);
+    sortChoice->callback(viewChanged, this);
+
+    filterInput = new Fl_Input(x + 200, y, 200, TOOLBAR_HEIGHT - 4, "Filter");
+    filterInput->when(FL_WHEN_CHANGED);
+    filterInput->callback(viewChanged, this);
+
+    theScrollbar = new Fl_Scrollbar(x, y + h - SCROLLBAR_HEIGHT, w, SCROLLBAR_HEIGHT);
+    theScrollbar->type(FL_HORIZONTAL);
+    theScrollbar->linesize(CELL_WIDTH);
+    theScrollbar->callback(scrolled, this);
+    end();
+
+    theLoader = new ThumbnailLoader(thumbnailsReady, this);
+    theIndex = NULL;
+    loadedCount = 0;
+    selected = -1;
+    position = 0;
+    scrollTo(0);
+}
+
+/**
+ * Destructor
+ * Saves the thumbnails and metadata extracted into the index
+ */
+Filmstrip::~Filmstrip()
+{
+    delete theLoader;
+    if (theIndex)
+        theIndex->save();
+    delete theIndex;
+    for (size_t i = 0; i < thumbnails.size(); i++)
+        delete thumbnails[i];
+}
+
+/**
+ * @param theExecutable - the path to dcraw, which extracts the thumbnails
+ */
+void Filmstrip::setExecutable(const string theExecutable)
+{
+    theLoader->setExecutable(theExecutable);
+    requestVisible();
+}
+
+/**
+ * Shows the raw files of a directory, reading its index
+ * @param directory - the directory to list
+ * @param selectedFile - the path of the file to select and scroll to, or "" for none
+ */
+void Filmstrip::setDirectory(const string directory, const string selectedFile)
+{
+    if (directory != this->directory || !theIndex)
+    {
+        if (theIndex)
+            theIndex->save();
+        delete theIndex;
+        for (size_t i = 0; i < thumbnails.size(); i++)
+            delete thumbnails[i];
+        thumbnails.clear();
+        files.clear();
+
+        this->directory = directory;
+        theIndex = new DirectoryIndex(directory);
+        theIndex->load();
+        allFiles = DirectoryIndex::listRawFiles(directory);
+    }
+
+    showFiles(selectedFile.empty() ? "" : fl_filename_name(selectedFile.c_str()));
+}
+
+/**
+ * @return the path of the selected raw file, or "" if none is selected
+ */
+const string Filmstrip::getSelectedFile() const
+{
+    return selected < 0 ? "" : directory + "/" + files[selected];
+}
+
+/**
+ * @param metadata - set to the indexed metadata of the selected raw file
+ * @return true if the selected file is indexed and unchanged, false otherwise
+ */
+bool Filmstrip::getSelectedMetadata(RawMetadata &metadata) const
+{
+    if (selected < 0 || !theIndex->isCurrent(files[selected]))
+        return false;
+    metadata = theIndex->getEntry(theIndex->find(files[selected]));
+    return true;
+}
+
+/**
+ * @return the number of raw files shown
+ */
+const int Filmstrip::getFileCount() const
+{
+    return (int)files.size();
+}
+
+/**
+ * Draws the cells on screen, then the bar and the scrollbar
+ */
+void Filmstrip::draw()
+{
+    int top = y() + TOOLBAR_HEIGHT;
+    int cellHeight = h() - TOOLBAR_HEIGHT - SCROLLBAR_HEIGHT;
+    fl_color(FL_BACKGROUND_COLOR);
+    fl_rectf(x(), y(), w(), TOOLBAR_HEIGHT);
+
+    fl_push_clip(x(), top, w(), cellHeight);
+    fl_color(FL_DARK3);
+    fl_rectf(x(), top, w(), cellHeight);
+
+    fl_font(FL_HELVETICA, 10);
+    int imageHeight = DirectoryIndex::THUMBNAIL_HEIGHT;
+    for (int i = getFirstVisible(); i <= getLastVisible(); i++)
+    {
+        int cellX = x() + i * CELL_WIDTH - position;
+        if (i == selected)
+        {
+            fl_color(FL_SELECTION_COLOR);
+            fl_rectf(cellX + 1, top + 1, CELL_WIDTH - 2, cellHeight - 2);
+        }
+
+        if (thumbnails[i])
+            thumbnails[i]->draw(cellX + (CELL_WIDTH - thumbnails[i]->w()) / 2,
+                                top + 4 + (imageHeight - thumbnails[i]->h()) / 2);
+        else
+        {
+            fl_color(FL_GRAY);
+            fl_rect(cellX + 8, top + 4, CELL_WIDTH - 16, imageHeight);
+            fl_draw(loaded[i] ? "No preview" : "...", cellX + 8, top + 4, CELL_WIDTH - 16, imageHeight, FL_ALIGN_CENTER);
+        }
+
+        fl_color(FL_WHITE);
+        fl_draw(files[i].c_str(), cellX + 2, top + cellHeight - 20, CELL_WIDTH - 4, 16, FL_ALIGN_CENTER | FL_ALIGN_CLIP);
+    }
+    fl_pop_clip();
+
+    draw_children();
+}
+
+/**
+ * Selects a cell on a click, and scrolls on the mouse wheel
+ * @param event - the FLTK event
+ * @return 1 if the event was used, 0 otherwise
+ */
+int Filmstrip::handle(int event)
+{
+    bool inCells = Fl::event_y() >= y() + TOOLBAR_HEIGHT && Fl::event_y() < y() + h() - SCROLLBAR_HEIGHT;
+    switch (event)
+    {
+        case FL_PUSH:
+            if (inCells)
+            {
+                int cell = (Fl::event_x() - x() + position) / CELL_WIDTH;
+                if (cell >= 0 && cell < (int)files.size())
+                {
+                    selected = cell;
+                    redraw();
+                    do_callback();
+                }
+                return 1;
+            }
+            break;
+        case FL_MOUSEWHEEL:
+            scrollTo(position + Fl::event_dy() * CELL_WIDTH);
+            return 1;
+    }
+    return Fl_Group::handle(event);
+}
+
+/**
+ * static callback method for the scrollbar
+ * @param theObject - the scrollbar
+ * @param data - the Filmstrip
+ */
+void Filmstrip::scrolled(Fl_Widget * theObject, void * data)
+{
+    Filmstrip * access = static_cast<Filmstrip *>(data);
+    access->scrollTo(access->theScrollbar->value());
+}
+
+/**
+ * static callback method for the sort choice and the filter
+ * @param theObject - the calling widget
+ * @param data - the Filmstrip
+ */
+void Filmstrip::viewChanged(Fl_Widget * theObject, void * data)
+{
+    Filmstrip * access = static_cast<Filmstrip *>(data);
+    if (access->theIndex)
+        access->showFiles(access->selected < 0 ? "" : access->files[access->selected]);
+}
+
+/**
+ * static handler run on the GUI thread by Fl::awake
+ * Adds the thumbnails and metadata that have finished to the
+ * index, shows the thumbnails and redraws
+ * @param data - the Filmstrip
+ */
+void Filmstrip::thumbnailsReady(void * data)
+{
+    Filmstrip * access = static_cast<Filmstrip *>(data);
+    vector<LoadedThumbnail> finished = access->theLoader->takeFinished();
+    for (size_t i = 0; i < finished.size(); i++)
+    {
+        const LoadedThumbnail &result = finished[i];
+        if (result.identified)
+            access->theIndex->store(result.metadata, result.pixels);
+        if (result.index < (int)access->loaded.size() && !access->loaded[result.index])
+            access->setThumbnail(result.index, result.pixels,
+                                 result.metadata.thumbnailWidth, result.metadata.thumbnailHeight);
+    }
+    access->freeThumbnails();
+    access->redraw();
+}
+
+/**
+ * Lists the files that pass the filter, in the chosen order
+ * Thumbnails already shown are kept; the rest are loaded as they come into view
+ * @param selectedName - the name of the file to select and scroll to, or "" for none
+ */
+void Filmstrip::showFiles(const string selectedName)
+{
+    map<string, Fl_Image *> shown;
+    for (size_t i = 0; i < files.size(); i++)
+        if (loaded[i])
+            shown[files[i]] = thumbnails[i];
+
+    files = theIndex->select(allFiles, sortChoice->value(), filterInput->value());
+    thumbnails.assign(files.size(), NULL);
+    loaded.assign(files.size(), 0);
+    loadedCount = 0;
+    selected = -1;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        map<string, Fl_Image *>::iterator found = shown.find(files[i]);
+        if (found != shown.end())
+        {
+            thumbnails[i] = found->second;
+            loaded[i] = 1;
+            loadedCount++;
+            shown.erase(found);
+        }
+        if (files[i] == selectedName)
+            selected = (int)i;
+    }
+    for (map<string, Fl_Image *>::iterator i = shown.begin(); i != shown.end(); ++i)
+        delete i->second;
+
+    vector<string> paths;
+    for (size_t i = 0; i < files.size(); i++)
+        paths.push_back(directory + "/" + files[i]);
+    theLoader->setFiles(paths);
+
+    // Centre the selected cell
+    scrollTo(selected < 0 ? 0 : selected * CELL_WIDTH - (w() - CELL_WIDTH) / 2);
+}
+
+/**
+ * Scrolls the cells, and asks for the thumbnails now wanted
+ * @param position - the pixels to scroll from the first cell
+ */
+void Filmstrip::scrollTo(const int position)
+{
+    int total = (int)files.size() * CELL_WIDTH;
+    this->position = max(min(position, total - w()), 0);
+    theScrollbar->value(this->position, w(), 0, max(total, w()));
+    requestVisible();
+    redraw();
+}
+
+/**
+ * Shows the thumbnails the index has for the cells on screen and a
+ * screen either side, and asks the loader for the rest: on-screen
+ * cells first, then outwards. Anything else still queued is cancelled
+ */
+void Filmstrip::requestVisible()
+{
+    int first = getFirstVisible();
+    int last = getLastVisible();
+    int margin = last - first + 1;
+
+    vector<int> wanted;
+    for (int i = first; i <= last; i++)
+        if (!loaded[i] && !loadFromIndex(i))
+            wanted.push_back(i);
+    for (int distance = 1; distance <= margin; distance++)
+    {
+        if (last + distance < (int)files.size() && !loaded[last + distance] && !loadFromIndex(last + distance))
+            wanted.push_back(last + distance);
+        if (first - distance >= 0 && !loaded[first - distance] && !loadFromIndex(first - distance))
+            wanted.push_back(first - distance);
+    }
+    theLoader->setWanted(wanted);
+}
+
+/**
+ * Shows the thumbnail of a cell from the index
+ * @param cell - the cell
+ * @return true if the index has the file and it has not changed since, false otherwise
+ */
+bool Filmstrip::loadFromIndex(const int cell)
+{
+    if (!theIndex || !theIndex->isCurrent(files[cell]))
+        return false;
+
+    int entry = theIndex->find(files[cell]);
+    RawMetadata metadata = theIndex->getEntry(entry);
+    vector<unsigned char> pixels;
+    theIndex->getThumbnail(entry, pixels);
+    setThumbnail(cell, pixels, metadata.thumbnailWidth, metadata.thumbnailHeight);
+    return true;
+}
+
+/**
+ * Shows a thumbnail in a cell
+ * @param cell - the cell
+ * @param pixels - the 8 bit RGB thumbnail, empty if the file has none
+ * @param width - the width of the thumbnail
+ * @param height - the height of the thumbnail
+ */
+void Filmstrip::setThumbnail(const int cell, const vector<unsigned char> &pixels, const int width, const int height)
+{
+    if (!pixels.empty() && width > 0 && height > 0)
+    {
+        unsigned char * copy = new unsigned char[pixels.size()];
+        memcpy(copy, &pixels[0], pixels.size());
+        Fl_RGB_Image * image = new Fl_RGB_Image(copy, width, height, 3);
+        image->alloc_array = 1;
+        thumbnails[cell] = image;
+    }
+    loaded[cell] = 1;
+    loadedCount++;
+}
+
+/**
+ * Frees the thumbnails furthest from the screen once more than
+ * MAX_THUMBNAILS are held; they are loaded again if scrolled back to
+ */
+void Filmstrip::freeThumbnails()
+{
+    if (loadedCount <= MAX_THUMBNAILS)
+        return;
+
+    int centre = (getFirstVisible() + getLastVisible()) / 2;
+    vector< pair<int, int> > byDistance;
+    for (size_t i = 0; i < loaded.size(); i++)
+        if (loaded[i])
+            byDistance.push_back(make_pair(abs((int)i - centre), (int)i));
+    sort(byDistance.begin(), byDistance.end());
+
+    for (size_t i = MAX_THUMBNAILS / 2; i < byDistance.size(); i++)
+    {
+        int index = byDistance[i].second;
+        delete thumbnails[index];
+        thumbnails[index] = NULL;
+        loaded[index] = 0;
+        loadedCount--;
+    }
+}
+
+/**
+ * @return the first cell on screen
+ */
+const int Filmstrip::getFirstVisible() const
+{
+    return position / CELL_WIDTH;
+}
+
+/**
+ * @return the last cell on screen, below the first if there are no files
+ */
+const int Filmstrip::getLastVisible() const
+{
+    return min((position + w() - 1) / CELL_WIDTH, (int)files.size() - 1);
+}
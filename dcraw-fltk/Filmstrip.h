@@ -0,0 +1,80 @@
+/**
+ * Filmstrip.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef FILMSTRIP_H
+#define FILMSTRIP_H
+
+#include <Fl/Fl.H>
+#include <Fl/Fl_Group.H>
+#include <Fl/Fl_Scrollbar.H>
+#include <Fl/Fl_Choice.H>
+#include <Fl/Fl_Input.H>
+#include <Fl/Fl_Image.H>
+#include <Fl/fl_draw.H>
+#include <Fl/filename.H>
+#include "ThumbnailLoader.h"
+#include "DirectoryIndex.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Filmstrip : public Fl_Group
+{
+    public:
+        Filmstrip(const int x, const int y, const int w, const int h, const char * label);
+        ~Filmstrip();
+
+        void setExecutable(const string theExecutable);
+        void setDirectory(const string directory, const string selectedFile);
+        const string getSelectedFile() const;
+        bool getSelectedMetadata(RawMetadata &metadata) const;
+        const int getFileCount() const;
+
+        void draw();
+        int handle(int event);
+
+        // Width of a cell, and the heights of the sort and filter bar above
+        // the cells and of the scrollbar below them
+        const static int CELL_WIDTH = 128;
+        const static int TOOLBAR_HEIGHT = 24;
+        const static int SCROLLBAR_HEIGHT = 16;
+        // Thumbnails kept before the ones furthest from view are freed
+        const static int MAX_THUMBNAILS = 512;
+
+    private:
+        static void scrolled(Fl_Widget * theObject, void * data);
+        static void viewChanged(Fl_Widget * theObject, void * data);
+        static void thumbnailsReady(void * data);
+
+        void showFiles(const string selectedName);
+        void scrollTo(const int position);
+        void requestVisible();
+        bool loadFromIndex(const int cell);
+        void setThumbnail(const int cell, const vector<unsigned char> &pixels, const int width, const int height);
+        void freeThumbnails();
+        const int getFirstVisible() const;
+        const int getLastVisible() const;
+
+        Fl_Choice * sortChoice;
+        Fl_Input * filterInput;
+        Fl_Scrollbar * theScrollbar;
+        ThumbnailLoader * theLoader;
+        DirectoryIndex * theIndex;
+
+        string directory;
+        // Every raw file in the directory, and the ones shown in the order shown
+        vector<string> allFiles;
+        vector<string> files;
+        // Thumbnail of each cell, NULL until loaded or if the file has none
+        vector<Fl_Image *> thumbnails;
+        // Whether each cell has had its thumbnail loaded, successfully or not
+        vector<char> loaded;
+        int loadedCount;
+        int selected;
+        // Pixels scrolled from the first cell
+        int position;
+};
+#endif
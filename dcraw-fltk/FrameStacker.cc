@@ -0,0 +1,574 @@
+/**
+ * class FrameStacker
+ * Stacks several raw frames of the same scene, such as a bracketed
+ * or astronomical sequence, into one linear image by taking the mean,
+ * the sigma-clipped mean or the median of each sample across the frames
+ *
+ * Every frame is decoded by its own dcraw, up to getMaxJobs() at once,
+ * straight to a temporary file in the spill directory (the system's
+ * temporary directory by default), so no frame is ever held
+ * whole in memory. The files are then read back in bands of rows:
+ * each thread reads the same band of every frame and reduces it into
+ * the stacked image. The band height is chosen so that the bands of
+ * all threads fit within the memory budget, so memory grows with the
+ * number of frames and the width of a band, not the size of an image
+ * A median needs every value of a sample at once, which is why the
+ * frames are spilled rather than summed as they are decoded
+ *
+ * The frames are decoded with the decode arguments of the Image
+ * settings, by the backend a DecoderBackends profile routes the first
+ * frame's camera to, as a sequence comes from one camera. A dark frame in the settings is unpacked once, and dcraw
+ * subtracts it, and repairs the pixels of the bad pixel map, in the raw
+ * data of every frame (see CalibrationFrames)
+ *
+ * PUBLIC FEATURES:
+ *       FrameStacker();
+ *       FrameStacker(string theExecutable, int method);
+ *       ~FrameStacker();
+ *       void setExecutable(string theExecutable);
+ *       void setMethod(int method);
+ *       void setClipSigma(double clipSigma);
+ *       void setMaxJobs(int maxJobs);
+ *       void setMemoryBudget(size_t memoryBudget);
+ *       void setSpillDirectory(string spillDirectory);
+ *       void setImage(Image * settings);
+ *       void addFrame(string filename);
+ *       bool run(PixelBuffer &stacked, string &error);
+ *       string getExecutable();
+ *       int getMethod();
+ *       double getClipSigma();
+ *       int getMaxJobs();
+ *       size_t getMemoryBudget();
+ *       string getSpillDirectory();
+ *       int getFrameCount();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "FrameStacker.h"
+#include "Converter.h"
+#include "CalibrationFrames.h"
+#include "DecoderBackends.h"
+#include "Process.h"
+#include "Supervisor.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Rejection threshold of the sigma-clipped mean, in standard deviations
+const static double DEFAULT_CLIP_SIGMA = 3.0;
+
+/**
+ * Reads from a position in a file without moving its file position, so
+ * that threads can read the same file at once. The position may be past
+ * 2 GB where a long is 32 bits
+ * @param file - the file
+ * @param buffer - filled with what is read
+ * @param bytes - the number of bytes to read
+ * @param offset - the position from the start of the file
+ * @return true if every byte was read, false on an error or the end of the file
+ */
+static bool readAt(FILE * file, void * buffer, const size_t bytes, const long long offset)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+#ifdef _WIN32
+        OVERLAPPED position;
+        memset(&position, 0, sizeof(position));
+        position.Offset = (DWORD)(offset + done);
+        position.OffsetHigh = (DWORD)((unsigned long long)(offset + done) >> 32);
+        DWORD count = 0;
+        DWORD wanted = (DWORD)min(bytes - done, (size_t)0x40000000);
+        if (!ReadFile((HANDLE)_get_osfhandle(_fileno(file)), (char *)buffer + done, wanted, &count, &position) || count == 0)
+            return false;
+#else
+        ssize_t count = pread(fileno(file), (char *)buffer + done, bytes - done, (off_t)(offset + done));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+#endif
+        done += (size_t)count;
+    }
+    return true;
+}
+
+/**
+ * @param file - the file
+ * @return the size of the file, which may be past 2 GB where a long is 32 bits, -1 if it is not known
+ */
+static long long sizeOfFile(FILE * file)
+{
+#ifdef _WIN32
+    struct _stat64 status;
+    if (_fstat64(_fileno(file), &status) != 0)
+        return -1;
+#else
+    struct stat status;
+    if (fstat(fileno(file), &status) != 0)
+        return -1;
+#endif
+    return (long long)status.st_size;
+}
+
+/**
+ * @param file - the file
+ * @return the position in the file, which may be past 2 GB where a long is 32 bits
+ */
+static long long tellFile(FILE * file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return (long long)ftello(file);
+#endif
+}
+
+/**
+ * Default constructor
+ * Stacks by the median, with one job per core
+ */
+FrameStacker::FrameStacker()
+{
+    theExecutable = "";
+    method = MEDIAN;
+    clipSigma = DEFAULT_CLIP_SIGMA;
+    maxJobs = (int)thread::hardware_concurrency();
+    if (maxJobs < 1)
+        maxJobs = 1;
+    memoryBudget = DEFAULT_MEMORY_BUDGET;
+    spillDirectory = "";
+    settings = NULL;
+}
+
+/**
+ * Constructor
+ * @param theExecutable - the name of the dcraw executable to run
+ * @param method - the stacking method (see FrameStacker.h for method constants)
+ */
+FrameStacker::FrameStacker(const string theExecutable, const int method)
+{
+    this->theExecutable = theExecutable;
+    this->method = method;
+    clipSigma = DEFAULT_CLIP_SIGMA;
+    maxJobs = (int)thread::hardware_concurrency();
+    if (maxJobs < 1)
+        maxJobs = 1;
+    memoryBudget = DEFAULT_MEMORY_BUDGET;
+    spillDirectory = "";
+    settings = NULL;
+}
+
+/**
+ * Destructor
+ * Removes any temporary files left by run()
+ */
+FrameStacker::~FrameStacker()
+{
+    removeSpillFiles();
+}
+
+/**
+ * @param theExecutable - the name of the dcraw executable to run
+ */
+void FrameStacker::setExecutable(const string theExecutable)
+{
+    this->theExecutable = theExecutable;
+}
+
+/**
+ * @param method - the stacking method (see FrameStacker.h for method constants)
+ */
+void FrameStacker::setMethod(const int method)
+{
+    this->method = method;
+}
+
+/**
+ * @param clipSigma - how many standard deviations from the mean a value
+ *                    may be before the sigma-clipped mean rejects it
+ */
+void FrameStacker::setClipSigma(const double clipSigma)
+{
+    this->clipSigma = clipSigma;
+}
+
+/**
+ * @param maxJobs - the most frames decoded, and bands reduced, at once
+ */
+void FrameStacker::setMaxJobs(const int maxJobs)
+{
+    this->maxJobs = maxJobs < 1 ? 1 : maxJobs;
+}
+
+/**
+ * @param memoryBudget - the memory in bytes that the bands of every frame may use at once
+ */
+void FrameStacker::setMemoryBudget(const size_t memoryBudget)
+{
+    this->memoryBudget = memoryBudget;
+}
+
+/**
+ * @param spillDirectory - where the decoded frames are spilled, "" for the
+ *                         system's temporary directory
+ */
+void FrameStacker::setSpillDirectory(const string spillDirectory)
+{
+    this->spillDirectory = spillDirectory;
+}
+
+/**
+ * @param settings - the Image whose decode and calibration settings every frame
+ *                   is stacked with, its source filename is not used
+ */
+void FrameStacker::setImage(Image * settings)
+{
+    this->settings = settings;
+}
+
+/**
+ * Adds a frame to the stack
+ * @param filename - the raw file of the frame
+ */
+void FrameStacker::addFrame(const string filename)
+{
+    Frame theFrame;
+    theFrame.source = filename;
+    theFrame.file = NULL;
+    theFrame.dataOffset = 0;
+    theFrame.width = 0;
+    theFrame.height = 0;
+    frames.push_back(theFrame);
+}
+
+/**
+ * Decodes and stacks every frame
+ * @param stacked - set to the stacked linear 16 bit RGB image
+ * @param error - set to the reason if the frames could not be stacked
+ * @return true if the frames were stacked, false otherwise
+ */
+bool FrameStacker::run(PixelBuffer &stacked, string &error)
+{
+    if (frames.empty() || !settings)
+    {
+        error = "there are no frames to stack";
+        return false;
+    }
+
+    if (!decodeFrames(error))
+    {
+        removeSpillFiles();
+        return false;
+    }
+
+    int width = frames[0].width;
+    int height = frames[0].height;
+    stacked.resize(width, height, 3);
+
+    // Each thread holds one band of every frame, plus the values of one sample
+    int threads = maxJobs;
+    size_t rowBytes = (size_t)width * 3 * sizeof(unsigned short);
+    size_t bandRows = memoryBudget / ((size_t)threads * frames.size() * rowBytes);
+    if (bandRows < 1)
+        bandRows = 1;
+    if (bandRows > (size_t)height)
+        bandRows = (size_t)height;
+    int bands = (int)((height + bandRows - 1) / bandRows);
+    if (threads > bands)
+        threads = bands;
+
+    atomic<int> nextBand(0);
+    atomic<bool> readAll(true);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&]()
+        {
+            vector<unsigned short> samples;
+            vector<float> values(frames.size());
+            for (int band = nextBand++; band < bands && readAll; band = nextBand++)
+            {
+                int firstRow = band * (int)bandRows;
+                if (!reduceBand(stacked, firstRow, min((int)bandRows, height - firstRow), samples, values))
+                    readAll = false;
+            }
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    removeSpillFiles();
+    if (!readAll)
+    {
+        error = "cannot read back the decoded frames";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Decodes every frame to a temporary PPM file in the spill directory,
+ * running up to getMaxJobs() dcraw processes at once, and opens the files
+ * @param error - set to the reason if a frame could not be decoded
+ * @return true if every frame was decoded and they are all the same size, false otherwise
+ */
+bool FrameStacker::decodeFrames(string &error)
+{
+    for (size_t f = 0; f < frames.size(); f++)
+        frames[f].spillFile = Process::getTemporaryFilename(".stack.ppm", spillDirectory);
+
+    string backend = frames.empty() ? theExecutable : DecoderBackends::getShared().route(theExecutable, frames[0].source);
+
+    // Unpacked once, and given to the dcraw of every frame
+    shared_ptr<const CalibrationFrames> calibration;
+    if (settings->hasCalibration())
+    {
+        calibration = CalibrationFrames::get(backend, settings->getDarkFrame(), settings->getBadPixelMap(), error);
+        if (!calibration)
+            return false;
+    }
+
+    atomic<size_t> nextFrame(0);
+    vector<char> decoded(frames.size(), 0);
+    vector<thread> workers;
+    int threads = min(maxJobs, (int)frames.size());
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&]()
+        {
+            for (size_t f = nextFrame++; f < frames.size(); f = nextFrame++)
+            {
+                Image theFrame(*settings);
+                theFrame.setSourceFilename(frames[f].source);
+                Converter theConverter(backend, "");
+                theConverter.setImage(&theFrame);
+
+                vector<string> args = theConverter.buildDecodeArguments(false);
+                if (calibration)
+                    calibration->addArguments(args);
+                Process dcraw(backend, args);
+                dcraw.setOutputFile(frames[f].spillFile);
+                decoded[f] = Supervisor().run(dcraw).succeeded() && openFrame(frames[f]);
+            }
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        if (!decoded[f])
+        {
+            error = "cannot decode " + frames[f].source;
+            return false;
+        }
+        if (frames[f].width != frames[0].width || frames[f].height != frames[0].height)
+        {
+            ostringstream message(ostringstream::out);
+            message << frames[f].source << " is " << frames[f].width << " x " << frames[f].height
+                    << " but " << frames[0].source << " is " << frames[0].width << " x " << frames[0].height;
+            error = message.str();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Opens the spill file of a decoded frame and reads its PPM header
+ * @param theFrame - the frame, whose file, offset and size are set
+ * @return true if the file holds the whole of a 16 bit RGB PPM, false otherwise
+ */
+bool FrameStacker::openFrame(Frame &theFrame)
+{
+    theFrame.file = fopen(theFrame.spillFile.c_str(), "rb");
+    if (!theFrame.file)
+        return false;
+
+    int maximum = 0;
+    if (fscanf(theFrame.file, "P6 %d %d %d", &theFrame.width, &theFrame.height, &maximum) != 3
+        || maximum != 65535 || theFrame.width < 1 || theFrame.height < 1)
+        return false;
+
+    // A single whitespace character separates the header from the samples
+    fgetc(theFrame.file);
+    theFrame.dataOffset = tellFile(theFrame.file);
+
+    // A frame cut short would otherwise stack as black
+    long long samples = (long long)theFrame.width * theFrame.height * 3;
+    return theFrame.dataOffset > 0
+        && sizeOfFile(theFrame.file) >= theFrame.dataOffset + samples * (long long)sizeof(unsigned short);
+}
+
+/**
+ * Reads one band of rows from every frame and stacks it
+ * Threads read the frames at once, each at its own position
+ * @param stacked - the stacked image the band is written into
+ * @param firstRow - the first row of the band
+ * @param rows - the number of rows in the band
+ * @param samples - work space for the band of every frame
+ * @param values - work space for the values of one sample, one per frame
+ * @return true if the band of every frame was read, false otherwise
+ */
+bool FrameStacker::reduceBand(PixelBuffer &stacked, const int firstRow, const int rows,
+                              vector<unsigned short> &samples, vector<float> &values) const
+{
+    size_t bandSamples = (size_t)rows * stacked.getWidth() * 3;
+    samples.resize(bandSamples * frames.size());
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        unsigned short * band = &samples[f * bandSamples];
+        long long offset = frames[f].dataOffset + (long long)firstRow * stacked.getWidth() * 3 * sizeof(unsigned short);
+        if (!readAt(frames[f].file, band, bandSamples * sizeof(unsigned short), offset))
+            return false;
+
+        // PPM samples are big-endian
+        const unsigned char * bytes = (const unsigned char *)band;
+        for (size_t i = 0; i < bandSamples; i++)
+            band[i] = (unsigned short)((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+    }
+
+    unsigned short * out = stacked.getRow(firstRow);
+    int count = (int)frames.size();
+    for (size_t i = 0; i < bandSamples; i++)
+    {
+        for (int f = 0; f < count; f++)
+            values[f] = samples[f * bandSamples + i];
+        out[i] = reduce(&values[0], count);
+    }
+    return true;
+}
+
+/**
+ * Stacks the values of one sample by the chosen method
+ * @param values - the value of the sample in each frame, reordered by the median
+ * @param count - the number of frames
+ * @return the stacked value
+ */
+const unsigned short FrameStacker::reduce(float * values, const int count) const
+{
+    double result = 0;
+    if (method == MEDIAN)
+    {
+        int middle = count / 2;
+        nth_element(values, values + middle, values + count);
+        result = values[middle];
+        if (count % 2 == 0)
+            result = (result + *max_element(values, values + middle)) / 2;
+    }
+    else
+    {
+        int kept = count;
+        for (int pass = 0; ; pass++)
+        {
+            double sum = 0, squares = 0;
+            for (int i = 0; i < kept; i++)
+            {
+                sum += values[i];
+                squares += (double)values[i] * values[i];
+            }
+            result = sum / kept;
+            if (method != SIGMA_CLIPPED || pass == CLIP_ITERATIONS || kept < 3)
+                break;
+
+            // Moves the values within range to the front, dropping the rest
+            double limit = clipSigma * sqrt(max(squares / kept - result * result, 0.0));
+            int within = 0;
+            for (int i = 0; i < kept; i++)
+                if (fabs(values[i] - result) <= limit)
+                    values[within++] = values[i];
+            if (within == kept || within == 0)
+                break;
+            kept = within;
+        }
+    }
+    return (unsigned short)min(result + 0.5, 65535.0);
+}
+
+/**
+ * Closes and deletes the temporary files of the decoded frames
+ */
+void FrameStacker::removeSpillFiles()
+{
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        if (frames[f].file)
+            fclose(frames[f].file);
+        frames[f].file = NULL;
+        if (!frames[f].spillFile.empty())
+            remove(frames[f].spillFile.c_str());
+        frames[f].spillFile = "";
+    }
+}
+
+/**
+ * @return the name of the dcraw executable to run
+ */
+const string FrameStacker::getExecutable() const
+{
+    return theExecutable;
+}
+
+/**
+ * @return the stacking method (see FrameStacker.h for method constants)
+ */
+const int FrameStacker::getMethod() const
+{
+    return method;
+}
+
+/**
+ * @return how many standard deviations from the mean the sigma-clipped mean keeps
+ */
+const double FrameStacker::getClipSigma() const
+{
+    return clipSigma;
+}
+
+/**
+ * @return the most frames decoded, and bands reduced, at once
+ */
+const int FrameStacker::getMaxJobs() const
+{
+    return maxJobs;
+}
+
+/**
+ * @return the memory in bytes that the bands of every frame may use at once
+ */
+const size_t FrameStacker::getMemoryBudget() const
+{
+    return memoryBudget;
+}
+
+/**
+ * @return where the decoded frames are spilled, "" for the system's temporary directory
+ */
+const string FrameStacker::getSpillDirectory() const
+{
+    return spillDirectory;
+}
+
+/**
+ * @return the number of frames added
+ */
+const int FrameStacker::getFrameCount() const
+{
+    return (int)frames.size();
+}
@@ -0,0 +1,87 @@
+/**
+ * FrameStacker.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef FRAMESTACKER_H
+#define FRAMESTACKER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include "Image.h"
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class FrameStacker
+{
+    public:
+        FrameStacker();
+        FrameStacker(const string theExecutable, const int method);
+        ~FrameStacker();
+
+        void setExecutable(const string theExecutable);
+        void setMethod(const int method);
+        void setClipSigma(const double clipSigma);
+        void setMaxJobs(const int maxJobs);
+        void setMemoryBudget(const size_t memoryBudget);
+        void setSpillDirectory(const string spillDirectory);
+        void setImage(Image * settings);
+        void addFrame(const string filename);
+        bool run(PixelBuffer &stacked, string &error);
+
+        const string getExecutable() const;
+        const int getMethod() const;
+        const double getClipSigma() const;
+        const int getMaxJobs() const;
+        const size_t getMemoryBudget() const;
+        const string getSpillDirectory() const;
+        const int getFrameCount() const;
+
+        // Stacking methods
+        const static int MEAN = 0;
+        const static int SIGMA_CLIPPED = 1;
+        const static int MEDIAN = 2;
+
+        // Most rejection passes of the sigma-clipped mean
+        const static int CLIP_ITERATIONS = 5;
+        // Memory the bands of every frame may use at once, by default
+        const static size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+    private:
+        FrameStacker(FrameStacker &toCopy);
+
+        /**
+         * One frame decoded by dcraw to a temporary PPM file
+         */
+        struct Frame
+        {
+            string source;
+            string spillFile;
+            FILE * file;
+            // Where the samples start in the spill file
+            long long dataOffset;
+            int width;
+            int height;
+        };
+
+        bool decodeFrames(string &error);
+        bool openFrame(Frame &theFrame);
+        bool reduceBand(PixelBuffer &stacked, const int firstRow, const int rows, vector<unsigned short> &samples,
+                        vector<float> &values) const;
+        const unsigned short reduce(float * values, const int count) const;
+        void removeSpillFiles();
+
+        string theExecutable;
+        int method;
+        double clipSigma;
+        int maxJobs;
+        size_t memoryBudget;
+        // Where the frames are spilled, "" for the system's temporary directory
+        string spillDirectory;
+        Image * settings;
+        vector<Frame> frames;
+};
+#endif
@@ -0,0 +1,181 @@
+/**
+ * class Histogram
+ * Counts the display levels of a toned preview: a histogram of each
+ * of red, green and blue, and of Rec. 709 luminance, with the share
+ * of each channel clipped to black or to white
+ *
+ * The rows are split between threads, each counting into its own
+ * tables, which are then added together. Each row is first reduced
+ * to 8 bit levels with SSE2, 16 samples at a time, and the levels
+ * are then counted. A preview sized image is counted in under a
+ * millisecond, so the histogram can follow the sliders as they move
+ *
+ * PUBLIC FEATURES:
+ *       Histogram();
+ *       ~Histogram();
+ *       void compute(PixelBuffer &toned);
+ *       unsigned int getCount(int channel, int bin);
+ *       unsigned int getPeak();
+ *       size_t getPixelCount();
+ *       double getShadowClipped(int channel);
+ *       double getHighlightClipped(int channel);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "Histogram.h"
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// SSE2 is part of every x86-64 processor, so needs no runtime check
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HISTOGRAM_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * Default constructor
+ * The histogram is empty until compute() is called
+ */
+Histogram::Histogram()
+{
+    memset(counts, 0, sizeof(counts));
+    pixelCount = 0;
+}
+
+/**
+ * Destructor
+ */
+Histogram::~Histogram()
+{}
+
+/**
+ * Counts a toned image
+ * @param toned - the 16 bit RGB image as it is displayed
+ */
+void Histogram::compute(const PixelBuffer &toned)
+{
+    memset(counts, 0, sizeof(counts));
+    pixelCount = 0;
+    if (toned.getChannels() != 3 || toned.getHeight() == 0)
+        return;
+
+    int height = toned.getHeight();
+    int threads = (int)min((size_t)max((int)thread::hardware_concurrency(), 1),
+                           max(toned.getPixelCount() / PIXELS_PER_THREAD, (size_t)1));
+    int rowsPerThread = (height + threads - 1) / threads;
+
+    vector< vector<unsigned int> > partial(threads, vector<unsigned int>(CHANNELS * BINS));
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(thread(countRows, ref(toned), t * rowsPerThread, min((t + 1) * rowsPerThread, height),
+                                 (unsigned int (*)[BINS])&partial[t][0]));
+    countRows(toned, 0, min(rowsPerThread, height), counts);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    for (int t = 1; t < threads; t++)
+        for (int c = 0; c < CHANNELS; c++)
+            for (int bin = 0; bin < BINS; bin++)
+                counts[c][bin] += partial[t][c * BINS + bin];
+    pixelCount = toned.getPixelCount();
+}
+
+/**
+ * Counts a band of rows
+ * @param toned - the 16 bit RGB image
+ * @param firstRow - the first row to count
+ * @param lastRow - one past the last row to count
+ * @param counts - the tables to count into, cleared first
+ */
+void Histogram::countRows(const PixelBuffer &toned, const int firstRow, const int lastRow,
+                          unsigned int counts[CHANNELS][BINS])
+{
+    memset(counts, 0, sizeof(unsigned int) * CHANNELS * BINS);
+    int width = toned.getWidth();
+    int rowSamples = width * 3;
+    vector<unsigned char> levels(rowSamples);
+    unsigned char * level = &levels[0];
+
+    for (int y = firstRow; y < lastRow; y++)
+    {
+        const unsigned short * row = toned.getData() + (size_t)y * rowSamples;
+
+        // The high byte of every sample, 16 at a time where SSE2 is available
+        int i = 0;
+#ifdef HISTOGRAM_SSE2
+        for (; i + 16 <= rowSamples; i += 16)
+        {
+            __m128i low = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(row + i)), 8);
+            __m128i high = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(row + i + 8)), 8);
+            _mm_storeu_si128((__m128i *)(level + i), _mm_packus_epi16(low, high));
+        }
+#endif
+        for (; i < rowSamples; i++)
+            level[i] = (unsigned char)(row[i] >> 8);
+
+        // Rec. 709 weights in 256ths, which add up to 256
+        for (int x = 0; x < rowSamples; x += 3)
+        {
+            unsigned int red = level[x], green = level[x + 1], blue = level[x + 2];
+            counts[0][red]++;
+            counts[1][green]++;
+            counts[2][blue]++;
+            counts[LUMINANCE][(red * 54 + green * 183 + blue * 19) >> 8]++;
+        }
+    }
+}
+
+/**
+ * @param channel - 0 to 2 for red, green and blue, or LUMINANCE
+ * @param bin - the display level, 0 to BINS - 1
+ * @return the number of pixels at that level
+ */
+const unsigned int Histogram::getCount(const int channel, const int bin) const
+{
+    return counts[channel][bin];
+}
+
+/**
+ * The highest count of any channel, leaving out the clipped levels at
+ * either end so that a clipped image does not flatten the rest
+ * @return the highest count
+ */
+const unsigned int Histogram::getPeak() const
+{
+    unsigned int peak = 0;
+    for (int c = 0; c < CHANNELS; c++)
+        for (int bin = 1; bin < BINS - 1; bin++)
+            peak = max(peak, counts[c][bin]);
+    return peak;
+}
+
+/**
+ * @return the number of pixels counted
+ */
+const size_t Histogram::getPixelCount() const
+{
+    return pixelCount;
+}
+
+/**
+ * @param channel - 0 to 2 for red, green and blue, or LUMINANCE
+ * @return the share of pixels at the lowest level, from 0 to 1
+ */
+const double Histogram::getShadowClipped(const int channel) const
+{
+    return pixelCount == 0 ? 0 : (double)counts[channel][0] / pixelCount;
+}
+
+/**
+ * @param channel - 0 to 2 for red, green and blue, or LUMINANCE
+ * @return the share of pixels at the highest level, from 0 to 1
+ */
+const double Histogram::getHighlightClipped(const int channel) const
+{
+    return pixelCount == 0 ? 0 : (double)counts[channel][BINS - 1] / pixelCount;
+}
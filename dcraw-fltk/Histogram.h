@@ -0,0 +1,42 @@
+/**
+ * Histogram.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class Histogram
+{
+    public:
+        Histogram();
+        ~Histogram();
+
+        void compute(const PixelBuffer &toned);
+
+        const unsigned int getCount(const int channel, const int bin) const;
+        const unsigned int getPeak() const;
+        const size_t getPixelCount() const;
+        const double getShadowClipped(const int channel) const;
+        const double getHighlightClipped(const int channel) const;
+
+        // Display levels counted, and the channels counted: red, green, blue and luminance
+        const static int BINS = 256;
+        const static int CHANNELS = 4;
+        const static int LUMINANCE = 3;
+
+        // Pixels each thread counts at least
+        const static int PIXELS_PER_THREAD = 65536;
+
+    private:
+        static void countRows(const PixelBuffer &toned, const int firstRow, const int lastRow,
+                              unsigned int counts[CHANNELS][BINS]);
+
+        unsigned int counts[CHANNELS][BINS];
+        size_t pixelCount;
+};
+#endif
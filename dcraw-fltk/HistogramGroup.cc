@@ -0,0 +1,156 @@
+/**
+ * class HistogramGroup
+ * Extends Fl_Group
+ * Shows the histogram of the preview as it is displayed: luminance
+ * filled in grey with red, green and blue drawn over it, and below
+ * it the share of each channel clipped to black and to white
+ * It is updated with every preview, including while the sliders move
+ *
+ * PUBLIC FEATURES:
+ *      HistogramGroup(int x, int y, int w, int h, const char * label);
+ *      ~HistogramGroup();
+ *      void update(PixelBuffer &toned);
+ *      void reset();
+ *      Histogram getHistogram();
+ *      void draw();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "HistogramGroup.h"
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Overloaded constructor
+ * Extends Fl_Group
+ * @param x - the horizontal position
+ * @param y - the vertical position
+ * @param w - the width
+ * @param h - the height
+ * @param label - the label for this HistogramGroup
+ */
+HistogramGroup::HistogramGroup(const int x, const int y, const int w, const int h, const char * label) : Fl_Group(x,y,w,h,label)
+{
+    box(FL_UP_BOX);
+    end();
+}
+
+/**
+ * Destructor
+ */
+HistogramGroup::~HistogramGroup()
+{}
+
+/**
+ * Counts a new preview and redraws
+ * @param toned - the 16 bit RGB preview as it is displayed
+ */
+void HistogramGroup::update(const PixelBuffer &toned)
+{
+    theHistogram.compute(toned);
+    redraw();
+}
+
+/**
+ * Empties the histogram, for when there is no preview
+ */
+void HistogramGroup::reset()
+{
+    theHistogram = Histogram();
+    redraw();
+}
+
+/**
+ * @return the histogram shown
+ */
+const Histogram & HistogramGroup::getHistogram() const
+{
+    return theHistogram;
+}
+
+/**
+ * Draws the graph and the clipping statistics
+ * Counts are drawn on a square root scale, so that the shadows and
+ * highlights are not lost beside a tall peak
+ */
+void HistogramGroup::draw()
+{
+    draw_box();
+
+    int graphX = x() + 10;
+    int graphY = y() + 8;
+    int graphW = w() - 20;
+    int graphH = h() - 16 - STATISTICS_HEIGHT;
+    fl_color(FL_BLACK);
+    fl_rectf(graphX, graphY, graphW, graphH);
+
+    fl_font(FL_HELVETICA, 11);
+    if (theHistogram.getPixelCount() == 0)
+    {
+        fl_color(FL_GRAY);
+        fl_draw("Preview an image to see its histogram", graphX, graphY, graphW, graphH, FL_ALIGN_CENTER);
+        return;
+    }
+
+    double scale = graphH / sqrt((double)max(theHistogram.getPeak(), 1u));
+    drawChannel(Histogram::LUMINANCE, graphX, graphY, graphW, graphH, scale);
+    for (int channel = 0; channel < 3; channel++)
+        drawChannel(channel, graphX, graphY, graphW, graphH, scale);
+
+    static const char * const names[Histogram::CHANNELS] = { "R", "G", "B", "L" };
+    char line[128];
+    int textY = graphY + graphH + 4;
+    for (int row = 0; row < 2; row++)
+    {
+        int length = snprintf(line, sizeof(line), row == 0 ? "Shadows clipped:   " : "Highlights clipped:");
+        for (int channel = 0; channel < Histogram::CHANNELS; channel++)
+        {
+            double share = row == 0 ? theHistogram.getShadowClipped(channel) : theHistogram.getHighlightClipped(channel);
+            length += snprintf(line + length, sizeof(line) - length, "   %s %.2f%%", names[channel], share * 100.0);
+        }
+        fl_color(FL_FOREGROUND_COLOR);
+        fl_draw(line, graphX, textY + row * 16, graphW, 16, FL_ALIGN_LEFT);
+    }
+}
+
+/**
+ * Draws one channel of the graph: luminance as filled columns, and
+ * red, green and blue as lines over them
+ * @param channel - 0 to 2 for red, green and blue, or Histogram::LUMINANCE
+ * @param graphX - the left of the graph
+ * @param graphY - the top of the graph
+ * @param graphW - the width of the graph
+ * @param graphH - the height of the graph
+ * @param scale - pixels of height per square root of a count
+ */
+void HistogramGroup::drawChannel(const int channel, const int graphX, const int graphY,
+                                 const int graphW, const int graphH, const double scale)
+{
+    static const unsigned char colours[Histogram::CHANNELS][3] =
+        { {230, 60, 60}, {60, 210, 60}, {80, 110, 255}, {110, 110, 110} };
+    fl_color(colours[channel][0], colours[channel][1], colours[channel][2]);
+
+    int bottom = graphY + graphH - 1;
+    int lastX = graphX, lastY = bottom;
+    for (int bin = 0; bin < Histogram::BINS; bin++)
+    {
+        int binX = graphX + bin * graphW / Histogram::BINS;
+        int binW = max((bin + 1) * graphW / Histogram::BINS - bin * graphW / Histogram::BINS, 1);
+        int height = min((int)(sqrt((double)theHistogram.getCount(channel, bin)) * scale + 0.5), graphH);
+
+        if (channel == Histogram::LUMINANCE)
+            fl_rectf(binX, bottom - height + 1, binW, height);
+        else
+        {
+            int binY = bottom - height + 1;
+            if (bin > 0)
+                fl_line(lastX, lastY, binX + binW / 2, binY);
+            lastX = binX + binW / 2;
+            lastY = binY;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+/**
+ * HistogramGroup.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef HISTOGRAMGROUP_H
+#define HISTOGRAMGROUP_H
+
+#include <Fl/Fl.H>
+#include <Fl/Fl_Group.H>
+#include <Fl/fl_draw.H>
+#include "Histogram.h"
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class HistogramGroup : public Fl_Group
+{
+    public:
+        HistogramGroup(const int x, const int y, const int w, const int h, const char * label);
+        ~HistogramGroup();
+
+        void update(const PixelBuffer &toned);
+        void reset();
+        const Histogram & getHistogram() const;
+
+        void draw();
+
+        // Height of the clipping statistics below the graph
+        const static int STATISTICS_HEIGHT = 36;
+
+    private:
+        HistogramGroup(HistogramGroup &toCopy);
+
+        void drawChannel(const int channel, const int graphX, const int graphY,
+                         const int graphW, const int graphH, const double scale);
+
+        Histogram theHistogram;
+};
+#endif
@@ -18,10 +18,16 @@
  *       void setBrightness(double brightness);
  *       void setRedMultiplier(double redMultiplier);
  *       void setBlueMultiplier(double blueMultiplier);
+ *       void setNoiseThreshold(double noiseThreshold);
+ *       void setDarkFrame(string filename);
+ *       void setBadPixelMap(string filename);
  *       void setFileFormat(int fileFormat);
  *       void setInterpolateRGBG(bool newstate);
+ *       void setInterpolationQuality(int quality);
  *       void setSourceFilename(string filename);
  *       void setOutputFilename(string filename);
+ *       void addOutputTarget(OutputTarget &target);
+ *       void clearOutputTargets();
  *
  *       // Get methods
  *       int getWhiteBalance();
@@ -29,10 +35,19 @@
  *       double getBrightness();
  *       double getRedMultiplier();
  *       double getBlueMultiplier();
+ *       double getNoiseThreshold();
+ *       string getDarkFrame();
+ *       string getBadPixelMap();
+ *       bool hasCalibration();
  *       int getFileFormat();
  *       bool getInterpolateRGBG();
+ *       int getInterpolationQuality();
  *       string getSourceFilename();
  *       string getOutputFilename();
+ *       vector<OutputTarget> getOutputTargets();
+ *       static string getFileExtension(int fileFormat);
+ *       string serialize();
+ *       bool deserialize(string text);
  *
  *       // File format constants
  *       const static int JPEG = 0;
@@ -46,9 +61,18 @@
  *       const static int CAMERA = 0;
  *       const static int AUTO = 1;
  *       const static int MANUAL = 2;
+ *
+ *       // Interpolation quality constants
+ *       const static int DEFAULT_QUALITY = -1;
+ *       const static int BILINEAR = 0;
+ *       const static int VNG = 1;
+ *       const static int PPG = 2;
+ *       const static int AHD = 3;
  */
 
 #include "Image.h"
+#include <sstream>
+#include <iomanip>
 
 /**
  * Default constructor
@@ -61,7 +85,11 @@ Image::Image()
    brightness = 3.5;
    redMultiplier = 1.0;
    blueMultiplier = 1.0;
+   noiseThreshold = 0;
+   darkFrame = "";
+   badPixelMap = "";
    interpolateRGBG = true;
+   interpolationQuality = DEFAULT_QUALITY;
    fileFormat = PPM_16;
    sourceFilename = "";
    outputFilename = "";
@@ -88,8 +116,12 @@ Image::Image(const string sourceFilename, const int whiteBalanceMode, const doub
     setBrightness(brightness);
     setRedMultiplier(redMultiplier);
     setBlueMultiplier(blueMultiplier);
+    setNoiseThreshold(0);
+    setDarkFrame("");
+    setBadPixelMap("");
     setFileFormat(fileFormat);
     setInterpolateRGBG(interpolateRGBG);
+    setInterpolationQuality(DEFAULT_QUALITY);
     setSourceFilename(sourceFilename);
     setOutputFilename(outputFilename);
 }
@@ -105,10 +137,15 @@ Image::Image(Image &toCopy)
     brightness = toCopy.brightness;
     redMultiplier = toCopy.redMultiplier;
     blueMultiplier = toCopy.blueMultiplier;
+    noiseThreshold = toCopy.noiseThreshold;
+    darkFrame = toCopy.darkFrame;
+    badPixelMap = toCopy.badPixelMap;
     fileFormat = toCopy.fileFormat;
     interpolateRGBG = toCopy.interpolateRGBG;
+    interpolationQuality = toCopy.interpolationQuality;
     sourceFilename = toCopy.sourceFilename;
     outputFilename = toCopy.outputFilename;
+    outputTargets = toCopy.outputTargets;
 }
 
 /**
@@ -157,6 +194,30 @@ void Image::setBlueMultiplier(const double blueMultiplier)
     this->blueMultiplier = blueMultiplier;
 }
 
+/**
+ * @param noiseThreshold - the wavelet noise threshold, as for dcraw -n, 0 for none
+ */
+void Image::setNoiseThreshold(const double noiseThreshold)
+{
+    this->noiseThreshold = noiseThreshold;
+}
+
+/**
+ * @param filename - a raw dark frame from the same camera to subtract, as for dcraw -K, "" for none
+ */
+void Image::setDarkFrame(const string filename)
+{
+    darkFrame = filename;
+}
+
+/**
+ * @param filename - a bad pixel map to repair, as for dcraw -P, "" for none
+ */
+void Image::setBadPixelMap(const string filename)
+{
+    badPixelMap = filename;
+}
+
 /**
  * @param fileFormat - value for the file format (see Image.h for format constants)
  */
@@ -173,6 +234,15 @@ void Image::setInterpolateRGBG(const bool newstate)
     this->interpolateRGBG = newstate;
 }
 
+/**
+ * @param quality - the demosaic quality as for dcraw -q (BILINEAR, VNG, PPG or AHD),
+ *                  DEFAULT_QUALITY for dcraw's own default
+ */
+void Image::setInterpolationQuality(const int quality)
+{
+    this->interpolationQuality = quality;
+}
+
 /**
  * @param filename - the original source filename for this Image (probably .RAW or .CRW extension)
  */
@@ -189,6 +259,24 @@ void Image::setOutputFilename(const string filename)
 	this->outputFilename = filename;
 }
 
+/**
+ * Adds a file to write from a single decode of this Image,
+ * in place of the one output file and format
+ * @param target - the format, size and filename of the file
+ */
+void Image::addOutputTarget(const OutputTarget &target)
+{
+    outputTargets.push_back(target);
+}
+
+/**
+ * Removes every output target
+ */
+void Image::clearOutputTargets()
+{
+    outputTargets.clear();
+}
+
 /**
  * @return the white balance mode for this Image
  */
@@ -229,6 +317,38 @@ const double Image::getBlueMultiplier() const
     return blueMultiplier;
 }
 
+/**
+ * @return the wavelet noise threshold for this Image, 0 for none
+ */
+const double Image::getNoiseThreshold() const
+{
+    return noiseThreshold;
+}
+
+/**
+ * @return the dark frame for this Image, "" for none
+ */
+const string Image::getDarkFrame() const
+{
+    return darkFrame;
+}
+
+/**
+ * @return the bad pixel map for this Image, "" for none
+ */
+const string Image::getBadPixelMap() const
+{
+    return badPixelMap;
+}
+
+/**
+ * @return true if this Image has a dark frame or bad pixel map, false otherwise
+ */
+const bool Image::hasCalibration() const
+{
+    return !darkFrame.empty() || !badPixelMap.empty();
+}
+
 /**
  * @return the file format for this Image
  */
@@ -245,6 +365,14 @@ const bool Image::getInterpolateRGBG() const
     return interpolateRGBG;
 }
 
+/**
+ * @return the demosaic quality as for dcraw -q, DEFAULT_QUALITY for dcraw's own default
+ */
+const int Image::getInterpolationQuality() const
+{
+    return interpolationQuality;
+}
+
 /**
  * @return the filename for this image
  */
@@ -260,3 +388,130 @@ const string Image::getOutputFilename() const
 {
     return outputFilename;
 }
+
+/**
+ * @return the output targets for this Image, empty to write the single output file
+ */
+const vector<OutputTarget> Image::getOutputTargets() const
+{
+    return outputTargets;
+}
+
+/**
+ * @param fileFormat - a file format constant
+ * @return the filename extension for the format, including the dot
+ */
+const string Image::getFileExtension(const int fileFormat)
+{
+    switch (fileFormat)
+    {
+        case JPEG:
+            return ".jpg";
+        case TIFF_8:
+        case TIFF_16:
+            return ".tiff";
+        case PSD:
+            return ".psd";
+        default:
+            return ".ppm";
+    }
+}
+
+/**
+ * Writes every setting of this Image as text, one "name value" line
+ * each, so that it can be queued in a file or sent to another process
+ * @return the settings, readable by deserialize()
+ */
+const string Image::serialize() const
+{
+    ostringstream text(ostringstream::out);
+    text << setprecision(17);
+    text << "whiteBalance " << whiteBalanceMode << "\n"
+         << "gamma " << gamma << "\n"
+         << "brightness " << brightness << "\n"
+         << "redMultiplier " << redMultiplier << "\n"
+         << "blueMultiplier " << blueMultiplier << "\n"
+         << "noiseThreshold " << noiseThreshold << "\n"
+         << "fileFormat " << fileFormat << "\n"
+         << "interpolateRGBG " << (interpolateRGBG ? 1 : 0) << "\n"
+         << "interpolationQuality " << interpolationQuality << "\n"
+         << "source " << sourceFilename << "\n"
+         << "output " << outputFilename << "\n"
+         << "darkFrame " << darkFrame << "\n"
+         << "badPixelMap " << badPixelMap << "\n";
+    for (size_t i = 0; i < outputTargets.size(); i++)
+        text << "target " << outputTargets[i].fileFormat << " " << outputTargets[i].maxSize << " "
+             << outputTargets[i].quality << " " << outputTargets[i].outputFilename << "\n";
+    return text.str();
+}
+
+/**
+ * Reads settings written by serialize(). Settings that are missing
+ * keep their current values, and unknown names are skipped
+ * Filenames take the rest of their line, so may contain spaces
+ * @param text - the settings
+ * @return true if every line could be read, false otherwise
+ */
+bool Image::deserialize(const string text)
+{
+    istringstream lines(text);
+    string line;
+    bool succeeded = true;
+    outputTargets.clear();
+    while (getline(lines, line))
+    {
+        if (!line.empty() && line[line.length() - 1] == '\r')
+            line.erase(line.length() - 1);
+        if (line.empty())
+            continue;
+
+        size_t space = line.find(' ');
+        string name = line.substr(0, space);
+        string value = space == string::npos ? "" : line.substr(space + 1);
+        istringstream number(value);
+
+        if (name == "source")
+            sourceFilename = value;
+        else if (name == "output")
+            outputFilename = value;
+        else if (name == "darkFrame")
+            darkFrame = value;
+        else if (name == "badPixelMap")
+            badPixelMap = value;
+        else if (name == "whiteBalance")
+            succeeded = (number >> whiteBalanceMode) && succeeded;
+        else if (name == "gamma")
+            succeeded = (number >> gamma) && succeeded;
+        else if (name == "brightness")
+            succeeded = (number >> brightness) && succeeded;
+        else if (name == "redMultiplier")
+            succeeded = (number >> redMultiplier) && succeeded;
+        else if (name == "blueMultiplier")
+            succeeded = (number >> blueMultiplier) && succeeded;
+        else if (name == "noiseThreshold")
+            succeeded = (number >> noiseThreshold) && succeeded;
+        else if (name == "fileFormat")
+            succeeded = (number >> fileFormat) && succeeded;
+        else if (name == "interpolationQuality")
+            succeeded = (number >> interpolationQuality) && succeeded;
+        else if (name == "interpolateRGBG")
+        {
+            int flag = 0;
+            succeeded = (number >> flag) && succeeded;
+            interpolateRGBG = flag != 0;
+        }
+        else if (name == "target")
+        {
+            OutputTarget target;
+            if (number >> target.fileFormat >> target.maxSize >> target.quality)
+            {
+                number.get();
+                getline(number, target.outputFilename);
+                outputTargets.push_back(target);
+            }
+            else
+                succeeded = false;
+        }
+    }
+    return succeeded;
+}
@@ -7,10 +7,25 @@
 #define IMAGE_H
 
 #include <string>
+#include <vector>
 #include <iostream>
 
 using namespace std;
 
+/**
+ * One file to write from a decoded Image
+ */
+struct OutputTarget
+{
+    // File format constant of Image, which also decides the bit depth
+    int fileFormat;
+    // Longest edge in pixels, 0 for the full size
+    int maxSize;
+    // JPEG quality from 1 to 100, unused by the other formats
+    int quality;
+    string outputFilename;
+};
+
 class Image
 {
     public:
@@ -27,10 +42,16 @@ class Image
         void setBrightness(const double brightness);
         void setRedMultiplier(const double redMultiplier);
         void setBlueMultiplier(const double blueMultiplier);
+        void setNoiseThreshold(const double noiseThreshold);
+        void setDarkFrame(const string filename);
+        void setBadPixelMap(const string filename);
         void setFileFormat(const int fileFormat);
         void setInterpolateRGBG(const bool newstate);
+        void setInterpolationQuality(const int quality);
         void setSourceFilename(const string filename);
         void setOutputFilename(const string filename);
+        void addOutputTarget(const OutputTarget &target);
+        void clearOutputTargets();
         
         // Get methods
         const int getWhiteBalance() const;
@@ -38,10 +59,21 @@ class Image
         const double getBrightness() const;
         const double getRedMultiplier() const;
         const double getBlueMultiplier() const;
+        const double getNoiseThreshold() const;
+        const string getDarkFrame() const;
+        const string getBadPixelMap() const;
+        const bool hasCalibration() const;
         const int getFileFormat() const;
         const bool getInterpolateRGBG() const;
+        const int getInterpolationQuality() const;
         const string getSourceFilename() const;
         const string getOutputFilename() const;
+        const vector<OutputTarget> getOutputTargets() const;
+
+        static const string getFileExtension(const int fileFormat);
+
+        const string serialize() const;
+        bool deserialize(const string text);
         
         // File format constants
         const static int JPEG = 0;
@@ -55,6 +87,13 @@ class Image
         const static int CAMERA = 0;
         const static int AUTO = 1;
         const static int MANUAL = 2;
+
+        // Interpolation quality constants, as for dcraw -q
+        const static int DEFAULT_QUALITY = -1;
+        const static int BILINEAR = 0;
+        const static int VNG = 1;
+        const static int PPG = 2;
+        const static int AHD = 3;
         
     private:
         int whiteBalanceMode;
@@ -62,10 +101,18 @@ class Image
         double brightness;
         double redMultiplier;
         double blueMultiplier;
+        // Wavelet noise threshold as for dcraw -n, 0 for none
+        double noiseThreshold;
+        // Dark frame and bad pixel map as for dcraw -K and -P, "" for none
+        string darkFrame;
+        string badPixelMap;
         int fileFormat;
         bool interpolateRGBG;
+        // Demosaic quality as for dcraw -q, DEFAULT_QUALITY for dcraw's own default
+        int interpolationQuality;
         string sourceFilename;
         string outputFilename;                        
+        vector<OutputTarget> outputTargets;
 };
 #endif
 
@@ -0,0 +1,209 @@
+/**
+ * class ImageWriter
+ * Writes a PixelBuffer as one of the output file formats that dcraw
+ * produces: 8 or 16 bit binary PPM, and 8 or 16 bit uncompressed TIFF,
+ * and the baseline JPEG that it does not (see JpegEncoder)
+ * The format and the channel layout of the buffer are looked at once
+ * per image, to pick the PixelPipeline that packs every row
+ *
+ * PUBLIC FEATURES:
+ *       static bool write(PixelBuffer &source, int fileFormat, string filename, int quality);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "ImageWriter.h"
+#include "PixelPipeline.h"
+#include "Image.h"
+#include <vector>
+
+using namespace std;
+
+/**
+ * Little-endian TIFF values, as written by writeTIFFHeader
+ */
+static void putShort(unsigned char * out, const unsigned int value)
+{
+    out[0] = (unsigned char)value;
+    out[1] = (unsigned char)(value >> 8);
+}
+
+static void putLong(unsigned char * out, const unsigned int value)
+{
+    putShort(out, value & 0xffff);
+    putShort(out + 2, value >> 16);
+}
+
+/**
+ * Writes an image file
+ * @param source - the image, 3 channel RGB or 4 channel RGBG
+ * @param fileFormat - Image::JPEG, Image::TIFF_8, Image::TIFF_16, Image::PPM_8 or Image::PPM_16
+ * @param filename - the file to write
+ * @param quality - the JPEG quality from 1 to 100
+ * @return true if the file was written, false otherwise
+ */
+bool ImageWriter::write(const PixelBuffer &source, const int fileFormat, const string filename, const int quality)
+{
+    if (source.getChannels() != 3 && source.getChannels() != 4)
+        return false;
+    if (fileFormat != Image::JPEG && fileFormat != Image::TIFF_8 && fileFormat != Image::TIFF_16 &&
+        fileFormat != Image::PPM_8 && fileFormat != Image::PPM_16)
+        return false;
+
+    FILE * file = fopen(filename.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool written;
+    switch (fileFormat)
+    {
+        case Image::JPEG:
+            written = writeJPEG(file, source, quality);
+            break;
+        case Image::TIFF_8:
+            written = writeTIFFHeader(file, source, 8) && writeRows<unsigned char, false>(file, source);
+            break;
+        case Image::TIFF_16:
+            written = writeTIFFHeader(file, source, 16) && writeRows<unsigned short, false>(file, source);
+            break;
+        case Image::PPM_8:
+            written = writePPMHeader(file, source, 8) && writeRows<unsigned char, true>(file, source);
+            break;
+        default:
+            written = writePPMHeader(file, source, 16) && writeRows<unsigned short, true>(file, source);
+            break;
+    }
+
+    return fclose(file) == 0 && written;
+}
+
+/**
+ * Reduces the image to 8 bit RGB and encodes it as a JPEG file
+ * @param file - the file to write to
+ * @param source - the image
+ * @param quality - the JPEG quality from 1 to 100
+ * @return true if the file was written, false otherwise
+ */
+bool ImageWriter::writeJPEG(FILE * file, const PixelBuffer &source, const int quality)
+{
+    // The rows are contiguous, so the whole image is packed as one long row
+    vector<unsigned char> pixels(source.getPixelCount() * 3);
+    if (source.getChannels() == 4)
+        PixelPipeline<unsigned char, 4, true>::packRow(source.getData(), &pixels[0], (int)source.getPixelCount());
+    else
+        PixelPipeline<unsigned char, 3, true>::packRow(source.getData(), &pixels[0], (int)source.getPixelCount());
+
+    JpegEncoder theEncoder(quality);
+    return theEncoder.write(file, &pixels[0], source.getWidth(), source.getHeight());
+}
+
+/**
+ * Writes the header of a binary PPM file
+ * @param file - the file to write to
+ * @param source - the image
+ * @param bits - 8 or 16 bits per sample
+ * @return true if the header was written, false otherwise
+ */
+bool ImageWriter::writePPMHeader(FILE * file, const PixelBuffer &source, const int bits)
+{
+    return fprintf(file, "P6\n%d %d\n%d\n", source.getWidth(), source.getHeight(), bits == 16 ? 65535 : 255) > 0;
+}
+
+/**
+ * Writes the header of a little-endian, uncompressed RGB TIFF file
+ * holding the whole image in one strip straight after the header
+ * @param file - the file to write to
+ * @param source - the image
+ * @param bits - 8 or 16 bits per sample
+ * @return true if the header was written, false otherwise
+ */
+bool ImageWriter::writeTIFFHeader(FILE * file, const PixelBuffer &source, const int bits)
+{
+    const int ENTRIES = 13;
+    const unsigned int IFD = 8;
+    const unsigned int BITS = IFD + 2 + ENTRIES * 12 + 4;
+    const unsigned int RESOLUTION = BITS + 6;
+    const unsigned int STRIP = RESOLUTION + 16;
+    unsigned int width = source.getWidth();
+    unsigned int height = source.getHeight();
+    unsigned int stripBytes = width * height * 3 * (bits / 8);
+
+    // Tag, type (3 = SHORT, 4 = LONG, 5 = RATIONAL), count, value or offset
+    const unsigned int tags[ENTRIES][4] = {
+        { 256, 4, 1, width },           // ImageWidth
+        { 257, 4, 1, height },          // ImageLength
+        { 258, 3, 3, BITS },            // BitsPerSample
+        { 259, 3, 1, 1 },               // Compression: none
+        { 262, 3, 1, 2 },               // PhotometricInterpretation: RGB
+        { 273, 4, 1, STRIP },           // StripOffsets
+        { 277, 3, 1, 3 },               // SamplesPerPixel
+        { 278, 4, 1, height },          // RowsPerStrip
+        { 279, 4, 1, stripBytes },      // StripByteCounts
+        { 282, 5, 1, RESOLUTION },      // XResolution
+        { 283, 5, 1, RESOLUTION + 8 },  // YResolution
+        { 284, 3, 1, 1 },               // PlanarConfiguration: chunky
+        { 296, 3, 1, 2 }                // ResolutionUnit: inch
+    };
+
+    vector<unsigned char> header(STRIP, 0);
+    header[0] = 'I';
+    header[1] = 'I';
+    putShort(&header[2], 42);
+    putLong(&header[4], IFD);
+    putShort(&header[IFD], ENTRIES);
+    for (int i = 0; i < ENTRIES; i++)
+    {
+        unsigned char * entry = &header[IFD + 2 + i * 12];
+        putShort(entry, tags[i][0]);
+        putShort(entry + 2, tags[i][1]);
+        putLong(entry + 4, tags[i][2]);
+        if (tags[i][1] == 3 && tags[i][2] == 1)
+            putShort(entry + 8, tags[i][3]);
+        else
+            putLong(entry + 8, tags[i][3]);
+    }
+    // The next IFD offset stays 0
+    for (int i = 0; i < 3; i++)
+        putShort(&header[BITS + i * 2], bits);
+    for (int i = 0; i < 2; i++)
+    {
+        putLong(&header[RESOLUTION + i * 8], 300);
+        putLong(&header[RESOLUTION + i * 8 + 4], 1);
+    }
+
+    return fwrite(&header[0], 1, header.size(), file) == header.size();
+}
+
+/**
+ * Picks the pipeline for the channel layout of the image
+ * and writes every row with it
+ * @param file - the file to write to
+ * @param source - the image
+ * @return true if every row was written, false otherwise
+ */
+template <typename Sample, bool BigEndian>
+bool ImageWriter::writeRows(FILE * file, const PixelBuffer &source)
+{
+    if (source.getChannels() == 4)
+        return writeRows< PixelPipeline<Sample, 4, BigEndian> >(file, source);
+    return writeRows< PixelPipeline<Sample, 3, BigEndian> >(file, source);
+}
+
+/**
+ * Packs and writes every row of the image
+ * @param file - the file to write to
+ * @param source - the image
+ * @return true if every row was written, false otherwise
+ */
+template <class Pipeline>
+bool ImageWriter::writeRows(FILE * file, const PixelBuffer &source)
+{
+    vector<unsigned char> row(Pipeline::rowBytes(source.getWidth()));
+    for (int y = 0; y < source.getHeight(); y++)
+    {
+        Pipeline::packRow(source.getRow(y), &row[0], source.getWidth());
+        if (fwrite(&row[0], 1, row.size(), file) != row.size())
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+/**
+ * ImageWriter.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <string>
+#include <cstdio>
+#include "PixelBuffer.h"
+#include "JpegEncoder.h"
+
+using namespace std;
+
+class ImageWriter
+{
+    public:
+        static bool write(const PixelBuffer &source, const int fileFormat, const string filename,
+                          const int quality = JpegEncoder::DEFAULT_QUALITY);
+
+    private:
+        ImageWriter();
+
+        static bool writePPMHeader(FILE * file, const PixelBuffer &source, const int bits);
+        static bool writeTIFFHeader(FILE * file, const PixelBuffer &source, const int bits);
+        static bool writeJPEG(FILE * file, const PixelBuffer &source, const int quality);
+        template <class Pipeline>
+        static bool writeRows(FILE * file, const PixelBuffer &source);
+        template <typename Sample, bool BigEndian>
+        static bool writeRows(FILE * file, const PixelBuffer &source);
+};
+#endif
@@ -0,0 +1,200 @@
+/**
+ * class InteractionRecorder
+ * Records what a user does in the SettingsGroup (the raw image and dcraw
+ * chosen, slider values, white balance and Preview clicks) with the time
+ * of each, and replays a recording through the same SettingsGroup and
+ * PreviewGroup code to measure what the user waits for: the time from
+ * each input to the new preview on screen
+ *
+ * A recording is a text file with a line per interaction:
+ *
+ *   <milliseconds> <event> <arguments>
+ *
+ * for example "1520 gamma 2.4" or "0 file /photos/IMG_0001.CR2". Replay
+ * waits for each interaction's time, so slider drags arrive as fast as
+ * they were made. The latency is taken from the time the interaction was
+ * due until the PreviewGroup has drawn, so if a slow render holds up the
+ * next input, the wait counts against that input, as it would for the
+ * user. Interactions that leave the preview as it was are not measured
+ *
+ * Replay needs a display; run it under Xvfb on a machine without one
+ *
+ * PUBLIC FEATURES:
+ *       InteractionRecorder();
+ *       ~InteractionRecorder();
+ *       bool startRecording(string filename);
+ *       void record(string event, string arguments);
+ *       bool load(string filename);
+ *       int replay(SettingsGroup * theSettings, PreviewGroup * thePreview);
+ *       int getInteractionCount();
+ *       vector<double> getLatencies();
+ *       int getFailures();
+ *       double getPercentile(double percentile);
+ *       string describe();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "InteractionRecorder.h"
+#include "SettingsGroup.h"
+#include "PreviewGroup.h"
+#include <Fl/Fl.H>
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Constructor
+ */
+InteractionRecorder::InteractionRecorder()
+{
+    failures = 0;
+}
+
+/**
+ * Destructor
+ */
+InteractionRecorder::~InteractionRecorder()
+{}
+
+/**
+ * Starts writing every interaction recorded from now on to a file
+ * @param filename - the file to write, replaced if it exists
+ * @return true if the file could be opened, false otherwise
+ */
+bool InteractionRecorder::startRecording(const string filename)
+{
+    recording.open(filename.c_str(), ios::out | ios::trunc);
+    recordingStarted = chrono::steady_clock::now();
+    return recording.is_open();
+}
+
+/**
+ * Records an interaction, if recording
+ * Each line is flushed, so a recording survives a crash it led to
+ * @param event - what was done, such as "gamma"
+ * @param arguments - the value given, such as "2.4"
+ */
+void InteractionRecorder::record(const string event, const string arguments)
+{
+    if (!recording.is_open())
+        return;
+    long long milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - recordingStarted).count();
+    recording << milliseconds << " " << event << " " << arguments << endl;
+}
+
+/**
+ * Reads a recording to replay
+ * @param filename - the recording
+ * @return true if it was read and holds at least one interaction, false otherwise
+ */
+bool InteractionRecorder::load(const string filename)
+{
+    ifstream in(filename.c_str());
+    if (!in)
+        return false;
+
+    interactions.clear();
+    string line;
+    while (getline(in, line))
+    {
+        istringstream fields(line);
+        Interaction theInteraction;
+        if (!(fields >> theInteraction.milliseconds >> theInteraction.event))
+            continue;
+        getline(fields >> ws, theInteraction.arguments);
+        interactions.push_back(theInteraction);
+    }
+    return !interactions.empty();
+}
+
+/**
+ * Replays the loaded interactions, each at its recorded time, and
+ * measures the time from each to the preview it leads to being drawn
+ * The window holding the groups must already be shown
+ * @param theSettings - the SettingsGroup to replay the interactions on
+ * @param thePreview - the PreviewGroup the SettingsGroup shows previews in
+ * @return the number of latencies measured
+ */
+int InteractionRecorder::replay(SettingsGroup * theSettings, PreviewGroup * thePreview)
+{
+    latencies.clear();
+    failures = 0;
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    for (size_t i = 0; i < interactions.size(); i++)
+    {
+        const Interaction &theInteraction = interactions[i];
+        // Timed from the first interaction, so the idle time before it is not replayed
+        double offset = theInteraction.milliseconds - interactions[0].milliseconds;
+        chrono::steady_clock::time_point due = started + chrono::microseconds((long long)(offset * 1000));
+
+        // Keep handling events, such as thumbnails arriving, until the interaction is due
+        while (chrono::steady_clock::now() < due)
+            Fl::wait(chrono::duration<double>(due - chrono::steady_clock::now()).count());
+
+        int framesDrawn = thePreview->getFramesDrawn();
+        if (!theSettings->apply(theInteraction.event, theInteraction.arguments))
+            failures++;
+        Fl::flush();
+        if (thePreview->getFramesDrawn() != framesDrawn)
+            latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - due).count());
+    }
+    return (int)latencies.size();
+}
+
+/**
+ * @return the number of interactions loaded
+ */
+const int InteractionRecorder::getInteractionCount() const
+{
+    return (int)interactions.size();
+}
+
+/**
+ * @return the milliseconds from each interaction that changed the preview to its display
+ */
+const vector<double> InteractionRecorder::getLatencies() const
+{
+    return latencies;
+}
+
+/**
+ * @return the number of interactions that could not be replayed, such as a preview that failed
+ */
+const int InteractionRecorder::getFailures() const
+{
+    return failures;
+}
+
+/**
+ * @param percentile - the percentile, 0 to 100
+ * @return the latency in milliseconds that the percentile of the replay's latencies are within
+ *         (nearest rank), 0 if none were measured
+ */
+const double InteractionRecorder::getPercentile(const double percentile) const
+{
+    if (latencies.empty())
+        return 0;
+    vector<double> sorted(latencies);
+    sort(sorted.begin(), sorted.end());
+    size_t rank = (size_t)ceil(percentile / 100.0 * sorted.size());
+    return sorted[rank < 1 ? 0 : min(rank, sorted.size()) - 1];
+}
+
+/**
+ * @return a summary of the replay, such as "24 previews: p50 31.2 ms, p95 88.0 ms, p99 102.5 ms"
+ */
+const string InteractionRecorder::describe() const
+{
+    ostringstream description(ostringstream::out);
+    description.setf(ios::fixed);
+    description.precision(1);
+    description << latencies.size() << " previews: p50 " << getPercentile(50) << " ms, p95 " << getPercentile(95)
+                << " ms, p99 " << getPercentile(99) << " ms";
+    if (failures > 0)
+        description << ", " << failures << " failed";
+    return description.str();
+}
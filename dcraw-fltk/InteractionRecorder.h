@@ -0,0 +1,61 @@
+/**
+ * InteractionRecorder.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef INTERACTIONRECORDER_H
+#define INTERACTIONRECORDER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+
+using namespace std;
+
+class SettingsGroup;
+class PreviewGroup;
+
+class InteractionRecorder
+{
+    public:
+        InteractionRecorder();
+        ~InteractionRecorder();
+
+        bool startRecording(const string filename);
+        void record(const string event, const string arguments);
+        bool load(const string filename);
+        int replay(SettingsGroup * theSettings, PreviewGroup * thePreview);
+
+        const int getInteractionCount() const;
+        const vector<double> getLatencies() const;
+        const int getFailures() const;
+        const double getPercentile(const double percentile) const;
+        const string describe() const;
+
+    private:
+        InteractionRecorder(InteractionRecorder &toCopy);
+
+        /**
+         * One recorded interaction
+         */
+        struct Interaction
+        {
+            // Milliseconds after recording started
+            double milliseconds;
+            // What was done, such as "file", "gamma" or "preview"
+            string event;
+            // The value given, such as a file name or slider value
+            string arguments;
+        };
+
+        vector<Interaction> interactions;
+        ofstream recording;
+        chrono::steady_clock::time_point recordingStarted;
+
+        // Milliseconds from each interaction that changed the preview to its display
+        vector<double> latencies;
+        // Previews that could not be shown
+        int failures;
+};
+#endif
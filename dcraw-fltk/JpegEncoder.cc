@@ -0,0 +1,416 @@
+/**
+ * class JpegEncoder
+ * A baseline JPEG (JFIF) encoder for 8 bit RGB images, used for the
+ * web and thumbnail outputs that dcraw cannot write itself
+ * Colour is subsampled 4:2:0 and coded with the example quantisation
+ * and Huffman tables of the JPEG standard, scaled for the quality the
+ * same way as the IJG library. The DCT is the floating point AAN one
+ *
+ * PUBLIC FEATURES:
+ *       JpegEncoder(int quality);
+ *       ~JpegEncoder();
+ *       bool write(FILE * file, unsigned char * pixels, int width, int height);
+ *       int getQuality();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "JpegEncoder.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// Position in the block of each coefficient, in the order they are coded
+static const unsigned char ZIGZAG[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Quantisation tables from Annex K of the standard, row by row
+static const unsigned char LUMA_QUANTISATION[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const unsigned char CHROMA_QUANTISATION[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Huffman tables from Annex K: the number of codes of each length from 1 to 16, then the symbols
+static const unsigned char LUMA_DC_COUNTS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const unsigned char CHROMA_DC_COUNTS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const unsigned char DC_SYMBOLS[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const unsigned char LUMA_AC_COUNTS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const unsigned char LUMA_AC_SYMBOLS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const unsigned char CHROMA_AC_COUNTS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const unsigned char CHROMA_AC_SYMBOLS[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+/**
+ * Constructor
+ * Scales the quantisation tables for the quality
+ * @param quality - from 1 (smallest file) to 100 (best quality)
+ */
+JpegEncoder::JpegEncoder(const int quality)
+{
+    this->quality = min(max(quality, 1), 100);
+    int scale = this->quality < 50 ? 5000 / this->quality : 200 - this->quality * 2;
+
+    // The AAN DCT leaves each coefficient scaled by these factors, which are divided out with the quantisation
+    const double SQRT8 = 2.828427125;
+    const double AAN_SCALES[8] = { 1.0, 1.387039845, 1.306562965, 1.175875602,
+                                   1.0, 0.785694958, 0.541196100, 0.275899379 };
+    for (int i = 0; i < 64; i++)
+    {
+        lumaTable[i] = (unsigned char)min(max((LUMA_QUANTISATION[i] * scale + 50) / 100, 1), 255);
+        chromaTable[i] = (unsigned char)min(max((CHROMA_QUANTISATION[i] * scale + 50) / 100, 1), 255);
+        double aan = AAN_SCALES[i / 8] * AAN_SCALES[i % 8] * SQRT8 * SQRT8;
+        lumaDivisors[i] = (float)(1.0 / (lumaTable[i] * aan));
+        chromaDivisors[i] = (float)(1.0 / (chromaTable[i] * aan));
+    }
+
+    buildHuffmanTable(LUMA_DC_COUNTS, DC_SYMBOLS, lumaDC);
+    buildHuffmanTable(LUMA_AC_COUNTS, LUMA_AC_SYMBOLS, lumaAC);
+    buildHuffmanTable(CHROMA_DC_COUNTS, DC_SYMBOLS, chromaDC);
+    buildHuffmanTable(CHROMA_AC_COUNTS, CHROMA_AC_SYMBOLS, chromaAC);
+
+    bitBuffer = 0;
+    bitCount = 0;
+}
+
+/**
+ * Destructor
+ */
+JpegEncoder::~JpegEncoder()
+{}
+
+/**
+ * @return the quality, from 1 to 100
+ */
+const int JpegEncoder::getQuality() const
+{
+    return quality;
+}
+
+/**
+ * Works out the code of every symbol from the number of codes of each length
+ * @param counts - the number of codes of each length from 1 to 16
+ * @param symbols - the symbols, in order of code length
+ * @param table - filled with the code and length of each symbol
+ */
+void JpegEncoder::buildHuffmanTable(const unsigned char * counts, const unsigned char * symbols, HuffmanTable &table)
+{
+    memset(&table, 0, sizeof(table));
+    unsigned int code = 0;
+    int k = 0;
+    for (int length = 1; length <= 16; length++)
+    {
+        for (int i = 0; i < counts[length - 1]; i++, k++)
+        {
+            table.code[symbols[k]] = (unsigned short)code++;
+            table.length[symbols[k]] = (unsigned char)length;
+        }
+        code <<= 1;
+    }
+}
+
+/**
+ * Encodes an image and writes it to a file
+ * @param file - the file to write to
+ * @param pixels - the image, 8 bit RGB row by row
+ * @param width - the width of the image in pixels
+ * @param height - the height of the image in pixels
+ * @return true if the image was written, false otherwise
+ */
+bool JpegEncoder::write(FILE * file, const unsigned char * pixels, const int width, const int height)
+{
+    if (width < 1 || height < 1 || width > 65535 || height > 65535)
+        return false;
+
+    output.clear();
+    output.reserve((size_t)width * height / 4 + 1024);
+    bitBuffer = 0;
+    bitCount = 0;
+    writeHeaders(width, height);
+
+    // Each 16x16 macroblock is four luma blocks and one block of each averaged chroma
+    float y[4][64], cb[64], cr[64];
+    int previousY = 0, previousCb = 0, previousCr = 0;
+    for (int top = 0; top < height; top += 16)
+    {
+        for (int left = 0; left < width; left += 16)
+        {
+            memset(cb, 0, sizeof(cb));
+            memset(cr, 0, sizeof(cr));
+            for (int row = 0; row < 16; row++)
+            {
+                // Edges are padded by repeating the last row and column
+                const unsigned char * line = pixels + (size_t)min(top + row, height - 1) * width * 3;
+                for (int column = 0; column < 16; column++)
+                {
+                    const unsigned char * pixel = line + min(left + column, width - 1) * 3;
+                    float r = pixel[0], g = pixel[1], b = pixel[2];
+                    int block = (row / 8) * 2 + column / 8;
+                    y[block][(row % 8) * 8 + column % 8] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+                    int chroma = (row / 2) * 8 + column / 2;
+                    cb[chroma] += 0.25f * (-0.168736f * r - 0.331264f * g + 0.5f * b);
+                    cr[chroma] += 0.25f * (0.5f * r - 0.418688f * g - 0.081312f * b);
+                }
+            }
+            for (int block = 0; block < 4; block++)
+                encodeBlock(y[block], lumaDivisors, previousY, lumaDC, lumaAC);
+            encodeBlock(cb, chromaDivisors, previousCb, chromaDC, chromaAC);
+            encodeBlock(cr, chromaDivisors, previousCr, chromaDC, chromaAC);
+        }
+    }
+
+    flushBits();
+    output.push_back(0xff);
+    output.push_back(0xd9);
+    return fwrite(&output[0], 1, output.size(), file) == output.size();
+}
+
+/**
+ * Writes the markers before the image data: JFIF, the quantisation
+ * tables, the frame header, the Huffman tables and the scan header
+ * @param width - the width of the image in pixels
+ * @param height - the height of the image in pixels
+ */
+void JpegEncoder::writeHeaders(const int width, const int height)
+{
+    output.push_back(0xff);
+    output.push_back(0xd8);
+
+    const unsigned char jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    writeMarker(0xe0, jfif, sizeof(jfif));
+
+    unsigned char tables[130];
+    tables[0] = 0;
+    tables[65] = 1;
+    for (int i = 0; i < 64; i++)
+    {
+        tables[1 + i] = lumaTable[ZIGZAG[i]];
+        tables[66 + i] = chromaTable[ZIGZAG[i]];
+    }
+    writeMarker(0xdb, tables, sizeof(tables));
+
+    // 8 bit samples, three components: luma sampled 2x2, chroma 1x1
+    const unsigned char frame[] = {
+        8, (unsigned char)(height >> 8), (unsigned char)height, (unsigned char)(width >> 8), (unsigned char)width, 3,
+        1, 0x22, 0,
+        2, 0x11, 1,
+        3, 0x11, 1
+    };
+    writeMarker(0xc0, frame, sizeof(frame));
+
+    const unsigned char * counts[4] = { LUMA_DC_COUNTS, LUMA_AC_COUNTS, CHROMA_DC_COUNTS, CHROMA_AC_COUNTS };
+    const unsigned char * symbols[4] = { DC_SYMBOLS, LUMA_AC_SYMBOLS, DC_SYMBOLS, CHROMA_AC_SYMBOLS };
+    const unsigned char classes[4] = { 0x00, 0x10, 0x01, 0x11 };
+    vector<unsigned char> huffman;
+    for (int t = 0; t < 4; t++)
+    {
+        huffman.push_back(classes[t]);
+        int total = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            huffman.push_back(counts[t][i]);
+            total += counts[t][i];
+        }
+        huffman.insert(huffman.end(), symbols[t], symbols[t] + total);
+    }
+    writeMarker(0xc4, &huffman[0], huffman.size());
+
+    const unsigned char scan[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    writeMarker(0xda, scan, sizeof(scan));
+}
+
+/**
+ * Writes a marker segment
+ * @param marker - the marker code, after the 0xff
+ * @param data - the contents of the segment
+ * @param length - the length of the contents in bytes
+ */
+void JpegEncoder::writeMarker(const int marker, const unsigned char * data, const size_t length)
+{
+    output.push_back(0xff);
+    output.push_back((unsigned char)marker);
+    output.push_back((unsigned char)((length + 2) >> 8));
+    output.push_back((unsigned char)(length + 2));
+    output.insert(output.end(), data, data + length);
+}
+
+/**
+ * Transforms, quantises and codes one 8x8 block
+ * @param block - the samples, centred on 0; overwritten by the transform
+ * @param divisors - the quantisation divisors for the component
+ * @param previousDC - the DC value of the previous block of the component, updated
+ * @param dc - the DC Huffman table of the component
+ * @param ac - the AC Huffman table of the component
+ */
+void JpegEncoder::encodeBlock(float * block, const float * divisors, int &previousDC,
+                              const HuffmanTable &dc, const HuffmanTable &ac)
+{
+    forwardDCT(block);
+
+    int coefficients[64];
+    for (int i = 0; i < 64; i++)
+    {
+        float value = block[ZIGZAG[i]] * divisors[ZIGZAG[i]];
+        coefficients[i] = (int)(value < 0 ? value - 0.5f : value + 0.5f);
+    }
+
+    // Values are coded as a size category, then that many bits (one less than the value if negative)
+    int difference = coefficients[0] - previousDC;
+    previousDC = coefficients[0];
+    int magnitude = difference < 0 ? -difference : difference;
+    int size = 0;
+    while (magnitude >> size)
+        size++;
+    putBits(dc.code[size], dc.length[size]);
+    if (size)
+        putBits((difference < 0 ? difference - 1 : difference) & ((1 << size) - 1), size);
+
+    int run = 0;
+    for (int i = 1; i < 64; i++)
+    {
+        if (coefficients[i] == 0)
+        {
+            run++;
+            continue;
+        }
+        while (run > 15)
+        {
+            // Sixteen zeros
+            putBits(ac.code[0xf0], ac.length[0xf0]);
+            run -= 16;
+        }
+        magnitude = coefficients[i] < 0 ? -coefficients[i] : coefficients[i];
+        size = 0;
+        while (magnitude >> size)
+            size++;
+        int symbol = (run << 4) | size;
+        putBits(ac.code[symbol], ac.length[symbol]);
+        putBits((coefficients[i] < 0 ? coefficients[i] - 1 : coefficients[i]) & ((1 << size) - 1), size);
+        run = 0;
+    }
+    if (run > 0)
+        // End of block
+        putBits(ac.code[0x00], ac.length[0x00]);
+}
+
+/**
+ * The scaled forward DCT of Arai, Agui and Nakajima, applied to the
+ * rows and then the columns of a block. The outputs are left scaled,
+ * which the quantisation divisors allow for
+ * @param block - the 8x8 block, transformed in place
+ */
+void JpegEncoder::forwardDCT(float * block)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        // Rows on the first pass, columns on the second
+        int step = pass == 0 ? 1 : 8;
+        int next = pass == 0 ? 8 : 1;
+        for (int line = 0; line < 8; line++)
+        {
+            float * d = block + line * next;
+            float tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+            float tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+            float tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+            float tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+            // Even part
+            float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+            float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+            d[0] = tmp10 + tmp11;
+            d[4 * step] = tmp10 - tmp11;
+            float z1 = (tmp12 + tmp13) * 0.707106781f;
+            d[2 * step] = tmp13 + z1;
+            d[6 * step] = tmp13 - z1;
+
+            // Odd part
+            tmp10 = tmp4 + tmp5;
+            tmp11 = tmp5 + tmp6;
+            tmp12 = tmp6 + tmp7;
+            float z5 = (tmp10 - tmp12) * 0.382683433f;
+            float z2 = 0.541196100f * tmp10 + z5;
+            float z4 = 1.306562965f * tmp12 + z5;
+            float z3 = tmp11 * 0.707106781f;
+            float z11 = tmp7 + z3, z13 = tmp7 - z3;
+            d[5 * step] = z13 + z2;
+            d[3 * step] = z13 - z2;
+            d[step] = z11 + z4;
+            d[7 * step] = z11 - z4;
+        }
+    }
+}
+
+/**
+ * Adds bits to the entropy coded data, stuffing a zero after every 0xff byte
+ * @param bits - the bits, in the low end
+ * @param count - the number of bits, at most 16
+ */
+void JpegEncoder::putBits(const unsigned int bits, const int count)
+{
+    bitBuffer = (bitBuffer << count) | (bits & ((1u << count) - 1));
+    bitCount += count;
+    while (bitCount >= 8)
+    {
+        unsigned char byte = (unsigned char)(bitBuffer >> (bitCount - 8));
+        output.push_back(byte);
+        if (byte == 0xff)
+            output.push_back(0);
+        bitCount -= 8;
+    }
+}
+
+/**
+ * Pads the last byte of the entropy coded data with one bits
+ */
+void JpegEncoder::flushBits()
+{
+    if (bitCount > 0)
+        putBits(0x7f, 8 - bitCount);
+}
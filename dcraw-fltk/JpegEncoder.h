@@ -0,0 +1,57 @@
+/**
+ * JpegEncoder.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef JPEGENCODER_H
+#define JPEGENCODER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+using namespace std;
+
+class JpegEncoder
+{
+    public:
+        JpegEncoder(const int quality);
+        ~JpegEncoder();
+
+        bool write(FILE * file, const unsigned char * pixels, const int width, const int height);
+        const int getQuality() const;
+
+        // Quality used when none is given
+        const static int DEFAULT_QUALITY = 90;
+
+    private:
+        JpegEncoder(JpegEncoder &toCopy);
+
+        struct HuffmanTable
+        {
+            unsigned short code[256];
+            unsigned char length[256];
+        };
+
+        static void buildHuffmanTable(const unsigned char * counts, const unsigned char * symbols, HuffmanTable &table);
+        static void forwardDCT(float * block);
+
+        void writeHeaders(const int width, const int height);
+        void writeMarker(const int marker, const unsigned char * data, const size_t length);
+        void encodeBlock(float * block, const float * divisors, int &previousDC,
+                         const HuffmanTable &dc, const HuffmanTable &ac);
+        void putBits(const unsigned int bits, const int count);
+        void flushBits();
+
+        int quality;
+        unsigned char lumaTable[64];
+        unsigned char chromaTable[64];
+        float lumaDivisors[64];
+        float chromaDivisors[64];
+        HuffmanTable lumaDC, lumaAC, chromaDC, chromaAC;
+
+        vector<unsigned char> output;
+        unsigned int bitBuffer;
+        int bitCount;
+};
+#endif
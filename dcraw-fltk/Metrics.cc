@@ -0,0 +1,373 @@
+/**
+ * class Metrics
+ * A registry of counters, gauges and fixed-bucket histograms that the
+ * converter, the caches and the schedulers update, and that
+ * MetricsExporter writes out in the Prometheus text format
+ *
+ * A metric is registered, or found if it already is, by its name and
+ * labels (for example counter("dcraw_fltk_cache_requests_total", help,
+ * "cache=\"render_graph\",result=\"hit\"")). Registration takes a lock;
+ * callers on a hot path keep the reference it returns, which stays
+ * valid for the life of the program, and update it without one:
+ * every update is a single atomic operation
+ *
+ * PUBLIC FEATURES:
+ *       static Counter & counter(string name, string help, string labels);
+ *       static Gauge & gauge(string name, string help, string labels);
+ *       static Histogram & histogram(string name, string help, string labels, vector<double> bounds);
+ *       static string render();
+ *       static vector<double> secondsBuckets();
+ *       static vector<double> bytesBuckets();
+ *
+ * class Metrics::Counter
+ *       void add(unsigned long long amount);
+ *       unsigned long long get();
+ *
+ * class Metrics::Gauge
+ *       void set(double value);
+ *       void add(double amount);
+ *       double get();
+ *
+ * class Metrics::Histogram
+ *       Histogram(vector<double> bounds);
+ *       void observe(double value);
+ *       vector<double> getBounds();
+ *       vector<unsigned long long> getCounts();
+ *       unsigned long long getCount();
+ *       double getSum();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "Metrics.h"
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    // One registered metric; the metrics themselves are never freed
+    struct Series
+    {
+        string name;
+        string help;
+        string labels;
+        Type type;
+        void * metric;
+    };
+
+    mutex registryLock;
+    vector<Series> registry;
+    map<string, size_t> registered;
+}
+
+/**
+ * Finds a registered metric, or registers a new one
+ * @param name - the metric name
+ * @param help - the help text, used if the metric is new
+ * @param labels - the labels, for example result="hit", or ""
+ * @param type - the kind of metric
+ * @param create - makes the metric if it is new
+ * @return the metric
+ */
+template <class Metric, class Create>
+static Metric & find(const string name, const string help, const string labels, const Type type, Create create)
+{
+    lock_guard<mutex> guard(registryLock);
+    string key = name + "{" + labels + "}";
+    map<string, size_t>::iterator found = registered.find(key);
+    if (found != registered.end())
+        return *static_cast<Metric *>(registry[found->second].metric);
+
+    Series series;
+    series.name = name;
+    series.help = help;
+    series.labels = labels;
+    series.type = type;
+    series.metric = create();
+    registered[key] = registry.size();
+    registry.push_back(series);
+    return *static_cast<Metric *>(series.metric);
+}
+
+/**
+ * Adds to a double atomically
+ * @param total - the double to add to
+ * @param amount - the amount to add
+ */
+static void atomicAdd(atomic<double> &total, const double amount)
+{
+    double current = total.load(memory_order_relaxed);
+    while (!total.compare_exchange_weak(current, current + amount, memory_order_relaxed))
+        ;
+}
+
+/**
+ * Constructor
+ */
+Metrics::Counter::Counter() : value(0)
+{}
+
+/**
+ * @param amount - the amount to count
+ */
+void Metrics::Counter::add(const unsigned long long amount)
+{
+    value.fetch_add(amount, memory_order_relaxed);
+}
+
+/**
+ * @return the count so far
+ */
+const unsigned long long Metrics::Counter::get() const
+{
+    return value.load(memory_order_relaxed);
+}
+
+/**
+ * Constructor
+ */
+Metrics::Gauge::Gauge() : value(0)
+{}
+
+/**
+ * @param value - the new value
+ */
+void Metrics::Gauge::set(const double value)
+{
+    this->value.store(value, memory_order_relaxed);
+}
+
+/**
+ * @param amount - the amount to add, negative to subtract
+ */
+void Metrics::Gauge::add(const double amount)
+{
+    atomicAdd(value, amount);
+}
+
+/**
+ * @return the value
+ */
+const double Metrics::Gauge::get() const
+{
+    return value.load(memory_order_relaxed);
+}
+
+/**
+ * Constructor
+ * @param bounds - the upper bound of each bucket, in increasing order;
+ *                 larger observations are only counted in the total
+ */
+Metrics::Histogram::Histogram(const vector<double> bounds) : counts(new atomic<unsigned long long>[bounds.size()]), count(0), sum(0)
+{
+    this->bounds = bounds;
+    for (size_t i = 0; i < bounds.size(); i++)
+        counts[i].store(0);
+}
+
+/**
+ * Counts an observation in the first bucket it fits
+ * @param value - the observation, such as a time in seconds
+ */
+void Metrics::Histogram::observe(const double value)
+{
+    size_t bucket = lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+    if (bucket < bounds.size())
+        counts[bucket].fetch_add(1, memory_order_relaxed);
+    count.fetch_add(1, memory_order_relaxed);
+    atomicAdd(sum, value);
+}
+
+/**
+ * @return the upper bound of each bucket
+ */
+const vector<double> Metrics::Histogram::getBounds() const
+{
+    return bounds;
+}
+
+/**
+ * @return the observations at or below each bound, cumulative as Prometheus expects
+ */
+const vector<unsigned long long> Metrics::Histogram::getCounts() const
+{
+    vector<unsigned long long> cumulative(bounds.size());
+    unsigned long long total = 0;
+    for (size_t i = 0; i < bounds.size(); i++)
+    {
+        total += counts[i].load(memory_order_relaxed);
+        cumulative[i] = total;
+    }
+    return cumulative;
+}
+
+/**
+ * @return the number of observations
+ */
+const unsigned long long Metrics::Histogram::getCount() const
+{
+    return count.load(memory_order_relaxed);
+}
+
+/**
+ * @return the sum of the observations
+ */
+const double Metrics::Histogram::getSum() const
+{
+    return sum.load(memory_order_relaxed);
+}
+
+/**
+ * @param name - the metric name, such as dcraw_fltk_conversions_total
+ * @param help - a description of the metric, used if it is new
+ * @param labels - the labels of this series, for example outcome="failed", or ""
+ * @return the counter, valid for the life of the program
+ */
+Metrics::Counter & Metrics::counter(const string name, const string help, const string labels)
+{
+    return find<Counter>(name, help, labels, COUNTER, []() { return (void *)new Counter(); });
+}
+
+/**
+ * @param name - the metric name
+ * @param help - a description of the metric, used if it is new
+ * @param labels - the labels of this series, or ""
+ * @return the gauge, valid for the life of the program
+ */
+Metrics::Gauge & Metrics::gauge(const string name, const string help, const string labels)
+{
+    return find<Gauge>(name, help, labels, GAUGE, []() { return (void *)new Gauge(); });
+}
+
+/**
+ * @param name - the metric name
+ * @param help - a description of the metric, used if it is new
+ * @param labels - the labels of this series, or ""
+ * @param bounds - the upper bound of each bucket, used if the histogram is new
+ * @return the histogram, valid for the life of the program
+ */
+Metrics::Histogram & Metrics::histogram(const string name, const string help, const string labels,
+                                        const vector<double> bounds)
+{
+    return find<Histogram>(name, help, labels, HISTOGRAM, [&]() { return (void *)new Histogram(bounds); });
+}
+
+/**
+ * @return the resident set size of this process in bytes, 0 if unknown
+ */
+static size_t residentMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#else
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    int fields = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    return fields == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+/**
+ * Joins the labels of a series with one more label
+ * @param labels - the labels of the series, or ""
+ * @param extra - another label, or ""
+ * @return the labels in braces, or "" if there are none
+ */
+static string labelSet(const string labels, const string extra)
+{
+    if (labels.empty() && extra.empty())
+        return "";
+    return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+}
+
+/**
+ * @return every metric in the Prometheus text exposition format
+ */
+const string Metrics::render()
+{
+    gauge("dcraw_fltk_resident_memory_bytes", "Resident set size of dcraw-fltk itself").set((double)residentMemory());
+
+    vector<Series> series;
+    {
+        lock_guard<mutex> guard(registryLock);
+        series = registry;
+    }
+    // Every series of a metric must be written together
+    stable_sort(series.begin(), series.end(), [](const Series &a, const Series &b) { return a.name < b.name; });
+
+    static const char * TYPE_NAMES[] = { "counter", "gauge", "histogram" };
+    ostringstream text(ostringstream::out);
+    text.precision(12);
+    for (size_t i = 0; i < series.size(); i++)
+    {
+        const Series &one = series[i];
+        if (i == 0 || series[i - 1].name != one.name)
+        {
+            text << "# HELP " << one.name << " " << one.help << "\n";
+            text << "# TYPE " << one.name << " " << TYPE_NAMES[one.type] << "\n";
+        }
+
+        if (one.type == COUNTER)
+            text << one.name << labelSet(one.labels, "") << " " << static_cast<Counter *>(one.metric)->get() << "\n";
+        else if (one.type == GAUGE)
+            text << one.name << labelSet(one.labels, "") << " " << static_cast<Gauge *>(one.metric)->get() << "\n";
+        else
+        {
+            const Histogram * histogram = static_cast<Histogram *>(one.metric);
+            vector<double> bounds = histogram->getBounds();
+            vector<unsigned long long> counts = histogram->getCounts();
+            unsigned long long count = histogram->getCount();
+            for (size_t b = 0; b < bounds.size(); b++)
+            {
+                ostringstream bound(ostringstream::out);
+                bound.precision(12);
+                bound << "le=\"" << bounds[b] << "\"";
+                text << one.name << "_bucket" << labelSet(one.labels, bound.str()) << " " << counts[b] << "\n";
+            }
+            text << one.name << "_bucket" << labelSet(one.labels, "le=\"+Inf\"") << " " << count << "\n";
+            text << one.name << "_sum" << labelSet(one.labels, "") << " " << histogram->getSum() << "\n";
+            text << one.name << "_count" << labelSet(one.labels, "") << " " << count << "\n";
+        }
+    }
+    return text.str();
+}
+
+/**
+ * @return buckets for times from a hundredth of a second to ten minutes
+ */
+const vector<double> Metrics::secondsBuckets()
+{
+    static const double BOUNDS[] = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 60, 120, 300, 600 };
+    return vector<double>(BOUNDS, BOUNDS + sizeof(BOUNDS) / sizeof(BOUNDS[0]));
+}
+
+/**
+ * @return buckets for memory sizes from 16 MB to 16 GB, doubling
+ */
+const vector<double> Metrics::bytesBuckets()
+{
+    vector<double> bounds;
+    for (double bytes = 16.0 * 1024 * 1024; bytes <= 16.0 * 1024 * 1024 * 1024; bytes *= 2)
+        bounds.push_back(bytes);
+    return bounds;
+}
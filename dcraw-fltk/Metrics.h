@@ -0,0 +1,71 @@
+/**
+ * Metrics.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+class Metrics
+{
+    public:
+        // A count that only goes up, such as conversions finished
+        class Counter
+        {
+            public:
+                Counter();
+                void add(const unsigned long long amount = 1);
+                const unsigned long long get() const;
+            private:
+                Counter(Counter &toCopy);
+                atomic<unsigned long long> value;
+        };
+
+        // A value that goes up and down, such as the queue depth
+        class Gauge
+        {
+            public:
+                Gauge();
+                void set(const double value);
+                void add(const double amount);
+                const double get() const;
+            private:
+                Gauge(Gauge &toCopy);
+                atomic<double> value;
+        };
+
+        // Counts of observations at or below each of a fixed set of bounds
+        class Histogram
+        {
+            public:
+                Histogram(const vector<double> bounds);
+                void observe(const double value);
+                const vector<double> getBounds() const;
+                const vector<unsigned long long> getCounts() const;
+                const unsigned long long getCount() const;
+                const double getSum() const;
+            private:
+                Histogram(Histogram &toCopy);
+                vector<double> bounds;
+                unique_ptr< atomic<unsigned long long>[] > counts;
+                atomic<unsigned long long> count;
+                atomic<double> sum;
+        };
+
+        static Counter & counter(const string name, const string help, const string labels = "");
+        static Gauge & gauge(const string name, const string help, const string labels = "");
+        static Histogram & histogram(const string name, const string help, const string labels,
+                                     const vector<double> bounds);
+        static const string render();
+
+        static const vector<double> secondsBuckets();
+        static const vector<double> bytesBuckets();
+};
+#endif
@@ -0,0 +1,246 @@
+/**
+ * class MetricsExporter
+ * Publishes the Metrics of a long batch, queue worker or service while
+ * it runs, for Prometheus or any tool that reads its text format
+ *
+ * Every few seconds the metrics are written to a text file, replaced
+ * whole so that a reader such as node_exporter's textfile collector
+ * never sees half of one. A local (Unix domain) socket may also be
+ * given: each connection to it is answered with the current metrics
+ * and closed, so a scrape sees them as they are rather than as they
+ * were at the last write. Both run on one thread of their own, away
+ * from the conversions
+ *
+ * PUBLIC FEATURES:
+ *       MetricsExporter(string textFile, string socketPath, int intervalSeconds);
+ *       ~MetricsExporter();
+ *       bool start();
+ *       void stop();
+ *       bool writeFile();
+ *       string getTextFile();
+ *       string getSocketPath();
+ *       int getIntervalSeconds();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+
+#include "MetricsExporter.h"
+#include "Metrics.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+
+using namespace std;
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+#define closeSocket closesocket
+static const Socket NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int Socket;
+#define closeSocket close
+static const Socket NO_SOCKET = -1;
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * Constructor
+ * @param textFile - the file to write the metrics to, or "" for none
+ * @param socketPath - the socket to answer scrapes on, replaced if it exists, or "" for none
+ * @param intervalSeconds - the seconds between writes of the file
+ */
+MetricsExporter::MetricsExporter(const string textFile, const string socketPath, const int intervalSeconds)
+{
+    this->textFile = textFile;
+    this->socketPath = socketPath;
+    this->intervalSeconds = intervalSeconds < 1 ? DEFAULT_INTERVAL_SECONDS : intervalSeconds;
+    listener = (long long)NO_SOCKET;
+    stopping = false;
+}
+
+/**
+ * Destructor
+ * Stops the exporter, leaving the file with the final metrics
+ */
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+/**
+ * Opens the socket, if there is one, and starts exporting
+ * @return true if exporting started, false if the socket could not be opened
+ */
+bool MetricsExporter::start()
+{
+    if (!socketPath.empty())
+    {
+#ifdef _WIN32
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+            return false;
+#endif
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            cerr << "The socket path " << socketPath << " is too long" << endl;
+            return false;
+        }
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+        remove(socketPath.c_str());
+
+        Socket socketHandle = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socketHandle == NO_SOCKET || ::bind(socketHandle, (sockaddr *)&address, sizeof(address)) != 0
+            || listen(socketHandle, 4) != 0)
+        {
+            cerr << "Cannot listen for metrics on " << socketPath << endl;
+            if (socketHandle != NO_SOCKET)
+                closeSocket(socketHandle);
+            return false;
+        }
+        listener = (long long)socketHandle;
+    }
+
+    stopping = false;
+    exporter = thread(&MetricsExporter::run, this);
+    return true;
+}
+
+/**
+ * Stops exporting, writes the file a last time and closes the socket
+ */
+void MetricsExporter::stop()
+{
+    if (!exporter.joinable())
+        return;
+    stopping = true;
+    exporter.join();
+    writeFile();
+
+    if ((Socket)listener != NO_SOCKET)
+    {
+        closeSocket((Socket)listener);
+        listener = (long long)NO_SOCKET;
+        remove(socketPath.c_str());
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+}
+
+/**
+ * Writes the metrics to the text file, replacing it whole
+ * @return true if written, or if there is no file
+ */
+bool MetricsExporter::writeFile() const
+{
+    if (textFile.empty())
+        return true;
+
+    string temporary = textFile + ".tmp";
+    {
+        ofstream out(temporary.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!out)
+            return false;
+        out << Metrics::render();
+        if (!out)
+            return false;
+    }
+#ifdef _WIN32
+    return MoveFileExA(temporary.c_str(), textFile.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(temporary.c_str(), textFile.c_str()) == 0;
+#endif
+}
+
+/**
+ * Writes the file every interval and answers scrapes until stopped
+ * Runs on the exporter thread
+ */
+void MetricsExporter::run()
+{
+    chrono::steady_clock::time_point due = chrono::steady_clock::now();
+    while (!stopping)
+    {
+        if (chrono::steady_clock::now() >= due)
+        {
+            writeFile();
+            due = chrono::steady_clock::now() + chrono::seconds(intervalSeconds);
+        }
+
+        if ((Socket)listener == NO_SOCKET)
+        {
+            this_thread::sleep_for(chrono::milliseconds(POLL_MILLISECONDS));
+            continue;
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET((Socket)listener, &readable);
+        struct timeval wait;
+        wait.tv_sec = 0;
+        wait.tv_usec = POLL_MILLISECONDS * 1000;
+        if (select((int)listener + 1, &readable, NULL, NULL, &wait) <= 0)
+            continue;
+
+        Socket client = accept((Socket)listener, NULL, NULL);
+        if (client == NO_SOCKET)
+            continue;
+        string text = Metrics::render();
+        size_t sent = 0;
+        while (sent < text.size())
+        {
+            int count = send(client, text.data() + sent, (int)(text.size() - sent), MSG_NOSIGNAL);
+            if (count <= 0)
+                break;
+            sent += count;
+        }
+        closeSocket(client);
+    }
+}
+
+/**
+ * @return the file the metrics are written to, "" if none
+ */
+const string MetricsExporter::getTextFile() const
+{
+    return textFile;
+}
+
+/**
+ * @return the socket scrapes are answered on, "" if none
+ */
+const string MetricsExporter::getSocketPath() const
+{
+    return socketPath;
+}
+
+/**
+ * @return the seconds between writes of the file
+ */
+const int MetricsExporter::getIntervalSeconds() const
+{
+    return intervalSeconds;
+}
@@ -0,0 +1,47 @@
+/**
+ * MetricsExporter.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+class MetricsExporter
+{
+    public:
+        MetricsExporter(const string textFile, const string socketPath, const int intervalSeconds);
+        ~MetricsExporter();
+
+        bool start();
+        void stop();
+        bool writeFile() const;
+
+        const string getTextFile() const;
+        const string getSocketPath() const;
+        const int getIntervalSeconds() const;
+
+        // Seconds between writes of the text file unless set
+        const static int DEFAULT_INTERVAL_SECONDS = 15;
+        // How often the exporter checks for scrapes and whether it has been stopped
+        const static int POLL_MILLISECONDS = 250;
+
+    private:
+        MetricsExporter(MetricsExporter &toCopy);
+
+        void run();
+
+        string textFile;
+        string socketPath;
+        int intervalSeconds;
+        // The listening socket handle, or -1
+        long long listener;
+        atomic<bool> stopping;
+        thread exporter;
+};
+#endif
@@ -0,0 +1,188 @@
+/**
+ * class Orientation
+ * Turns and mirrors decoded images upright, as dcraw does unless given -t 0
+ *
+ * dcraw writes a turned image by reading its whole frame down the
+ * columns, one pixel from every row in turn, which misses the cache
+ * and the TLB on every pixel of a large frame. Here the image is
+ * turned in square tiles of TILE_SIZE pixels, each read and written
+ * while it is in the cache, on every core at once. The orientation
+ * itself is read from the raw file, so frames can be decoded in the
+ * sensor's orientation (-t 0) and turned here, or turned as they are
+ * resized (see ResizePyramid)
+ *
+ * Orientations are dcraw's flip values, from the TIFF orientation tag
+ *
+ * PUBLIC FEATURES:
+ *       static int read(string filename);
+ *       static void apply(PixelBuffer &source, int flip, PixelBuffer &destination);
+ *       static void getSize(int width, int height, int flip, int &orientedWidth, int &orientedHeight);
+ *       static size_t getOffset(int row, int column, int width, int height, int flip);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "Orientation.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Reads an unsigned integer from a TIFF header
+ * @param bytes - the first byte
+ * @param size - 2 or 4
+ * @param bigEndian - true for Motorola ("MM") order, false for Intel ("II")
+ * @return the value
+ */
+static unsigned int readNumber(const unsigned char * bytes, const int size, const bool bigEndian)
+{
+    unsigned int value = 0;
+    for (int i = 0; i < size; i++)
+        value |= (unsigned int)bytes[bigEndian ? i : size - 1 - i] << (8 * (size - 1 - i));
+    return value;
+}
+
+/**
+ * Reads the orientation of a raw file from the orientation tag of
+ * its first TIFF directory, which is where NEF, CR2, DNG, ARW, PEF,
+ * ORF and RW2 files keep it
+ * @param filename - the raw file
+ * @return dcraw's flip value, or -1 if the file is not TIFF based or has no orientation tag
+ */
+const int Orientation::read(const string filename)
+{
+    FILE * in = fopen(filename.c_str(), "rb");
+    if (!in)
+        return -1;
+
+    int flip = -1;
+    unsigned char header[8];
+    if (fread(header, 1, sizeof(header), in) == sizeof(header)
+        && ((header[0] == 'I' && header[1] == 'I') || (header[0] == 'M' && header[1] == 'M')))
+    {
+        bool bigEndian = header[0] == 'M';
+        unsigned char count[2];
+        if (fseek(in, (long)readNumber(header + 4, 4, bigEndian), SEEK_SET) == 0 && fread(count, 1, 2, in) == 2)
+        {
+            unsigned int entries = readNumber(count, 2, bigEndian);
+            unsigned char entry[12];
+            for (unsigned int i = 0; i < entries && i < 1000 && fread(entry, 1, sizeof(entry), in) == sizeof(entry); i++)
+                if (readNumber(entry, 2, bigEndian) == 274)
+                {
+                    // As dcraw reads it: 1 upright, 3 upside down, 6 and 8 a quarter turn
+                    flip = "50132467"[readNumber(entry + 8, 2, bigEndian) & 7] - '0';
+                    break;
+                }
+        }
+    }
+    fclose(in);
+    return flip;
+}
+
+/**
+ * Turns or mirrors an image
+ * @param source - the image as decoded with -t 0
+ * @param flip - dcraw's flip value
+ * @param destination - the image the way up dcraw would have written it
+ */
+void Orientation::apply(const PixelBuffer &source, const int flip, PixelBuffer &destination)
+{
+    int width, height;
+    getSize(source.getWidth(), source.getHeight(), flip, width, height);
+    destination.resize(width, height, source.getChannels());
+    if (flip == NONE)
+    {
+        copy(source.getData(), source.getData() + source.getPixelCount() * source.getChannels(), destination.getData());
+        return;
+    }
+
+    int tilesAcross = (source.getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesAcross * ((source.getHeight() + TILE_SIZE - 1) / TILE_SIZE);
+    int threads = max(min((int)thread::hardware_concurrency(), tileCount), 1);
+
+    atomic<int> next(0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&]()
+        {
+            for (int tile = next++; tile < tileCount; tile = next++)
+                applyTile(source, flip, destination, (tile % tilesAcross) * TILE_SIZE, (tile / tilesAcross) * TILE_SIZE);
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+/**
+ * Turns one tile, reading its rows in order and writing each one
+ * along a row or column of the destination
+ * @param source - the image as decoded with -t 0
+ * @param flip - dcraw's flip value
+ * @param destination - the turned image, whose part of the tile is written
+ * @param tileX - the left of the tile in the source
+ * @param tileY - the top of the tile in the source
+ */
+void Orientation::applyTile(const PixelBuffer &source, const int flip, PixelBuffer &destination,
+                            const int tileX, const int tileY)
+{
+    int width = source.getWidth();
+    int height = source.getHeight();
+    int channels = source.getChannels();
+    int columns = min(TILE_SIZE, width - tileX);
+    int rows = min(TILE_SIZE, height - tileY);
+
+    // Each source row lands on a line of destination pixels a fixed step apart
+    long long step = width > 1 ? (long long)getOffset(0, 1, width, height, flip) - (long long)getOffset(0, 0, width, height, flip)
+                               : 1;
+    unsigned short * out = destination.getData();
+    for (int y = tileY; y < tileY + rows; y++)
+    {
+        const unsigned short * in = source.getRow(y) + (size_t)tileX * channels;
+        unsigned short * pixel = out + getOffset(y, tileX, width, height, flip) * channels;
+        if (channels == 3)
+            for (int x = 0; x < columns; x++, in += 3, pixel += step * 3)
+            {
+                pixel[0] = in[0];
+                pixel[1] = in[1];
+                pixel[2] = in[2];
+            }
+        else
+            for (int x = 0; x < columns; x++, in += channels, pixel += step * channels)
+                memcpy(pixel, in, channels * sizeof(unsigned short));
+    }
+}
+
+/**
+ * @param width - the width of the image as decoded with -t 0
+ * @param height - the height of the image as decoded with -t 0
+ * @param flip - dcraw's flip value
+ * @param orientedWidth - set to the width of the image once turned
+ * @param orientedHeight - set to the height of the image once turned
+ */
+void Orientation::getSize(const int width, const int height, const int flip, int &orientedWidth, int &orientedHeight)
+{
+    orientedWidth = (flip & TRANSPOSE) ? height : width;
+    orientedHeight = (flip & TRANSPOSE) ? width : height;
+}
+
+/**
+ * Finds where a pixel goes when an image is turned, the inverse of dcraw's flip_index()
+ * @param row - the row of the pixel in the image as decoded with -t 0
+ * @param column - the column of the pixel in the image as decoded with -t 0
+ * @param width - the width of the image as decoded with -t 0
+ * @param height - the height of the image as decoded with -t 0
+ * @param flip - dcraw's flip value
+ * @return the index of the pixel in the turned image
+ */
+const size_t Orientation::getOffset(const int row, const int column, const int width, const int height, const int flip)
+{
+    int y = (flip & MIRROR_ROWS) ? height - 1 - row : row;
+    int x = (flip & MIRROR_COLUMNS) ? width - 1 - column : column;
+    if (flip & TRANSPOSE)
+        return (size_t)x * height + y;
+    return (size_t)y * width + x;
+}
@@ -0,0 +1,39 @@
+/**
+ * Orientation.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef ORIENTATION_H
+#define ORIENTATION_H
+
+#include <string>
+#include <cstddef>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class Orientation
+{
+    public:
+        static const int read(const string filename);
+        static void apply(const PixelBuffer &source, const int flip, PixelBuffer &destination);
+        static void getSize(const int width, const int height, const int flip, int &orientedWidth, int &orientedHeight);
+        static const size_t getOffset(const int row, const int column, const int width, const int height, const int flip);
+
+        // dcraw's flip bits, combined as it combines them: 3 turns the image
+        // half way round, 5 a quarter anticlockwise and 6 a quarter clockwise
+        const static int NONE = 0;
+        const static int MIRROR_COLUMNS = 1;
+        const static int MIRROR_ROWS = 2;
+        const static int TRANSPOSE = 4;
+        // Side of the square tiles each thread turns, small enough that a tile
+        // of the source and the destination lines it is written to stay in cache
+        const static int TILE_SIZE = 64;
+
+    private:
+        Orientation();
+
+        static void applyTile(const PixelBuffer &source, const int flip, PixelBuffer &destination,
+                              const int tileX, const int tileY);
+};
+#endif
@@ -0,0 +1,311 @@
+/**
+ * class PixelBuffer
+ * An in-memory image of 16 bit samples, stored row by row
+ * with the channels of each pixel interleaved
+ * Reads the PPM / PGM files that dcraw produces
+ * The samples are kept in memory of the buffer's own, or in memory held
+ * elsewhere, such as a SharedFrame mapping, so that a frame decoded in
+ * another process is used where it lies rather than copied
+ *
+ * PUBLIC FEATURES:
+ *       PixelBuffer();
+ *       PixelBuffer(int width, int height, int channels);
+ *       PixelBuffer(PixelBuffer &toCopy);
+ *       ~PixelBuffer();
+ *       void resize(int width, int height, int channels);
+ *       void swap(PixelBuffer &other);
+ *       void setStorage(int width, int height, int channels, shared_ptr<unsigned short> storage);
+ *       void setAllocator(Allocator allocator, void * data);
+ *       void setAllocator(PixelBuffer &other);
+ *       bool readPPM(string filename);
+ *       bool parsePPM(string &contents);
+ *       unsigned short * getData();
+ *       unsigned short * getRow(int row);
+ *       int getWidth();
+ *       int getHeight();
+ *       int getChannels();
+ *       size_t getPixelCount();
+ *       size_t getMemorySize();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "PixelBuffer.h"
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+using namespace std;
+
+/**
+ * Default constructor
+ * Creates an empty buffer
+ */
+PixelBuffer::PixelBuffer()
+{
+    width = 0;
+    height = 0;
+    channels = 0;
+    samples = NULL;
+    allocator = NULL;
+    allocatorData = NULL;
+}
+
+/**
+ * Constructor
+ * @param width - the width in pixels
+ * @param height - the height in pixels
+ * @param channels - the number of samples per pixel
+ */
+PixelBuffer::PixelBuffer(const int width, const int height, const int channels)
+{
+    samples = NULL;
+    allocator = NULL;
+    allocatorData = NULL;
+    resize(width, height, channels);
+}
+
+/**
+ * Copy constructor
+ * The copy's samples are its own, wherever those of toCopy are
+ * @param toCopy - the PixelBuffer to make a copy of
+ */
+PixelBuffer::PixelBuffer(PixelBuffer &toCopy)
+{
+    width = toCopy.width;
+    height = toCopy.height;
+    channels = toCopy.channels;
+    data.assign(toCopy.samples, toCopy.samples + toCopy.getPixelCount() * toCopy.channels);
+    samples = data.empty() ? NULL : &data[0];
+    allocator = NULL;
+    allocatorData = NULL;
+}
+
+/**
+ * Destructor
+ */
+PixelBuffer::~PixelBuffer()
+{}
+
+/**
+ * Resizes the buffer, discarding its contents
+ * The samples are placed in memory from the allocator, if one is set
+ * and it provides them, and are all 0
+ * @param width - the width in pixels
+ * @param height - the height in pixels
+ * @param channels - the number of samples per pixel
+ */
+void PixelBuffer::resize(const int width, const int height, const int channels)
+{
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    size_t count = (size_t)width * (size_t)height * (size_t)channels;
+    storage.reset();
+    if (allocator && count > 0)
+        storage = allocator(count, allocatorData);
+    if (storage)
+    {
+        vector<unsigned short>().swap(data);
+        samples = storage.get();
+        return;
+    }
+    data.assign(count, 0);
+    samples = data.empty() ? NULL : &data[0];
+}
+
+/**
+ * Exchanges the contents of two buffers without copying their samples
+ * Each buffer keeps its allocator
+ * @param other - the buffer to exchange with
+ */
+void PixelBuffer::swap(PixelBuffer &other)
+{
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(channels, other.channels);
+    data.swap(other.data);
+    storage.swap(other.storage);
+    std::swap(samples, other.samples);
+}
+
+/**
+ * Uses memory held elsewhere, such as a shared memory mapping, as the
+ * samples of the buffer, without copying them
+ * @param width - the width in pixels
+ * @param height - the height in pixels
+ * @param channels - the number of samples per pixel
+ * @param storage - at least width * height * channels samples, released once no buffer uses them
+ */
+void PixelBuffer::setStorage(const int width, const int height, const int channels, shared_ptr<unsigned short> storage)
+{
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    vector<unsigned short>().swap(data);
+    this->storage = storage;
+    samples = storage.get();
+}
+
+/**
+ * Sets where resize() places the samples from now on
+ * @param allocator - provides the memory, NULL for the buffer's own
+ * @param data - passed to the allocator
+ */
+void PixelBuffer::setAllocator(Allocator allocator, void * data)
+{
+    this->allocator = allocator;
+    allocatorData = data;
+}
+
+/**
+ * Has resize() place the samples wherever another buffer's resize() does
+ * @param other - the buffer to allocate like
+ */
+void PixelBuffer::setAllocator(const PixelBuffer &other)
+{
+    allocator = other.allocator;
+    allocatorData = other.allocatorData;
+}
+
+/**
+ * Reads a binary PPM (P6) or PGM (P5) file
+ * @param filename - the file to read
+ * @return true if the file was read, false otherwise
+ */
+bool PixelBuffer::readPPM(const string filename)
+{
+    ifstream file(filename.c_str(), ios::in | ios::binary);
+    if (!file)
+        return false;
+    string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    return parsePPM(contents);
+}
+
+/**
+ * Parses a binary PPM (P6) or PGM (P5) image held in memory, as written
+ * by dcraw with -c. 8 bit samples are scaled to the 16 bit range
+ * @param contents - the bytes of the image
+ * @return true if the image was parsed, false otherwise
+ */
+bool PixelBuffer::parsePPM(const string &contents)
+{
+    if (contents.size() < 2 || contents[0] != 'P' || (contents[1] != '5' && contents[1] != '6'))
+        return false;
+    int newChannels = contents[1] == '6' ? 3 : 1;
+
+    // Header fields are separated by whitespace and may be interleaved with comments
+    int fields[3] = { 0, 0, 0 };
+    size_t position = 2;
+    for (int field = 0; field < 3; field++)
+    {
+        while (position < contents.size() && (isspace((unsigned char)contents[position]) || contents[position] == '#'))
+        {
+            if (contents[position] == '#')
+                while (position < contents.size() && contents[position] != '\n')
+                    position++;
+            else
+                position++;
+        }
+        if (position >= contents.size() || !isdigit((unsigned char)contents[position]))
+            return false;
+        while (position < contents.size() && isdigit((unsigned char)contents[position]))
+            fields[field] = fields[field] * 10 + (contents[position++] - '0');
+    }
+    position++;
+
+    int maxValue = fields[2];
+    int bytesPerSample = maxValue > 255 ? 2 : 1;
+    if (fields[0] <= 0 || fields[1] <= 0 || maxValue <= 0 || maxValue > 65535)
+        return false;
+
+    size_t count = (size_t)fields[0] * (size_t)fields[1] * (size_t)newChannels;
+    if (contents.size() < position + count * bytesPerSample)
+        return false;
+
+    resize(fields[0], fields[1], newChannels);
+    const unsigned char * source = (const unsigned char *)contents.data() + position;
+    if (bytesPerSample == 2)
+        for (size_t i = 0; i < count; i++)
+            samples[i] = (unsigned short)(source[i * 2] << 8 | source[i * 2 + 1]);
+    else
+        for (size_t i = 0; i < count; i++)
+            samples[i] = (unsigned short)(source[i] * 257);
+
+    return true;
+}
+
+/**
+ * @return the first sample of the buffer
+ */
+unsigned short * PixelBuffer::getData()
+{
+    return samples;
+}
+
+/**
+ * @return the first sample of the buffer
+ */
+const unsigned short * PixelBuffer::getData() const
+{
+    return samples;
+}
+
+/**
+ * @param row - the row number, counted from the top
+ * @return the first sample of the row
+ */
+unsigned short * PixelBuffer::getRow(const int row)
+{
+    return samples + (size_t)row * (size_t)width * (size_t)channels;
+}
+
+/**
+ * @param row - the row number, counted from the top
+ * @return the first sample of the row
+ */
+const unsigned short * PixelBuffer::getRow(const int row) const
+{
+    return samples + (size_t)row * (size_t)width * (size_t)channels;
+}
+
+/**
+ * @return the width in pixels
+ */
+const int PixelBuffer::getWidth() const
+{
+    return width;
+}
+
+/**
+ * @return the height in pixels
+ */
+const int PixelBuffer::getHeight() const
+{
+    return height;
+}
+
+/**
+ * @return the number of samples per pixel
+ */
+const int PixelBuffer::getChannels() const
+{
+    return channels;
+}
+
+/**
+ * @return the number of pixels
+ */
+const size_t PixelBuffer::getPixelCount() const
+{
+    return (size_t)width * (size_t)height;
+}
+
+/**
+ * @return the size of the samples in bytes
+ */
+const size_t PixelBuffer::getMemorySize() const
+{
+    return getPixelCount() * (size_t)channels * sizeof(unsigned short);
+}
@@ -0,0 +1,58 @@
+/**
+ * PixelBuffer.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef PIXELBUFFER_H
+#define PIXELBUFFER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <memory>
+
+using namespace std;
+
+class PixelBuffer
+{
+    public:
+        // Provides zeroed memory for the samples of a buffer, such as shared
+        // memory, or returns NULL to have the buffer use its own
+        typedef shared_ptr<unsigned short> (*Allocator)(const size_t samples, void * data);
+
+        PixelBuffer();
+        PixelBuffer(const int width, const int height, const int channels);
+        PixelBuffer(PixelBuffer &toCopy);
+        ~PixelBuffer();
+
+        void resize(const int width, const int height, const int channels);
+        void swap(PixelBuffer &other);
+        void setStorage(const int width, const int height, const int channels, shared_ptr<unsigned short> storage);
+        void setAllocator(Allocator allocator, void * data);
+        void setAllocator(const PixelBuffer &other);
+        bool readPPM(const string filename);
+        bool parsePPM(const string &contents);
+
+        unsigned short * getData();
+        const unsigned short * getData() const;
+        unsigned short * getRow(const int row);
+        const unsigned short * getRow(const int row) const;
+        const int getWidth() const;
+        const int getHeight() const;
+        const int getChannels() const;
+        const size_t getPixelCount() const;
+        const size_t getMemorySize() const;
+
+    private:
+        int width;
+        int height;
+        int channels;
+        vector<unsigned short> data;
+        // Memory held elsewhere that the samples are in, NULL if they are in data
+        shared_ptr<unsigned short> storage;
+        unsigned short * samples;
+        // Provides the memory resize() uses, NULL to use data
+        Allocator allocator;
+        void * allocatorData;
+};
+#endif
@@ -0,0 +1,85 @@
+/**
+ * PixelPipeline.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef PIXELPIPELINE_H
+#define PIXELPIPELINE_H
+
+#include <cstddef>
+
+using namespace std;
+
+/**
+ * class PixelPipeline
+ * Packs rows of 16 bit PixelBuffer samples into the bytes of an
+ * output file. The sample type, the number of input channels
+ * and the byte order are template parameters, so each output
+ * format is compiled into its own loop with no per-pixel checks:
+ * the caller chooses the specialisation once per image
+ *
+ * Sample - unsigned char for 8 bit output, unsigned short for 16 bit output
+ * Channels - 3 for RGB input, 4 for RGBG input (the two greens are averaged)
+ * BigEndian - true for PPM byte order, false for little-endian TIFF
+ *
+ * PUBLIC FEATURES:
+ *       static size_t rowBytes(int width);
+ *       static void packRow(unsigned short * in, unsigned char * out, int width);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+template <typename Sample, int Channels, bool BigEndian>
+class PixelPipeline
+{
+    public:
+        // Output samples per pixel
+        const static int OUTPUT_CHANNELS = 3;
+
+        /**
+         * @param width - the width of the row in pixels
+         * @return the number of output bytes in one row
+         */
+        static size_t rowBytes(const int width)
+        {
+            return (size_t)width * OUTPUT_CHANNELS * sizeof(Sample);
+        }
+
+        /**
+         * Packs one row
+         * @param in - the input samples, Channels per pixel
+         * @param out - the output bytes, rowBytes(width) long
+         * @param width - the width of the row in pixels
+         */
+        static void packRow(const unsigned short * in, unsigned char * out, const int width)
+        {
+            for (int x = 0; x < width; x++, in += Channels, out += OUTPUT_CHANNELS * sizeof(Sample))
+            {
+                store(out, in[0]);
+                store(out + sizeof(Sample), Channels == 4 ? (unsigned short)((in[1] + in[3] + 1) >> 1) : in[1]);
+                store(out + 2 * sizeof(Sample), in[2]);
+            }
+        }
+
+    private:
+        /**
+         * Stores one sample in the output format
+         * @param out - where to store the sample
+         * @param value - the 16 bit sample
+         */
+        static void store(unsigned char * out, const unsigned short value)
+        {
+            if (sizeof(Sample) == 1)
+                out[0] = (unsigned char)(value >> 8);
+            else if (BigEndian)
+            {
+                out[0] = (unsigned char)(value >> 8);
+                out[1] = (unsigned char)value;
+            }
+            else
+            {
+                out[0] = (unsigned char)value;
+                out[1] = (unsigned char)(value >> 8);
+            }
+        }
+};
+#endif
@@ -8,9 +8,14 @@
  *      PreviewGroup(int x, int y, int w, int h, const char * label);
  *      ~PreviewGroup();
  * 	    void loadImage(char * filename);
+ * 	    void loadImage(PixelBuffer &theBuffer);
+ * 	    int getDisplayWidth();
+ * 	    int getDisplayHeight();
+ * 	    int getFramesDrawn();
  */
 
 #include "PreviewGroup.h"
+#include "PixelPipeline.h"
 
 /**
  * Overloaded constructor
@@ -24,6 +29,9 @@
  */
 PreviewGroup::PreviewGroup(const int x, const int y, const int w, const int h, const char * label) : Fl_Group(x,y,w,h,label)
 {
+  thePreview = NULL;
+  theDisplayImage = NULL;
+  framesDrawn = 0;
   theBox = new Fl_Box(x,y,w,h);
   loadImage("./default.bmp");
   end();
@@ -34,6 +42,8 @@ PreviewGroup::PreviewGroup(const int x, const int y, const int w, const int h, c
  */
 PreviewGroup::~PreviewGroup()
 {
+  if (thePreview) thePreview->release();
+  delete theDisplayImage;
 }
 
 /**
@@ -46,6 +56,9 @@ void PreviewGroup::loadImage(const char * filename)
 {
   theBox->redraw();
   if (thePreview) thePreview->release();
+  thePreview = NULL;
+  delete theDisplayImage;
+  theDisplayImage = NULL;
 
     thePreview = Fl_Shared_Image::get(filename);
     if (!thePreview)
@@ -69,3 +82,91 @@ void PreviewGroup::loadImage(const char * filename)
     theBox->image(thePreview);
     theBox->redraw();
 }
+
+/**
+ * Displays an image decoded in memory, without going through a file
+ * Samples are reduced to 8 bits and the image is scaled to fit the box
+ * @param theBuffer - the 3 channel RGB or 4 channel RGBG image to display
+ */
+void PreviewGroup::loadImage(const PixelBuffer &theBuffer)
+{
+  if ((theBuffer.getChannels() != 3 && theBuffer.getChannels() != 4) || theBuffer.getPixelCount() == 0)
+  {
+    fl_alert("Cannot preview that image!");
+    return;
+  }
+
+  unsigned char * pixels = new unsigned char[theBuffer.getPixelCount() * 3];
+  // The rows are contiguous, so the whole image is packed as one long row
+  if (theBuffer.getChannels() == 4)
+    PixelPipeline<unsigned char, 4, true>::packRow(theBuffer.getData(), pixels, (int)theBuffer.getPixelCount());
+  else
+    PixelPipeline<unsigned char, 3, true>::packRow(theBuffer.getData(), pixels, (int)theBuffer.getPixelCount());
+
+  Fl_RGB_Image * theImage = new Fl_RGB_Image(pixels, theBuffer.getWidth(), theBuffer.getHeight(), 3);
+  theImage->alloc_array = 1;
+  showImage(theImage);
+}
+
+/**
+ * @return the width that images are scaled down to fit
+ */
+const int PreviewGroup::getDisplayWidth() const
+{
+  return theBox->w();
+}
+
+/**
+ * @return the height that images are scaled down to fit
+ */
+const int PreviewGroup::getDisplayHeight() const
+{
+  return theBox->h();
+}
+
+/**
+ * @return the number of times the preview has been drawn on screen, which
+ *         changes once a new image has actually been displayed
+ */
+const int PreviewGroup::getFramesDrawn() const
+{
+  return framesDrawn;
+}
+
+/**
+ * Draws the preview and counts the frame
+ * Called by FLTK when the preview needs drawing
+ */
+void PreviewGroup::draw()
+{
+  Fl_Group::draw();
+  framesDrawn++;
+}
+
+/**
+ * Shows an image in the box in place of the current one,
+ * scaling it down to fit the bounds of the box
+ * @param theImage - the image to show, owned by the PreviewGroup from now on
+ */
+void PreviewGroup::showImage(Fl_Image * theImage)
+{
+  if (theImage->w() > theBox->w() || theImage->h() > theBox->h())
+  {
+    Fl_Image *temp;
+    if (theImage->w() > theImage->h())
+      temp = theImage->copy(theBox->w(), theBox->h() * theImage->h() / theImage->w());
+    else
+      temp = theImage->copy(theBox->w() * theImage->w() / theImage->h(), theBox->h());
+
+    delete theImage;
+    theImage = temp;
+  }
+
+  if (thePreview) thePreview->release();
+  thePreview = NULL;
+  delete theDisplayImage;
+  theDisplayImage = theImage;
+
+  theBox->image(theDisplayImage);
+  theBox->redraw();
+}
@@ -13,6 +13,7 @@
 #include <Fl/Fl_Shared_Image.H>
 #include <Fl/fl_message.H>
 #include <Fl/Fl_Box.H>
+#include "PixelBuffer.h"
 
 using namespace std;
 
@@ -23,9 +24,21 @@ class PreviewGroup : public Fl_Group
         ~PreviewGroup();
         
         void loadImage(const char * filename);
+        void loadImage(const PixelBuffer &theBuffer);
+        const int getDisplayWidth() const;
+        const int getDisplayHeight() const;
+        const int getFramesDrawn() const;
+
+    protected:
+        void draw();
 
     private:
+        void showImage(Fl_Image * theImage);
+
         Fl_Shared_Image * thePreview;
+        Fl_Image * theDisplayImage;
         Fl_Box * theBox;
+        // The number of times the preview has been drawn on screen
+        int framesDrawn;
 };
 #endif
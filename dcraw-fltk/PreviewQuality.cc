@@ -0,0 +1,157 @@
+/**
+ * class PreviewQuality
+ * The quality ladder of the preview, and a cost model for each rung
+ * learned from the decodes timed so far
+ *
+ *   BINNED     dcraw -h, each 2x2 block of the sensor becomes one pixel
+ *              without demosaicing; half the size and the quickest
+ *   BILINEAR   full size, dcraw -q 0, about twice the cost of BINNED
+ *   VNG        full size, dcraw -q 1
+ *   AHD        full size, dcraw -q 3, as good as a full conversion
+ *
+ * BILINEAR is decoded at full size rather than half: dcraw -h drops the
+ * colour filter pattern before it interpolates, so -q has no effect at
+ * half size and a half size bilinear rung would only repeat BINNED
+ *
+ * Each rung's cost is kept in seconds per sensor megapixel, as a moving
+ * average of the recent decodes of each sensor size (which in practice
+ * tells the cameras apart), then of every size, then from a guess of
+ * dcraw's speed until a rung has been timed. The preview picks the best
+ * rung that is predicted to fit its time budget
+ *
+ * PUBLIC FEATURES:
+ *       PreviewQuality();
+ *       ~PreviewQuality();
+ *       void record(Rung rung, double megapixels, double seconds);
+ *       double predict(Rung rung, double megapixels);
+ *       Rung choose(double megapixels, double targetSeconds);
+ *       static void apply(Rung rung, Image &theImage, bool &halfSize);
+ *       static double getSensorMegapixels(Rung rung, int width, int height);
+ *       static string getRungName(int rung);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "PreviewQuality.h"
+#include <cmath>
+
+using namespace std;
+
+// Seconds per sensor megapixel of each rung before it has been timed
+static const double GUESSED_SECONDS_PER_MEGAPIXEL[PreviewQuality::RUNGS] = { 0.015, 0.03, 0.1, 0.08 };
+// Weight of the newest timing in the moving averages
+static const double LEARNING_RATE = 0.3;
+
+/**
+ * Constructor
+ */
+PreviewQuality::PreviewQuality()
+{
+    for (int i = 0; i < RUNGS; i++)
+    {
+        rungCosts[i].secondsPerMegapixel = GUESSED_SECONDS_PER_MEGAPIXEL[i];
+        rungCosts[i].samples = 0;
+    }
+}
+
+/**
+ * Destructor
+ */
+PreviewQuality::~PreviewQuality()
+{}
+
+/**
+ * Learns from a timed preview decode
+ * @param rung - the rung decoded
+ * @param megapixels - the size of the sensor in megapixels
+ * @param seconds - how long the preview took
+ */
+void PreviewQuality::record(const Rung rung, const double megapixels, const double seconds)
+{
+    if (megapixels <= 0 || seconds <= 0)
+        return;
+
+    lock_guard<mutex> guard(lock);
+    Cost &theCost = costs[make_pair((int)rung, (int)floor(megapixels * 10 + 0.5))];
+    learn(theCost, seconds / megapixels);
+    learn(rungCosts[rung], seconds / megapixels);
+}
+
+/**
+ * Adds a timing to a moving average, which starts from the first timing
+ * @param theCost - the average
+ * @param secondsPerMegapixel - the new timing
+ */
+void PreviewQuality::learn(Cost &theCost, const double secondsPerMegapixel)
+{
+    if (theCost.samples == 0)
+        theCost.secondsPerMegapixel = secondsPerMegapixel;
+    else
+        theCost.secondsPerMegapixel += LEARNING_RATE * (secondsPerMegapixel - theCost.secondsPerMegapixel);
+    theCost.samples++;
+}
+
+/**
+ * @param rung - a rung of the ladder
+ * @param megapixels - the size of the sensor in megapixels
+ * @return the seconds a preview at the rung is expected to take
+ */
+const double PreviewQuality::predict(const Rung rung, const double megapixels) const
+{
+    lock_guard<mutex> guard(lock);
+    map< pair<int, int>, Cost >::const_iterator found = costs.find(make_pair((int)rung, (int)floor(megapixels * 10 + 0.5)));
+    if (found != costs.end())
+        return found->second.secondsPerMegapixel * megapixels;
+    return rungCosts[rung].secondsPerMegapixel * megapixels;
+}
+
+/**
+ * @param megapixels - the size of the sensor in megapixels, 0 if not known yet
+ * @param targetSeconds - how long the preview may take
+ * @return the best rung expected to fit the time, BINNED if none does
+ *         or the size is not known
+ */
+const PreviewQuality::Rung PreviewQuality::choose(const double megapixels, const double targetSeconds) const
+{
+    if (megapixels <= 0)
+        return BINNED;
+    for (int rung = AHD; rung > BINNED; rung--)
+        if (predict((Rung)rung, megapixels) <= targetSeconds)
+            return (Rung)rung;
+    return BINNED;
+}
+
+/**
+ * Sets an Image up to be decoded at a rung
+ * Only BINNED is half size (see the ladder above)
+ * @param rung - the rung
+ * @param theImage - the Image, whose interpolation quality is set
+ * @param halfSize - set to true if the rung decodes at half size
+ */
+void PreviewQuality::apply(const Rung rung, Image &theImage, bool &halfSize)
+{
+    static const int QUALITIES[RUNGS] = { Image::DEFAULT_QUALITY, Image::BILINEAR, Image::VNG, Image::AHD };
+    halfSize = rung == BINNED;
+    theImage.setInterpolationQuality(QUALITIES[rung]);
+}
+
+/**
+ * @param rung - the rung an image was decoded at
+ * @param width - the width of the decoded image
+ * @param height - the height of the decoded image
+ * @return the size of the sensor in megapixels
+ */
+const double PreviewQuality::getSensorMegapixels(const Rung rung, const int width, const int height)
+{
+    return (double)width * height * (rung == BINNED ? 4 : 1) / 1000000.0;
+}
+
+/**
+ * @param rung - a rung of the ladder
+ * @return the name of the rung
+ */
+const string PreviewQuality::getRungName(const int rung)
+{
+    static const char * NAMES[RUNGS] = { "binned", "bilinear", "VNG", "AHD" };
+    return rung >= 0 && rung < RUNGS ? NAMES[rung] : "unknown";
+}
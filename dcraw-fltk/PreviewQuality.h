@@ -0,0 +1,54 @@
+/**
+ * PreviewQuality.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef PREVIEWQUALITY_H
+#define PREVIEWQUALITY_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include "Image.h"
+
+using namespace std;
+
+class PreviewQuality
+{
+    public:
+        // The ladder, from the quickest to the best
+        enum Rung { BINNED, BILINEAR, VNG, AHD };
+        const static int RUNGS = AHD + 1;
+
+        PreviewQuality();
+        ~PreviewQuality();
+
+        void record(const Rung rung, const double megapixels, const double seconds);
+        const double predict(const Rung rung, const double megapixels) const;
+        const Rung choose(const double megapixels, const double targetSeconds) const;
+
+        static void apply(const Rung rung, Image &theImage, bool &halfSize);
+        static const double getSensorMegapixels(const Rung rung, const int width, const int height);
+        static const string getRungName(const int rung);
+
+    private:
+        PreviewQuality(PreviewQuality &toCopy);
+
+        /**
+         * The learned cost of one rung, in seconds per sensor megapixel
+         */
+        struct Cost
+        {
+            double secondsPerMegapixel;
+            int samples;
+        };
+
+        static void learn(Cost &theCost, const double secondsPerMegapixel);
+
+        // By rung and sensor size in tenths of a megapixel, which tells the cameras apart
+        map< pair<int, int>, Cost > costs;
+        // By rung, over every size, for sizes not seen yet
+        Cost rungCosts[RUNGS];
+        mutable mutex lock;
+};
+#endif
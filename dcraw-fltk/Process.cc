@@ -0,0 +1,1103 @@
+/**
+ * class Process
+ * Starts a child program (usually dcraw) with an argument list,
+ * optionally captures its standard output or sends it to a file,
+ * or talks to it a line at a time over its standard input and output,
+ * waits for it to exit
+ * and reports its exit code and memory usage
+ * The child can be held to a wall clock timeout, after which it is
+ * killed, and to address space and CPU time limits, set with setrlimit()
+ * in the child or with a Job Object on Windows
+ * Its standard error can be handed, a line at a time as it is
+ * written, to a handler, such as ConversionProgress::handleLine
+ *
+ * PUBLIC FEATURES:
+ *       Process();
+ *       Process(string theExecutable, vector<string> theArguments);
+ *       ~Process();
+ *       void setExecutable(string theExecutable);
+ *       void setArguments(vector<string> theArguments);
+ *       void addArgument(string argument);
+ *       void setCaptureOutput(bool captureOutput);
+ *       void setOutputFile(string filename);
+ *       void setInteractive(bool interactive);
+ *       void setTimeout(int seconds);
+ *       void setCancel(const atomic<bool> * cancel);
+ *       void setMemoryLimit(size_t bytes);
+ *       void setCPULimit(int seconds);
+ *       void setErrorHandler(LineHandler handler, void * data);
+ *       bool start();
+ *       int wait();
+ *       bool isRunning();
+ *       bool writeInput(string text);
+ *       bool readLine(string &line);
+ *       void closeInput();
+ *       void terminate();
+ *       void reset();
+ *       string getExecutable();
+ *       vector<string> getArguments();
+ *       string getCommandLine();
+ *       string getOutput();
+ *       string getOutputFile();
+ *       bool hasStarted();
+ *       int getExitCode();
+ *       int getSignal();
+ *       bool hasTimedOut();
+ *       bool wasCancelled();
+ *       double getCPUTime();
+ *       size_t getCurrentRSS();
+ *       size_t getPeakRSS();
+ *       static size_t getPhysicalMemory();
+ *       static size_t getOwnRSS();
+ *       static string getTemporaryFilename(string suffix, string directory);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "Process.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+/**
+ * Opens a pipe whose ends are both close-on-exec from the start
+ * @param ends - set to the read and write ends
+ * @return 0 on success, -1 on failure
+ */
+static int openPipe(int ends[2])
+{
+#ifdef __APPLE__
+    // macOS has no pipe2(), so a fork on another thread may still catch
+    // the ends before they are marked
+    if (pipe(ends) != 0)
+        return -1;
+    fcntl(ends[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ends[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#else
+    return pipe2(ends, O_CLOEXEC);
+#endif
+}
+#endif
+
+/**
+ * Quotes a single argument so that it survives the
+ * command line parsing of the C runtime of the child
+ * @param argument - the argument to quote
+ * @return the quoted argument
+ */
+static string quoteArgument(const string argument)
+{
+    if (!argument.empty() && argument.find_first_of(" \t\"") == string::npos)
+        return argument;
+
+    string quoted = "\"";
+    size_t backslashes = 0;
+    for (size_t i = 0; i < argument.length(); i++)
+    {
+        if (argument[i] == '\\')
+        {
+            backslashes++;
+            continue;
+        }
+        if (argument[i] == '"')
+            quoted.append(backslashes * 2 + 1, '\\');
+        else
+            quoted.append(backslashes, '\\');
+        backslashes = 0;
+        quoted += argument[i];
+    }
+    quoted.append(backslashes * 2, '\\');
+    quoted += "\"";
+    return quoted;
+}
+
+/**
+ * Default constructor
+ */
+Process::Process()
+{
+    captureOutput = false;
+    interactive = false;
+    timeoutSeconds = 0;
+    cancel = NULL;
+    cpuLimit = 0;
+    memoryLimit = 0;
+    errorHandler = NULL;
+    errorData = NULL;
+    started = false;
+    finished = false;
+    exitCode = SPAWN_FAILED;
+    termSignal = 0;
+    timedOut = false;
+    cancelled = false;
+    cpuTime = 0;
+    peakRSS = 0;
+    alive = false;
+#ifdef _WIN32
+    processHandle = NULL;
+    outputPipe = NULL;
+    inputPipe = NULL;
+    errorPipe = NULL;
+    jobHandle = NULL;
+#else
+    pid = -1;
+    outputPipe = -1;
+    inputPipe = -1;
+    errorPipe = -1;
+#endif
+}
+
+/**
+ * Constructor
+ * @param theExecutable - the program to run
+ * @param theArguments - the arguments to run the program with
+ */
+Process::Process(const string theExecutable, const vector<string> theArguments)
+{
+    this->theExecutable = theExecutable;
+    this->theArguments = theArguments;
+    captureOutput = false;
+    interactive = false;
+    timeoutSeconds = 0;
+    cancel = NULL;
+    cpuLimit = 0;
+    memoryLimit = 0;
+    errorHandler = NULL;
+    errorData = NULL;
+    started = false;
+    finished = false;
+    exitCode = SPAWN_FAILED;
+    termSignal = 0;
+    timedOut = false;
+    cancelled = false;
+    cpuTime = 0;
+    peakRSS = 0;
+    alive = false;
+#ifdef _WIN32
+    processHandle = NULL;
+    outputPipe = NULL;
+    inputPipe = NULL;
+    errorPipe = NULL;
+    jobHandle = NULL;
+#else
+    pid = -1;
+    outputPipe = -1;
+    inputPipe = -1;
+    errorPipe = -1;
+#endif
+}
+
+/**
+ * Destructor
+ * Waits for a child that is still running so that it is not left behind
+ */
+Process::~Process()
+{
+    if (started && !finished)
+        wait();
+    lock_guard<mutex> guard(stateLock);
+#ifdef _WIN32
+    if (processHandle)
+        CloseHandle(processHandle);
+    if (jobHandle)
+        CloseHandle(jobHandle);
+#endif
+}
+
+/**
+ * @param theExecutable - the program to run
+ */
+void Process::setExecutable(const string theExecutable)
+{
+    this->theExecutable = theExecutable;
+}
+
+/**
+ * @param theArguments - the arguments to run the program with
+ */
+void Process::setArguments(const vector<string> theArguments)
+{
+    this->theArguments = theArguments;
+}
+
+/**
+ * @param argument - a single argument to append to the argument list
+ */
+void Process::addArgument(const string argument)
+{
+    theArguments.push_back(argument);
+}
+
+/**
+ * @param captureOutput - true to collect the standard output of the child, false to inherit ours
+ */
+void Process::setCaptureOutput(const bool captureOutput)
+{
+    this->captureOutput = captureOutput;
+}
+
+/**
+ * Sends the standard output of the child straight to a file, so that
+ * a large image does not pass through memory. Takes the place of capture
+ * @param filename - the file to create or overwrite, "" to inherit our standard output
+ */
+void Process::setOutputFile(const string filename)
+{
+    outputFile = filename;
+}
+
+/**
+ * @param interactive - true to talk to the child with writeInput() and readLine()
+ *                      while it runs, false otherwise. Takes the place of capture
+ */
+void Process::setInteractive(const bool interactive)
+{
+    this->interactive = interactive;
+}
+
+/**
+ * @param seconds - the wall clock time wait() lets the child run before
+ *                  killing it, 0 to wait for as long as it takes
+ */
+void Process::setTimeout(const int seconds)
+{
+    timeoutSeconds = seconds;
+}
+
+/**
+ * Sets a flag that another thread raises to have wait() kill the child
+ * @param cancel - the flag, or NULL for none
+ */
+void Process::setCancel(const atomic<bool> * cancel)
+{
+    this->cancel = cancel;
+}
+
+/**
+ * @param bytes - the address space the child may allocate, 0 for no limit
+ */
+void Process::setMemoryLimit(const size_t bytes)
+{
+    memoryLimit = bytes;
+}
+
+/**
+ * @param seconds - the CPU time the child may use before it is killed, 0 for no limit
+ */
+void Process::setCPULimit(const int seconds)
+{
+    cpuLimit = seconds;
+}
+
+/**
+ * Sends the standard error of the child to a handler instead of ours
+ * The handler is called on a thread of wait() for each line, so wait()
+ * should be called soon after start()
+ * @param handler - called with each line, without its line ending; NULL to inherit ours
+ * @param data - passed to the handler
+ */
+void Process::setErrorHandler(LineHandler handler, void * data)
+{
+    errorHandler = handler;
+    errorData = data;
+}
+
+/**
+ * Starts the child program
+ * @return true if the child was started, false otherwise
+ */
+bool Process::start()
+{
+    if (started)
+        return false;
+
+#ifdef _WIN32
+    // Every handle is created uninheritable and only the child's ends are
+    // then marked inheritable and listed for it, so that other children,
+    // such as those of parallel conversions started from other threads,
+    // never hold these pipes open, or their readers would never see the end of them
+    HANDLE writePipe = NULL;
+    HANDLE readPipe = NULL;
+    STARTUPINFOEXA startup;
+    memset(&startup, 0, sizeof(startup));
+    startup.StartupInfo.cb = sizeof(startup);
+
+    if (!outputFile.empty())
+    {
+        writePipe = CreateFileA(outputFile.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+        if (writePipe == INVALID_HANDLE_VALUE)
+            return false;
+        startup.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startup.StartupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        startup.StartupInfo.hStdOutput = writePipe;
+        startup.StartupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    }
+    else if (captureOutput || interactive)
+    {
+        if (!CreatePipe(&outputPipe, &writePipe, NULL, 0))
+            return false;
+        startup.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startup.StartupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        if (interactive && CreatePipe(&readPipe, &inputPipe, NULL, 0))
+            startup.StartupInfo.hStdInput = readPipe;
+        startup.StartupInfo.hStdOutput = writePipe;
+        startup.StartupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    }
+
+    HANDLE errorWrite = NULL;
+    if (errorHandler && CreatePipe(&errorPipe, &errorWrite, NULL, 0))
+    {
+        if (!(startup.StartupInfo.dwFlags & STARTF_USESTDHANDLES))
+        {
+            startup.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+            startup.StartupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+            startup.StartupInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+        }
+        startup.StartupInfo.hStdError = errorWrite;
+    }
+
+    // The child inherits its own ends, and those of our standard handles
+    // it shares that are already inheritable, and nothing else
+    vector<HANDLE> inherited;
+    HANDLE ends[3] = { writePipe, readPipe, errorWrite };
+    for (int i = 0; i < 3; i++)
+        if (ends[i] && SetHandleInformation(ends[i], HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT))
+            inherited.push_back(ends[i]);
+    if (startup.StartupInfo.dwFlags & STARTF_USESTDHANDLES)
+    {
+        HANDLE standard[3] = { startup.StartupInfo.hStdInput, startup.StartupInfo.hStdOutput, startup.StartupInfo.hStdError };
+        for (int i = 0; i < 3; i++)
+        {
+            DWORD flags = 0;
+            if (standard[i] && standard[i] != INVALID_HANDLE_VALUE
+                && find(inherited.begin(), inherited.end(), standard[i]) == inherited.end()
+                && GetHandleInformation(standard[i], &flags) && (flags & HANDLE_FLAG_INHERIT))
+                inherited.push_back(standard[i]);
+        }
+    }
+
+    SIZE_T listSize = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &listSize);
+    vector<char> list(listSize);
+    bool listed = false;
+    if (!inherited.empty() && listSize > 0)
+    {
+        startup.lpAttributeList = (LPPROC_THREAD_ATTRIBUTE_LIST)&list[0];
+        listed = InitializeProcThreadAttributeList(startup.lpAttributeList, 1, 0, &listSize) != FALSE;
+        if (listed && !UpdateProcThreadAttribute(startup.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, &inherited[0],
+                                                 inherited.size() * sizeof(HANDLE), NULL, NULL))
+        {
+            DeleteProcThreadAttributeList(startup.lpAttributeList);
+            listed = false;
+        }
+    }
+
+    string commandLine = getCommandLine();
+    vector<char> buffer(commandLine.begin(), commandLine.end());
+    buffer.push_back('\0');
+
+    // Without a list the child would inherit every inheritable handle we
+    // have, so it is not started at all if one was needed and not made
+    PROCESS_INFORMATION information;
+    bool limited = memoryLimit > 0 || cpuLimit > 0;
+    BOOL created = FALSE;
+    if (listed || inherited.empty())
+        created = CreateProcessA(NULL, &buffer[0], NULL, NULL, listed ? TRUE : FALSE,
+                                 (limited ? CREATE_SUSPENDED : 0) | (listed ? EXTENDED_STARTUPINFO_PRESENT : 0),
+                                 NULL, NULL, &startup.StartupInfo, &information);
+    if (listed)
+        DeleteProcThreadAttributeList(startup.lpAttributeList);
+    if (writePipe)
+        CloseHandle(writePipe);
+    if (readPipe)
+        CloseHandle(readPipe);
+    if (errorWrite)
+        CloseHandle(errorWrite);
+    if (!created)
+    {
+        if (outputPipe)
+            CloseHandle(outputPipe);
+        outputPipe = NULL;
+        if (errorPipe)
+            CloseHandle(errorPipe);
+        errorPipe = NULL;
+        closeInput();
+        return false;
+    }
+
+    if (limited)
+    {
+        // The child is held suspended until it is in the Job Object, so it cannot
+        // allocate before the limits apply; it runs without them if that fails
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+        memset(&limits, 0, sizeof(limits));
+        limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        if (memoryLimit > 0)
+        {
+            limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_PROCESS_MEMORY;
+            limits.ProcessMemoryLimit = memoryLimit;
+        }
+        if (cpuLimit > 0)
+        {
+            limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_PROCESS_TIME;
+            limits.BasicLimitInformation.PerProcessUserTimeLimit.QuadPart = (LONGLONG)cpuLimit * 10000000;
+        }
+        jobHandle = CreateJobObjectA(NULL, NULL);
+        if (jobHandle && (!SetInformationJobObject(jobHandle, JobObjectExtendedLimitInformation, &limits, sizeof(limits)) ||
+                          !AssignProcessToJobObject(jobHandle, information.hProcess)))
+        {
+            CloseHandle(jobHandle);
+            jobHandle = NULL;
+        }
+        ResumeThread(information.hThread);
+    }
+
+    CloseHandle(information.hThread);
+    processHandle = information.hProcess;
+#else
+    // Every descriptor is opened close-on-exec, so that other children, such
+    // as those of parallel conversions started from other threads, never
+    // hold these pipes open, or their readers would never see the end of them
+    // With an output file the child writes to pipes[1] and there is nothing to read
+    int pipes[2] = { -1, -1 };
+    bool toFile = !outputFile.empty();
+    if (toFile)
+    {
+        pipes[1] = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (pipes[1] < 0)
+            return false;
+    }
+    else if ((captureOutput || interactive) && openPipe(pipes) != 0)
+        return false;
+
+    int inputs[2] = { -1, -1 };
+    int errors[2] = { -1, -1 };
+    if ((interactive && openPipe(inputs) != 0) || (errorHandler && openPipe(errors) != 0))
+    {
+        int opened[4] = { pipes[0], pipes[1], inputs[0], inputs[1] };
+        for (int i = 0; i < 4; i++)
+            if (opened[i] >= 0)
+                close(opened[i]);
+        return false;
+    }
+
+    vector<char *> argv;
+    argv.push_back(const_cast<char *>(theExecutable.c_str()));
+    for (size_t i = 0; i < theArguments.size(); i++)
+        argv.push_back(const_cast<char *>(theArguments[i].c_str()));
+    argv.push_back(NULL);
+
+    pid = fork();
+    if (pid == 0)
+    {
+        if (pipes[1] >= 0)
+            dup2(pipes[1], STDOUT_FILENO);
+        if (inputs[0] >= 0)
+            dup2(inputs[0], STDIN_FILENO);
+        if (errors[1] >= 0)
+            dup2(errors[1], STDERR_FILENO);
+        struct rlimit limit;
+        if (memoryLimit > 0)
+        {
+            limit.rlim_cur = limit.rlim_max = (rlim_t)memoryLimit;
+            setrlimit(RLIMIT_AS, &limit);
+        }
+        if (cpuLimit > 0)
+        {
+            // SIGXCPU at the limit, SIGKILL a second later if it is caught
+            limit.rlim_cur = (rlim_t)cpuLimit;
+            limit.rlim_max = (rlim_t)cpuLimit + 1;
+            setrlimit(RLIMIT_CPU, &limit);
+        }
+        execvp(argv[0], &argv[0]);
+        _exit(127);
+    }
+
+    if (pipes[1] >= 0)
+        close(pipes[1]);
+    if (inputs[0] >= 0)
+        close(inputs[0]);
+    if (errors[1] >= 0)
+        close(errors[1]);
+    inputPipe = inputs[1];
+    if (pid < 0)
+    {
+        if (pipes[0] >= 0)
+            close(pipes[0]);
+        if (errors[0] >= 0)
+            close(errors[0]);
+        closeInput();
+        return false;
+    }
+    outputPipe = pipes[0];
+    errorPipe = errors[0];
+#endif
+
+    lock_guard<mutex> guard(stateLock);
+    started = true;
+    alive = true;
+    return true;
+}
+
+/**
+ * Reads the captured standard output of the child until it closes
+ */
+void Process::readOutput()
+{
+    char buffer[4096];
+#ifdef _WIN32
+    if (!outputPipe)
+        return;
+    DWORD count = 0;
+    while (ReadFile(outputPipe, buffer, sizeof(buffer), &count, NULL) && count > 0)
+        output.append(buffer, count);
+    CloseHandle(outputPipe);
+    outputPipe = NULL;
+#else
+    if (outputPipe < 0)
+        return;
+    ssize_t count;
+    while ((count = read(outputPipe, buffer, sizeof(buffer))) != 0)
+    {
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        output.append(buffer, count);
+    }
+    close(outputPipe);
+    outputPipe = -1;
+#endif
+}
+
+/**
+ * Reads the standard error of the child until it closes, handing
+ * each line to the error handler as soon as it is complete
+ */
+void Process::readErrors()
+{
+    char buffer[1024];
+    string line;
+    while (true)
+    {
+#ifdef _WIN32
+        DWORD count = 0;
+        if (!ReadFile(errorPipe, buffer, sizeof(buffer), &count, NULL) || count == 0)
+            break;
+#else
+        ssize_t count = read(errorPipe, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+#endif
+        for (size_t i = 0; i < (size_t)count; i++)
+        {
+            if (buffer[i] != '\n' && buffer[i] != '\r')
+                line += buffer[i];
+            else if (!line.empty())
+            {
+                errorHandler(line, errorData);
+                line.clear();
+            }
+        }
+    }
+    if (!line.empty())
+        errorHandler(line, errorData);
+
+#ifdef _WIN32
+    CloseHandle(errorPipe);
+    errorPipe = NULL;
+#else
+    close(errorPipe);
+    errorPipe = -1;
+#endif
+}
+
+/**
+ * Waits for the child to exit
+ * @return the exit code of the child, or SPAWN_FAILED if it never started
+ */
+int Process::wait()
+{
+    if (!started || finished)
+        return exitCode;
+
+    closeInput();
+
+    // The watchdog kills the child at the timeout or once it is cancelled,
+    // which also ends the read of its output. It is stopped once the child
+    // has exited but before the child is reaped, so that it can never signal
+    // a reused pid
+    mutex watchdogLock;
+    condition_variable exited;
+    bool hasExited = false;
+    thread watchdog;
+    if (timeoutSeconds > 0 || cancel)
+        watchdog = thread([&]() {
+            unique_lock<mutex> guard(watchdogLock);
+            chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(timeoutSeconds);
+            chrono::milliseconds step = cancel ? chrono::milliseconds(CANCEL_POLL_MILLISECONDS)
+                                               : chrono::milliseconds(timeoutSeconds * 1000LL);
+            while (!exited.wait_for(guard, step, [&]() { return hasExited; }))
+            {
+                if (cancel && cancel->load())
+                {
+                    cancelled = true;
+                    terminate();
+                    return;
+                }
+                if (timeoutSeconds > 0 && chrono::steady_clock::now() >= deadline)
+                {
+                    timedOut = true;
+                    terminate();
+                    return;
+                }
+            }
+        });
+
+    thread errorReader;
+#ifdef _WIN32
+    if (errorPipe)
+#else
+    if (errorPipe >= 0)
+#endif
+        errorReader = thread(&Process::readErrors, this);
+
+    readOutput();
+    if (errorReader.joinable())
+        errorReader.join();
+
+#ifdef _WIN32
+    WaitForSingleObject(processHandle, INFINITE);
+#else
+    siginfo_t information;
+    while (waitid(P_PID, pid, &information, WEXITED | WNOWAIT) < 0 && errno == EINTR)
+        ;
+#endif
+    {
+        lock_guard<mutex> guard(stateLock);
+        alive = false;
+    }
+
+    if (watchdog.joinable())
+    {
+        {
+            lock_guard<mutex> guard(watchdogLock);
+            hasExited = true;
+        }
+        exited.notify_one();
+        watchdog.join();
+    }
+
+#ifdef _WIN32
+    DWORD code = 0;
+    GetExitCodeProcess(processHandle, &code);
+    exitCode = (int)code;
+
+    FILETIME creation, exitTime, kernel, user;
+    if (GetProcessTimes(processHandle, &creation, &exitTime, &kernel, &user))
+        cpuTime = (((unsigned long long)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+                   ((unsigned long long)user.dwHighDateTime << 32 | user.dwLowDateTime)) / 1e7;
+
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(processHandle, &counters, sizeof(counters)))
+        peakRSS = counters.PeakWorkingSetSize;
+#else
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR)
+        ;
+
+    if (WIFEXITED(status))
+        exitCode = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+    {
+        termSignal = WTERMSIG(status);
+        exitCode = 128 + termSignal;
+    }
+    cpuTime = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+              (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+#ifdef __APPLE__
+    peakRSS = (size_t)usage.ru_maxrss;
+#else
+    peakRSS = (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+
+    finished = true;
+    return exitCode;
+}
+
+/**
+ * Writes to the standard input of an interactive child
+ * @param text - the text to write
+ * @return true if it was written, false if the child has closed its input
+ */
+bool Process::writeInput(const string text)
+{
+    size_t written = 0;
+#ifdef _WIN32
+    while (inputPipe && written < text.size())
+    {
+        DWORD count = 0;
+        if (!WriteFile(inputPipe, text.data() + written, (DWORD)(text.size() - written), &count, NULL))
+            return false;
+        written += count;
+    }
+#else
+    while (inputPipe >= 0 && written < text.size())
+    {
+        ssize_t count = write(inputPipe, text.data() + written, text.size() - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        written += count;
+    }
+#endif
+    return written == text.size();
+}
+
+/**
+ * Reads one line from the standard output of an interactive child
+ * @param line - set to the line, without its newline
+ * @return true if a line was read, false if the child closed its output first
+ */
+bool Process::readLine(string &line)
+{
+    char buffer[4096];
+    size_t end;
+    while ((end = output.find('\n')) == string::npos)
+    {
+#ifdef _WIN32
+        DWORD count = 0;
+        if (!outputPipe || !ReadFile(outputPipe, buffer, sizeof(buffer), &count, NULL) || count == 0)
+            return false;
+#else
+        if (outputPipe < 0)
+            return false;
+        ssize_t count = read(outputPipe, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+#endif
+        output.append(buffer, count);
+    }
+    line = output.substr(0, end);
+    output.erase(0, end + 1);
+    if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+    return true;
+}
+
+/**
+ * Closes the standard input of an interactive child, which tells it to finish
+ */
+void Process::closeInput()
+{
+#ifdef _WIN32
+    if (inputPipe)
+        CloseHandle(inputPipe);
+    inputPipe = NULL;
+#else
+    if (inputPipe >= 0)
+        close(inputPipe);
+    inputPipe = -1;
+#endif
+}
+
+/**
+ * Kills the child if it is still running; wait() must still be called
+ */
+void Process::terminate()
+{
+    if (!started || finished)
+        return;
+#ifdef _WIN32
+    TerminateProcess(processHandle, 1);
+#else
+    ::kill(pid, SIGKILL);
+#endif
+}
+
+/**
+ * Waits for a child that is still running, then makes the Process
+ * ready to start() again with the same program, arguments and limits
+ */
+void Process::reset()
+{
+    if (started && !finished)
+        wait();
+#ifdef _WIN32
+    if (processHandle)
+        CloseHandle(processHandle);
+    processHandle = NULL;
+    if (jobHandle)
+        CloseHandle(jobHandle);
+    jobHandle = NULL;
+#else
+    pid = -1;
+#endif
+    started = false;
+    finished = false;
+    exitCode = SPAWN_FAILED;
+    termSignal = 0;
+    timedOut = false;
+    cancelled = false;
+    cpuTime = 0;
+    peakRSS = 0;
+    output.clear();
+}
+
+/**
+ * @return true if the child has been started and has not exited yet
+ */
+bool Process::isRunning()
+{
+    if (!started || finished)
+        return false;
+#ifdef _WIN32
+    return WaitForSingleObject(processHandle, 0) == WAIT_TIMEOUT;
+#else
+    return kill(pid, 0) == 0 && getCurrentRSS() > 0;
+#endif
+}
+
+/**
+ * @return the program to run
+ */
+const string Process::getExecutable() const
+{
+    return theExecutable;
+}
+
+/**
+ * @return the arguments to run the program with
+ */
+const vector<string> Process::getArguments() const
+{
+    return theArguments;
+}
+
+/**
+ * @return the executable and arguments joined and quoted as a single command line
+ */
+const string Process::getCommandLine() const
+{
+    string commandLine = quoteArgument(theExecutable);
+    for (size_t i = 0; i < theArguments.size(); i++)
+        commandLine += " " + quoteArgument(theArguments[i]);
+    return commandLine;
+}
+
+/**
+ * @return the captured standard output (empty unless capture was requested)
+ */
+const string Process::getOutput() const
+{
+    return output;
+}
+
+/**
+ * @return the file the standard output of the child is written to, "" for none
+ */
+const string Process::getOutputFile() const
+{
+    return outputFile;
+}
+
+/**
+ * @return the exit code of the child (128 + signal number if it was killed)
+ */
+const int Process::getExitCode() const
+{
+    return exitCode;
+}
+
+/**
+ * @return true if the child has been started since the last reset()
+ */
+const bool Process::hasStarted() const
+{
+    return started;
+}
+
+/**
+ * @return the signal that killed the child, 0 if it exited or on Windows
+ */
+const int Process::getSignal() const
+{
+    return termSignal;
+}
+
+/**
+ * @return true if wait() killed the child at its timeout
+ */
+const bool Process::hasTimedOut() const
+{
+    return timedOut;
+}
+
+/**
+ * @return true if wait() killed the child because its cancel flag was set
+ */
+const bool Process::wasCancelled() const
+{
+    return cancelled;
+}
+
+/**
+ * @return the user and system CPU time of the child in seconds, known once it has exited
+ */
+const double Process::getCPUTime() const
+{
+    return cpuTime;
+}
+
+/**
+ * Samples the resident set size of the running child
+ * Safe to call from another thread while the child is started, waited
+ * for or reset
+ * @return the resident set size in bytes, or 0 if it is not running or unknown
+ */
+const size_t Process::getCurrentRSS() const
+{
+    lock_guard<mutex> guard(stateLock);
+    if (!alive)
+        return 0;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(processHandle, &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#else
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE * statm = fopen(path, "r");
+    if (!statm)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    int fields = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    if (fields != 2)
+        return 0;
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/**
+ * @return the peak resident set size of the child in bytes, known once it has exited
+ */
+const size_t Process::getPeakRSS() const
+{
+    return peakRSS;
+}
+
+/**
+ * @return the amount of physical memory installed in bytes, or 0 if unknown
+ */
+const size_t Process::getPhysicalMemory()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return (size_t)status.ullTotalPhys;
+    return 0;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0)
+        return 0;
+    return (size_t)pages * (size_t)pageSize;
+#endif
+}
+
+/**
+ * Samples the resident set size of this process, for work that is
+ * done here rather than in a child
+ * @return the resident set size in bytes, or 0 if it is unknown
+ */
+const size_t Process::getOwnRSS()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#else
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    int fields = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    if (fields != 2)
+        return 0;
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/**
+ * Names a temporary file that no other call, and no other running copy
+ * of the program, is given. The file is not created
+ * @param suffix - the end of the name, for example ".dark.pgm"
+ * @param directory - the directory of the file, "" for the system's temporary
+ *                    directory ($TMPDIR or /tmp, or the user's temporary folder on Windows)
+ * @return the path of the file
+ */
+const string Process::getTemporaryFilename(const string suffix, const string directory)
+{
+    static atomic<unsigned int> sequence(0);
+
+    string path = directory;
+#ifdef _WIN32
+    if (path.empty())
+    {
+        char temporary[MAX_PATH + 1];
+        DWORD length = GetTempPathA(sizeof(temporary), temporary);
+        path = length > 0 && length < sizeof(temporary) ? string(temporary, length) : ".";
+    }
+    unsigned long processId = GetCurrentProcessId();
+#else
+    const char * temporary = getenv("TMPDIR");
+    if (path.empty())
+        path = temporary && *temporary ? temporary : "/tmp";
+    unsigned long processId = (unsigned long)getpid();
+#endif
+    if (path.find_last_of("/\\") != path.size() - 1)
+        path += "/";
+
+    ostringstream name(ostringstream::out);
+    name << path << "dcraw-fltk." << processId << "." << sequence++ << suffix;
+    return name.str();
+}
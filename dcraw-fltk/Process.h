@@ -0,0 +1,129 @@
+/**
+ * Process.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <mutex>
+#include <atomic>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#endif
+
+using namespace std;
+
+// Called with each line the child writes to its standard error
+typedef void (*LineHandler)(const string line, void * data);
+
+class Process
+{
+    public:
+        Process();
+        Process(const string theExecutable, const vector<string> theArguments);
+        ~Process();
+
+        void setExecutable(const string theExecutable);
+        void setArguments(const vector<string> theArguments);
+        void addArgument(const string argument);
+        void setCaptureOutput(const bool captureOutput);
+        void setOutputFile(const string filename);
+        void setInteractive(const bool interactive);
+        void setTimeout(const int seconds);
+        void setCancel(const atomic<bool> * cancel);
+        void setMemoryLimit(const size_t bytes);
+        void setCPULimit(const int seconds);
+        void setErrorHandler(LineHandler handler, void * data);
+
+        bool start();
+        int wait();
+        bool isRunning();
+        bool writeInput(const string text);
+        bool readLine(string &line);
+        void closeInput();
+        void terminate();
+        void reset();
+
+        const string getExecutable() const;
+        const vector<string> getArguments() const;
+        const string getCommandLine() const;
+        const string getOutput() const;
+        const string getOutputFile() const;
+        const bool hasStarted() const;
+        const int getExitCode() const;
+        const int getSignal() const;
+        const bool hasTimedOut() const;
+        const bool wasCancelled() const;
+        const double getCPUTime() const;
+        const size_t getCurrentRSS() const;
+        const size_t getPeakRSS() const;
+
+        static const size_t getPhysicalMemory();
+        static const size_t getOwnRSS();
+        static const string getTemporaryFilename(const string suffix, const string directory = "");
+
+        // Exit code reported when the child could not be started
+        const static int SPAWN_FAILED = -1;
+        // Milliseconds between looks at the cancel flag while waiting
+        const static int CANCEL_POLL_MILLISECONDS = 100;
+
+    private:
+        Process(Process &toCopy);
+        void readOutput();
+        void readErrors();
+
+        string theExecutable;
+        vector<string> theArguments;
+        bool captureOutput;
+        // File the standard output of the child is written to, "" for none
+        string outputFile;
+        // True to pipe our input to the child and read its output a line at a time
+        bool interactive;
+        // Wall clock and CPU seconds before the child is killed, 0 for no limit
+        int timeoutSeconds;
+        // Set by another thread to kill the child, NULL for none
+        const atomic<bool> * cancel;
+        int cpuLimit;
+        // Address space the child may allocate in bytes, 0 for no limit
+        size_t memoryLimit;
+        // Receives the standard error of the child, NULL to inherit ours
+        LineHandler errorHandler;
+        void * errorData;
+        bool started;
+        bool finished;
+        int exitCode;
+        // Signal that ended the child, 0 if it exited
+        int termSignal;
+        bool timedOut;
+        // True if wait() killed the child because the cancel flag was set
+        bool cancelled;
+        double cpuTime;
+        size_t peakRSS;
+        string output;
+        // True from start() until the child is reaped, so that other threads
+        // sample its memory only while its pid or handle is still its own
+        bool alive;
+        mutable mutex stateLock;
+
+#ifdef _WIN32
+        HANDLE processHandle;
+        HANDLE outputPipe;
+        HANDLE inputPipe;
+        HANDLE errorPipe;
+        // Job Object that holds the limits of the child
+        HANDLE jobHandle;
+#else
+        pid_t pid;
+        int outputPipe;
+        int inputPipe;
+        int errorPipe;
+#endif
+};
+#endif
@@ -0,0 +1,738 @@
+/**
+ * class RawProbe
+ * Recognises raw files from their headers alone, without running
+ * dcraw: the format, camera, size of the sensor data and its
+ * compression, and whether the file is cut short or is not a raw
+ * file at all
+ *
+ * Only the first PROBE_BYTES of a file are read up front. TIFF
+ * directories and the few tags of them that matter are read where
+ * they lie, so probing a directory of raw files reads a few kilobytes
+ * of each and several files are probed at once (see probeAll())
+ *
+ * TIFF based raw files (CR2, NEF, ARW, DNG, PEF, ORF, RW2, ...), CRW,
+ * RAF and MRW are understood. X3F is recognised by its signature
+ * only, and anything unrecognised is left for dcraw to decide, since
+ * dcraw knows many headerless formats by their size alone
+ *
+ * PUBLIC FEATURES:
+ *       RawProbe();
+ *       ~RawProbe();
+ *       Header probe(string filename);
+ *       static vector<Header> probeAll(vector<string> filenames, int threads);
+ *       static string getFilePattern();
+ *       static string getStatusName(Status status);
+ *       static string getCompressionName(int compression);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "RawProbe.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+// The TIFF tags whose values are read; the rest (maker notes, colour
+// matrices, linearization tables) are skipped without reading them
+static const int WANTED_TAGS[] = { 2, 3, 254, 256, 257, 258, 259, 271, 272, 273, 279, 322, 323, 324, 325, 330, 50706, 50752 };
+
+// The raw format of a TIFF based file, from the start of its camera make in capitals
+static const char * const MAKE_FORMATS[][2] =
+{
+    { "NIKON", "NEF" }, { "SONY", "ARW" }, { "PENTAX", "PEF" }, { "RICOH", "PEF" }, { "SAMSUNG", "SRW" },
+    { "KODAK", "DCR" }, { "EASTMAN KODAK", "DCR" }, { "HASSELBLAD", "3FR" }, { "LEAF", "MOS" },
+    { "MAMIYA", "MOS" }, { "PHASE ONE", "IIQ" }, { "SEIKO EPSON", "ERF" }, { "LEICA", "RWL" },
+    { "OLYMPUS", "ORF" }, { "PANASONIC", "RW2" }
+};
+
+/**
+ * @return true if nothing will be decoded from the file
+ */
+const bool RawProbe::Header::isRejected() const
+{
+    return status != RAW && status != UNKNOWN;
+}
+
+/**
+ * @return a one line description, for example
+ *         "CR2, Canon EOS 5D Mark II, 5792x3804, 14 bit lossless JPEG"
+ */
+const string RawProbe::Header::describe() const
+{
+    ostringstream description(ostringstream::out);
+    if (status == UNKNOWN)
+        return "not recognised, left to dcraw";
+    if (isRejected())
+    {
+        description << getStatusName(status);
+        if (!format.empty())
+            description << " " << format;
+        description << ", " << problem;
+        return description.str();
+    }
+
+    description << format;
+    // Models usually repeat the first word of the make: NIKON CORPORATION, NIKON D850
+    string brand = make.substr(0, make.find(' '));
+    if (!model.empty() && (brand.empty() || model.compare(0, brand.size(), brand) == 0))
+        description << ", " << model;
+    else if (!make.empty())
+        description << ", " << make << (model.empty() ? "" : " ") << model;
+    if (width > 0 && height > 0)
+        description << ", " << width << "x" << height;
+    if (bits > 0 || compression > 0)
+        description << ",";
+    if (bits > 0)
+        description << " " << bits << " bit";
+    if (compression > 0)
+        description << " " << getCompressionName(compression);
+    return description.str();
+}
+
+/**
+ * Constructor
+ */
+RawProbe::RawProbe()
+{
+    fileSize = 0;
+    bytesRead = 0;
+    bigEndian = false;
+}
+
+/**
+ * Destructor
+ */
+RawProbe::~RawProbe()
+{}
+
+/**
+ * Reads what the headers of a file say about it
+ * @param filename - the file
+ * @return what was found, with status UNREADABLE if the file cannot be read
+ */
+const RawProbe::Header RawProbe::probe(const string filename)
+{
+    Header header;
+    header.filename = filename;
+    header.status = UNKNOWN;
+    header.width = 0;
+    header.height = 0;
+    header.bits = 0;
+    header.compression = 0;
+    header.fileSize = 0;
+    header.bytesRead = 0;
+
+    file.close();
+    file.clear();
+    file.open(filename.c_str(), ios::in | ios::binary);
+    if (!file)
+    {
+        header.status = UNREADABLE;
+        header.problem = "cannot open the file";
+        return header;
+    }
+    file.seekg(0, ios::end);
+    fileSize = (size_t)file.tellg();
+    file.seekg(0, ios::beg);
+    head.resize(min(fileSize, (size_t)PROBE_BYTES));
+    bytesRead = head.size();
+    bigEndian = false;
+    header.fileSize = fileSize;
+    if (!head.empty() && !file.read((char *)&head[0], head.size()))
+    {
+        header.status = UNREADABLE;
+        header.problem = "cannot read the file";
+        return header;
+    }
+
+    const unsigned char * start = head.empty() ? NULL : &head[0];
+    size_t length = head.size();
+    if (length == 0)
+    {
+        header.status = NOT_RAW;
+        header.problem = "the file is empty";
+    }
+    else if (length >= 14 && memcmp(start, "II", 2) == 0 && memcmp(start + 6, "HEAPCCDR", 8) == 0)
+    {
+        header.status = RAW;
+        header.format = "CRW";
+        header.make = "Canon";
+        size_t heap = get(2, 4);
+        if (heap >= fileSize)
+        {
+            header.status = TRUNCATED;
+            header.problem = "the file ends before its data";
+        }
+        else
+            probeCIFF(heap, fileSize - heap, 0, header);
+    }
+    else if (length >= 8 && (memcmp(start, "II", 2) == 0 || memcmp(start, "MM", 2) == 0))
+        probeTIFF(header);
+    else if (length >= 108 && memcmp(start, "FUJIFILM", 8) == 0)
+        probeRAF(header);
+    else if (length >= 8 && memcmp(start, "\0MRM", 4) == 0)
+        probeMRW(header);
+    else if (length >= 4 && memcmp(start, "FOVb", 4) == 0)
+    {
+        header.status = RAW;
+        header.format = "X3F";
+        header.make = "SIGMA";
+    }
+    else if (length >= 12 && memcmp(start + 4, "ftypcrx ", 8) == 0)
+    {
+        header.status = UNSUPPORTED;
+        header.format = "CR3";
+        header.make = "Canon";
+        header.problem = "which dcraw cannot decode";
+    }
+    else if (length >= 3 && start[0] == 0xff && start[1] == 0xd8 && start[2] == 0xff)
+    {
+        header.status = NOT_RAW;
+        header.problem = "a JPEG image";
+    }
+    else if (length >= 4 && memcmp(start, "\x89PNG", 4) == 0)
+    {
+        header.status = NOT_RAW;
+        header.problem = "a PNG image";
+    }
+    else if (length >= 4 && memcmp(start, "GIF8", 4) == 0)
+    {
+        header.status = NOT_RAW;
+        header.problem = "a GIF image";
+    }
+
+    header.bytesRead = bytesRead;
+    file.close();
+    return header;
+}
+
+/**
+ * Probes files on several threads at once
+ * @param filenames - the files
+ * @param threads - the most files to probe at once
+ * @return what was found in each file, in the same order
+ */
+const vector<RawProbe::Header> RawProbe::probeAll(const vector<string> filenames, const int threads)
+{
+    vector<Header> headers(filenames.size());
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    int count = (int)min((size_t)max(threads, 1), filenames.size());
+    for (int t = 0; t < count; t++)
+        workers.push_back(thread([&]()
+        {
+            RawProbe theProbe;
+            for (size_t i = next++; i < filenames.size(); i = next++)
+                headers[i] = theProbe.probe(filenames[i]);
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    return headers;
+}
+
+/**
+ * @return a file name pattern, as fl_filename_match() takes it, for the
+ *         extensions of the raw formats dcraw decodes
+ */
+const string RawProbe::getFilePattern()
+{
+    return "*.{3fr,arw,bay,cap,cr2,crw,cs1,dc2,dcr,dng,erf,fff,iiq,k25,kdc,mdc,mef,mos,mrw,nef,nrw,orf,"
+           "pef,ptx,pxn,raf,raw,rw2,rwl,rwz,sr2,srf,srw,sti,x3f}";
+}
+
+/**
+ * @param status - a probe status
+ * @return its name, for example "truncated"
+ */
+const string RawProbe::getStatusName(const Status status)
+{
+    switch (status)
+    {
+        case RAW:         return "raw";
+        case UNKNOWN:     return "unknown";
+        case NOT_RAW:     return "not raw";
+        case TRUNCATED:   return "truncated";
+        case UNSUPPORTED: return "unsupported";
+        case UNREADABLE:  return "unreadable";
+    }
+    return "unknown";
+}
+
+/**
+ * @param compression - a TIFF compression value
+ * @return what it is called, for example "lossless JPEG"
+ */
+const string RawProbe::getCompressionName(const int compression)
+{
+    switch (compression)
+    {
+        case 1:     return "uncompressed";
+        case 7:     return "lossless JPEG";
+        case 8:     return "Deflate";
+        case 262:   return "Kodak";
+        case 32767: return "Sony";
+        case 32769:
+        case 32770:
+        case 32773: return "packed";
+        case 34316: return "Panasonic";
+        case 34713: return "Nikon Huffman";
+        case 34892: return "lossy JPEG";
+        case 52546: return "JPEG XL";
+        case 65000: return "Kodak";
+        case 65535: return "Pentax Huffman";
+    }
+    return "compression " + to_string(compression);
+}
+
+/**
+ * Reads part of the file, from what was read up front if it is there
+ * @param offset - where to start
+ * @param length - how many bytes
+ * @param bytes - set to the bytes
+ * @return true if the file has all of them, false otherwise
+ */
+const bool RawProbe::fetch(const size_t offset, const size_t length, vector<unsigned char> &bytes)
+{
+    if (offset > fileSize || length > fileSize - offset)
+        return false;
+    bytes.resize(length);
+    if (length == 0)
+        return true;
+    if (offset + length <= head.size())
+    {
+        memcpy(&bytes[0], &head[offset], length);
+        return true;
+    }
+    file.clear();
+    file.seekg((streamoff)offset, ios::beg);
+    if (!file.read((char *)&bytes[0], length))
+        return false;
+    bytesRead += length;
+    return true;
+}
+
+/**
+ * @param offset - where a number lies in the file
+ * @param bytes - its size, 1, 2 or 4
+ * @return the number, in the file's byte order, or 0 if it lies past the end
+ */
+const unsigned int RawProbe::get(const size_t offset, const int bytes)
+{
+    if (offset + bytes <= head.size())
+        return get(&head[offset], bytes);
+    vector<unsigned char> number;
+    return fetch(offset, bytes, number) ? get(&number[0], bytes) : 0;
+}
+
+/**
+ * @param data - a number
+ * @param bytes - its size, 1, 2 or 4
+ * @return the number, in the file's byte order
+ */
+const unsigned int RawProbe::get(const unsigned char * data, const int bytes) const
+{
+    unsigned int value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (unsigned int)data[bigEndian ? i : bytes - 1 - i] << (8 * (bytes - 1 - i));
+    return value;
+}
+
+/**
+ * Reads the values of the wanted tags of a TIFF directory
+ * @param offset - where the directory starts
+ * @param theDirectory - filled with the tags
+ * @return the offset of the next directory in the chain, 0 if there is none
+ */
+const size_t RawProbe::readDirectory(const size_t offset, Directory &theDirectory)
+{
+    vector<unsigned char> entries;
+    if (offset < 8 || !fetch(offset, 2, entries))
+        return 0;
+    unsigned int count = get(&entries[0], 2);
+    if (count == 0 || !fetch(offset + 2, (size_t)count * 12 + 4, entries))
+        return 0;
+
+    const int * wantedEnd = WANTED_TAGS + sizeof(WANTED_TAGS) / sizeof(WANTED_TAGS[0]);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const unsigned char * entry = &entries[i * 12];
+        int tag = (int)get(entry, 2);
+        int type = (int)get(entry + 2, 2);
+        unsigned int values = get(entry + 4, 4);
+        int bytes = (type == 1 || type == 2 || type == 6 || type == 7) ? 1 : (type == 3 || type == 8) ? 2 : (type == 4 || type == 9) ? 4 : 0;
+        if (!bytes || values == 0 || values > (unsigned int)MAX_VALUES || find(WANTED_TAGS, wantedEnd, tag) == wantedEnd)
+            continue;
+
+        size_t size = (size_t)values * bytes;
+        vector<unsigned char> outside;
+        const unsigned char * data = entry + 8;
+        if (size > 4)
+        {
+            if (!fetch(get(entry + 8, 4), size, outside))
+                continue;
+            data = &outside[0];
+        }
+        vector<unsigned int> &theValues = theDirectory[tag];
+        theValues.resize(values);
+        for (unsigned int v = 0; v < values; v++)
+            theValues[v] = get(data + (size_t)v * bytes, bytes);
+    }
+    return get(&entries[(size_t)count * 12], 4);
+}
+
+/**
+ * @param theDirectory - a TIFF directory
+ * @param tag - the tag
+ * @param missing - what to return if the directory has no value for the tag
+ * @return the tag's first value
+ */
+const unsigned int RawProbe::getValue(const Directory &theDirectory, const int tag, const unsigned int missing) const
+{
+    Directory::const_iterator found = theDirectory.find(tag);
+    return found == theDirectory.end() || found->second.empty() ? missing : found->second[0];
+}
+
+/**
+ * @param theDirectory - a TIFF directory
+ * @param tag - a tag of text
+ * @return the text up to its first null, without trailing spaces
+ */
+const string RawProbe::getText(const Directory &theDirectory, const int tag) const
+{
+    string text;
+    Directory::const_iterator found = theDirectory.find(tag);
+    if (found != theDirectory.end())
+        for (size_t i = 0; i < found->second.size() && found->second[i] != 0; i++)
+            text += (char)found->second[i];
+    size_t last = text.find_last_not_of(' ');
+    return last == string::npos ? "" : text.substr(0, last + 1);
+}
+
+/**
+ * Probes a file in TIFF form: its directory chain and SubIFDs, the
+ * largest full resolution image among them taken as the sensor data
+ * @param header - filled in
+ */
+void RawProbe::probeTIFF(Header &header)
+{
+    bigEndian = head[0] == 'M';
+    unsigned int magic = get(2, 2);
+    if (magic == 0x4f52 || magic == 0x5352)
+        header.format = "ORF";
+    else if (magic == 0x55)
+        header.format = "RW2";
+    else if (magic != 42)
+        return;
+
+    size_t first = get(4, 4);
+    if (first >= fileSize)
+    {
+        header.status = TRUNCATED;
+        header.problem = "the file ends before its first directory";
+        return;
+    }
+
+    vector<Directory> chain;
+    for (size_t offset = first; offset && (int)chain.size() < MAX_DIRECTORIES; )
+    {
+        Directory theDirectory;
+        offset = readDirectory(offset, theDirectory);
+        if (theDirectory.empty())
+            break;
+        chain.push_back(theDirectory);
+    }
+    if (chain.empty())
+    {
+        header.status = NOT_RAW;
+        header.problem = "a TIFF file without a directory";
+        return;
+    }
+    vector<Directory> directories(chain);
+    for (size_t i = 0; i < directories.size() && (int)directories.size() < MAX_DIRECTORIES; i++)
+    {
+        Directory::const_iterator below = directories[i].find(330);
+        if (below == directories[i].end())
+            continue;
+        vector<unsigned int> offsets = below->second;
+        for (size_t s = 0; s < offsets.size() && (int)directories.size() < MAX_DIRECTORIES; s++)
+        {
+            Directory theDirectory;
+            readDirectory(offsets[s], theDirectory);
+            if (!theDirectory.empty())
+                directories.push_back(theDirectory);
+        }
+    }
+
+    for (size_t i = 0; i < directories.size() && (header.make.empty() || header.model.empty()); i++)
+    {
+        if (header.make.empty())
+            header.make = getText(directories[i], 271);
+        if (header.model.empty())
+            header.model = getText(directories[i], 272);
+    }
+
+    bool isCR2 = head.size() >= 10 && head[8] == 'C' && head[9] == 'R';
+    if (header.format.empty())
+    {
+        if (chain[0].count(50706))
+            header.format = "DNG";
+        else if (isCR2)
+            header.format = "CR2";
+        string make = header.make;
+        transform(make.begin(), make.end(), make.begin(), ::toupper);
+        for (size_t i = 0; header.format.empty() && i < sizeof(MAKE_FORMATS) / sizeof(MAKE_FORMATS[0]); i++)
+            if (make.compare(0, strlen(MAKE_FORMATS[i][0]), MAKE_FORMATS[i][0]) == 0)
+                header.format = MAKE_FORMATS[i][1];
+        if (header.format.empty() && header.make.empty())
+        {
+            header.status = NOT_RAW;
+            header.problem = "a TIFF image without a camera make";
+            return;
+        }
+        if (header.format.empty())
+            header.format = "TIFF";
+    }
+    header.status = RAW;
+
+    if (isCR2)
+    {
+        // The sensor data is in the fourth directory of the chain
+        if (chain.size() < 4)
+        {
+            header.status = TRUNCATED;
+            header.problem = "the directory of the sensor data is missing";
+            return;
+        }
+        probeCR2(chain[3], header);
+        return;
+    }
+
+    int best = -1;
+    size_t bestArea = 0;
+    bool bestFull = false;
+    for (size_t i = 0; i < directories.size(); i++)
+    {
+        // RW2 keeps the sensor size in tags 2 and 3
+        unsigned int width = getValue(directories[i], 256, magic == 0x55 ? getValue(directories[i], 2, 0) : 0);
+        unsigned int height = getValue(directories[i], 257, magic == 0x55 ? getValue(directories[i], 3, 0) : 0);
+        bool full = (getValue(directories[i], 254, 0) & 1) == 0;
+        size_t area = (size_t)width * height;
+        if (area == 0 || getValue(directories[i], 259, 1) == 6 || (bestFull && !full))
+            continue;
+        if ((full && !bestFull) || area > bestArea)
+        {
+            best = (int)i;
+            bestArea = area;
+            bestFull = full;
+        }
+    }
+    if (best < 0)
+        return;
+
+    const Directory &sensor = directories[best];
+    header.width = (int)getValue(sensor, 256, getValue(sensor, 2, 0));
+    header.height = (int)getValue(sensor, 257, getValue(sensor, 3, 0));
+    header.bits = (int)getValue(sensor, 258, 0);
+    header.compression = (int)getValue(sensor, 259, 1);
+    checkExtent(sensor, 273, 279, header);
+    checkExtent(sensor, 324, 325, header);
+    if (header.compression == 52546)
+    {
+        header.status = UNSUPPORTED;
+        header.problem = "JPEG XL compressed, which dcraw cannot decode";
+    }
+}
+
+/**
+ * Probes the sensor data of a CR2 file: its size is that of the
+ * lossless JPEG frame, laid out as dcraw lays it out
+ * @param theDirectory - the fourth directory of the chain
+ * @param header - filled in
+ */
+void RawProbe::probeCR2(const Directory &theDirectory, Header &header)
+{
+    checkExtent(theDirectory, 273, 279, header);
+    size_t offset = getValue(theDirectory, 273, 0);
+    vector<unsigned char> stream;
+    if (offset >= fileSize || !fetch(offset, min((size_t)1024, fileSize - offset), stream)
+        || stream.size() < 4 || stream[0] != 0xff || stream[1] != 0xd8)
+        return;
+
+    // Markers up to the frame header, which JPEG always writes big endian
+    for (size_t at = 2; at + 4 <= stream.size() && stream[at] == 0xff; at += 2 + (stream[at + 2] << 8 | stream[at + 3]))
+    {
+        if (stream[at + 1] == 0xda)
+            break;
+        if (stream[at + 1] != 0xc3 || at + 10 > stream.size())
+            continue;
+        int height = stream[at + 5] << 8 | stream[at + 6];
+        int width = (stream[at + 7] << 8 | stream[at + 8]) * stream[at + 9];
+        if (stream[at + 9] % 2 == 0 && width > 4 * height)
+        {
+            width /= 2;
+            height *= 2;
+        }
+        header.width = width;
+        header.height = height;
+        header.bits = stream[at + 4];
+        header.compression = 7;
+        break;
+    }
+}
+
+/**
+ * Probes one heap of a CRW file and the heaps within it, as dcraw's
+ * parse_ciff() reads them
+ * @param offset - where the heap starts
+ * @param length - its size
+ * @param depth - how many heaps it is within
+ * @param header - filled in
+ */
+void RawProbe::probeCIFF(const size_t offset, const size_t length, const int depth, Header &header)
+{
+    if (depth > 4 || length < 4 || header.isRejected())
+        return;
+
+    // The heap's directory is found from its last four bytes
+    size_t table = offset + get(offset + length - 4, 4);
+    vector<unsigned char> records;
+    unsigned int count = table + 2 <= offset + length ? get(table, 2) : 0;
+    if (count == 0 || table + 2 + (size_t)count * 10 > offset + length || !fetch(table + 2, (size_t)count * 10, records))
+    {
+        header.status = TRUNCATED;
+        header.problem = "a heap directory is missing";
+        return;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        int type = (int)get(&records[i * 10], 2);
+        size_t size = get(&records[i * 10 + 2], 4);
+        size_t at = offset + get(&records[i * 10 + 6], 4);
+        if ((type >> 14) == 0 && at + size > offset + length)
+        {
+            header.status = TRUNCATED;
+            header.problem = "the file ends before its data";
+            return;
+        }
+        if ((type >> 8) == 0x28 || (type >> 8) == 0x30)
+            probeCIFF(at, size, depth + 1, header);
+        else if (type == 0x080a)
+        {
+            // The make and the model, each ending in a null
+            vector<unsigned char> text;
+            if (fetch(at, min(size, (size_t)64), text))
+            {
+                string names(text.begin(), text.end());
+                size_t end = names.find('\0');
+                header.make = names.substr(0, end);
+                if (end != string::npos)
+                    header.model = names.substr(end + 1).c_str();
+            }
+        }
+        else if (type == 0x1031)
+        {
+            header.width = (int)get(at + 2, 2);
+            header.height = (int)get(at + 4, 2);
+        }
+    }
+}
+
+/**
+ * Probes a Fuji RAF file: the camera from its header and the sensor
+ * size from its own directory, as dcraw's parse_fuji() reads it
+ * @param header - filled in
+ */
+void RawProbe::probeRAF(Header &header)
+{
+    bigEndian = true;
+    header.status = RAW;
+    header.format = "RAF";
+    header.make = "FUJIFILM";
+    header.model = string((const char *)&head[0x1c], strnlen((const char *)&head[0x1c], 32));
+
+    size_t jpegEnd = (size_t)get(84, 4) + get(88, 4);
+    size_t sensorEnd = (size_t)get(100, 4) + get(104, 4);
+    if (max(jpegEnd, sensorEnd) > fileSize)
+    {
+        header.status = TRUNCATED;
+        header.problem = "the file ends before its data";
+        return;
+    }
+
+    size_t at = get(92, 4);
+    unsigned int entries = get(at, 4);
+    at += 4;
+    for (unsigned int i = 0; i < entries && i < 256 && at + 4 <= fileSize; i++)
+    {
+        unsigned int tag = get(at, 2);
+        unsigned int size = get(at + 2, 2);
+        if (tag == 0x100)
+        {
+            header.height = (int)get(at + 4, 2);
+            header.width = (int)get(at + 6, 2);
+            break;
+        }
+        at += 4 + size;
+    }
+}
+
+/**
+ * Probes a Minolta MRW file: the sensor size from its PRD block
+ * @param header - filled in
+ */
+void RawProbe::probeMRW(Header &header)
+{
+    bigEndian = true;
+    header.status = RAW;
+    header.format = "MRW";
+    header.make = "Minolta";
+
+    size_t data = (size_t)get(4, 4) + 8;
+    int storedBits = 12;
+    for (size_t at = 8; at + 8 <= data && at + 8 <= head.size(); at += 8 + get(at + 4, 4))
+        if (get(at, 4) == 0x505244)
+        {
+            // After a version: the sensor's height and width, the image's, then the bits stored and used
+            header.height = (int)get(at + 16, 2);
+            header.width = (int)get(at + 18, 2);
+            storedBits = (int)get(at + 24, 1) == 16 ? 16 : 12;
+            header.bits = (int)get(at + 25, 1);
+            break;
+        }
+
+    if (data + (size_t)header.width * header.height * storedBits / 8 > fileSize)
+    {
+        header.status = TRUNCATED;
+        header.problem = "the file ends before its data";
+    }
+}
+
+/**
+ * Checks that the strips or tiles of an image lie within the file
+ * @param theDirectory - the image's directory
+ * @param offsetTag - the tag of their offsets
+ * @param countTag - the tag of their sizes
+ * @param header - marked truncated if one of them does not
+ */
+void RawProbe::checkExtent(const Directory &theDirectory, const int offsetTag, const int countTag, Header &header)
+{
+    Directory::const_iterator offsets = theDirectory.find(offsetTag);
+    Directory::const_iterator counts = theDirectory.find(countTag);
+    if (offsets == theDirectory.end() || counts == theDirectory.end())
+        return;
+
+    size_t end = 0;
+    for (size_t i = 0; i < offsets->second.size() && i < counts->second.size(); i++)
+        end = max(end, (size_t)offsets->second[i] + counts->second[i]);
+    if (end > fileSize)
+    {
+        header.status = TRUNCATED;
+        header.problem = "its data needs " + to_string(end) + " bytes but the file has " + to_string(fileSize);
+    }
+}
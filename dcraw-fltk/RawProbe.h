@@ -0,0 +1,89 @@
+/**
+ * RawProbe.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef RAWPROBE_H
+#define RAWPROBE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstddef>
+
+using namespace std;
+
+class RawProbe
+{
+    public:
+        // What a probe made of a file
+        enum Status { RAW, UNKNOWN, NOT_RAW, TRUNCATED, UNSUPPORTED, UNREADABLE };
+
+        struct Header
+        {
+            string filename;
+            Status status;
+            // Why the file will not decode, "" if nothing is known against it
+            string problem;
+            // CR2, NEF, DNG, ... or "" if the format was not recognised
+            string format;
+            string make;
+            string model;
+            // The size of the sensor data, 0 if the headers do not give it
+            int width;
+            int height;
+            int bits;
+            // The TIFF compression of the sensor data, 0 if not known
+            int compression;
+            size_t fileSize;
+            size_t bytesRead;
+
+            const bool isRejected() const;
+            const string describe() const;
+        };
+
+        RawProbe();
+        ~RawProbe();
+
+        const Header probe(const string filename);
+
+        static const vector<Header> probeAll(const vector<string> filenames, const int threads);
+        static const string getFilePattern();
+        static const string getStatusName(const Status status);
+        static const string getCompressionName(const int compression);
+
+        // Read from the start of every file; anything further is read only as needed
+        const static int PROBE_BYTES = 16384;
+        // The most directories read from one file, against loops in corrupt ones
+        const static int MAX_DIRECTORIES = 64;
+        // The most values read for one tag, enough for the tile offsets of a large DNG
+        const static int MAX_VALUES = 65536;
+
+    private:
+        RawProbe(RawProbe &toCopy);
+
+        // The values of each tag of a TIFF directory, text as one value per byte
+        typedef map< int, vector<unsigned int> > Directory;
+
+        const bool fetch(const size_t offset, const size_t length, vector<unsigned char> &bytes);
+        const unsigned int get(const size_t offset, const int bytes);
+        const unsigned int get(const unsigned char * data, const int bytes) const;
+        const size_t readDirectory(const size_t offset, Directory &theDirectory);
+        const unsigned int getValue(const Directory &theDirectory, const int tag, const unsigned int missing) const;
+        const string getText(const Directory &theDirectory, const int tag) const;
+        void probeTIFF(Header &header);
+        void probeCR2(const Directory &theDirectory, Header &header);
+        void probeCIFF(const size_t offset, const size_t length, const int depth, Header &header);
+        void probeRAF(Header &header);
+        void probeMRW(Header &header);
+        void checkExtent(const Directory &theDirectory, const int offsetTag, const int countTag, Header &header);
+
+        ifstream file;
+        // The first PROBE_BYTES of the file, or all of it if it is shorter
+        vector<unsigned char> head;
+        size_t fileSize;
+        size_t bytesRead;
+        bool bigEndian;
+};
+#endif
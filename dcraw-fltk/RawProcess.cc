@@ -5,6 +5,17 @@
  * for the dcraw raw image conversion program
  * Utilises the FLTK libraries
  *
+ * Runs without the GUI when given one of the command line
+ * modes handled by CommandLine
+ *
+ * The GUI also takes:
+ *   --record file          record the interactions with the settings to a file
+ *   --replay file [--latency-budget ms]
+ *                          replay a recording, report the input to preview
+ *                          latency percentiles and exit, failing if the
+ *                          95th percentile is over the budget
+ * (see InteractionRecorder)
+ *
  * PUBLIC FEATURES:
  *	 int main(int argc, char **argv)
  *
@@ -12,48 +23,116 @@
  */
 
 #include "Image.h"
+#include "CommandLine.h"
 #include "SettingsGroup.h"
 #include "PreviewGroup.h"
+#include "Filmstrip.h"
+#include "HistogramGroup.h"
+#include "InteractionRecorder.h"
 #include <Fl/Fl.H>
 #include <Fl/Fl_Window.H>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
 
 using namespace std;
 
 // Window size constants
 const static int WIDTH = 1200;
-const static int HEIGHT = 800;
+const static int HEIGHT = 940;
 const static int X = 500;
 const static int Y = 200;
 const static int SETTINGS_WIDTH = 480;
-const static int SETTINGS_HEIGHT = 780;
+const static int SETTINGS_HEIGHT = 740;
 const static int SETTINGS_X = 10;
 const static int SETTINGS_Y = 10;
 const static int PREVIEW_WIDTH = 680;
 const static int PREVIEW_HEIGHT = 780;
 const static int PREVIEW_X = 500;
 const static int PREVIEW_Y = 10;
+const static int FILMSTRIP_WIDTH = 680;
+const static int FILMSTRIP_HEIGHT = 140;
+const static int FILMSTRIP_X = 500;
+const static int FILMSTRIP_Y = 800;
+const static int HISTOGRAM_WIDTH = 480;
+const static int HISTOGRAM_HEIGHT = 170;
+const static int HISTOGRAM_X = 10;
+const static int HISTOGRAM_Y = 760;
 
 int main(int argc, char **argv)
 {
+    if (CommandLine::isCommand(argc, argv))
+        return CommandLine::run(argc, argv);
+
+    // Take out the options FLTK does not know
+    string recordFile, replayFile;
+    double latencyBudget = 0;
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordFile = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayFile = argv[++i];
+        else if (strcmp(argv[i], "--latency-budget") == 0 && i + 1 < argc)
+            latencyBudget = atof(argv[++i]);
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    InteractionRecorder theRecorder;
+    if (!replayFile.empty() && !theRecorder.load(replayFile))
+    {
+        cerr << "Cannot read the recording " << replayFile << endl;
+        return 1;
+    }
+    if (!recordFile.empty() && !theRecorder.startRecording(recordFile))
+    {
+        cerr << "Cannot record to " << recordFile << endl;
+        return 1;
+    }
+
+    // Thumbnails are loaded on background threads, which wake the GUI with Fl::awake
+    Fl::lock();
+
     Fl_Window * theWindow = new Fl_Window(X,Y,WIDTH,HEIGHT,"dcraw-fltk");
 
     fl_register_images();
 
     PreviewGroup * thePreview = new PreviewGroup(PREVIEW_X,PREVIEW_Y,PREVIEW_WIDTH,PREVIEW_HEIGHT,"");
+    Filmstrip * theFilmstrip = new Filmstrip(FILMSTRIP_X,FILMSTRIP_Y,FILMSTRIP_WIDTH,FILMSTRIP_HEIGHT,"");
     SettingsGroup * theSettings = new SettingsGroup(SETTINGS_X,SETTINGS_Y,SETTINGS_WIDTH,SETTINGS_HEIGHT,"");
+    HistogramGroup * theHistogram = new HistogramGroup(HISTOGRAM_X,HISTOGRAM_Y,HISTOGRAM_WIDTH,HISTOGRAM_HEIGHT,"");
 
     theSettings->setImage(new Image());
     theSettings->setPreview(thePreview);
+    theSettings->setFilmstrip(theFilmstrip);
+    theSettings->setHistogram(theHistogram);
+    if (!recordFile.empty())
+        theSettings->setRecorder(&theRecorder);
 
     theWindow->add(theSettings);
     theWindow->end();
     theWindow->show(argc, argv);
 
-    Fl::run();
+    int exitCode = 0;
+    if (replayFile.empty())
+        Fl::run();
+    else
+    {
+        theWindow->wait_for_expose();
+        theRecorder.replay(theSettings, thePreview);
+        cout << theRecorder.describe() << endl;
+        if (theRecorder.getFailures() > 0 || (latencyBudget > 0 && theRecorder.getPercentile(95) > latencyBudget))
+            exitCode = 1;
+    }
 
     delete theSettings;
+    delete theFilmstrip;
+    delete theHistogram;
     delete thePreview;
     delete theWindow;
 
-    return 0;
+    return exitCode;
 }
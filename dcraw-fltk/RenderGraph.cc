@@ -0,0 +1,279 @@
+/**
+ * class RenderNode
+ * One stage of a render: it turns the outputs of its input
+ * nodes into a new PixelBuffer according to its parameters
+ * A node is only a description of the work; its output is kept
+ * by the RenderGraph that evaluates it
+ *
+ * PUBLIC FEATURES:
+ *       RenderNode(string name);
+ *       virtual ~RenderNode();
+ *       void addInput(RenderNode * input);
+ *       vector<RenderNode *> getInputs();
+ *       string getName();
+ *       virtual string getParameters() = 0;
+ *       virtual bool compute(vector< shared_ptr<PixelBuffer> > &inputs, PixelBuffer &output) = 0;
+ *
+ * class RenderGraph
+ * Evaluates a graph of RenderNodes, keeping the output of every
+ * node under a key spelling out its name, its parameters and the keys
+ * of its inputs, so two different nodes can never share an output
+ * Rendering a node only computes the stages whose key is not
+ * cached yet, so changing a parameter re-runs that stage and the
+ * stages after it, but none of the stages before it
+ * Outputs are evicted, least recently used first, once they take
+ * more than the memory budget
+ *
+ * PUBLIC FEATURES:
+ *       RenderGraph(size_t memoryBudget);
+ *       ~RenderGraph();
+ *       shared_ptr<PixelBuffer> render(RenderNode * node);
+ *       shared_ptr<PixelBuffer> getCached(RenderNode * node);
+ *       void insert(RenderNode * node, shared_ptr<PixelBuffer> output);
+ *       void clear();
+ *       void setMemoryBudget(size_t memoryBudget);
+ *       size_t getMemoryBudget();
+ *       size_t getMemoryUsed();
+ *       int getStagesComputed();
+ *       static string getKey(RenderNode * node);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "RenderGraph.h"
+#include "Metrics.h"
+#include <sstream>
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param name - the name of the stage, part of the key of its output
+ */
+RenderNode::RenderNode(const string name)
+{
+    this->name = name;
+}
+
+/**
+ * Destructor
+ * The input nodes belong to the caller
+ */
+RenderNode::~RenderNode()
+{}
+
+/**
+ * Adds a node whose output this node reads
+ * @param input - the input node, which must outlive this node
+ */
+void RenderNode::addInput(RenderNode * input)
+{
+    inputs.push_back(input);
+}
+
+/**
+ * @return the input nodes, in the order they were added
+ */
+const vector<RenderNode *> RenderNode::getInputs() const
+{
+    return inputs;
+}
+
+/**
+ * @return the name of the stage
+ */
+const string RenderNode::getName() const
+{
+    return name;
+}
+
+/**
+ * Constructor
+ * @param memoryBudget - the number of bytes of output to keep cached
+ */
+RenderGraph::RenderGraph(const size_t memoryBudget)
+{
+    this->memoryBudget = memoryBudget;
+    memoryUsed = 0;
+    stagesComputed = 0;
+}
+
+/**
+ * Destructor
+ */
+RenderGraph::~RenderGraph()
+{}
+
+/**
+ * Works out the key of a node without computing anything
+ * @param node - the node
+ * @return a description of the node, its parameters and all of its inputs
+ */
+const string RenderGraph::getKey(const RenderNode * node)
+{
+    ostringstream description(ostringstream::out);
+    description << node->getName() << "(" << node->getParameters() << ")";
+    vector<RenderNode *> inputs = node->getInputs();
+    for (size_t i = 0; i < inputs.size(); i++)
+        description << "<" << getKey(inputs[i]) << ">";
+    return description.str();
+}
+
+/**
+ * Renders a node, computing only the stages that are not cached
+ * @param node - the node to render
+ * @return the output of the node, or an empty pointer if a stage failed
+ */
+shared_ptr<const PixelBuffer> RenderGraph::render(const RenderNode * node)
+{
+    stagesComputed = 0;
+    return evaluate(node, getKey(node));
+}
+
+/**
+ * @param node - the node
+ * @return the cached output of the node, or an empty pointer if it is not cached
+ */
+shared_ptr<const PixelBuffer> RenderGraph::getCached(const RenderNode * node) const
+{
+    map<string, Entry>::const_iterator found = cache.find(getKey(node));
+    if (found == cache.end())
+        return shared_ptr<const PixelBuffer>();
+    return found->second.buffer;
+}
+
+/**
+ * Caches an output computed elsewhere, for example on another thread,
+ * as if the node had been rendered
+ * @param node - the node the output is of
+ * @param output - the output
+ */
+void RenderGraph::insert(const RenderNode * node, shared_ptr<const PixelBuffer> output)
+{
+    string key = getKey(node);
+    map<string, Entry>::iterator found = cache.find(key);
+    if (found != cache.end())
+    {
+        memoryUsed -= found->second.buffer->getMemorySize();
+        ages.erase(found->second.age);
+        cache.erase(found);
+    }
+    store(key, output);
+}
+
+/**
+ * Returns the cached output of a node, or computes it
+ * after evaluating its inputs in turn
+ * @param node - the node to evaluate
+ * @param key - the key of the node
+ * @return the output of the node, or an empty pointer if a stage failed
+ */
+shared_ptr<const PixelBuffer> RenderGraph::evaluate(const RenderNode * node, const string key)
+{
+    static Metrics::Counter &hits = Metrics::counter("dcraw_fltk_cache_requests_total", "Cache lookups, by cache and result",
+                                                   "cache=\"render_graph\",result=\"hit\"");
+    static Metrics::Counter &misses = Metrics::counter("dcraw_fltk_cache_requests_total", "Cache lookups, by cache and result",
+                                                     "cache=\"render_graph\",result=\"miss\"");
+
+    map<string, Entry>::iterator found = cache.find(key);
+    if (found != cache.end())
+    {
+        ages.splice(ages.begin(), ages, found->second.age);
+        hits.add();
+        return found->second.buffer;
+    }
+    misses.add();
+
+    vector<RenderNode *> inputNodes = node->getInputs();
+    vector< shared_ptr<const PixelBuffer> > inputs;
+    for (size_t i = 0; i < inputNodes.size(); i++)
+    {
+        shared_ptr<const PixelBuffer> input = evaluate(inputNodes[i], getKey(inputNodes[i]));
+        if (!input)
+            return shared_ptr<const PixelBuffer>();
+        inputs.push_back(input);
+    }
+
+    shared_ptr<PixelBuffer> output(new PixelBuffer());
+    stagesComputed++;
+    if (!node->compute(inputs, *output))
+        return shared_ptr<const PixelBuffer>();
+
+    store(key, output);
+    return output;
+}
+
+/**
+ * Caches an output as the most recently used one
+ * @param key - the key of the output
+ * @param buffer - the output
+ */
+void RenderGraph::store(const string key, shared_ptr<const PixelBuffer> buffer)
+{
+    ages.push_front(key);
+    Entry entry;
+    entry.buffer = buffer;
+    entry.age = ages.begin();
+    cache[key] = entry;
+    memoryUsed += buffer->getMemorySize();
+    evict();
+}
+
+/**
+ * Drops the least recently used outputs until the cache fits the budget
+ * Outputs still held by a caller stay alive until the caller lets go
+ */
+void RenderGraph::evict()
+{
+    while (memoryUsed > memoryBudget && !ages.empty())
+    {
+        map<string, Entry>::iterator oldest = cache.find(ages.back());
+        memoryUsed -= oldest->second.buffer->getMemorySize();
+        cache.erase(oldest);
+        ages.pop_back();
+    }
+}
+
+/**
+ * Drops every cached output
+ */
+void RenderGraph::clear()
+{
+    cache.clear();
+    ages.clear();
+    memoryUsed = 0;
+}
+
+/**
+ * Sets the memory budget, evicting outputs if it shrinks
+ * @param memoryBudget - the number of bytes of output to keep cached
+ */
+void RenderGraph::setMemoryBudget(const size_t memoryBudget)
+{
+    this->memoryBudget = memoryBudget;
+    evict();
+}
+
+/**
+ * @return the number of bytes of output to keep cached
+ */
+const size_t RenderGraph::getMemoryBudget() const
+{
+    return memoryBudget;
+}
+
+/**
+ * @return the number of bytes of output cached
+ */
+const size_t RenderGraph::getMemoryUsed() const
+{
+    return memoryUsed;
+}
+
+/**
+ * @return the number of stages computed by the last render
+ */
+const int RenderGraph::getStagesComputed() const
+{
+    return stagesComputed;
+}
@@ -0,0 +1,76 @@
+/**
+ * RenderGraph.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <cstddef>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class RenderNode
+{
+    public:
+        RenderNode(const string name);
+        virtual ~RenderNode();
+
+        void addInput(RenderNode * input);
+        const vector<RenderNode *> getInputs() const;
+        const string getName() const;
+
+        virtual const string getParameters() const = 0;
+        virtual bool compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const = 0;
+
+    private:
+        RenderNode(RenderNode &toCopy);
+
+        string name;
+        vector<RenderNode *> inputs;
+};
+
+class RenderGraph
+{
+    public:
+        RenderGraph(const size_t memoryBudget);
+        ~RenderGraph();
+
+        shared_ptr<const PixelBuffer> render(const RenderNode * node);
+        shared_ptr<const PixelBuffer> getCached(const RenderNode * node) const;
+        void insert(const RenderNode * node, shared_ptr<const PixelBuffer> output);
+        void clear();
+
+        void setMemoryBudget(const size_t memoryBudget);
+        const size_t getMemoryBudget() const;
+        const size_t getMemoryUsed() const;
+        const int getStagesComputed() const;
+
+        static const string getKey(const RenderNode * node);
+
+    private:
+        RenderGraph(RenderGraph &toCopy);
+        shared_ptr<const PixelBuffer> evaluate(const RenderNode * node, const string key);
+        void store(const string key, shared_ptr<const PixelBuffer> buffer);
+        void evict();
+
+        struct Entry
+        {
+            shared_ptr<const PixelBuffer> buffer;
+            list<string>::iterator age;
+        };
+
+        // Cached outputs by key, and keys from most to least recently used
+        map<string, Entry> cache;
+        list<string> ages;
+        size_t memoryBudget;
+        size_t memoryUsed;
+        int stagesComputed;
+};
+#endif
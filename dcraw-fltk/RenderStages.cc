@@ -0,0 +1,258 @@
+/**
+ * class DecodeStage
+ * The first stage of a render: dcraw unpacks the raw file, scales it
+ * between the black and white levels, applies the white balance,
+ * demosaics it and converts it to the output colour space in one
+ * call, writing a linear 16 bit image that the later stages work on
+ * Manual and automatic multipliers are left to the ToneStage, so that
+ * changing them does not decode the raw file again
+ *
+ * PUBLIC FEATURES:
+ *       DecodeStage(string theExecutable, Image &theImage, bool halfSize);
+ *       ~DecodeStage();
+ *       string getParameters();
+ *       bool compute(vector< shared_ptr<PixelBuffer> > &inputs, PixelBuffer &output);
+ *
+ * class DenoiseStage
+ * Removes noise from its linear input with the WaveletDenoiser,
+ * as dcraw -n would
+ *
+ * PUBLIC FEATURES:
+ *       DenoiseStage(RenderNode * input, double threshold);
+ *       ~DenoiseStage();
+ *       string getParameters();
+ *       bool compute(vector< shared_ptr<PixelBuffer> > &inputs, PixelBuffer &output);
+ *
+ * class ResizeStage
+ * Shrinks its input to fit a box, averaging the linear samples
+ * under every output pixel. Inputs that already fit are copied
+ *
+ * PUBLIC FEATURES:
+ *       ResizeStage(RenderNode * input, int maxWidth, int maxHeight);
+ *       ~ResizeStage();
+ *       string getParameters();
+ *       bool compute(vector< shared_ptr<PixelBuffer> > &inputs, PixelBuffer &output);
+ *
+ * class ToneStage
+ * Applies the manual or automatic white balance, brightness and gamma to its
+ * linear input with ToneKernels, scaling to the automatic white level
+ *
+ * PUBLIC FEATURES:
+ *       ToneStage(RenderNode * input, double redMultiplier, double blueMultiplier,
+ *                 double brightness, double gamma);
+ *       ~ToneStage();
+ *       string getParameters();
+ *       bool compute(vector< shared_ptr<PixelBuffer> > &inputs, PixelBuffer &output);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "RenderStages.h"
+#include "Converter.h"
+#include "DecoderPool.h"
+#include "ToneKernels.h"
+#include "ResizePyramid.h"
+#include "Orientation.h"
+#include "WaveletDenoiser.h"
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param theExecutable - the path to dcraw
+ * @param theImage - the Image to decode; only its source file,
+ *                   white balance and interpolation are used
+ * @param halfSize - true to decode at half size, for previews
+ */
+DecodeStage::DecodeStage(const string theExecutable, Image &theImage, const bool halfSize) : RenderNode("decode")
+{
+    this->theExecutable = theExecutable;
+    this->theImage = new Image(theImage);
+    this->halfSize = halfSize;
+}
+
+/**
+ * Destructor
+ */
+DecodeStage::~DecodeStage()
+{
+    delete theImage;
+}
+
+/**
+ * The parameters are the dcraw command line itself, together
+ * with the size and modification time of the raw file, so that
+ * the output is decoded again if the file changes on disk. Every white
+ * balance decodes with the camera's (-w): the manual or automatic
+ * multipliers are applied afterwards by the ToneStage, and are part of
+ * its parameters rather than these
+ * @return the parameters of the stage
+ */
+const string DecodeStage::getParameters() const
+{
+    Converter theConverter;
+    theConverter.setExecutable(theExecutable);
+    theConverter.setImage(theImage);
+
+    ostringstream parameters(ostringstream::out);
+    parameters << theExecutable;
+    vector<string> args = theConverter.buildDecodeArguments(halfSize);
+    for (size_t i = 0; i < args.size(); i++)
+        parameters << " " << args[i];
+
+    struct stat status;
+    if (stat(theImage->getSourceFilename().c_str(), &status) == 0)
+        parameters << " " << (long long)status.st_size << " " << (long long)status.st_mtime;
+    return parameters.str();
+}
+
+/**
+ * Runs dcraw, in one of the shared DecoderPool's worker processes so
+ * that a raw file that crashes the decode cannot take the GUI with it
+ * The stage has no inputs
+ * @param output - the decoded image
+ * @return true if dcraw decoded the image, false otherwise
+ */
+bool DecodeStage::compute(const vector< shared_ptr<const PixelBuffer> > &, PixelBuffer &output) const
+{
+    return DecoderPool::getShared().decode(theExecutable, *theImage, halfSize, output);
+}
+
+/**
+ * Constructor
+ * @param input - the linear node to denoise
+ * @param threshold - the noise threshold, as given to dcraw -n
+ */
+DenoiseStage::DenoiseStage(RenderNode * input, const double threshold) : RenderNode("denoise")
+{
+    addInput(input);
+    this->threshold = threshold;
+}
+
+/**
+ * Destructor
+ */
+DenoiseStage::~DenoiseStage()
+{}
+
+/**
+ * @return the parameters of the stage
+ */
+const string DenoiseStage::getParameters() const
+{
+    ostringstream parameters(ostringstream::out);
+    parameters.precision(17);
+    parameters << threshold;
+    return parameters.str();
+}
+
+/**
+ * Denoises the input
+ * @param inputs - the linear image
+ * @param output - the denoised image
+ * @return true
+ */
+bool DenoiseStage::compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const
+{
+    WaveletDenoiser theDenoiser(threshold);
+    theDenoiser.apply(*inputs[0], output);
+    return true;
+}
+
+/**
+ * Constructor
+ * @param input - the node to resize
+ * @param maxWidth - the width of the box to fit
+ * @param maxHeight - the height of the box to fit
+ */
+ResizeStage::ResizeStage(RenderNode * input, const int maxWidth, const int maxHeight) : RenderNode("resize")
+{
+    addInput(input);
+    this->maxWidth = maxWidth;
+    this->maxHeight = maxHeight;
+}
+
+/**
+ * Destructor
+ */
+ResizeStage::~ResizeStage()
+{}
+
+/**
+ * @return the parameters of the stage
+ */
+const string ResizeStage::getParameters() const
+{
+    ostringstream parameters(ostringstream::out);
+    parameters << maxWidth << "x" << maxHeight;
+    return parameters.str();
+}
+
+/**
+ * Averages the input down to fit the box, keeping its aspect ratio
+ * @param inputs - the image to resize
+ * @param output - the resized image
+ * @return true
+ */
+bool ResizeStage::compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const
+{
+    ResizePyramid::fit(*inputs[0], maxWidth, maxHeight, output, Orientation::NONE);
+    return true;
+}
+
+/**
+ * Constructor
+ * @param input - the linear node to tone
+ * @param redMultiplier - the red white balance multiplier
+ * @param blueMultiplier - the blue white balance multiplier
+ * @param brightness - the brightness, as given to dcraw -b
+ * @param gamma - the gamma, as given to dcraw -g
+ */
+ToneStage::ToneStage(RenderNode * input, const double redMultiplier, const double blueMultiplier,
+                     const double brightness, const double gamma) : RenderNode("tone")
+{
+    addInput(input);
+    this->redMultiplier = redMultiplier;
+    this->blueMultiplier = blueMultiplier;
+    this->brightness = brightness;
+    this->gamma = gamma;
+}
+
+/**
+ * Destructor
+ */
+ToneStage::~ToneStage()
+{}
+
+/**
+ * @return the parameters of the stage
+ */
+const string ToneStage::getParameters() const
+{
+    ostringstream parameters(ostringstream::out);
+    // Every digit of a double, so that two slider positions never share an output
+    parameters.precision(17);
+    parameters << redMultiplier << " " << blueMultiplier << " " << brightness << " " << gamma;
+    return parameters.str();
+}
+
+/**
+ * Tones the input
+ * @param inputs - the linear 3 channel image
+ * @param output - the toned image
+ * @return true if the input could be toned, false otherwise
+ */
+bool ToneStage::compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const
+{
+    const PixelBuffer &source = *inputs[0];
+    if (source.getChannels() != 3)
+        return false;
+
+    ToneKernels theKernels(redMultiplier, blueMultiplier, brightness, ToneKernels::autoWhiteLevel(source), gamma);
+    output.resize(source.getWidth(), source.getHeight(), 3);
+    theKernels.apply(source.getData(), output.getData(), source.getPixelCount());
+    return true;
+}
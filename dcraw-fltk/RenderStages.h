@@ -0,0 +1,73 @@
+/**
+ * RenderStages.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef RENDERSTAGES_H
+#define RENDERSTAGES_H
+
+#include <string>
+#include "RenderGraph.h"
+#include "Image.h"
+
+using namespace std;
+
+class DecodeStage : public RenderNode
+{
+    public:
+        DecodeStage(const string theExecutable, Image &theImage, const bool halfSize);
+        ~DecodeStage();
+
+        const string getParameters() const;
+        bool compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const;
+
+    private:
+        string theExecutable;
+        Image * theImage;
+        bool halfSize;
+};
+
+class DenoiseStage : public RenderNode
+{
+    public:
+        DenoiseStage(RenderNode * input, const double threshold);
+        ~DenoiseStage();
+
+        const string getParameters() const;
+        bool compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const;
+
+    private:
+        double threshold;
+};
+
+class ResizeStage : public RenderNode
+{
+    public:
+        ResizeStage(RenderNode * input, const int maxWidth, const int maxHeight);
+        ~ResizeStage();
+
+        const string getParameters() const;
+        bool compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const;
+
+    private:
+        int maxWidth;
+        int maxHeight;
+};
+
+class ToneStage : public RenderNode
+{
+    public:
+        ToneStage(RenderNode * input, const double redMultiplier, const double blueMultiplier,
+                  const double brightness, const double gamma);
+        ~ToneStage();
+
+        const string getParameters() const;
+        bool compute(const vector< shared_ptr<const PixelBuffer> > &inputs, PixelBuffer &output) const;
+
+    private:
+        double redMultiplier;
+        double blueMultiplier;
+        double brightness;
+        double gamma;
+};
+#endif
@@ -0,0 +1,220 @@
+/**
+ * class ResizePyramid
+ * Downscaled copies of one image, shared by every output that
+ * needs a smaller version of it. Each level is half the size of
+ * the one before and is only built when an output first needs it;
+ * an output is then averaged down from the smallest level that is
+ * still at least as large as it, rather than from the full image
+ * The levels keep the orientation of the base image, and each output
+ * is turned upright as it is averaged down, without a pass over the
+ * full image unless the output is full size
+ * Safe to use from several threads at once
+ *
+ * PUBLIC FEATURES:
+ *       ResizePyramid(shared_ptr<PixelBuffer> base, int flip);
+ *       ~ResizePyramid();
+ *       shared_ptr<PixelBuffer> get(int maxWidth, int maxHeight);
+ *       int getLevelCount();
+ *       static void fit(PixelBuffer &source, int maxWidth, int maxHeight, PixelBuffer &destination, int flip);
+ *       static void halve(PixelBuffer &source, PixelBuffer &destination);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "ResizePyramid.h"
+#include "Orientation.h"
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param base - the full size image
+ * @param flip - dcraw's flip value to turn every output by, Orientation::NONE for none
+ */
+ResizePyramid::ResizePyramid(shared_ptr<const PixelBuffer> base, const int flip)
+{
+    levels.push_back(base);
+    this->flip = flip;
+}
+
+/**
+ * Destructor
+ */
+ResizePyramid::~ResizePyramid()
+{}
+
+/**
+ * Returns the image shrunk to fit a box, keeping its aspect ratio, and turned upright
+ * @param maxWidth - the width of the box, 0 for no limit
+ * @param maxHeight - the height of the box, 0 for no limit
+ * @return the image, which is the base image itself if it already fits and is not turned
+ */
+shared_ptr<const PixelBuffer> ResizePyramid::get(const int maxWidth, const int maxHeight)
+{
+    // The box the other way round, to fit the levels before they are turned
+    int boxWidth, boxHeight;
+    Orientation::getSize(maxWidth, maxHeight, flip, boxWidth, boxHeight);
+    int width, height;
+    fittedSize(*levels[0], boxWidth > 0 ? boxWidth : levels[0]->getWidth(),
+               boxHeight > 0 ? boxHeight : levels[0]->getHeight(), width, height);
+
+    // The smallest level whose half would be smaller than the output
+    shared_ptr<const PixelBuffer> level;
+    {
+        lock_guard<mutex> lock(levelsMutex);
+        size_t i = 0;
+        while (levels[i]->getWidth() / 2 >= width && levels[i]->getHeight() / 2 >= height)
+        {
+            if (i + 1 == levels.size())
+            {
+                shared_ptr<PixelBuffer> half(new PixelBuffer());
+                halve(*levels[i], *half);
+                levels.push_back(half);
+            }
+            i++;
+        }
+        level = levels[i];
+    }
+
+    if (level->getWidth() == width && level->getHeight() == height && flip == Orientation::NONE)
+        return level;
+    shared_ptr<PixelBuffer> fitted(new PixelBuffer());
+    if (level->getWidth() == width && level->getHeight() == height)
+        Orientation::apply(*level, flip, *fitted);
+    else
+    {
+        int orientedWidth, orientedHeight;
+        Orientation::getSize(width, height, flip, orientedWidth, orientedHeight);
+        fit(*level, orientedWidth, orientedHeight, *fitted, flip);
+    }
+    return fitted;
+}
+
+/**
+ * @return the number of levels built so far, including the base image
+ */
+const int ResizePyramid::getLevelCount()
+{
+    lock_guard<mutex> lock(levelsMutex);
+    return (int)levels.size();
+}
+
+/**
+ * Averages an image down to fit a box, keeping its aspect ratio, and
+ * turns it as it goes. Every output pixel covers a whole number of input
+ * rows and columns. Images that already fit are copied, or turned
+ * @param source - the image to resize
+ * @param maxWidth - the width of the box, once turned
+ * @param maxHeight - the height of the box, once turned
+ * @param destination - the resized image
+ * @param flip - dcraw's flip value to turn the image by, Orientation::NONE for none
+ */
+void ResizePyramid::fit(const PixelBuffer &source, const int maxWidth, const int maxHeight, PixelBuffer &destination,
+                        const int flip)
+{
+    int width = source.getWidth();
+    int height = source.getHeight();
+    int channels = source.getChannels();
+    int boxWidth, boxHeight;
+    Orientation::getSize(maxWidth, maxHeight, flip, boxWidth, boxHeight);
+
+    if (width <= boxWidth && height <= boxHeight)
+    {
+        Orientation::apply(source, flip, destination);
+        return;
+    }
+
+    int outWidth, outHeight, orientedWidth, orientedHeight;
+    fittedSize(source, boxWidth, boxHeight, outWidth, outHeight);
+    Orientation::getSize(outWidth, outHeight, flip, orientedWidth, orientedHeight);
+    destination.resize(orientedWidth, orientedHeight, channels);
+
+    // Each output row is written along a line of the turned image, a fixed step apart
+    long long step = outWidth > 1 ? (long long)Orientation::getOffset(0, 1, outWidth, outHeight, flip)
+                                    - (long long)Orientation::getOffset(0, 0, outWidth, outHeight, flip) : 1;
+
+    // First input column of every output column, plus the end of the last
+    vector<int> columns(outWidth + 1);
+    for (int x = 0; x <= outWidth; x++)
+        columns[x] = (int)((long long)x * width / outWidth);
+
+    vector<size_t> sums((size_t)outWidth * channels);
+    for (int y = 0; y < outHeight; y++)
+    {
+        int firstRow = (int)((long long)y * height / outHeight);
+        int lastRow = (int)((long long)(y + 1) * height / outHeight);
+        fill(sums.begin(), sums.end(), 0);
+
+        for (int row = firstRow; row < lastRow; row++)
+        {
+            const unsigned short * in = source.getRow(row);
+            for (int x = 0; x < outWidth; x++)
+                for (int column = columns[x]; column < columns[x + 1]; column++)
+                    for (int c = 0; c < channels; c++)
+                        sums[x * channels + c] += in[column * channels + c];
+        }
+
+        unsigned short * out = destination.getData() + Orientation::getOffset(y, 0, outWidth, outHeight, flip) * channels;
+        for (int x = 0; x < outWidth; x++, out += step * channels)
+        {
+            size_t area = (size_t)(lastRow - firstRow) * (columns[x + 1] - columns[x]);
+            for (int c = 0; c < channels; c++)
+                out[c] = (unsigned short)((sums[x * channels + c] + area / 2) / area);
+        }
+    }
+}
+
+/**
+ * Halves an image in each direction, averaging every 2x2 block
+ * An odd last row or column is dropped
+ * @param source - the image to halve
+ * @param destination - the halved image
+ */
+void ResizePyramid::halve(const PixelBuffer &source, PixelBuffer &destination)
+{
+    int channels = source.getChannels();
+    int outWidth = max(source.getWidth() / 2, 1);
+    int outHeight = max(source.getHeight() / 2, 1);
+    destination.resize(outWidth, outHeight, channels);
+
+    int nextColumn = source.getWidth() > 1 ? channels : 0;
+    for (int y = 0; y < outHeight; y++)
+    {
+        const unsigned short * top = source.getRow(min(y * 2, source.getHeight() - 1));
+        const unsigned short * bottom = source.getRow(min(y * 2 + 1, source.getHeight() - 1));
+        unsigned short * out = destination.getRow(y);
+        for (int x = 0; x < outWidth; x++, top += channels * 2, bottom += channels * 2, out += channels)
+            for (int c = 0; c < channels; c++)
+                out[c] = (unsigned short)((top[c] + top[c + nextColumn] + bottom[c] + bottom[c + nextColumn] + 2) >> 2);
+    }
+}
+
+/**
+ * Works out the size of an image shrunk to fit a box, keeping its aspect ratio
+ * @param source - the image
+ * @param maxWidth - the width of the box
+ * @param maxHeight - the height of the box
+ * @param width - set to the fitted width, at least 1
+ * @param height - set to the fitted height, at least 1
+ */
+void ResizePyramid::fittedSize(const PixelBuffer &source, const int maxWidth, const int maxHeight, int &width, int &height)
+{
+    width = source.getWidth();
+    height = source.getHeight();
+    if (width <= maxWidth && height <= maxHeight)
+        return;
+
+    if ((long long)width * maxHeight > (long long)height * maxWidth)
+    {
+        height = (int)((long long)height * maxWidth / width);
+        width = maxWidth;
+    }
+    else
+    {
+        width = (int)((long long)width * maxHeight / height);
+        height = maxHeight;
+    }
+    width = max(width, 1);
+    height = max(height, 1);
+}
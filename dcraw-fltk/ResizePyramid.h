@@ -0,0 +1,39 @@
+/**
+ * ResizePyramid.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef RESIZEPYRAMID_H
+#define RESIZEPYRAMID_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class ResizePyramid
+{
+    public:
+        ResizePyramid(shared_ptr<const PixelBuffer> base, const int flip);
+        ~ResizePyramid();
+
+        shared_ptr<const PixelBuffer> get(const int maxWidth, const int maxHeight);
+        const int getLevelCount();
+
+        static void fit(const PixelBuffer &source, const int maxWidth, const int maxHeight, PixelBuffer &destination,
+                        const int flip);
+        static void halve(const PixelBuffer &source, PixelBuffer &destination);
+
+    private:
+        ResizePyramid(ResizePyramid &toCopy);
+        static void fittedSize(const PixelBuffer &source, const int maxWidth, const int maxHeight, int &width, int &height);
+
+        // The base image, then each level half the size of the one before
+        vector< shared_ptr<const PixelBuffer> > levels;
+        // How every output is turned from the levels (see Orientation)
+        int flip;
+        mutex levelsMutex;
+};
+#endif
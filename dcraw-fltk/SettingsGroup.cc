@@ -10,12 +10,30 @@
  *      void setImage(Image * theImage);
  *      void setBrowseFileText(char * text);
  *		void setPreview(PreviewGroup * thePreview);
+ *		void setFilmstrip(Filmstrip * theFilmstrip);
+ *		void setHistogram(HistogramGroup * theHistogram);
+ *		void setRecorder(InteractionRecorder * theRecorder);
  *      Image * getImage();
+ *      bool apply(string event, string arguments);
  *
  * @author https://github.com/aaronmboyd
  */
 
 #include "SettingsGroup.h"
+#include "RawProbe.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+// How often, in seconds, the progress bar follows a running conversion
+const static double PROGRESS_SECONDS = 0.1;
+// How long, in seconds, a preview may take; the best rung expected to fit is used
+const static double PREVIEW_TARGET_SECONDS = 0.2;
+// How long, in seconds, after the last interaction the preview is refined to the best rung
+const static double REFINE_SECONDS = 0.5;
 
 /**
  * Overloaded constructor
@@ -35,6 +53,23 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
 	int xPositionColumn2 = 240;
 	int xColumn2Inset = xPositionColumn2 + 20;
 
+	// An eighth of the installed memory, up to 1GB, for cached preview stages
+	size_t memory = Process::getPhysicalMemory();
+	size_t budget = PREVIEW_CACHE_MEMORY;
+	if (memory != 0)
+		budget = min(memory / 8, PREVIEW_CACHE_MEMORY * 4);
+	previewGraph = new RenderGraph(budget);
+	previewQuality = new PreviewQuality();
+	shownRung = PreviewQuality::BINNED;
+	previewMegapixels = 0;
+	refining = false;
+	refinedKey = "";
+	thePreview = NULL;
+	theFilmstrip = NULL;
+	theHistogram = NULL;
+	theRecorder = NULL;
+	previewShown = false;
+
     // Choose file button
     chooseFileButton = new Fl_Button(xPositionColumn1, yPosition, 200, 50,"Browse for raw image...");
     chooseFileButton->callback(chooseFilePressed,this);
@@ -90,6 +125,17 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
     // Interpolate RGBG check box
 	yPosition += 60;
     interpolateRGBG = new Fl_Check_Button(xPositionColumn1, yPosition, 20, 20, "Interpolate RGBG" );
+    interpolateRGBG->callback(interpolateChanged, this);
+
+    // Noise threshold slider, which denoises the preview when released
+    noiseInput = new Fl_Value_Slider(xPositionColumn2, yPosition - 5, 200, 20, "Noise threshold (0 = off)");
+    noiseInput->type(FL_HOR_NICE_SLIDER);
+    noiseInput->minimum(0);
+    noiseInput->maximum(1000);
+    noiseInput->step(10);
+    noiseInput->value(0);
+    noiseInput->when(FL_WHEN_RELEASE);
+    noiseInput->callback(toneChanged, this);
 
     // Gamma slider
 	yPosition += 40;
@@ -98,6 +144,8 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
     gammaInput->minimum(0.3);
     gammaInput->maximum(1.5);
     gammaInput->value(0.6);
+    gammaInput->when(FL_WHEN_CHANGED);
+    gammaInput->callback(toneChanged, this);
 
 	// Brightness slider
 	yPosition += 60;
@@ -106,10 +154,12 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
     brightnessInput->minimum(1.0);
     brightnessInput->maximum(6.0);
     brightnessInput->value(3.5);
+    brightnessInput->when(FL_WHEN_CHANGED);
+    brightnessInput->callback(toneChanged, this);
 
     // White balance mode select
 	yPosition += 80;
-    whiteBalanceGroup = new Fl_Group(xPositionColumn1, yPosition, 440, 240, "");
+    whiteBalanceGroup = new Fl_Group(xPositionColumn1, yPosition, 440, 200, "");
 
 	yPosition += 20;
 	whiteBalanceText = new Fl_Button((xPositionColumn1 + 80), yPosition, 0, 0, "White Balance Mode" );
@@ -140,6 +190,8 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
     redMultiplier->minimum(0.5);
     redMultiplier->maximum(2.0);
     redMultiplier->value(1.0);
+    redMultiplier->when(FL_WHEN_CHANGED);
+    redMultiplier->callback(toneChanged, this);
     redMultiplier->deactivate();
 
 	yPosition += 60;
@@ -148,19 +200,28 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
     blueMultiplier->minimum(0.5);
     blueMultiplier->maximum(2.0);
     blueMultiplier->value(1.0);
+    blueMultiplier->when(FL_WHEN_CHANGED);
+    blueMultiplier->callback(toneChanged, this);
     blueMultiplier->deactivate();
 
     whiteBalanceGroup->add(redMultiplier);
     whiteBalanceGroup->add(blueMultiplier);
 
     // Action Buttons
-	yPosition += 120;
+	yPosition += 80;
 	previewButton = new Fl_Button(xColumn1Inset, yPosition, 140, 40, "Preview" );
     previewButton->callback(previewButtonPressed,this);
 
 	convertButton = new Fl_Button(xPositionColumn2, yPosition, 140, 40, "Convert" );
     convertButton->callback(convertButtonPressed,this);
 
+    // Conversion progress, from the stages dcraw reports
+	yPosition += 45;
+    conversionProgress = new Fl_Progress(xPositionColumn1, yPosition, 400, 16, "");
+    conversionProgress->minimum(0);
+    conversionProgress->maximum(1);
+    conversionProgress->value(0);
+
     // Add to group (order irrelevant)
     this->add(chooseFileButton);
     this->add(browseFileText);
@@ -168,11 +229,13 @@ SettingsGroup::SettingsGroup(int x,int y,int w,int h, const char * label) : Fl_G
 	this->add(browseDCRAWFileText);
     this->add(fileFormatGroup);
     this->add(interpolateRGBG);
+    this->add(noiseInput);
     this->add(gammaInput);
     this->add(brightnessInput);
     this->add(whiteBalanceGroup);
     this->add(previewButton);
     this->add(convertButton);
+    this->add(conversionProgress);
     this->box(FL_UP_BOX);
 
     end();
@@ -188,6 +251,11 @@ SettingsGroup::~SettingsGroup()
 	 *  as their memory is handled
 	 *  by their parent objects
 	 */
+	Fl::remove_timeout(refineTimeout, this);
+	if (refiner.joinable())
+		refiner.join();
+	delete previewGraph;
+	delete previewQuality;
 }
 
 /**
@@ -227,6 +295,26 @@ void SettingsGroup::setPreview(PreviewGroup * thePreview)
   this->thePreview = thePreview;
 }
 
+/**
+ * Shows the directory of each chosen raw image in the Filmstrip,
+ * and selects the raw image clicked there
+ * @param theFilmstrip - the pointer to the Filmstrip
+ */
+void SettingsGroup::setFilmstrip(Filmstrip * theFilmstrip)
+{
+  this->theFilmstrip = theFilmstrip;
+  theFilmstrip->callback(filmstripSelected, this);
+}
+
+/**
+ * Sets the HistogramGroup that shows the histogram of each preview
+ * @param theHistogram - the HistogramGroup to update
+ */
+void SettingsGroup::setHistogram(HistogramGroup * theHistogram)
+{
+  this->theHistogram = theHistogram;
+}
+
 /**
  * @return the Image currently being prepared for conversion
  */
@@ -235,6 +323,66 @@ Image * SettingsGroup::getImage() const
     return theImage;
 }
 
+/**
+ * Records every interaction from now on, for replay (see InteractionRecorder)
+ * @param theRecorder - the recorder, or NULL to stop recording
+ */
+void SettingsGroup::setRecorder(InteractionRecorder * theRecorder)
+{
+  this->theRecorder = theRecorder;
+}
+
+/**
+ * Performs an interaction as the user would, for replay (see InteractionRecorder)
+ * Files are chosen without showing the file chooser, and a preview that
+ * fails is reported by the return value rather than a message box
+ * @param event - what to do: file, filmstrip, dcraw, gamma, brightness,
+ *                noise, red, blue, whitebalance, interpolate or preview
+ * @param arguments - the file, slider value, white balance mode (camera,
+ *                    auto or manual) or 1/0 for interpolate
+ * @return true if the interaction was performed, false if it is unknown or failed
+ */
+bool SettingsGroup::apply(const string event, const string arguments)
+{
+    if (event == "file" || event == "filmstrip")
+    {
+        selectFile(arguments, event == "file");
+        return true;
+    }
+    if (event == "dcraw")
+    {
+        setDCRAWBrowseFileText(arguments.c_str());
+        if (theFilmstrip)
+            theFilmstrip->setExecutable(arguments);
+        return true;
+    }
+    if (event == "whitebalance")
+    {
+        Fl_Round_Button * theButton = arguments == "manual" ? manualWhiteBalance
+                                    : arguments == "auto" ? autoWhiteBalance : cameraWhiteBalance;
+        theButton->setonly();
+        theButton->do_callback();
+        return true;
+    }
+    if (event == "interpolate")
+    {
+        interpolateRGBG->value(atoi(arguments.c_str()) != 0);
+        return true;
+    }
+    if (event == "preview")
+    {
+        string error;
+        return preview(error);
+    }
+
+    Fl_Value_Slider * theSlider = getSlider(event);
+    if (!theSlider)
+        return false;
+    theSlider->value(atof(arguments.c_str()));
+    theSlider->do_callback();
+    return true;
+}
+
 /**
  * static callback method for conversion button
  * This method does not need to be explicitly called from the code
@@ -272,23 +420,59 @@ void SettingsGroup::convertButtonPressed(Fl_Widget * theObject, void * data)
 	}
 	free(access->pathToDCRAW->text());
 
-  // Convert Image for real
+  // Convert Image for real, on a thread so that the progress bar
+  // can follow the stages dcraw reports while it runs
+  // The thread converts its own copy of the Image, as the filmstrip and
+  // the preview go on changing theImage while the GUI waits for it
+  ConversionProgress progress;
+  Image * toConvert = new Image(*access->theImage);
   Converter * theConverter = new Converter();
-  theConverter->setImage(access->theImage);
+  theConverter->setImage(toConvert);
   theConverter->setExecutable(access->pathToDCRAW->text());
-  theConverter->run(false);
+  theConverter->setProgress(&progress);
+
+  atomic<bool> converted(false);
+  int exitCode = 0;
+  thread converting([&]() {
+    exitCode = theConverter->run(false);
+    converted = true;
+  });
+  while (!converted)
+  {
+    access->showProgress(progress.getFraction(), ConversionProgress::getStageName(progress.getStage()));
+    Fl::wait(PROGRESS_SECONDS);
+  }
+  converting.join();
   delete theConverter;
+  delete toConvert;
 
+  cout << "\n" << progress.describe() << endl;
+  access->showProgress(exitCode == 0 ? 1.0 : 0.0, exitCode == 0 ? "converted" : "conversion failed");
   access->activate();
 }
 
+/**
+ * Shows how far a conversion has got in the progress bar
+ * @param fraction - the share of the conversion done, 0 to 1
+ * @param stage - the label to show, such as the name of the stage
+ */
+void SettingsGroup::showProgress(const double fraction, const string stage)
+{
+    if (conversionProgress->value() == (float)fraction && progressLabel == stage)
+        return;
+    progressLabel = stage;
+    conversionProgress->value((float)fraction);
+    conversionProgress->label(progressLabel.c_str());
+    conversionProgress->redraw();
+}
+
 /**
  * static callback method for preview button
  * This method does not need to be explicitly called from the code
  * Fl_Widgets that have this method set as their callback will enter
  * this method on certain events
  * Creates a new Converter, and performs a quick conversion
- * Indicates that the PreviewGroup should load this new image
+ * Indicates that the PreviewGroup should show this new image
  *
  * @param theObject - the calling object
  * @param data - pointer to data (usually the "this" keyword, to give this
@@ -298,46 +482,40 @@ void SettingsGroup::convertButtonPressed(Fl_Widget * theObject, void * data)
 void SettingsGroup::previewButtonPressed(Fl_Widget * theObject, void * data)
 {
     SettingsGroup * access = static_cast<SettingsGroup *>(data);
+    access->record("preview", "");
     access->deactivate();
-    access->createImage();
-   
-	string file = access->filename->text();
-	if (file == "Not selected")
-	{
-		fl_message("Please select a raw image first");
-		access->activate();
-		return;
-	}
-	free(access->filename->text());
 
-	file = access->pathToDCRAW->text();
-	if (file == "Not set")
-	{
-		fl_message("Please select the path to DRCRAW first");
-		access->activate();
-		return;
-	}
-	free(access->pathToDCRAW->text());
-
-	// Convert Image
-	Converter * theConverter = new Converter();
-	theConverter->setImage(access->theImage);
-	theConverter->setExecutable(access->pathToDCRAW->text());
-
-	// Running in preview mode will override file format and default to PPM
-	theConverter->run(true);
-	delete theConverter;
-
-	// Show conversion (force it to be .PPM)
-	string filename = string(access->theImage->getSourceFilename());
-	int extension = filename.find_last_of(".");
-	filename = filename.substr(0, extension);
-	filename = filename.insert(filename.length(), ".ppm");
-	access->thePreview->loadImage(filename.c_str());
+	string error;
+	if (!access->preview(error))
+		fl_message("%s", error.c_str());
 
 	access->activate();
 }
 
+/**
+ * Previews the Image with the settings shown, once a raw image and
+ * dcraw have been chosen
+ * @param error - set to the reason if there is no preview
+ * @return true if the preview was shown, false otherwise
+ */
+bool SettingsGroup::preview(string &error)
+{
+	createImage();
+
+	char * source = filename->text();
+	char * theExecutable = pathToDCRAW->text();
+	if (strcmp(source, "Not selected") == 0)
+		error = "Please select a raw image first";
+	else if (strcmp(theExecutable, "Not set") == 0)
+		error = "Please select the path to DRCRAW first";
+	// Render the stages that changed since the last preview
+	else if (!renderPreview(theExecutable))
+		error = "Cannot preview that image!";
+	free(source);
+	free(theExecutable);
+	return error.empty();
+}
+
 /**
  * static callback method for file chooser
  * This method does not need to be explicitly called from the code
@@ -352,7 +530,8 @@ void SettingsGroup::chooseFilePressed(Fl_Widget * theObject, void * data)
 {
     SettingsGroup * access = static_cast<SettingsGroup *>(data);
 
-    access->fileChooser = new Fl_File_Chooser(".","RAW Image Files (*.{crw,raw,rw2})",FL_SINGLE,"Select a file...");
+    string filter = "RAW Image Files (" + RawProbe::getFilePattern() + ")";
+    access->fileChooser = new Fl_File_Chooser(".",filter.c_str(),FL_SINGLE,"Select a file...");
     access->fileChooser->show();
 
     while (access->fileChooser->visible())
@@ -360,14 +539,29 @@ void SettingsGroup::chooseFilePressed(Fl_Widget * theObject, void * data)
 
     if(access->fileChooser->value() != 0)
     {
-      const char * filename = access->fileChooser->value();
-      access->getImage()->setSourceFilename(filename);
-      access->setBrowseFileText(filename);
+      access->selectFile(access->fileChooser->value(), true);
+      access->record("file", access->fileChooser->value());
     }
 
     access->redraw();
 }
 
+/**
+ * Makes a raw image the one to preview and convert
+ * @param filename - the raw image
+ * @param showDirectory - true to show the raw images beside it in the Filmstrip
+ */
+void SettingsGroup::selectFile(const string filename, const bool showDirectory)
+{
+    getImage()->setSourceFilename(filename);
+    setBrowseFileText(filename.c_str());
+    previewShown = false;
+    previewMegapixels = 0;
+
+    if (showDirectory && theFilmstrip)
+        theFilmstrip->setDirectory(filename.substr(0, filename.find_last_of("/\\")), filename);
+}
+
 /**
 * static callback method for DCRAW file chooser
 * This method does not need to be explicitly called from the code
@@ -392,6 +586,9 @@ void SettingsGroup::chooseDCRAWFilePressed(Fl_Widget * theObject, void * data)
 	{
 		const char * pathToDCRAW = access->dcrawFileChooser->value();
 		access->setDCRAWBrowseFileText(pathToDCRAW);
+		access->record("dcraw", pathToDCRAW);
+		if (access->theFilmstrip)
+			access->theFilmstrip->setExecutable(pathToDCRAW);
 	}
 
 	access->redraw();
@@ -452,6 +649,210 @@ void SettingsGroup::whiteBalanceChanged(Fl_Widget * theObject, void * data)
         else if(access->cameraWhiteBalance->value() == 1)
             access->whiteBalanceMode = Image::CAMERA;
     }
+
+    access->record("whitebalance", access->whiteBalanceMode == Image::MANUAL ? "manual"
+                                 : access->whiteBalanceMode == Image::AUTO ? "auto" : "camera");
+}
+
+/**
+ * static callback method for the Filmstrip
+ * This method does not need to be explicitly called from the code
+ * Makes the raw image clicked in the Filmstrip the one to convert
+ * @param theObject - the calling object
+ * @param data - pointer to data (usually the "this" keyword, to give this
+ *                                function access to non-static members of this class)
+ *
+ */
+void SettingsGroup::filmstripSelected(Fl_Widget * theObject, void * data)
+{
+    SettingsGroup * access = static_cast<SettingsGroup *>(data);
+    string filename = access->theFilmstrip->getSelectedFile();
+    if (filename.empty())
+        return;
+
+    access->selectFile(filename, false);
+    access->record("filmstrip", filename);
+    access->redraw();
+}
+
+/**
+ * static callback method for the gamma, brightness, multiplier and noise sliders
+ * This method does not need to be explicitly called from the code
+ * Once an image has been previewed, renders the preview again as a
+ * slider moves. Only the stages after the change run, which for all
+ * but the noise slider is the tone stage, so this keeps up with the slider
+ * @param theObject - the calling object
+ * @param data - pointer to data (usually the "this" keyword, to give this
+ *                                function access to non-static members of this class)
+ *
+ */
+void SettingsGroup::toneChanged(Fl_Widget * theObject, void * data)
+{
+    SettingsGroup * access = static_cast<SettingsGroup *>(data);
+    ostringstream value(ostringstream::out);
+    value << static_cast<Fl_Value_Slider *>(theObject)->value();
+    access->record(access->getSliderName(theObject), value.str());
+    if (!access->previewShown)
+        return;
+
+    access->createImage();
+    char * theExecutable = access->pathToDCRAW->text();
+    access->previewShown = access->renderPreview(theExecutable);
+    free(theExecutable);
+}
+
+/**
+ * static callback method for the Interpolate RGBG check box
+ * This method does not need to be explicitly called from the code
+ * Only records the change; the preview and conversion read the check box
+ * @param theObject - the calling object
+ * @param data - pointer to data (usually the "this" keyword, to give this
+ *                                function access to non-static members of this class)
+ *
+ */
+void SettingsGroup::interpolateChanged(Fl_Widget * theObject, void * data)
+{
+    SettingsGroup * access = static_cast<SettingsGroup *>(data);
+    access->record("interpolate", access->interpolateRGBG->value() ? "1" : "0");
+}
+
+/**
+ * Records an interaction, if there is an InteractionRecorder
+ * @param event - what was done
+ * @param arguments - the value given
+ */
+void SettingsGroup::record(const string event, const string arguments)
+{
+    if (theRecorder)
+        theRecorder->record(event, arguments);
+}
+
+/**
+ * @param theSlider - one of the sliders
+ * @return the name the slider is recorded by: gamma, brightness, noise, red or blue
+ */
+const string SettingsGroup::getSliderName(const Fl_Widget * theSlider) const
+{
+    if (theSlider == gammaInput)
+        return "gamma";
+    if (theSlider == brightnessInput)
+        return "brightness";
+    if (theSlider == noiseInput)
+        return "noise";
+    if (theSlider == redMultiplier)
+        return "red";
+    return "blue";
+}
+
+/**
+ * @param name - the name a slider is recorded by
+ * @return the slider, or NULL if there is none by that name
+ */
+Fl_Value_Slider * SettingsGroup::getSlider(const string name) const
+{
+    if (name == "gamma")
+        return gammaInput;
+    if (name == "brightness")
+        return brightnessInput;
+    if (name == "noise")
+        return noiseInput;
+    if (name == "red")
+        return redMultiplier;
+    if (name == "blue")
+        return blueMultiplier;
+    return NULL;
+}
+
+/**
+ * static callback method for the refinement timer
+ * Starts decoding the best rung of the preview in the background, once
+ * the user has stopped interacting for a moment. If a refinement is
+ * still running, waits for it first
+ * @param data - pointer to data (usually the "this" keyword, to give this
+ *                                function access to non-static members of this class)
+ */
+void SettingsGroup::refineTimeout(void * data)
+{
+    SettingsGroup * access = static_cast<SettingsGroup *>(data);
+    if (!access->previewShown || access->shownRung == PreviewQuality::AHD)
+        return;
+    if (access->refining)
+    {
+        Fl::repeat_timeout(REFINE_SECONDS, refineTimeout, data);
+        return;
+    }
+
+    if (access->refiner.joinable())
+        access->refiner.join();
+    char * theExecutable = access->pathToDCRAW->text();
+    access->refining = true;
+    access->refiner = thread(&SettingsGroup::refine, access, string(theExecutable),
+                             shared_ptr<Image>(new Image(*access->theImage)));
+    free(theExecutable);
+}
+
+/**
+ * Decodes the best rung of the preview for a copy of the settings
+ * Runs on the refiner thread, and hands the result to the GUI thread
+ * @param theExecutable - the path to dcraw
+ * @param settings - the settings of the preview being refined
+ */
+void SettingsGroup::refine(const string theExecutable, shared_ptr<Image> settings)
+{
+    bool halfSize;
+    PreviewQuality::apply(PreviewQuality::AHD, *settings, halfSize);
+    DecodeStage decode(theExecutable, *settings, halfSize);
+
+    shared_ptr<PixelBuffer> output(new PixelBuffer());
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    bool decoded = decode.compute(vector< shared_ptr<const PixelBuffer> >(), *output);
+    if (decoded)
+        previewQuality->record(PreviewQuality::AHD,
+                               PreviewQuality::getSensorMegapixels(PreviewQuality::AHD, output->getWidth(), output->getHeight()),
+                               chrono::duration<double>(chrono::steady_clock::now() - started).count());
+
+    {
+        lock_guard<mutex> guard(refineLock);
+        refinedFrame = decoded ? output : shared_ptr<PixelBuffer>();
+        refinedKey = RenderGraph::getKey(&decode);
+    }
+    refining = false;
+    Fl::awake(refined, this);
+}
+
+/**
+ * static handler run on the GUI thread by Fl::awake once a refinement is decoded
+ * Shows the refined preview, unless the settings have changed since
+ * it started, in which case the newer preview will be refined instead
+ * @param data - pointer to data (usually the "this" keyword, to give this
+ *                                function access to non-static members of this class)
+ */
+void SettingsGroup::refined(void * data)
+{
+    SettingsGroup * access = static_cast<SettingsGroup *>(data);
+    shared_ptr<const PixelBuffer> frame;
+    string key;
+    {
+        lock_guard<mutex> guard(access->refineLock);
+        frame = access->refinedFrame;
+        key = access->refinedKey;
+        access->refinedFrame.reset();
+    }
+    if (!frame || !access->previewShown)
+        return;
+
+    access->createImage();
+    char * theExecutable = access->pathToDCRAW->text();
+    Image settings(*access->theImage);
+    bool halfSize;
+    PreviewQuality::apply(PreviewQuality::AHD, settings, halfSize);
+    DecodeStage decode(theExecutable, settings, halfSize);
+    if (RenderGraph::getKey(&decode) == key)
+    {
+        access->previewGraph->insert(&decode, frame);
+        access->renderPreview(theExecutable, PreviewQuality::AHD);
+    }
+    free(theExecutable);
 }
 
 /**
@@ -466,6 +867,7 @@ void SettingsGroup::createImage()
     theImage->setBrightness(brightnessInput->value());
     theImage->setRedMultiplier(redMultiplier->value());
     theImage->setBlueMultiplier(blueMultiplier->value());
+    theImage->setNoiseThreshold(noiseInput->value());
 
 	// Set interpolate RGBG
 	if(interpolateRGBG->value() == 1)
@@ -491,3 +893,91 @@ void SettingsGroup::createImage()
 		theImage->setOutputFilename(output.c_str());
 	}
 }
+
+/**
+ * Renders the preview at the best rung of the PreviewQuality ladder that
+ * is already decoded or is expected to take no longer than the target,
+ * and refines it to the best rung once the user stops interacting
+ * @param theExecutable - the path to dcraw
+ * @return true if the preview was shown, false if it could not be decoded
+ */
+bool SettingsGroup::renderPreview(const string theExecutable)
+{
+	PreviewQuality::Rung rung = previewQuality->choose(previewMegapixels, PREVIEW_TARGET_SECONDS);
+	for (int better = PreviewQuality::AHD; better > rung; better--)
+	{
+		Image settings(*theImage);
+		bool halfSize;
+		PreviewQuality::apply((PreviewQuality::Rung)better, settings, halfSize);
+		DecodeStage decode(theExecutable, settings, halfSize);
+		if (previewGraph->getCached(&decode))
+		{
+			rung = (PreviewQuality::Rung)better;
+			break;
+		}
+	}
+
+	if (!renderPreview(theExecutable, rung))
+		return false;
+
+	// Every interaction puts the refinement off again
+	Fl::remove_timeout(refineTimeout, this);
+	if (shownRung != PreviewQuality::AHD)
+		Fl::add_timeout(REFINE_SECONDS, refineTimeout, this);
+	return true;
+}
+
+/**
+ * Renders the preview for the current Image through the preview RenderGraph:
+ * a linear decode at a rung of the PreviewQuality ladder, denoised if there
+ * is a noise threshold, shrunk to fit the preview and then toned
+ * Changing gamma, brightness, the white balance mode or the manual
+ * multipliers only runs the tone stage again; dcraw is only run when
+ * the source file, interpolation or rung change. The histogram is counted from the toned
+ * preview. A decode that has to run is timed for the PreviewQuality cost model
+ * @param theExecutable - the path to dcraw
+ * @param rung - the rung to decode at
+ * @return true if the preview was shown, false if it could not be decoded
+ */
+bool SettingsGroup::renderPreview(const string theExecutable, const PreviewQuality::Rung rung)
+{
+	Image settings(*theImage);
+	bool halfSize;
+	PreviewQuality::apply(rung, settings, halfSize);
+	DecodeStage decode(theExecutable, settings, halfSize);
+	bool decoded = (bool)previewGraph->getCached(&decode);
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+	DenoiseStage denoise(&decode, theImage->getNoiseThreshold());
+	RenderNode * linear = &decode;
+	if (theImage->getNoiseThreshold() > 0)
+		linear = &denoise;
+	ResizeStage resize(linear, thePreview->getDisplayWidth(), thePreview->getDisplayHeight());
+	if (!previewGraph->render(&resize))
+		return false;
+
+	// Automatic white balance is measured from the first decode of the file,
+	// so every rung and the conversion afterwards share it
+	shared_ptr<const PixelBuffer> linearImage = previewGraph->getCached(&decode);
+	double redMultiplier = 1.0, blueMultiplier = 1.0;
+	if (linearImage)
+		Converter::resolveWhiteBalance(theImage, *linearImage, redMultiplier, blueMultiplier);
+	ToneStage tone(&resize, redMultiplier, blueMultiplier, theImage->getBrightness(), theImage->getGamma());
+
+	shared_ptr<const PixelBuffer> toned = previewGraph->render(&tone);
+	if (!toned)
+		return false;
+
+	if (linearImage)
+		previewMegapixels = PreviewQuality::getSensorMegapixels(rung, linearImage->getWidth(), linearImage->getHeight());
+	if (!decoded)
+		previewQuality->record(rung, previewMegapixels,
+		                       chrono::duration<double>(chrono::steady_clock::now() - started).count());
+	shownRung = rung;
+
+	thePreview->loadImage(*toned);
+	if (theHistogram)
+		theHistogram->update(*toned);
+	previewShown = true;
+	return true;
+}
@@ -17,11 +17,23 @@
 #include <Fl/Fl_Check_Button.H>
 #include <Fl/Fl_Text_Display.H>
 #include <Fl/Fl_Text_Buffer.H>
+#include <Fl/Fl_Progress.H>
 #include <Fl/fl_message.H>
 #include "Image.h"
 #include "Converter.h"
+#include "ConversionProgress.h"
 #include "PreviewGroup.h"
+#include "Filmstrip.h"
+#include "HistogramGroup.h"
+#include "RenderGraph.h"
+#include "RenderStages.h"
+#include "InteractionRecorder.h"
+#include "PreviewQuality.h"
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
 
 using namespace std;
 
@@ -34,7 +46,14 @@ class SettingsGroup : public Fl_Group
         void setBrowseFileText(const char * text);
 		void setDCRAWBrowseFileText(const char * text);
         void setPreview(PreviewGroup * thePreview);
+        void setFilmstrip(Filmstrip * theFilmstrip);
+        void setHistogram(HistogramGroup * theHistogram);
+        void setRecorder(InteractionRecorder * theRecorder);
         Image * getImage() const;   
+        bool apply(const string event, const string arguments);
+
+        // Preview cache budget when the installed memory is unknown
+        const static size_t PREVIEW_CACHE_MEMORY = 256 * 1024 * 1024;
 
     private:
         // Instance variables
@@ -42,9 +61,36 @@ class SettingsGroup : public Fl_Group
         int fileFormat;
         int whiteBalanceMode;
         PreviewGroup * thePreview;
+        Filmstrip * theFilmstrip;
+        HistogramGroup * theHistogram;
+        // Records the interactions, if set
+        InteractionRecorder * theRecorder;
+
+        // True once the current raw image has been previewed, after which
+        // the sliders update the preview as they move
+        bool previewShown;
+
+        // Preview stages kept between renders, so only changed stages are run again
+        RenderGraph * previewGraph;
+
+        // The rungs the preview can decode at and what each costs, and the rung shown
+        PreviewQuality * previewQuality;
+        PreviewQuality::Rung shownRung;
+        // Sensor size of the current raw image, 0 until it has been decoded
+        double previewMegapixels;
+
+        // Decodes the best rung in the background once the user stops interacting
+        thread refiner;
+        atomic<bool> refining;
+        mutex refineLock;
+        shared_ptr<const PixelBuffer> refinedFrame;
+        string refinedKey;
 
         // FLTK Widgets
         Fl_Button * convertButton;
+        Fl_Progress * conversionProgress;
+        // The label of the progress bar, which FLTK does not copy
+        string progressLabel;
         Fl_Button * previewButton;
         Fl_Button * chooseFileButton;
 		Fl_Button * chooseDCRAWFileButton;
@@ -59,6 +105,7 @@ class SettingsGroup : public Fl_Group
 
         Fl_Value_Slider * gammaInput;
         Fl_Value_Slider * brightnessInput;
+        Fl_Value_Slider * noiseInput;
         Fl_Value_Slider * redMultiplier;
         Fl_Value_Slider * blueMultiplier;
 
@@ -85,8 +132,22 @@ class SettingsGroup : public Fl_Group
 		static void chooseDCRAWFilePressed(Fl_Widget * theObject, void * data);
         static void fileFormatChanged(Fl_Widget * theObject, void * data);
         static void whiteBalanceChanged(Fl_Widget * theObject, void * data);
+        static void filmstripSelected(Fl_Widget * theObject, void * data);
+        static void toneChanged(Fl_Widget * theObject, void * data);
+        static void interpolateChanged(Fl_Widget * theObject, void * data);
+        static void refineTimeout(void * data);
+        static void refined(void * data);
 
         // Other private methods
         void createImage();       
+        void selectFile(const string filename, const bool showDirectory);
+        bool preview(string &error);
+        bool renderPreview(const string theExecutable);
+        bool renderPreview(const string theExecutable, const PreviewQuality::Rung rung);
+        void refine(const string theExecutable, shared_ptr<Image> settings);
+        void record(const string event, const string arguments);
+        const string getSliderName(const Fl_Widget * theSlider) const;
+        Fl_Value_Slider * getSlider(const string name) const;
+        void showProgress(const double fraction, const string stage);
 };
 #endif
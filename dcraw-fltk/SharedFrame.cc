@@ -0,0 +1,300 @@
+/**
+ * class SharedFrame
+ * A decoded frame placed in a shared memory segment, so that another
+ * process can map it instead of reading it through a pipe
+ * The segment is an anonymous memfd on Linux, which the reader opens
+ * through /proc and which the kernel frees once neither side has it
+ * open or mapped, even if the creator is killed. Elsewhere it is a
+ * POSIX shared memory object that the reader removes as soon as it
+ * has opened it, or a named file mapping on Windows
+ *
+ * A frame that is prepare()d before it is decoded has its samples
+ * placed in a segment as they are decoded, so create() shares them
+ * where they lie. read() maps the segment as the samples of the
+ * reader's PixelBuffer, copy on write, so the frame is never copied
+ * The creator keeps the segment until it calls release(), by which
+ * time the reader must have mapped it
+ *
+ * A frame is described to the reader as
+ * "<name> <width> <height> <channels> <bytes>" of 16 bit samples
+ * in native byte order
+ *
+ * PUBLIC FEATURES:
+ *       SharedFrame();
+ *       ~SharedFrame();
+ *       void prepare(PixelBuffer &frame);
+ *       bool create(PixelBuffer &frame);
+ *       void release();
+ *       string getName();
+ *       string describe();
+ *       static bool read(string description, PixelBuffer &frame);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "SharedFrame.h"
+#include <atomic>
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Makes the names of the segments of this process unique
+static atomic<unsigned int> frameSequence(0);
+
+/**
+ * Default constructor
+ */
+SharedFrame::SharedFrame()
+{
+    name = "";
+    width = height = channels = 0;
+    bytes = 0;
+}
+
+/**
+ * Destructor
+ * Releases the segment
+ */
+SharedFrame::~SharedFrame()
+{
+    release();
+}
+
+/**
+ * Has a frame place its samples in a new segment each time it is
+ * resized, so that create() can share it without copying it
+ * The frame must not outlive the SharedFrame
+ * @param frame - the frame, before it is decoded
+ */
+void SharedFrame::prepare(PixelBuffer &frame)
+{
+    frame.setAllocator(allocate, this);
+}
+
+/**
+ * Shares a frame, releasing any earlier one. A frame decoded after
+ * prepare() is shared where it lies; any other is copied into a new segment
+ * @param frame - the frame
+ * @return true if the frame was shared, false otherwise
+ */
+bool SharedFrame::create(const PixelBuffer &frame)
+{
+    release();
+    size_t size = frame.getMemorySize();
+    if (size == 0)
+        return false;
+
+    for (size_t i = 0; i < segments.size() && !shared; i++)
+    {
+        shared_ptr<unsigned short> samples = segments[i].samples.lock();
+        if (samples && samples.get() == frame.getData() && segments[i].bytes >= size)
+        {
+            shared = samples;
+            name = segments[i].name;
+        }
+    }
+    if (!shared)
+    {
+        shared = createSegment(size, name);
+        if (!shared)
+            return false;
+        memcpy(shared.get(), frame.getData(), size);
+    }
+
+    width = frame.getWidth();
+    height = frame.getHeight();
+    channels = frame.getChannels();
+    bytes = size;
+    return true;
+}
+
+/**
+ * Gives up the segment. Readers that have mapped it keep their mapping
+ */
+void SharedFrame::release()
+{
+    if (name.empty())
+        return;
+#if !defined(_WIN32) && !defined(__linux__)
+    shm_unlink(name.c_str());
+#endif
+    shared.reset();
+    name = "";
+
+    // Forget the segments of frames that have gone
+    for (size_t i = segments.size(); i-- > 0; )
+        if (segments[i].samples.expired())
+            segments.erase(segments.begin() + i);
+}
+
+/**
+ * @return the name of the segment, "" if there is none
+ */
+const string SharedFrame::getName() const
+{
+    return name;
+}
+
+/**
+ * @return the segment as read() expects it: "<name> <width> <height> <channels> <bytes>"
+ */
+const string SharedFrame::describe() const
+{
+    ostringstream description(ostringstream::out);
+    description << name << " " << width << " " << height << " " << channels << " " << bytes;
+    return description.str();
+}
+
+/**
+ * Maps a frame out of a segment created by another process, as the
+ * samples of a PixelBuffer. The mapping is private, so changes to the
+ * samples are not seen by the creator
+ * @param description - the segment, as given by describe()
+ * @param frame - set to the frame
+ * @return true if the frame was mapped, false otherwise
+ */
+bool SharedFrame::read(const string description, PixelBuffer &frame)
+{
+    istringstream fields(description);
+    string segmentName;
+    int frameWidth, frameHeight, frameChannels;
+    size_t size;
+    if (!(fields >> segmentName >> frameWidth >> frameHeight >> frameChannels >> size) || frameWidth < 1
+        || frameHeight < 1 || frameChannels < 1
+        || size != (size_t)frameWidth * frameHeight * frameChannels * sizeof(unsigned short))
+        return false;
+
+#ifdef _WIN32
+    HANDLE opened = OpenFileMappingA(FILE_MAP_COPY, FALSE, segmentName.c_str());
+    void * view = opened ? MapViewOfFile(opened, FILE_MAP_COPY, 0, 0, size) : NULL;
+    if (!view)
+    {
+        if (opened)
+            CloseHandle(opened);
+        return false;
+    }
+    shared_ptr<unsigned short> samples((unsigned short *)view, [opened](unsigned short * view) {
+        UnmapViewOfFile(view);
+        CloseHandle(opened);
+    });
+#else
+#ifdef __linux__
+    int segment = open(segmentName.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+    int segment = shm_open(segmentName.c_str(), O_RDONLY, 0);
+    // Both sides have it open, so it no longer needs a name
+    if (segment >= 0)
+        shm_unlink(segmentName.c_str());
+#endif
+    if (segment < 0)
+        return false;
+    // Mapping past the end of a segment would fault when it is read
+    struct stat status;
+    void * view = MAP_FAILED;
+    if (fstat(segment, &status) == 0 && (size_t)status.st_size >= size)
+        view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, segment, 0);
+    close(segment);
+    if (view == MAP_FAILED)
+        return false;
+    shared_ptr<unsigned short> samples((unsigned short *)view, [size](unsigned short * view) {
+        munmap(view, size);
+    });
+#endif
+    frame.setStorage(frameWidth, frameHeight, frameChannels, samples);
+    return true;
+}
+
+/**
+ * Provides the samples of a prepared frame, in a new segment
+ * @param samples - the number of samples
+ * @param data - the SharedFrame the frame was prepared by
+ * @return the samples, NULL if no segment could be made
+ */
+shared_ptr<unsigned short> SharedFrame::allocate(const size_t samples, void * data)
+{
+    SharedFrame * theFrame = (SharedFrame *)data;
+    Segment theSegment;
+    theSegment.bytes = samples * sizeof(unsigned short);
+    shared_ptr<unsigned short> mapped = createSegment(theSegment.bytes, theSegment.name);
+    if (mapped)
+    {
+        theSegment.samples = mapped;
+        theFrame->segments.push_back(theSegment);
+    }
+    return mapped;
+}
+
+/**
+ * Makes a segment and maps it. The segment is closed, and removed if
+ * it has a name, once the mapping is no longer used
+ * @param bytes - the size of the segment
+ * @param segmentName - set to the name readers open it by
+ * @return the mapping, which is all 0, NULL if the segment could not be made
+ */
+shared_ptr<unsigned short> SharedFrame::createSegment(const size_t bytes, string &segmentName)
+{
+    ostringstream unique(ostringstream::out);
+#ifdef _WIN32
+    unique << "Local\\dcraw-fltk-" << GetCurrentProcessId() << "-" << frameSequence++;
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)bytes >> 32),
+                                        (DWORD)bytes, unique.str().c_str());
+    void * view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes) : NULL;
+    if (!view)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        return shared_ptr<unsigned short>();
+    }
+    segmentName = unique.str();
+    return shared_ptr<unsigned short>((unsigned short *)view, [mapping](unsigned short * view) {
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+    });
+#else
+#ifdef __linux__
+    // Open until the mapping goes, so that readers can open it through /proc
+    int segment = memfd_create("dcraw-fltk-frame", MFD_CLOEXEC);
+    unique << "/proc/" << getpid() << "/fd/" << segment;
+#else
+    unique << "/dcraw-fltk-" << getpid() << "-" << frameSequence++;
+    int segment = shm_open(unique.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+#endif
+    void * view = MAP_FAILED;
+    if (segment >= 0 && ftruncate(segment, (off_t)bytes) == 0)
+        view = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment, 0);
+    if (view == MAP_FAILED)
+    {
+        if (segment >= 0)
+            close(segment);
+#ifndef __linux__
+        shm_unlink(unique.str().c_str());
+#endif
+        return shared_ptr<unsigned short>();
+    }
+    segmentName = unique.str();
+#ifdef __linux__
+    return shared_ptr<unsigned short>((unsigned short *)view, [segment, bytes](unsigned short * view) {
+        munmap(view, bytes);
+        close(segment);
+    });
+#else
+    close(segment);
+    string unlinkName = segmentName;
+    return shared_ptr<unsigned short>((unsigned short *)view, [unlinkName, bytes](unsigned short * view) {
+        munmap(view, bytes);
+        shm_unlink(unlinkName.c_str());
+    });
+#endif
+#endif
+}
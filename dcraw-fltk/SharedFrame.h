@@ -0,0 +1,59 @@
+/**
+ * SharedFrame.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef SHAREDFRAME_H
+#define SHAREDFRAME_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class SharedFrame
+{
+    public:
+        SharedFrame();
+        ~SharedFrame();
+
+        void prepare(PixelBuffer &frame);
+        bool create(const PixelBuffer &frame);
+        void release();
+
+        const string getName() const;
+        const string describe() const;
+
+        static bool read(const string description, PixelBuffer &frame);
+
+    private:
+        SharedFrame(SharedFrame &toCopy);
+
+        /**
+         * A segment made for the samples of a prepared frame
+         */
+        struct Segment
+        {
+            string name;
+            // The mapped samples, which last while a frame uses them
+            weak_ptr<unsigned short> samples;
+            size_t bytes;
+        };
+
+        static shared_ptr<unsigned short> allocate(const size_t samples, void * data);
+        static shared_ptr<unsigned short> createSegment(const size_t bytes, string &segmentName);
+
+        string name;
+        int width;
+        int height;
+        int channels;
+        size_t bytes;
+        // The segment being shared, kept until release()
+        shared_ptr<unsigned short> shared;
+        // Segments made for prepared frames, which may be shared
+        vector<Segment> segments;
+};
+#endif
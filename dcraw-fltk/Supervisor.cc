@@ -0,0 +1,377 @@
+/**
+ * class Supervisor
+ * Runs a child Process (dcraw) under a wall clock timeout and address
+ * space and CPU time limits, so that a corrupt raw file which sends
+ * dcraw into an endless loop or a huge allocation costs a bounded
+ * amount of time and memory rather than stalling a batch and the host
+ *
+ * A run ends in one of the Outcomes: dcraw SUCCEEDED or FAILED (exited
+ * with another code), CRASHED (a fault, such as SIGSEGV, or an abort),
+ * was KILLED by an unexplained SIGKILL (for example from the kernel's
+ * out of memory killer), was STOPPED by SIGINT, SIGTERM or SIGHUP (a
+ * Ctrl-C in the terminal, or a shutdown), TIMED_OUT, hit its CPU_LIMIT,
+ * could not be started (SPAWN_FAILED), or was CANCELLED through the
+ * cancel flag of its Process. Only outcomes that depend on the host
+ * rather than the file are retried: a failure to start and a SIGKILL
+ * from outside, up to the retry count, after a backoff that doubles
+ * with each attempt, and never once stop() has been called. A file that
+ * makes dcraw fail, crash or run past its limits does the same every
+ * time, and is not retried so that it costs no more than one timeout.
+ * A run that was asked to stop is not retried either
+ *
+ * A Supervisor starts with the defaults, which the command line sets
+ * once for every conversion of the run: a timeout of ten minutes, an
+ * address space of half the physical memory, no CPU limit and two retries
+ *
+ * PUBLIC FEATURES:
+ *       Supervisor();
+ *       void setTimeout(int seconds);
+ *       void setMemoryLimit(size_t bytes);
+ *       void setCPULimit(int seconds);
+ *       void setRetries(int retries);
+ *       void setBackoff(int milliseconds);
+ *       int getTimeout();
+ *       size_t getMemoryLimit();
+ *       int getCPULimit();
+ *       int getRetries();
+ *       int getBackoff();
+ *       Result run(Process &theProcess);
+ *       static void setDefaults(Supervisor &defaults);
+ *       static void stop();
+ *       static bool isStopping();
+ *       static Outcome classify(Process &theProcess, int cpuLimit);
+ *       static bool isRetryable(Outcome outcome);
+ *       static string getOutcomeName(Outcome outcome);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "Supervisor.h"
+#include "Metrics.h"
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+using namespace std;
+
+// The settings every new Supervisor starts with
+static mutex defaultsLock;
+static int defaultTimeout = Supervisor::DEFAULT_TIMEOUT_SECONDS;
+static size_t defaultMemoryLimit = Process::getPhysicalMemory() / 2;
+static int defaultCPULimit = 0;
+static int defaultRetries = Supervisor::DEFAULT_RETRIES;
+static int defaultBackoff = Supervisor::DEFAULT_BACKOFF_MILLISECONDS;
+
+// Set once the process is shutting down, after which nothing is retried
+static atomic<bool> stopping(false);
+
+/**
+ * Counts a finished run by its outcome and records its peak memory
+ * @param result - how the run ended
+ */
+static void record(const Supervisor::Result &result)
+{
+    // Registered once; the counters are then updated without a lock
+    static vector<Metrics::Counter *> runs = []()
+    {
+        vector<Metrics::Counter *> counters;
+        for (int outcome = Supervisor::SUCCEEDED; outcome <= Supervisor::CANCELLED; outcome++)
+        {
+            string name = Supervisor::getOutcomeName((Supervisor::Outcome)outcome);
+            for (size_t i = 0; i < name.size(); i++)
+                if (name[i] == ' ')
+                    name[i] = '_';
+            counters.push_back(&Metrics::counter("dcraw_fltk_dcraw_runs_total", "dcraw runs by how they ended",
+                                                 "outcome=\"" + name + "\""));
+        }
+        return counters;
+    }();
+    static Metrics::Histogram &memory = Metrics::histogram("dcraw_fltk_dcraw_peak_memory_bytes",
+        "Peak resident memory of each dcraw run", "", Metrics::bytesBuckets());
+    static Metrics::Counter &retried = Metrics::counter("dcraw_fltk_dcraw_retries_total",
+        "dcraw runs tried again after being killed or failing to start");
+
+    runs[result.outcome]->add();
+    retried.add(result.attempts - 1);
+    if (result.peakRSS > 0)
+        memory.observe((double)result.peakRSS);
+}
+
+/**
+ * Constructor
+ * Starts with the defaults
+ */
+Supervisor::Supervisor()
+{
+    lock_guard<mutex> guard(defaultsLock);
+    timeoutSeconds = defaultTimeout;
+    memoryLimit = defaultMemoryLimit;
+    cpuLimit = defaultCPULimit;
+    retries = defaultRetries;
+    backoffMilliseconds = defaultBackoff;
+}
+
+/**
+ * @param seconds - the wall clock time an attempt may take, 0 for no limit
+ */
+void Supervisor::setTimeout(const int seconds)
+{
+    timeoutSeconds = seconds;
+}
+
+/**
+ * @param bytes - the address space an attempt may allocate, 0 for no limit
+ */
+void Supervisor::setMemoryLimit(const size_t bytes)
+{
+    memoryLimit = bytes;
+}
+
+/**
+ * @param seconds - the CPU time an attempt may use, 0 for no limit
+ */
+void Supervisor::setCPULimit(const int seconds)
+{
+    cpuLimit = seconds;
+}
+
+/**
+ * @param retries - the number of times a retryable outcome is tried again
+ */
+void Supervisor::setRetries(const int retries)
+{
+    this->retries = retries;
+}
+
+/**
+ * @param milliseconds - the wait before the first retry, doubled before each one after
+ */
+void Supervisor::setBackoff(const int milliseconds)
+{
+    backoffMilliseconds = milliseconds;
+}
+
+/**
+ * @return the wall clock time an attempt may take, 0 for no limit
+ */
+const int Supervisor::getTimeout() const
+{
+    return timeoutSeconds;
+}
+
+/**
+ * @return the address space an attempt may allocate, 0 for no limit
+ */
+const size_t Supervisor::getMemoryLimit() const
+{
+    return memoryLimit;
+}
+
+/**
+ * @return the CPU time an attempt may use, 0 for no limit
+ */
+const int Supervisor::getCPULimit() const
+{
+    return cpuLimit;
+}
+
+/**
+ * @return the number of times a retryable outcome is tried again
+ */
+const int Supervisor::getRetries() const
+{
+    return retries;
+}
+
+/**
+ * @return the wait before the first retry in milliseconds
+ */
+const int Supervisor::getBackoff() const
+{
+    return backoffMilliseconds;
+}
+
+/**
+ * Runs a Process under the limits, trying it again as the retry policy
+ * allows. The Process may already have been started, in which case the
+ * first attempt is only waited for; its limits are then those it was
+ * started with
+ * @param theProcess - the Process to run, with its program and arguments set
+ * @return how the last attempt ended
+ */
+const Supervisor::Result Supervisor::run(Process &theProcess) const
+{
+    Result result;
+    result.attempts = 0;
+    result.seconds = 0;
+    result.peakRSS = 0;
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    int backoff = backoffMilliseconds;
+    while (true)
+    {
+        theProcess.setTimeout(timeoutSeconds);
+        if (result.attempts > 0 || !theProcess.hasStarted())
+        {
+            theProcess.reset();
+            theProcess.setMemoryLimit(memoryLimit);
+            theProcess.setCPULimit(cpuLimit);
+            theProcess.start();
+        }
+        theProcess.wait();
+        result.attempts++;
+
+        result.outcome = classify(theProcess, cpuLimit);
+        result.exitCode = theProcess.getExitCode();
+        result.signal = theProcess.getSignal();
+        if (theProcess.getPeakRSS() > result.peakRSS)
+            result.peakRSS = theProcess.getPeakRSS();
+
+        if (result.outcome == SUCCEEDED || !isRetryable(result.outcome) || result.attempts > retries || stopping)
+            break;
+        this_thread::sleep_for(chrono::milliseconds(backoff));
+        backoff *= 2;
+        if (stopping)
+            break;
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    record(result);
+    return result;
+}
+
+/**
+ * @param defaults - the settings every Supervisor created from now on starts with
+ */
+void Supervisor::setDefaults(const Supervisor &defaults)
+{
+    lock_guard<mutex> guard(defaultsLock);
+    defaultTimeout = defaults.timeoutSeconds;
+    defaultMemoryLimit = defaults.memoryLimit;
+    defaultCPULimit = defaults.cpuLimit;
+    defaultRetries = defaults.retries;
+    defaultBackoff = defaults.backoffMilliseconds;
+}
+
+/**
+ * Stops every Supervisor from retrying, as the process shuts down
+ * Only sets a flag, so may be called from a signal handler
+ */
+void Supervisor::stop()
+{
+    stopping = true;
+}
+
+/**
+ * @return true once stop() has been called
+ */
+const bool Supervisor::isStopping()
+{
+    return stopping;
+}
+
+/**
+ * Works out how a finished Process ended from its exit code or signal
+ * @param theProcess - the Process, which has been waited for
+ * @param cpuLimit - the CPU time it was limited to, 0 for none
+ * @return the outcome
+ */
+const Supervisor::Outcome Supervisor::classify(const Process &theProcess, const int cpuLimit)
+{
+    if (theProcess.wasCancelled())
+        return CANCELLED;
+    if (theProcess.hasTimedOut())
+        return TIMED_OUT;
+    if (theProcess.getExitCode() == Process::SPAWN_FAILED)
+        return SPAWN_FAILED;
+    if (theProcess.getExitCode() == 0)
+        return SUCCEEDED;
+    // A child killed at its hard CPU limit looks like any other SIGKILL
+    if (cpuLimit > 0 && theProcess.getCPUTime() >= cpuLimit)
+        return CPU_LIMIT;
+
+#ifdef _WIN32
+    // Unhandled exceptions exit with their NTSTATUS code, such as 0xC0000005
+    if (((unsigned int)theProcess.getExitCode() & 0xC0000000u) == 0xC0000000u)
+        return CRASHED;
+    return FAILED;
+#else
+    switch (theProcess.getSignal())
+    {
+        case 0:
+            // execvp() failing in the child
+            return theProcess.getExitCode() == 127 ? SPAWN_FAILED : FAILED;
+        case SIGXCPU:
+            return CPU_LIMIT;
+        case SIGKILL:
+            return KILLED;
+        case SIGTERM:
+        case SIGINT:
+        case SIGHUP:
+            return STOPPED;
+        default:
+            return CRASHED;
+    }
+#endif
+}
+
+/**
+ * @param outcome - how a run ended
+ * @return true if running again might end differently, false otherwise
+ */
+const bool Supervisor::isRetryable(const Outcome outcome)
+{
+    return outcome == SPAWN_FAILED || outcome == KILLED;
+}
+
+/**
+ * @param outcome - how a run ended
+ * @return the name of the outcome, as used in reports
+ */
+const string Supervisor::getOutcomeName(const Outcome outcome)
+{
+    switch (outcome)
+    {
+        case SUCCEEDED:    return "succeeded";
+        case FAILED:       return "failed";
+        case CRASHED:      return "crashed";
+        case KILLED:       return "killed";
+        case STOPPED:      return "stopped";
+        case TIMED_OUT:    return "timed out";
+        case CPU_LIMIT:    return "cpu limit";
+        case SPAWN_FAILED: return "spawn failed";
+        case CANCELLED:    return "cancelled";
+    }
+    return "unknown";
+}
+
+/**
+ * @return true if the last attempt succeeded
+ */
+const bool Supervisor::Result::succeeded() const
+{
+    return outcome == SUCCEEDED;
+}
+
+/**
+ * @return a one line description of the result, for example
+ *         "crashed (signal 11) after 1 attempt in 0.4 s"
+ */
+const string Supervisor::Result::describe() const
+{
+    ostringstream description(ostringstream::out);
+    description << getOutcomeName(outcome);
+    if (signal != 0)
+        description << " (signal " << signal << ")";
+    else if (outcome != SUCCEEDED && outcome != SPAWN_FAILED && outcome != TIMED_OUT && outcome != CANCELLED)
+        description << " (exit code " << exitCode << ")";
+    description << " after " << attempts << (attempts == 1 ? " attempt" : " attempts");
+    description.precision(3);
+    description << " in " << seconds << " s";
+    return description.str();
+}
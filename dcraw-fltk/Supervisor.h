@@ -0,0 +1,71 @@
+/**
+ * Supervisor.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <string>
+#include <cstddef>
+#include "Process.h"
+
+using namespace std;
+
+class Supervisor
+{
+    public:
+        // How a supervised run ended
+        enum Outcome { SUCCEEDED, FAILED, CRASHED, KILLED, STOPPED, TIMED_OUT, CPU_LIMIT, SPAWN_FAILED, CANCELLED };
+
+        struct Result
+        {
+            Outcome outcome;
+            // Exit code of the last attempt, 128 + the signal if it was killed
+            int exitCode;
+            // Signal that ended the last attempt, 0 if it exited
+            int signal;
+            int attempts;
+            // Wall clock seconds of every attempt and the backoff between them
+            double seconds;
+            size_t peakRSS;
+
+            const bool succeeded() const;
+            const string describe() const;
+        };
+
+        Supervisor();
+
+        void setTimeout(const int seconds);
+        void setMemoryLimit(const size_t bytes);
+        void setCPULimit(const int seconds);
+        void setRetries(const int retries);
+        void setBackoff(const int milliseconds);
+
+        const int getTimeout() const;
+        const size_t getMemoryLimit() const;
+        const int getCPULimit() const;
+        const int getRetries() const;
+        const int getBackoff() const;
+
+        const Result run(Process &theProcess) const;
+
+        static void setDefaults(const Supervisor &defaults);
+        static void stop();
+        static const bool isStopping();
+        static const Outcome classify(const Process &theProcess, const int cpuLimit);
+        static const bool isRetryable(const Outcome outcome);
+        static const string getOutcomeName(const Outcome outcome);
+
+        const static int DEFAULT_TIMEOUT_SECONDS = 600;
+        const static int DEFAULT_RETRIES = 2;
+        const static int DEFAULT_BACKOFF_MILLISECONDS = 500;
+
+    private:
+        int timeoutSeconds;
+        size_t memoryLimit;
+        int cpuLimit;
+        int retries;
+        int backoffMilliseconds;
+};
+#endif
@@ -0,0 +1,161 @@
+/**
+ * class ThumbnailLoader
+ * Loads the thumbnails that cameras embed in raw files, and their
+ * metadata, on a pool of background threads (see DirectoryIndex::extract)
+ * The queue holds only the cells the Filmstrip currently wants, most
+ * wanted first: every call to setWanted replaces it, which cancels
+ * the queued work for cells that have been scrolled out of view
+ * Each finished thumbnail is handed to the GUI thread through
+ * Fl::awake, so the GUI never waits on dcraw
+ *
+ * PUBLIC FEATURES:
+ *       ThumbnailLoader(Fl_Awake_Handler ready, void * data);
+ *       ~ThumbnailLoader();
+ *       void setExecutable(string theExecutable);
+ *       void setFiles(vector<string> files);
+ *       void setWanted(vector<int> indices);
+ *       vector<LoadedThumbnail> takeFinished();
+ *       int getThreadCount();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "ThumbnailLoader.h"
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Constructor
+ * Starts the worker threads, which wait for cells to load
+ * @param ready - called on the GUI thread whenever thumbnails have finished
+ * @param data - passed to ready
+ */
+ThumbnailLoader::ThumbnailLoader(Fl_Awake_Handler ready, void * data)
+{
+    this->ready = ready;
+    this->data = data;
+    generation = 0;
+    stopping = false;
+
+    // Half the cores: dcraw extracting a thumbnail spends most of its time reading the file
+    int threads = max((int)thread::hardware_concurrency() / 2, 2);
+    for (int i = 0; i < threads; i++)
+        workers.push_back(thread(&ThumbnailLoader::work, this));
+}
+
+/**
+ * Destructor
+ * Waits for the thumbnails being loaded
+ */
+ThumbnailLoader::~ThumbnailLoader()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+        queue.clear();
+    }
+    queueChanged.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+/**
+ * @param theExecutable - the path to dcraw
+ */
+void ThumbnailLoader::setExecutable(const string theExecutable)
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        this->theExecutable = theExecutable;
+    }
+    queueChanged.notify_all();
+}
+
+/**
+ * Replaces the files to load thumbnails of, dropping all work on the old ones
+ * @param files - the raw files, indexed by cell
+ */
+void ThumbnailLoader::setFiles(const vector<string> files)
+{
+    lock_guard<mutex> lock(queueMutex);
+    this->files = files;
+    generation++;
+    queue.clear();
+    loading.clear();
+    finished.clear();
+}
+
+/**
+ * Replaces the queue with the cells that still need thumbnails
+ * @param indices - the cells to load, most wanted (on screen) first
+ */
+void ThumbnailLoader::setWanted(const vector<int> indices)
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queue.clear();
+        for (size_t i = 0; i < indices.size(); i++)
+            if (loading.count(indices[i]) == 0)
+                queue.push_back(indices[i]);
+    }
+    queueChanged.notify_all();
+}
+
+/**
+ * Called on the GUI thread after the ready handler is run
+ * @return the thumbnails finished since the last call
+ */
+const vector<LoadedThumbnail> ThumbnailLoader::takeFinished()
+{
+    lock_guard<mutex> lock(queueMutex);
+    vector<LoadedThumbnail> taken;
+    taken.swap(finished);
+    return taken;
+}
+
+/**
+ * @return the number of worker threads
+ */
+const int ThumbnailLoader::getThreadCount() const
+{
+    return (int)workers.size();
+}
+
+/**
+ * The loop of each worker thread: takes the most wanted cell,
+ * loads its thumbnail without holding the lock and hands it on
+ */
+void ThumbnailLoader::work()
+{
+    unique_lock<mutex> lock(queueMutex);
+    while (true)
+    {
+        queueChanged.wait(lock, [this]() { return stopping || (!queue.empty() && !theExecutable.empty()); });
+        if (stopping)
+            return;
+
+        int index = queue.front();
+        queue.pop_front();
+        if (index < 0 || index >= (int)files.size())
+            continue;
+
+        int started = generation;
+        string executable = theExecutable;
+        string filename = files[index];
+        loading.insert(index);
+        lock.unlock();
+
+        // A file that cannot be read is still reported, so the cell is not asked for again
+        LoadedThumbnail loaded;
+        loaded.index = index;
+        loaded.identified = DirectoryIndex::extract(executable, filename, loaded.metadata, loaded.pixels);
+
+        lock.lock();
+        if (started != generation || stopping)
+            continue;
+        loading.erase(index);
+        finished.push_back(loaded);
+        Fl::awake(ready, data);
+    }
+}
@@ -0,0 +1,68 @@
+/**
+ * ThumbnailLoader.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef THUMBNAILLOADER_H
+#define THUMBNAILLOADER_H
+
+#include <Fl/Fl.H>
+#include "DirectoryIndex.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+/**
+ * The thumbnail and metadata extracted from one raw file
+ */
+struct LoadedThumbnail
+{
+    // The cell, as given to setFiles
+    int index;
+    // False if dcraw could not identify the file
+    bool identified;
+    RawMetadata metadata;
+    vector<unsigned char> pixels;
+};
+
+class ThumbnailLoader
+{
+    public:
+        ThumbnailLoader(Fl_Awake_Handler ready, void * data);
+        ~ThumbnailLoader();
+
+        void setExecutable(const string theExecutable);
+        void setFiles(const vector<string> files);
+        void setWanted(const vector<int> indices);
+        const vector<LoadedThumbnail> takeFinished();
+
+        const int getThreadCount() const;
+
+    private:
+        ThumbnailLoader(ThumbnailLoader &toCopy);
+        void work();
+
+        Fl_Awake_Handler ready;
+        void * data;
+
+        // Everything below is shared with the worker threads
+        mutex queueMutex;
+        condition_variable queueChanged;
+        string theExecutable;
+        vector<string> files;
+        // Bumped whenever the files change, so stale results are dropped
+        int generation;
+        // Cells to load, most wanted first, and cells being loaded
+        deque<int> queue;
+        set<int> loading;
+        vector<LoadedThumbnail> finished;
+        bool stopping;
+        vector<thread> workers;
+};
+#endif
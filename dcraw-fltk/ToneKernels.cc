@@ -0,0 +1,479 @@
+/**
+ * class ToneKernels
+ * The per-pixel white balance, brightness and gamma of an image
+ * in memory: each sample is multiplied by its channel multiplier
+ * and by brightness / white level, clipped, and then mapped
+ * through a gamma curve table
+ * Each of these steps keeps to its own channel, as dcraw has already
+ * converted the colour space, so the curve table is exact at a fixed
+ * cost per pixel and a 3D colour table would only interpolate it
+ *
+ * The work is done by one of several kernels written for
+ * different instruction sets (SSE4.1, AVX2, AVX-512 and a scalar
+ * reference). The best kernel the processor supports is chosen
+ * the first time one is needed. All kernels do the same single
+ * precision arithmetic in the same order, so their output is
+ * identical to the scalar reference
+ *
+ * PUBLIC FEATURES:
+ *       ToneKernels(double redMultiplier, double blueMultiplier, double brightness,
+ *                   int whiteLevel, double gamma);
+ *       ~ToneKernels();
+ *       void apply(unsigned short * in, unsigned short * out, size_t pixels);
+ *       void apply(float * in, unsigned short * out, size_t pixels);
+ *       void apply(unsigned short * in, unsigned short * out, size_t pixels, int instructionSet);
+ *       void apply(float * in, unsigned short * out, size_t pixels, int instructionSet);
+ *       static int getInstructionSet();
+ *       static bool isSupported(int instructionSet);
+ *       static char * getInstructionSetName(int instructionSet);
+ *       static int autoWhiteLevel(PixelBuffer &source);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "ToneKernels.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TONE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911)
+#define TONE_AVX512
+#endif
+#endif
+
+// GCC and Clang compile each kernel for its own instruction set;
+// MSVC accepts the intrinsics without any option
+#if defined(__GNUC__)
+#define TONE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TONE_TARGET(isa)
+#endif
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param redMultiplier - the multiplier for the red channel
+ * @param blueMultiplier - the multiplier for the blue channel
+ * @param brightness - the brightness, as passed to dcraw -b
+ * @param whiteLevel - the sample value that maps to white at brightness 1.0
+ * @param gamma - the gamma value, as passed to dcraw -g
+ */
+ToneKernels::ToneKernels(const double redMultiplier, const double blueMultiplier, const double brightness,
+                         const int whiteLevel, const double gamma)
+{
+    double toCurve = brightness / (whiteLevel < 1 ? 1 : whiteLevel) * CURVE_MAX;
+    scale[0] = (float)(redMultiplier * toCurve);
+    scale[1] = (float)toCurve;
+    scale[2] = (float)(blueMultiplier * toCurve);
+
+    // dcraw -g takes the reciprocal of its argument as the curve exponent
+    double power = gamma > 0 ? 1.0 / gamma : 1.0;
+    curve.resize(CURVE_MAX + 2);
+    for (int i = 0; i <= CURVE_MAX; i++)
+        curve[i] = (unsigned short)(pow((double)i / CURVE_MAX, power) * 65535.0 + 0.5);
+    curve[CURVE_MAX + 1] = 0;
+}
+
+/**
+ * Destructor
+ */
+ToneKernels::~ToneKernels()
+{}
+
+/**
+ * Scalar reference kernel, also used for the pixels left over by the vector kernels
+ * @param in - interleaved red, green and blue input samples
+ * @param out - interleaved output samples
+ * @param pixels - the number of pixels
+ * @param scale - the scale of the red, green and blue samples
+ * @param curve - the gamma curve table
+ */
+template <typename Sample>
+static void toneScalar(const Sample * in, unsigned short * out, const size_t pixels,
+                       const float scale[3], const unsigned short * curve)
+{
+    const float top = (float)ToneKernels::CURVE_MAX;
+    for (size_t i = 0; i < pixels * 3; i += 3)
+        for (int c = 0; c < 3; c++)
+        {
+            float t = (float)in[i + c] * scale[c];
+            t = t > 0.0f ? t : 0.0f;
+            t = t < top ? t : top;
+            out[i + c] = curve[(int)t];
+        }
+}
+
+#ifdef TONE_X86
+
+/**
+ * Scales, clips and converts 4 samples to curve indices
+ */
+TONE_TARGET("sse4.1")
+static inline __m128i toneIndexSSE41(const __m128 samples, const __m128 scale)
+{
+    __m128 t = _mm_mul_ps(samples, scale);
+    t = _mm_max_ps(t, _mm_setzero_ps());
+    t = _mm_min_ps(t, _mm_set1_ps((float)ToneKernels::CURVE_MAX));
+    return _mm_cvttps_epi32(t);
+}
+
+/**
+ * Looks up 4 curve indices one at a time (SSE4.1 has no gather)
+ */
+TONE_TARGET("sse4.1")
+static inline __m128i toneLookupSSE41(const __m128i index, const unsigned short * curve)
+{
+    return _mm_set_epi32(curve[_mm_extract_epi32(index, 3)], curve[_mm_extract_epi32(index, 2)],
+                         curve[_mm_extract_epi32(index, 1)], curve[_mm_extract_epi32(index, 0)]);
+}
+
+TONE_TARGET("sse4.1")
+static inline __m128 toneLoadSSE41(const unsigned short * in)
+{
+    return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)in)));
+}
+
+TONE_TARGET("sse4.1")
+static inline __m128 toneLoadSSE41(const float * in)
+{
+    return _mm_loadu_ps(in);
+}
+
+/**
+ * SSE4.1 kernel, 4 pixels (12 samples) at a time
+ */
+template <typename Sample>
+TONE_TARGET("sse4.1")
+static void toneSSE41(const Sample * in, unsigned short * out, const size_t pixels,
+                      const float * pattern, const unsigned short * curve)
+{
+    const __m128 scale0 = _mm_loadu_ps(pattern);
+    const __m128 scale1 = _mm_loadu_ps(pattern + 4);
+    const __m128 scale2 = _mm_loadu_ps(pattern + 8);
+
+    size_t blocks = pixels / 4;
+    for (size_t block = 0; block < blocks; block++, in += 12, out += 12)
+    {
+        __m128i v0 = toneLookupSSE41(toneIndexSSE41(toneLoadSSE41(in), scale0), curve);
+        __m128i v1 = toneLookupSSE41(toneIndexSSE41(toneLoadSSE41(in + 4), scale1), curve);
+        __m128i v2 = toneLookupSSE41(toneIndexSSE41(toneLoadSSE41(in + 8), scale2), curve);
+        _mm_storeu_si128((__m128i *)out, _mm_packus_epi32(v0, v1));
+        _mm_storel_epi64((__m128i *)(out + 8), _mm_packus_epi32(v2, v2));
+    }
+    toneScalar(in, out, pixels - blocks * 4, pattern, curve);
+}
+
+TONE_TARGET("avx2")
+static inline __m256 toneLoadAVX2(const unsigned short * in)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)in)));
+}
+
+TONE_TARGET("avx2")
+static inline __m256 toneLoadAVX2(const float * in)
+{
+    return _mm256_loadu_ps(in);
+}
+
+/**
+ * Scales, clips and looks up 8 samples, gathering 32 bits at each
+ * 16 bit table entry and keeping the low half
+ */
+TONE_TARGET("avx2")
+static inline __m256i toneAVX2(const __m256 samples, const __m256 scale, const unsigned short * curve)
+{
+    __m256 t = _mm256_mul_ps(samples, scale);
+    t = _mm256_max_ps(t, _mm256_setzero_ps());
+    t = _mm256_min_ps(t, _mm256_set1_ps((float)ToneKernels::CURVE_MAX));
+    __m256i gathered = _mm256_i32gather_epi32((const int *)curve, _mm256_cvttps_epi32(t), 2);
+    return _mm256_and_si256(gathered, _mm256_set1_epi32(0xffff));
+}
+
+/**
+ * AVX2 kernel, 8 pixels (24 samples) at a time
+ */
+template <typename Sample>
+TONE_TARGET("avx2")
+static void toneAVX2(const Sample * in, unsigned short * out, const size_t pixels,
+                     const float * pattern, const unsigned short * curve)
+{
+    const __m256 scale0 = _mm256_loadu_ps(pattern);
+    const __m256 scale1 = _mm256_loadu_ps(pattern + 8);
+    const __m256 scale2 = _mm256_loadu_ps(pattern + 16);
+
+    size_t blocks = pixels / 8;
+    for (size_t block = 0; block < blocks; block++, in += 24, out += 24)
+    {
+        __m256i v0 = toneAVX2(toneLoadAVX2(in), scale0, curve);
+        __m256i v1 = toneAVX2(toneLoadAVX2(in + 8), scale1, curve);
+        __m256i v2 = toneAVX2(toneLoadAVX2(in + 16), scale2, curve);
+
+        // packus works within 128 bit lanes, so the quarters are put back in order
+        __m256i packed01 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v0, v1), 0xd8);
+        __m256i packed22 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v2, v2), 0xd8);
+        _mm256_storeu_si256((__m256i *)out, packed01);
+        _mm_storeu_si128((__m128i *)(out + 16), _mm256_castsi256_si128(packed22));
+    }
+    toneScalar(in, out, pixels - blocks * 8, pattern, curve);
+}
+
+#ifdef TONE_AVX512
+
+TONE_TARGET("avx512f")
+static inline __m512 toneLoadAVX512(const unsigned short * in)
+{
+    return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)in)));
+}
+
+TONE_TARGET("avx512f")
+static inline __m512 toneLoadAVX512(const float * in)
+{
+    return _mm512_loadu_ps(in);
+}
+
+/**
+ * Scales, clips and looks up 16 samples
+ */
+TONE_TARGET("avx512f")
+static inline __m256i toneAVX512(const __m512 samples, const __m512 scale, const unsigned short * curve)
+{
+    __m512 t = _mm512_mul_ps(samples, scale);
+    t = _mm512_max_ps(t, _mm512_setzero_ps());
+    t = _mm512_min_ps(t, _mm512_set1_ps((float)ToneKernels::CURVE_MAX));
+    __m512i gathered = _mm512_i32gather_epi32(_mm512_cvttps_epi32(t), (const void *)curve, 2);
+    return _mm512_cvtepi32_epi16(_mm512_and_si512(gathered, _mm512_set1_epi32(0xffff)));
+}
+
+/**
+ * AVX-512 kernel, 16 pixels (48 samples) at a time
+ */
+template <typename Sample>
+TONE_TARGET("avx512f")
+static void toneAVX512(const Sample * in, unsigned short * out, const size_t pixels,
+                       const float * pattern, const unsigned short * curve)
+{
+    const __m512 scale0 = _mm512_loadu_ps(pattern);
+    const __m512 scale1 = _mm512_loadu_ps(pattern + 16);
+    const __m512 scale2 = _mm512_loadu_ps(pattern + 32);
+
+    size_t blocks = pixels / 16;
+    for (size_t block = 0; block < blocks; block++, in += 48, out += 48)
+    {
+        _mm256_storeu_si256((__m256i *)out, toneAVX512(toneLoadAVX512(in), scale0, curve));
+        _mm256_storeu_si256((__m256i *)(out + 16), toneAVX512(toneLoadAVX512(in + 16), scale1, curve));
+        _mm256_storeu_si256((__m256i *)(out + 32), toneAVX512(toneLoadAVX512(in + 32), scale2, curve));
+    }
+    toneScalar(in, out, pixels - blocks * 16, pattern, curve);
+}
+
+#endif
+#endif
+
+/**
+ * Runs the kernel for an instruction set
+ * @param in - interleaved red, green and blue input samples
+ * @param out - interleaved output samples
+ * @param pixels - the number of pixels
+ * @param instructionSet - the kernel to use; unsupported ones fall back to SCALAR
+ * @param scale - the scale of the red, green and blue samples
+ * @param curve - the gamma curve table
+ */
+template <typename Sample>
+static void toneDispatch(const Sample * in, unsigned short * out, const size_t pixels, int instructionSet,
+                         const float scale[3], const unsigned short * curve)
+{
+    // The channel scales repeated across three vectors of the widest kernel
+    float pattern[48];
+    for (int i = 0; i < 48; i++)
+        pattern[i] = scale[i % 3];
+
+    if (!ToneKernels::isSupported(instructionSet))
+        instructionSet = ToneKernels::SCALAR;
+
+    switch (instructionSet)
+    {
+#ifdef TONE_X86
+#ifdef TONE_AVX512
+        case ToneKernels::AVX512:
+            toneAVX512(in, out, pixels, pattern, curve);
+            return;
+#endif
+        case ToneKernels::AVX2:
+            toneAVX2(in, out, pixels, pattern, curve);
+            return;
+        case ToneKernels::SSE41:
+            toneSSE41(in, out, pixels, pattern, curve);
+            return;
+#endif
+        default:
+            toneScalar(in, out, pixels, pattern, curve);
+            return;
+    }
+}
+
+/**
+ * Applies white balance, brightness and gamma to 16 bit samples with the best kernel
+ * @param in - interleaved red, green and blue input samples
+ * @param out - interleaved output samples (may be the same as in)
+ * @param pixels - the number of pixels
+ */
+void ToneKernels::apply(const unsigned short * in, unsigned short * out, const size_t pixels) const
+{
+    toneDispatch(in, out, pixels, getInstructionSet(), scale, &curve[0]);
+}
+
+/**
+ * Applies white balance, brightness and gamma to float samples with the best kernel
+ * @param in - interleaved red, green and blue input samples, on the 16 bit scale
+ * @param out - interleaved output samples
+ * @param pixels - the number of pixels
+ */
+void ToneKernels::apply(const float * in, unsigned short * out, const size_t pixels) const
+{
+    toneDispatch(in, out, pixels, getInstructionSet(), scale, &curve[0]);
+}
+
+/**
+ * Applies white balance, brightness and gamma to 16 bit samples with a chosen kernel
+ * @param in - interleaved red, green and blue input samples
+ * @param out - interleaved output samples (may be the same as in)
+ * @param pixels - the number of pixels
+ * @param instructionSet - the kernel to use
+ */
+void ToneKernels::apply(const unsigned short * in, unsigned short * out, const size_t pixels,
+                        const int instructionSet) const
+{
+    toneDispatch(in, out, pixels, instructionSet, scale, &curve[0]);
+}
+
+/**
+ * Applies white balance, brightness and gamma to float samples with a chosen kernel
+ * @param in - interleaved red, green and blue input samples, on the 16 bit scale
+ * @param out - interleaved output samples
+ * @param pixels - the number of pixels
+ * @param instructionSet - the kernel to use
+ */
+void ToneKernels::apply(const float * in, unsigned short * out, const size_t pixels,
+                        const int instructionSet) const
+{
+    toneDispatch(in, out, pixels, instructionSet, scale, &curve[0]);
+}
+
+/**
+ * Asks the processor (and operating system, for the wider
+ * registers) which instruction sets can be used
+ * @return the best instruction set available
+ */
+static int detectInstructionSet()
+{
+#ifdef TONE_X86
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int highest = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    unsigned long long enabled = osxsave ? _xgetbv(0) : 0;
+    bool avx2 = false, avx512 = false;
+    if (highest >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = avx && (enabled & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+        avx512 = (enabled & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse41 = __builtin_cpu_supports("sse4.1") != 0;
+    bool avx2 = __builtin_cpu_supports("avx2") != 0;
+    bool avx512 = __builtin_cpu_supports("avx512f") != 0;
+#endif
+#ifdef TONE_AVX512
+    if (avx512)
+        return ToneKernels::AVX512;
+#endif
+    if (avx2)
+        return ToneKernels::AVX2;
+    if (sse41)
+        return ToneKernels::SSE41;
+#endif
+    return ToneKernels::SCALAR;
+}
+
+/**
+ * @return the best instruction set this processor supports, detected once
+ */
+const int ToneKernels::getInstructionSet()
+{
+    static const int best = detectInstructionSet();
+    return best;
+}
+
+/**
+ * @param instructionSet - the instruction set to check
+ * @return true if this processor (and build) can run the kernel for it
+ */
+const bool ToneKernels::isSupported(const int instructionSet)
+{
+    return instructionSet >= SCALAR && instructionSet <= getInstructionSet();
+}
+
+/**
+ * @param instructionSet - the instruction set
+ * @return the name of the instruction set
+ */
+const char * ToneKernels::getInstructionSetName(const int instructionSet)
+{
+    switch (instructionSet)
+    {
+        case SSE41:
+            return "SSE4.1";
+        case AVX2:
+            return "AVX2";
+        case AVX512:
+            return "AVX-512";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+ * Finds the white level the way dcraw does when it brightens its
+ * output: the level that 1% of the samples of the brightest
+ * channel lie above, counted in bins of 8
+ * @param source - the linear image
+ * @return the white level
+ */
+const int ToneKernels::autoWhiteLevel(const PixelBuffer &source)
+{
+    int channels = source.getChannels();
+    if (channels < 1 || source.getPixelCount() == 0)
+        return 0xffff;
+
+    vector<unsigned int> histogram((size_t)channels * 0x2000, 0);
+    const unsigned short * sample = source.getData();
+    size_t pixels = source.getPixelCount();
+    for (size_t i = 0; i < pixels; i++)
+        for (int c = 0; c < channels; c++)
+            histogram[(size_t)c * 0x2000 + (*sample++ >> 3)]++;
+
+    double percentile = source.getPixelCount() * 0.01;
+    int white = 0;
+    for (int c = 0; c < channels; c++)
+    {
+        int value;
+        double total = 0;
+        for (value = 0x2000; --value > 32; )
+            if ((total += histogram[(size_t)c * 0x2000 + value]) > percentile)
+                break;
+        if (white < value)
+            white = value;
+    }
+    return white << 3;
+}
@@ -0,0 +1,47 @@
+/**
+ * ToneKernels.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef TONEKERNELS_H
+#define TONEKERNELS_H
+
+#include <vector>
+#include <cstddef>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class ToneKernels
+{
+    public:
+        ToneKernels(const double redMultiplier, const double blueMultiplier, const double brightness,
+                    const int whiteLevel, const double gamma);
+        ~ToneKernels();
+
+        void apply(const unsigned short * in, unsigned short * out, const size_t pixels) const;
+        void apply(const float * in, unsigned short * out, const size_t pixels) const;
+        void apply(const unsigned short * in, unsigned short * out, const size_t pixels, const int instructionSet) const;
+        void apply(const float * in, unsigned short * out, const size_t pixels, const int instructionSet) const;
+
+        static const int getInstructionSet();
+        static const bool isSupported(const int instructionSet);
+        static const char * getInstructionSetName(const int instructionSet);
+        static const int autoWhiteLevel(const PixelBuffer &source);
+
+        // Instruction sets, in order of preference
+        const static int SCALAR = 0;
+        const static int SSE41 = 1;
+        const static int AVX2 = 2;
+        const static int AVX512 = 3;
+
+        // Largest index of the tone curve table
+        const static int CURVE_MAX = 0xffff;
+
+    private:
+        // Per sample scale for three pixels (red, green, blue repeated)
+        float scale[3];
+        // Gamma curve over the scaled range, padded by one entry for 32 bit gathers
+        vector<unsigned short> curve;
+};
+#endif
@@ -0,0 +1,252 @@
+/**
+ * class WaveletDenoiser
+ * Removes noise the way dcraw's -n option does: each channel is
+ * square-root transformed, split into five levels of detail with the
+ * "a trous" wavelet transform, and each level is soft-thresholded,
+ * by the threshold scaled to the noise expected at that level
+ *
+ * dcraw runs this on one thread over the whole image. Here the image
+ * is cut into tiles that are denoised on all processors at once. Each
+ * tile is transformed together with an apron of APRON pixels around
+ * it, which is as far as the five levels of the transform reach, so
+ * the tiles join without seams and give the same result as the whole
+ * image. The transforms run along rows of contiguous floats, including
+ * the vertical pass, so that the compiler vectorises them
+ *
+ * Unlike dcraw, which denoises the raw channels before demosaicing,
+ * this works on decoded RGB, so it can follow a cached decode
+ *
+ * PUBLIC FEATURES:
+ *       WaveletDenoiser(double threshold);
+ *       ~WaveletDenoiser();
+ *       void apply(PixelBuffer &source, PixelBuffer &destination);
+ *       double getThreshold();
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "WaveletDenoiser.h"
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+// Noise at each level of the transform for unit noise in the image, from dcraw
+static const float LEVEL_NOISE[WaveletDenoiser::LEVELS] = { 0.8002f, 0.2735f, 0.1202f, 0.0585f, 0.0291f };
+
+/**
+ * Square root transform of every 16 bit sample, as dcraw calculates it
+ * @return the table, built on first use
+ */
+static const vector<float> & sqrtTable()
+{
+    static const vector<float> table = []()
+    {
+        vector<float> values(65536);
+        for (int i = 0; i < 65536; i++)
+            values[i] = (float)(256 * sqrt((double)i));
+        return values;
+    }();
+    return table;
+}
+
+/**
+ * Reflects an index off the ends of a row or column, as dcraw does
+ * @param index - the index, at most one length outside
+ * @param size - the length of the row or column
+ * @return the reflected index
+ */
+static inline int reflect(const int index, const int size)
+{
+    if (index < 0)
+        return -index;
+    if (index >= size)
+        return 2 * size - 2 - index;
+    return index;
+}
+
+/**
+ * Constructor
+ * @param threshold - the noise threshold, as passed to dcraw -n (100 to 1000 is usual)
+ */
+WaveletDenoiser::WaveletDenoiser(const double threshold)
+{
+    this->threshold = (float)threshold;
+}
+
+/**
+ * Destructor
+ */
+WaveletDenoiser::~WaveletDenoiser()
+{}
+
+/**
+ * Denoises an image
+ * @param source - the linear 16 bit image
+ * @param destination - set to the denoised image, the same size
+ */
+void WaveletDenoiser::apply(const PixelBuffer &source, PixelBuffer &destination) const
+{
+    destination.resize(source.getWidth(), source.getHeight(), source.getChannels());
+    int width = source.getWidth();
+    int height = source.getHeight();
+
+    // The widest level reaches 16 pixels either side, and reflects off
+    // the edges, so smaller images are left as they are, as dcraw cannot do them
+    int reach = 1 << (LEVELS - 1);
+    if (width <= reach || height <= reach || threshold <= 0)
+    {
+        copy(source.getData(), source.getData() + source.getPixelCount() * source.getChannels(), destination.getData());
+        return;
+    }
+
+    int tilesAcross = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesAcross * ((height + TILE_SIZE - 1) / TILE_SIZE);
+    int threads = max(min((int)thread::hardware_concurrency(), tileCount), 1);
+
+    atomic<int> next(0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread([&]()
+        {
+            vector<float> work;
+            for (int tile = next++; tile < tileCount; tile = next++)
+                denoiseTile(source, destination, (tile % tilesAcross) * TILE_SIZE, (tile / tilesAcross) * TILE_SIZE, work);
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+/**
+ * Denoises one tile, reading the apron around it
+ * @param source - the linear 16 bit image
+ * @param destination - the denoised image, whose tile is written
+ * @param tileX - the left of the tile
+ * @param tileY - the top of the tile
+ * @param work - memory for the transform, kept between tiles
+ */
+void WaveletDenoiser::denoiseTile(const PixelBuffer &source, PixelBuffer &destination, const int tileX, const int tileY,
+                                  vector<float> &work) const
+{
+    int channels = source.getChannels();
+    int imageWidth = source.getWidth();
+    int left = max(tileX - APRON, 0);
+    int top = max(tileY - APRON, 0);
+    int right = min(tileX + TILE_SIZE + APRON, imageWidth);
+    int bottom = min(tileY + TILE_SIZE + APRON, source.getHeight());
+    int width = right - left;
+    int height = bottom - top;
+    size_t size = (size_t)width * height;
+
+    // The denoised detail summed so far, two lowpass images in turn,
+    // and the rows-only pass of each level
+    work.resize(size * 4);
+    float * sum = &work[0];
+    float * lowpass[2] = { &work[size], &work[size * 2] };
+    float * rows = &work[size * 3];
+    const vector<float> &roots = sqrtTable();
+
+    for (int c = 0; c < channels; c++)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned short * in = source.getData() + ((size_t)(top + y) * imageWidth + left) * channels + c;
+            float * out = sum + (size_t)y * width;
+            for (int x = 0; x < width; x++)
+                out[x] = roots[in[x * channels]];
+        }
+
+        float * base = sum;
+        float * low = NULL;
+        for (int level = 0; level < LEVELS; level++)
+        {
+            low = lowpass[level & 1];
+            hatRows(base, rows, width, height, 1 << level);
+            hatColumns(rows, low, width, height, 1 << level);
+
+            // The detail at this level is what the smoothing removed
+            float limit = threshold * LEVEL_NOISE[level];
+            for (size_t i = 0; i < size; i++)
+            {
+                float detail = base[i] - low[i];
+                detail = detail < -limit ? detail + limit : (detail > limit ? detail - limit : 0.0f);
+                base[i] = detail;
+            }
+            if (level > 0)
+                for (size_t i = 0; i < size; i++)
+                    sum[i] += base[i];
+            base = low;
+        }
+
+        int tileWidth = min(TILE_SIZE, imageWidth - tileX);
+        int tileHeight = min(TILE_SIZE, source.getHeight() - tileY);
+        for (int y = tileY - top; y < tileY - top + tileHeight; y++)
+        {
+            const float * detail = sum + (size_t)y * width;
+            const float * smooth = low + (size_t)y * width;
+            unsigned short * out = destination.getData() + ((size_t)(top + y) * imageWidth + tileX) * channels + c;
+            for (int x = tileX - left; x < tileX - left + tileWidth; x++)
+            {
+                float value = detail[x] + smooth[x];
+                int sample = (int)(value * value / 0x10000);
+                out[(x - (tileX - left)) * channels] = (unsigned short)(sample < 0 ? 0 : (sample > 65535 ? 65535 : sample));
+            }
+        }
+    }
+}
+
+/**
+ * The horizontal half of one level of the transform: a quarter of
+ * each sample doubled plus its neighbours spacing either side
+ * @param in - the image
+ * @param out - set to the transformed image
+ * @param width - the width of the image
+ * @param height - the height of the image
+ * @param spacing - the distance to the neighbours, 2 to the power of the level
+ */
+void WaveletDenoiser::hatRows(const float * in, float * out, const int width, const int height, const int spacing)
+{
+    for (int y = 0; y < height; y++, in += width, out += width)
+    {
+        int x = 0;
+        for (; x < spacing; x++)
+            out[x] = (2 * in[x] + in[reflect(x - spacing, width)] + in[reflect(x + spacing, width)]) * 0.25f;
+        for (; x + spacing < width; x++)
+            out[x] = (2 * in[x] + in[x - spacing] + in[x + spacing]) * 0.25f;
+        for (; x < width; x++)
+            out[x] = (2 * in[x] + in[reflect(x - spacing, width)] + in[reflect(x + spacing, width)]) * 0.25f;
+    }
+}
+
+/**
+ * The vertical half of one level of the transform. Whole rows are
+ * combined at once, rather than walking
+ * down each column, so the loop runs over contiguous samples
+ * @param in - the image after hatRows()
+ * @param out - set to the lowpass image of the level
+ * @param width - the width of the image
+ * @param height - the height of the image
+ * @param spacing - the distance to the neighbours, 2 to the power of the level
+ */
+void WaveletDenoiser::hatColumns(const float * in, float * out, const int width, const int height, const int spacing)
+{
+    for (int y = 0; y < height; y++)
+    {
+        const float * centre = in + (size_t)y * width;
+        const float * above = in + (size_t)reflect(y - spacing, height) * width;
+        const float * below = in + (size_t)reflect(y + spacing, height) * width;
+        float * row = out + (size_t)y * width;
+        for (int x = 0; x < width; x++)
+            row[x] = (2 * centre[x] + above[x] + below[x]) * 0.25f;
+    }
+}
+
+/**
+ * @return the noise threshold
+ */
+const double WaveletDenoiser::getThreshold() const
+{
+    return threshold;
+}
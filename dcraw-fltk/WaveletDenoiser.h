@@ -0,0 +1,40 @@
+/**
+ * WaveletDenoiser.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef WAVELETDENOISER_H
+#define WAVELETDENOISER_H
+
+#include <vector>
+#include "PixelBuffer.h"
+
+using namespace std;
+
+class WaveletDenoiser
+{
+    public:
+        WaveletDenoiser(const double threshold);
+        ~WaveletDenoiser();
+
+        void apply(const PixelBuffer &source, PixelBuffer &destination) const;
+        const double getThreshold() const;
+
+        // Wavelet levels, as in dcraw
+        const static int LEVELS = 5;
+        // Side of the square tiles each thread denoises
+        const static int TILE_SIZE = 256;
+        // Pixels around each tile that the transforms read: 1 + 2 + 4 + 8 + 16 rounded up
+        const static int APRON = 32;
+
+    private:
+        WaveletDenoiser(WaveletDenoiser &toCopy);
+
+        void denoiseTile(const PixelBuffer &source, PixelBuffer &destination, const int tileX, const int tileY,
+                         vector<float> &work) const;
+        static void hatRows(const float * in, float * out, const int width, const int height, const int spacing);
+        static void hatColumns(const float * in, float * out, const int width, const int height, const int spacing);
+
+        float threshold;
+};
+#endif
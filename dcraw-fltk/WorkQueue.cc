@@ -0,0 +1,547 @@
+/**
+ * class WorkQueue
+ * A queue of conversions kept as files in a directory, so that any
+ * number of processes, on any number of hosts sharing the directory,
+ * can work through one batch without a server
+ *
+ * Each job is an Image serialized into a file that moves between the
+ * pending, claimed, done and failed subdirectories. A worker claims a
+ * job by renaming it from pending to claimed under a name of its own,
+ * the job's name followed by the worker, a claim number and the lease
+ * time: rename is atomic, so exactly one worker succeeds, and a claim
+ * is its file in claimed, which no other worker can take over without
+ * renaming it away. The worker touches the file as a heartbeat. A claim
+ * not touched for its lease time belongs to a worker that has died or
+ * lost the share, and any worker renames its job back to pending to be
+ * claimed again
+ * Lease times are measured against the modification time of a file
+ * the worker has just touched, so hosts use the file server's clock
+ * rather than their own, and need not agree on the time
+ *
+ * A job is converted at least once, and recorded done or failed once:
+ * a worker that stalls for longer than its lease finds its claim file
+ * gone at its next heartbeat, kills its conversion and does not record
+ * it, although outputs it wrote before then may be written again
+
+ * PUBLIC FEATURES:
+ *       WorkQueue(string directory);
+ *       ~WorkQueue();
+ *       bool create();
+ *       bool submit(Image &theImage, string &jobName);
+ *       bool claim(Image &theImage, string &jobName);
+ *       bool heartbeat(string jobName);
+ *       bool complete(string jobName, int exitCode);
+ *       int reclaim();
+ *       int work(string theExecutable, int jobs, bool untilEmpty);
+ *       void setLeaseSeconds(int leaseSeconds);
+ *       int getLeaseSeconds();
+ *       string getDirectory();
+ *       string getWorkerId();
+ *       int count(int state);
+ *
+ * @author https://github.com/aaronmboyd
+ */
+
+#include "WorkQueue.h"
+#include "Converter.h"
+#include "Process.h"
+#include <Fl/filename.H>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+using namespace std;
+
+// Subdirectory of each job state
+static const char * const STATE_DIRECTORIES[WorkQueue::STATES] = { "pending", "claimed", "done", "failed" };
+
+// Jobs are named so that they sort in the order they were submitted
+static atomic<unsigned int> jobSequence(0);
+// Numbers the claims of this process, so that every claim has a name of its own
+static atomic<unsigned int> claimSequence(0);
+
+/**
+ * Constructor
+ * @param directory - the directory of the queue, shared by every worker
+ */
+WorkQueue::WorkQueue(const string directory)
+{
+    this->directory = directory;
+    leaseSeconds = DEFAULT_LEASE_SECONDS;
+
+    char host[256] = "";
+#ifdef _WIN32
+    DWORD length = sizeof(host);
+    GetComputerNameA(host, &length);
+    unsigned long processId = GetCurrentProcessId();
+#else
+    gethostname(host, sizeof(host) - 1);
+    unsigned long processId = (unsigned long)getpid();
+#endif
+    ostringstream id(ostringstream::out);
+    id << host << "-" << processId;
+    workerId = id.str();
+}
+
+/**
+ * Destructor
+ */
+WorkQueue::~WorkQueue()
+{}
+
+/**
+ * Creates the queue directory and the directory of each job state
+ * @return true if they all exist, false otherwise
+ */
+bool WorkQueue::create()
+{
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+    for (int state = 0; state < STATES; state++)
+        _mkdir((directory + "/" + STATE_DIRECTORIES[state]).c_str());
+#else
+    mkdir(directory.c_str(), 0777);
+    for (int state = 0; state < STATES; state++)
+        mkdir((directory + "/" + STATE_DIRECTORIES[state]).c_str(), 0777);
+#endif
+    for (int state = 0; state < STATES; state++)
+        if (!fl_filename_isdir((directory + "/" + STATE_DIRECTORIES[state]).c_str()))
+            return false;
+    return true;
+}
+
+/**
+ * Adds a conversion to the queue
+ * The job is written aside and renamed into pending, so that no
+ * worker can claim it half written
+ * @param theImage - the conversion, with filenames every worker can reach
+ * @param jobName - set to the name of the job
+ * @return true if the job was queued, false otherwise
+ */
+bool WorkQueue::submit(const Image &theImage, string &jobName)
+{
+    long long now = (long long)chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    char name[64];
+    snprintf(name, sizeof(name), "%014lld-", now);
+    ostringstream unique(ostringstream::out);
+    unique << name << workerId << "-" << jobSequence++ << ".job";
+    jobName = unique.str();
+
+    string temporary = directory + "/." + jobName + ".tmp";
+    if (!writeFile(temporary, theImage.serialize()))
+        return false;
+    if (rename(temporary.c_str(), path(PENDING, jobName).c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Claims the oldest pending job and takes out a lease on it
+ * The caller must heartbeat() the job until it calls complete()
+ * @param theImage - set to the conversion
+ * @param jobName - set to the name of the job
+ * @return true if a job was claimed, false if none is pending
+ */
+bool WorkQueue::claim(Image &theImage, string &jobName)
+{
+    vector<string> pending = listJobs(PENDING);
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        // The lease starts from the modification time, which rename keeps,
+        // so it is renewed before the job can be seen in claimed
+#ifdef _WIN32
+        if (_utime(path(PENDING, pending[i]).c_str(), NULL) != 0)
+#else
+        if (utime(path(PENDING, pending[i]).c_str(), NULL) != 0)
+#endif
+            continue;
+
+        // Only one of the workers renaming the same job succeeds
+        ostringstream claimName(ostringstream::out);
+        claimName << pending[i] << "@" << workerId << "." << claimSequence++ << "." << leaseSeconds << "s";
+        if (rename(path(PENDING, pending[i]).c_str(), path(CLAIMED, claimName.str()).c_str()) != 0)
+            continue;
+
+        jobName = pending[i];
+        {
+            lock_guard<mutex> guard(heldLock);
+            Lease &lease = held[jobName];
+            lease.claimName = claimName.str();
+            lease.lost = make_shared< atomic<bool> >(false);
+        }
+
+        string contents;
+        if (!readFile(path(CLAIMED, claimName.str()), contents) || !theImage.deserialize(contents))
+        {
+            cerr << jobName << ": cannot read the job" << endl;
+            complete(jobName, Process::SPAWN_FAILED);
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Renews the lease on a claimed job by touching its claim file, which
+ * fails once another worker has renamed it away
+ * @param jobName - the job
+ * @return true if the lease was renewed, false if it has been lost, in which case the job's conversion is stopped
+ */
+bool WorkQueue::heartbeat(const string jobName)
+{
+    Lease lease;
+    {
+        lock_guard<mutex> guard(heldLock);
+        map<string, Lease>::iterator found = held.find(jobName);
+        if (found == held.end())
+            return false;
+        lease = found->second;
+    }
+    if (lease.lost->load())
+        return false;
+
+#ifdef _WIN32
+    bool renewed = _utime(path(CLAIMED, lease.claimName).c_str(), NULL) == 0;
+#else
+    bool renewed = utime(path(CLAIMED, lease.claimName).c_str(), NULL) == 0;
+#endif
+    if (!renewed)
+        lease.lost->store(true);
+    return renewed;
+}
+
+/**
+ * Finishes a claimed job, moving it to done or failed with the exit
+ * code and worker appended, and gives up its lease
+ * The move is the rename of this worker's own claim file, so a job
+ * whose lease has been lost is never finished here
+ * @param jobName - the job
+ * @param exitCode - the exit code of the conversion, 0 if it succeeded
+ * @return true if the job was finished, false if its lease had been lost
+ */
+bool WorkQueue::complete(const string jobName, const int exitCode)
+{
+    Lease lease;
+    {
+        lock_guard<mutex> guard(heldLock);
+        map<string, Lease>::iterator found = held.find(jobName);
+        if (found == held.end())
+            return false;
+        lease = found->second;
+        held.erase(found);
+    }
+    if (lease.lost->load())
+        return false;
+
+    string finished = path(exitCode == 0 ? DONE : FAILED, jobName);
+    if (rename(path(CLAIMED, lease.claimName).c_str(), finished.c_str()) != 0)
+        return false;
+
+    string contents;
+    ostringstream result(ostringstream::out);
+    if (readFile(finished, contents))
+        result << contents;
+    result << "exitCode " << exitCode << "\nworker " << workerId << "\n";
+    writeFile(finished, result.str());
+    return true;
+}
+
+/**
+ * Moves every claimed job whose lease has expired back to pending
+ * @return the number of jobs moved back to pending
+ */
+const int WorkQueue::reclaim()
+{
+    long long now = filesystemTime();
+    if (now == 0)
+        return 0;
+
+    int reclaimed = 0;
+    vector<string> claimed = listJobs(CLAIMED);
+    for (size_t i = 0; i < claimed.size(); i++)
+    {
+        // The claim name is <job>@<worker>.<claim>.<lease seconds>s
+        string claimName = claimed[i];
+        size_t at = claimName.find('@');
+        size_t dot = claimName.rfind('.');
+        if (at == string::npos || dot == string::npos || dot < at)
+            continue;
+        string jobName = claimName.substr(0, at);
+        int seconds = atoi(claimName.c_str() + dot + 1);
+        if (seconds < 1)
+            seconds = leaseSeconds;
+
+        long long renewed;
+        if (!modifiedTime(path(CLAIMED, claimName), renewed) || now <= renewed + seconds)
+            continue;
+
+        if (rename(path(CLAIMED, claimName).c_str(), path(PENDING, jobName).c_str()) == 0)
+        {
+            cerr << jobName << ": lease expired, returned to the queue" << endl;
+            reclaimed++;
+        }
+    }
+    return reclaimed;
+}
+
+/**
+ * Converts jobs from the queue on several threads, heartbeating the
+ * leases of the jobs in progress and reclaiming expired leases
+ * @param theExecutable - the name of the dcraw executable to run
+ * @param jobs - the number of conversions to run at once
+ * @param untilEmpty - true to return once no job is pending or claimed, false to wait for more forever
+ * @return the number of conversions that failed
+ */
+const int WorkQueue::work(const string theExecutable, const int jobs, const bool untilEmpty)
+{
+    bool stopping = false;
+    thread heartbeat(&WorkQueue::heartbeats, this, ref(stopping));
+
+    atomic<int> failures(0);
+    vector<thread> workers;
+    for (int t = 0; t < max(jobs, 1); t++)
+        workers.push_back(thread([&]()
+        {
+            while (true)
+            {
+                Image theImage;
+                string jobName;
+                if (!claim(theImage, jobName))
+                {
+                    if (untilEmpty && listJobs(PENDING).empty() && listJobs(CLAIMED).empty())
+                        break;
+                    this_thread::sleep_for(chrono::milliseconds(POLL_MILLISECONDS));
+                    continue;
+                }
+
+                shared_ptr< atomic<bool> > lost;
+                {
+                    lock_guard<mutex> guard(heldLock);
+                    lost = held[jobName].lost;
+                }
+
+                Converter theConverter(theExecutable, "");
+                theConverter.setImage(&theImage);
+                theConverter.setCancel(lost.get());
+                int exitCode = theImage.getOutputTargets().empty() ? theConverter.run(false)
+                                                                   : (theConverter.runTargets() ? 0 : 1);
+                if (!complete(jobName, exitCode))
+                {
+                    cerr << jobName << ": lease was lost before the job finished, not recorded" << endl;
+                    continue;
+                }
+                if (exitCode != 0)
+                    failures++;
+                cout << jobName << ": " << theImage.getSourceFilename() << ", exit code " << exitCode << endl;
+            }
+        }));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    {
+        lock_guard<mutex> guard(heldLock);
+        stopping = true;
+    }
+    heartbeat.join();
+    return failures;
+}
+
+/**
+ * Renews the lease of every held job that has not been lost, stopping
+ * the conversion of any that is found lost, and reclaims expired leases,
+ * three times per lease time, until told to stop
+ * Runs on its own thread
+ * @param stopping - set, with the held lock held, to stop
+ */
+void WorkQueue::heartbeats(const bool &stopping)
+{
+    int period = max(leaseSeconds * 1000 / 3, POLL_MILLISECONDS);
+    for (int waited = 0; ; waited += POLL_MILLISECONDS)
+    {
+        vector<string> jobs;
+        {
+            lock_guard<mutex> guard(heldLock);
+            if (stopping)
+                return;
+            if (waited < period)
+                jobs.clear();
+            else
+                for (map<string, Lease>::iterator job = held.begin(); job != held.end(); job++)
+                    if (!job->second.lost->load())
+                        jobs.push_back(job->first);
+        }
+        if (waited >= period)
+        {
+            for (size_t i = 0; i < jobs.size(); i++)
+                if (!heartbeat(jobs[i]))
+                    cerr << jobs[i] << ": lease was lost, abandoning the conversion" << endl;
+            reclaim();
+            waited = 0;
+        }
+        this_thread::sleep_for(chrono::milliseconds(POLL_MILLISECONDS));
+    }
+}
+
+/**
+ * @param leaseSeconds - how long a lease lasts without a heartbeat
+ */
+void WorkQueue::setLeaseSeconds(const int leaseSeconds)
+{
+    this->leaseSeconds = leaseSeconds < 1 ? 1 : leaseSeconds;
+}
+
+/**
+ * @return how long a lease lasts without a heartbeat
+ */
+const int WorkQueue::getLeaseSeconds() const
+{
+    return leaseSeconds;
+}
+
+/**
+ * @return the directory of the queue
+ */
+const string WorkQueue::getDirectory() const
+{
+    return directory;
+}
+
+/**
+ * @return the host name and process id that identify this worker's claims
+ */
+const string WorkQueue::getWorkerId() const
+{
+    return workerId;
+}
+
+/**
+ * @param state - a job state (see WorkQueue.h for state constants)
+ * @return the number of jobs in that state
+ */
+const int WorkQueue::count(const int state) const
+{
+    return (int)listJobs(state).size();
+}
+
+/**
+ * @param state - a job state
+ * @param jobName - the name of a job
+ * @return the path of the job's file in that state
+ */
+const string WorkQueue::path(const int state, const string jobName) const
+{
+    return directory + "/" + STATE_DIRECTORIES[state] + "/" + jobName;
+}
+
+/**
+ * @param state - a job state
+ * @return the names of the jobs in that state, oldest first
+ */
+const vector<string> WorkQueue::listJobs(const int state) const
+{
+    vector<string> jobs;
+    dirent ** entries;
+    int entryCount = fl_filename_list((directory + "/" + STATE_DIRECTORIES[state]).c_str(), &entries, fl_alphasort);
+    for (int i = 0; i < entryCount; i++)
+        if (fl_filename_match(entries[i]->d_name, state == CLAIMED ? "*.job@*" : "*.job"))
+            jobs.push_back(entries[i]->d_name);
+    if (entryCount > 0)
+        fl_filename_free_list(&entries, entryCount);
+    sort(jobs.begin(), jobs.end());
+    return jobs;
+}
+
+/**
+ * Finds the time on the clock of the filesystem holding the queue, by
+ * touching a file in it and reading back its modification time
+ * @return the time in seconds, 0 if it could not be found
+ */
+const long long WorkQueue::filesystemTime() const
+{
+    string clock = directory + "/." + workerId + ".clock";
+    long long now = 0;
+    if (!writeFile(clock, workerId) || !modifiedTime(clock, now))
+        now = 0;
+    remove(clock.c_str());
+    return now;
+}
+
+/**
+ * @param path - the file to read
+ * @param contents - set to the contents of the file
+ * @return true if the file was read, false otherwise
+ */
+bool WorkQueue::readFile(const string path, string &contents)
+{
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    contents.clear();
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        contents.append(buffer, count);
+    bool succeeded = !ferror(file);
+    fclose(file);
+    return succeeded;
+}
+
+/**
+ * Writes a file aside and renames it over the old one, so that
+ * readers on other hosts never see it half written
+ * @param path - the file to write
+ * @param contents - the contents of the file
+ * @return true if the file was written, false otherwise
+ */
+bool WorkQueue::writeFile(const string path, const string contents)
+{
+    string temporary = path + ".tmp";
+    FILE * file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    written = written && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    written = written && rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+    if (!written)
+        remove(temporary.c_str());
+    return written;
+}
+
+/**
+ * @param path - a file
+ * @param modified - set to the modification time of the file in seconds
+ * @return true if the file exists, false otherwise
+ */
+bool WorkQueue::modifiedTime(const string path, long long &modified)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        return false;
+    modified = (long long)status.st_mtime;
+    return true;
+}
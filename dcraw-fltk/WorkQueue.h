@@ -0,0 +1,79 @@
+/**
+ * WorkQueue.h
+ * @author https://github.com/aaronmboyd
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include "Image.h"
+
+using namespace std;
+
+class WorkQueue
+{
+    public:
+        WorkQueue(const string directory);
+        ~WorkQueue();
+
+        bool create();
+        bool submit(const Image &theImage, string &jobName);
+        bool claim(Image &theImage, string &jobName);
+        bool heartbeat(const string jobName);
+        bool complete(const string jobName, const int exitCode);
+        const int reclaim();
+        const int work(const string theExecutable, const int jobs, const bool untilEmpty);
+
+        void setLeaseSeconds(const int leaseSeconds);
+        const int getLeaseSeconds() const;
+        const string getDirectory() const;
+        const string getWorkerId() const;
+        const int count(const int state) const;
+
+        // Job states, each a subdirectory of the queue
+        const static int PENDING = 0;
+        const static int CLAIMED = 1;
+        const static int DONE = 2;
+        const static int FAILED = 3;
+        const static int STATES = 4;
+
+        // How long a lease lasts without a heartbeat, by default
+        const static int DEFAULT_LEASE_SECONDS = 60;
+        // How often an idle worker looks for new jobs
+        const static int POLL_MILLISECONDS = 500;
+
+    private:
+        WorkQueue(WorkQueue &toCopy);
+
+        // A claim this process holds on a job
+        struct Lease
+        {
+            // The name of the job in claimed, unique to this claim
+            string claimName;
+            // Raised once the lease is found lost, to stop the conversion
+            shared_ptr< atomic<bool> > lost;
+        };
+
+        const string path(const int state, const string jobName) const;
+        const vector<string> listJobs(const int state) const;
+        const long long filesystemTime() const;
+        void heartbeats(const bool &stopping);
+        static bool readFile(const string path, string &contents);
+        static bool writeFile(const string path, const string contents);
+        static bool modifiedTime(const string path, long long &modified);
+
+        string directory;
+        string workerId;
+        int leaseSeconds;
+
+        // Jobs this process holds leases on, kept alive by heartbeats()
+        map<string, Lease> held;
+        mutex heldLock;
+};
+#endif